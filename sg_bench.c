@@ -0,0 +1,931 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_bench.c
+//  Description    : This file contains the cache benchmarks run by sg_sim -b,
+//                   one table per feature, driven through the public cache
+//                   and tier interfaces.  They measure speed and hit rates,
+//                   not correctness (see sg_unit.c).
+//
+//   Author        : Yinan Lang
+//   Last Modified : 10/18/2026
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <sg_cache.h>
+#include <sg_cache_shm.h>
+#include <sg_cache_ztier.h>
+#include <sg_cache_arena.h>
+
+// Defines
+#define BENCH_TRACE_STEPS 200000       // Accesses per policy trace
+#define BENCH_THREAD_OPS 400000        // Accesses per thread or process
+#define BENCH_MAX_WORKERS 8            // Most threads or processes run at once
+#define BENCH_ZTIER_STEPS 100000       // Accesses per compressed tier trace
+#define BENCH_CODEC_ROUNDS 20000       // Blocks compressed per codec timing
+#define BENCH_CODEC_SAMPLES 16         // Distinct blocks per codec timing
+
+//
+// Type definitions
+
+// Benchmark Worker Structure
+struct benchworker{
+
+    uint32_t keys;              // Distinct blocks touched
+    uint32_t ops;               // Accesses to make
+    uint64_t seed;              // Random state
+    uint32_t hits;              // Reads served from the cache
+
+};
+
+// Linear Scan Key Structure (the cache before the hash index)
+struct benchkey{
+
+    SG_Node_ID nodeID;          // Node of the block
+    SG_Block_ID blockID;        // Block on the node
+
+};
+
+//
+// Functional Prototypes
+
+int sgCacheBenchmark( void );                                    // Run every table
+static int benchLookups( void );                                 // Lookup time by size
+static int benchHugePages( void );                               // Reads by page size
+static int benchPolicies( void );                                // Policy hit rates
+static int benchPartitions( void );                              // Hot file beside a scan
+static int benchThreads( void );                                 // Throughput by shards
+static int benchSharedTier( void );                              // Processes on one segment
+static int benchCompression( void );                             // Codec and compressed tier
+static int benchClosePolicies( void );                           // What closing does
+static void benchConfig( SG_Cache_Config *cfg, uint32_t elements, SG_Cache_Policy policy ); // Plain cache
+static int benchStart( const SG_Cache_Config *cfg );             // Start a cache
+static double benchNanoseconds( void );                          // Monotonic time
+static uint32_t benchRandom( uint64_t *r );                      // Next random number
+static uint64_t benchClock( void );                              // Access count clock
+static SG_Block_ID benchTraceBlock( int trace, uint32_t step, uint64_t *r ); // Trace block
+static void benchFillBlock( char *block, int content, uint64_t seed ); // Block contents
+static int benchCodec( int content );                            // Codec ratio and speed
+static int benchCompressedHits( int content, uint32_t elements, uint32_t compressed, double *rate ); // Tier hit rate
+static void *benchWorker( void *arg );                           // Stress thread
+static int benchShmProcess( const char *name, uint32_t keys, uint32_t ops, uint64_t seed, uint64_t *result ); // Shared tier process
+
+// Global data
+static SG_Cache_Config benchSaved;                               // Configuration to restore
+static uint64_t benchTicks = 0;                                  // What benchClock gives
+static volatile const char *benchSink = NULL;                    // Keeps timed reads alive
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheBenchmark
+// Description  : Time cache lookups as the number of resident blocks grows
+//                against the old linear scan, reads on huge and base pages,
+//                the eviction policies with and without admission, a hot
+//                file beside a scan, threads and processes on one cache or
+//                segment, the compressed tier and the close policies
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int sgCacheBenchmark( void ) {
+
+    int ret;
+
+    // Each table starts and closes its own caches; their log lines would
+    // only get in between the rows
+    getSGCacheConfig( &benchSaved );
+    disableLogLevels( LOG_INFO_LEVEL );
+    ret = benchLookups() || benchHugePages() || benchPolicies() || benchPartitions() ||
+            benchThreads() || benchSharedTier() || benchCompression() || benchClosePolicies();
+    enableLogLevels( LOG_INFO_LEVEL );
+    setSGCacheConfig( &benchSaved );
+
+    return( ret ? -1 : 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchLookups
+// Description  : Time lookups of resident blocks in a pseudo-random order as
+//                the cache grows, with the selected tag matcher, with the
+//                scalar one, and with a scan of every key as the cache did
+//                before it had an index
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int benchLookups( void ) {
+
+    static const uint32_t sizes[] = { 128, 1024, 8192, 32768, 65536 };
+    SG_Cache_Config cfg;
+    struct benchkey *keys;
+    char block[SG_BLOCK_SIZE], name[16];
+    uint32_t s, n, x, y, k, lookups;
+    double start, matchNs[2], scanNs;
+    uint64_t r = 1;
+    int portable;
+
+    memset( block, 0, SG_BLOCK_SIZE );
+    snprintf( name, sizeof(name), "%s ns/op", setSGCacheTagMatch(0) );
+    printf( "%10s %14s %14s %14s\n", "elements", name, "scalar ns/op", "scan ns/op" );
+
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+
+        // Fill the cache with random-looking (node, block) keys, and the
+        // same keys in a plain array
+        n = sizes[s];
+        benchConfig( &cfg, n, SG_CACHE_LRU );
+        if ( (keys = malloc(sizeof(struct benchkey) * n)) == NULL ) {
+            return( -1 );
+        }
+        if ( benchStart(&cfg) ) {
+            free( keys );
+            return( -1 );
+        }
+        for (x = 0; x < n; x++){
+            keys[x].nodeID = (x % 7) + 1;
+            keys[x].blockID = ((uint64_t)x * 2654435761ULL) + 1;
+            putSGDataBlock( keys[x].nodeID, keys[x].blockID, block );
+        }
+
+        // Index lookups with each tag matcher
+        lookups = 1000000;
+        for (portable = 0; portable < 2; portable++){
+            setSGCacheTagMatch( portable );
+            start = benchNanoseconds();
+            for (x = 0; x < lookups; x++){
+                k = benchRandom( &r ) % n;
+                benchSink = getSGDataBlock( keys[k].nodeID, keys[k].blockID );
+            }
+            matchNs[portable] = (benchNanoseconds() - start) / lookups;
+        }
+        setSGCacheTagMatch( 0 );
+
+        // Every key compared in turn
+        lookups = (n > 8192) ? 2000 : 20000;
+        start = benchNanoseconds();
+        for (x = 0; x < lookups; x++){
+            k = benchRandom( &r ) % n;
+            for (y = 0; y < n; y++){
+                if ( (keys[y].blockID == keys[k].blockID) && (keys[y].nodeID == keys[k].nodeID) ) {
+                    benchSink = (const char *)&keys[y];
+                    break;
+                }
+            }
+        }
+        scanNs = (benchNanoseconds() - start) / lookups;
+
+        printf( "%10u %14.1f %14.1f %14.1f\n", n, matchNs[0], matchNs[1], scanNs );
+        closeSGCache();
+        free( keys );
+
+    }
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchHugePages
+// Description  : Time random 256 byte reads over a large cache, with the
+//                block storage on base pages and on whatever huge pages the
+//                system gives
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int benchHugePages( void ) {
+
+    static const uint32_t sizes[] = { 65536, 262144 };
+    SG_Cache_Config cfg;
+    SG_Cache_Stats stats;
+    char block[SG_BLOCK_SIZE], part[256], *buf;
+    uint32_t s, n, x, lookups;
+    uint64_t r = 1;
+    double start;
+    int huge;
+
+    memset( block, 0, SG_BLOCK_SIZE );
+    printf( "\n%10s %10s %14s %10s %14s\n", "elements", "pages", "reads Mops/s", "pages", "reads Mops/s" );
+    for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        n = sizes[s];
+        printf( "%10u", n );
+        for (huge = 0; huge < 2; huge++){
+            benchConfig( &cfg, n, SG_CACHE_LRU );
+            cfg.hugePages = huge;
+            if ( benchStart(&cfg) ) {
+                return( -1 );
+            }
+            for (x = 0; x < n; x++){
+                putSGDataBlock( 1, x + 1, block );
+            }
+            lookups = 2000000;
+            start = benchNanoseconds();
+            for (x = 0; x < lookups; x++){
+                if ( (buf = getSGDataBlock(1, benchRandom(&r) % n + 1)) == NULL ) {
+                    logMessage( LOG_ERROR_LEVEL, "benchHugePages: resident block missing from %u element cache", n );
+                    closeSGCache();
+                    return( -1 );
+                }
+                memcpy( part, buf + (x % 4) * 256, sizeof(part) );
+            }
+            sgGetCacheStats( &stats );
+            printf( " %10s %14.2f", arenaBackingName(stats.slabBacking),
+                    lookups * 1000.0 / (benchNanoseconds() - start) );
+            closeSGCache();
+        }
+        printf( "\n" );
+    }
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchPolicies
+// Description  : Hit rate of each eviction policy on 128 blocks for the
+//                trace shapes, alone and behind the TinyLFU admission filter
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int benchPolicies( void ) {
+
+    SG_Cache_Config cfg;
+    SG_Cache_Stats stats;
+    char block[SG_BLOCK_SIZE], name[16];
+    uint32_t x, hits;
+    uint64_t sketchSize = 0, r = 1;
+    SG_Block_ID blk;
+    int admission, p, trace;
+
+    memset( block, 0, SG_BLOCK_SIZE );
+    printf( "\n%10s %10s %10s %10s\n", "policy", "linear", "locality", "mixed" );
+    for (admission = 0; admission < 2; admission++){
+        for (p = 0; p < SG_CACHE_MAX_POLICY; p++){
+            snprintf( name, sizeof(name), "%s%s", sgCachePolicyName(p), admission ? "+tlfu" : "" );
+            printf( "%10s", name );
+            for (trace = 0; trace < 3; trace++){
+                benchConfig( &cfg, 128, p );
+                cfg.admission = admission;
+                if ( benchStart(&cfg) ) {
+                    return( -1 );
+                }
+                hits = 0;
+                for (x = 0; x < BENCH_TRACE_STEPS; x++){
+                    blk = benchTraceBlock( trace, x, &r );
+                    if ( getSGDataBlock(1, blk) != NULL ) {
+                        hits++;
+                    } else {
+                        insertSGDataBlock( SG_CACHE_NO_OWNER, 1, blk, block, 0 );
+                    }
+                }
+                printf( " %9.1f%%", 100.0 * hits / BENCH_TRACE_STEPS );
+                sgGetCacheStats( &stats );
+                sketchSize = stats.sketchBytes;
+                closeSGCache();
+            }
+            printf( "\n" );
+        }
+    }
+    printf( "TinyLFU sketch: %lu bytes for 128 blocks (%.1f bytes per block)\n",
+            (unsigned long)sketchSize, (double)sketchSize / 128 );
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchPartitions
+// Description  : A hot file of 96 blocks read at random while a scan streams
+//                through new blocks four times as fast, on 256 blocks: the
+//                hot file's hit rate sharing the cache, partitioned, and
+//                with the scan held to a 32 block quota
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int benchPartitions( void ) {
+
+    SG_Cache_Config cfg;
+    char block[SG_BLOCK_SIZE];
+    uint32_t x, y, hits;
+    uint64_t r = 1;
+    SG_Block_ID blk;
+    int p, mode;
+
+    memset( block, 0, SG_BLOCK_SIZE );
+    printf( "\nhot file hit rate beside a scan\n%10s %10s %12s %10s\n", "policy", "shared", "partitioned", "quota" );
+    for (p = 0; p < SG_CACHE_MAX_POLICY; p++){
+        printf( "%10s", sgCachePolicyName(p) );
+        for (mode = 0; mode < 3; mode++){
+            benchConfig( &cfg, 256, p );
+            cfg.partitioned = (mode == 1);
+            if ( benchStart(&cfg) ) {
+                return( -1 );
+            }
+            if ( (mode == 2) && setSGCacheQuota(2, 32) ) {
+                closeSGCache();
+                return( -1 );
+            }
+            hits = 0;
+            for (x = 0; x < BENCH_TRACE_STEPS; x++){
+                blk = benchRandom( &r ) % 96 + 1;
+                if ( getSGDataBlock(1, blk) != NULL ) {
+                    hits++;
+                } else {
+                    insertSGDataBlock( 1, 1, blk, block, 0 );
+                }
+                for (y = 0; y < 4; y++){
+                    insertSGDataBlock( 2, 2, (uint64_t)x * 4 + y + 1, block, 0 );
+                }
+            }
+            printf( " %*.1f%%", (mode == 1) ? 11 : 9, 100.0 * hits / BENCH_TRACE_STEPS );
+            closeSGCache();
+        }
+        printf( "\n" );
+    }
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchThreads
+// Description  : Threads reading and filling a shared 4096 block cache, on
+//                one lock against the sharded layout
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int benchThreads( void ) {
+
+    static const uint32_t threadCounts[] = { 1, 2, 4, BENCH_MAX_WORKERS };
+    static const uint32_t shardCounts[] = { 1, SG_CACHE_SHARDS, 64 };
+    struct benchworker workers[BENCH_MAX_WORKERS];
+    pthread_t tids[BENCH_MAX_WORKERS];
+    SG_Cache_Config cfg;
+    uint32_t th, sh, w;
+    double start;
+
+    printf( "\nthreaded throughput, Mops/s (%ld online CPUs)\n%10s", sysconf(_SC_NPROCESSORS_ONLN), "shards" );
+    for (th = 0; th < sizeof(threadCounts) / sizeof(threadCounts[0]); th++){
+        printf( " %7u thr", threadCounts[th] );
+    }
+    printf( "\n" );
+
+    for (sh = 0; sh < sizeof(shardCounts) / sizeof(shardCounts[0]); sh++){
+        printf( "%10u", shardCounts[sh] );
+        for (th = 0; th < sizeof(threadCounts) / sizeof(threadCounts[0]); th++){
+            benchConfig( &cfg, 4096, SG_CACHE_LRU );
+            cfg.shards = shardCounts[sh];
+            if ( benchStart(&cfg) ) {
+                return( -1 );
+            }
+            for (w = 0; w < threadCounts[th]; w++){
+                workers[w].keys = 6144;
+                workers[w].ops = BENCH_THREAD_OPS;
+                workers[w].seed = w + 1;
+                workers[w].hits = 0;
+            }
+            start = benchNanoseconds();
+            for (w = 0; w < threadCounts[th]; w++){
+                pthread_create( &tids[w], NULL, benchWorker, &workers[w] );
+            }
+            for (w = 0; w < threadCounts[th]; w++){
+                pthread_join( tids[w], NULL );
+            }
+            printf( " %11.2f", (double)threadCounts[th] * BENCH_THREAD_OPS * 1000.0 / (benchNanoseconds() - start) );
+            closeSGCache();
+        }
+        printf( "\n" );
+    }
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchSharedTier
+// Description  : Processes sharing one 4096 block segment against each
+//                keeping its own, readers checking every block for torn
+//                copies
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int benchSharedTier( void ) {
+
+    static const uint32_t procCounts[] = { 1, 2, 4 };
+    char name[64];
+    uint64_t *results, torn, hits, reads;
+    pid_t pids[BENCH_MAX_WORKERS];
+    uint32_t pc, w;
+    SG_Shm *tier;
+    double start;
+    int status, failed = 0;
+
+    snprintf( name, sizeof(name), "/sg_cache_bench.%d", (int)getpid() );
+    results = mmap( NULL, sizeof(uint64_t) * 2 * BENCH_MAX_WORKERS, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+    if ( results == MAP_FAILED ) {
+        return( -1 );
+    }
+
+    printf( "\n%10s %14s %10s %10s %14s %14s\n", "processes", "shm Mops/s", "hit rate", "torn", "segment KB", "private KB" );
+    for (pc = 0; (pc < sizeof(procCounts) / sizeof(procCounts[0])) && !failed; pc++){
+        unlinkSGShm( name );
+        if ( (tier = openSGShm(name, 4096)) == NULL ) {
+            failed = 1;
+            break;
+        }
+        start = benchNanoseconds();
+        for (w = 0; w < procCounts[pc]; w++){
+            if ( (pids[w] = fork()) == 0 ) {
+                _exit( benchShmProcess(name, 4096, BENCH_THREAD_OPS, w + 1, results + w * 2) ? 1 : 0 );
+            }
+        }
+        for (w = 0; w < procCounts[pc]; w++){
+            if ( (pids[w] == -1) || (waitpid(pids[w], &status, 0) == -1) ||
+                    !WIFEXITED(status) || (WEXITSTATUS(status) != 0) ) {
+                failed = 1;
+            }
+        }
+        hits = torn = 0;
+        for (w = 0; w < procCounts[pc]; w++){
+            hits += results[w * 2];
+            torn += results[w * 2 + 1];
+        }
+        reads = (uint64_t)procCounts[pc] * (BENCH_THREAD_OPS - BENCH_THREAD_OPS / 8);
+        printf( "%10u %14.2f %9.1f%% %10lu %14lu %14lu\n", procCounts[pc],
+                (double)procCounts[pc] * BENCH_THREAD_OPS * 1000.0 / (benchNanoseconds() - start),
+                100.0 * hits / reads, (unsigned long)torn, (unsigned long)(shmBytes(tier) / 1024),
+                (unsigned long)procCounts[pc] * 4096 * SG_BLOCK_SIZE / 1024 );
+        closeSGShm( tier );
+    }
+    unlinkSGShm( name );
+    munmap( results, sizeof(uint64_t) * 2 * BENCH_MAX_WORKERS );
+
+    if ( failed ) {
+        logMessage( LOG_ERROR_LEVEL, "benchSharedTier: shared tier processes failed" );
+        return( -1 );
+    }
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchCompression
+// Description  : The codec on workload-like random printable blocks,
+//                English-like text and blocks a quarter full, then the hit
+//                rate of a 64 block cache on the locality trace alone, with
+//                64 blocks' worth of compressed tier, and at twice the size
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int benchCompression( void ) {
+
+    double alone, packed, doubled;
+    int content;
+
+    printf( "\n%10s %10s %14s %14s %10s %12s %10s\n", "content", "ratio", "compress MB/s", "decompress ns",
+            "64 blocks", "+64 packed", "128 blocks" );
+    for (content = 0; content < 3; content++){
+        if ( benchCodec(content) ||
+                benchCompressedHits(content, 64, 0, &alone) ||
+                benchCompressedHits(content, 64, 64, &packed) ||
+                benchCompressedHits(content, 128, 0, &doubled) ) {
+            return( -1 );
+        }
+        printf( " %9.1f%% %11.1f%% %9.1f%%\n", alone, packed, doubled );
+    }
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchClosePolicies
+// Description  : Two files stay open and are read at random (72 blocks each)
+//                while short files of 32 blocks are opened, read through and
+//                closed, on 192 blocks; every other one is opened and read
+//                again after the next (160 accesses later).  Hit rates of
+//                the open files and of the rereads, with closed files'
+//                blocks left in place, going first, and going first after
+//                170 accesses.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int benchClosePolicies( void ) {
+
+    SG_Cache_Config cfg;
+    SG_Cache_Stats stats;
+    char block[SG_BLOCK_SIZE];
+    uint32_t openHits, openReads, reHits, reReads, n, x, y;
+    SG_Block_ID blk, hot;
+    uint64_t r;
+    int p, pass, fileId;
+
+    memset( block, 0, SG_BLOCK_SIZE );
+    printf( "\n%10s %10s %10s %10s\n", "close", "open", "reopened", "releases" );
+    setSGCacheClockHandler( benchClock );
+    for (p = 0; p < SG_CACHE_MAX_CLOSE; p++){
+        benchConfig( &cfg, 192, SG_CACHE_LRU );
+        if ( benchStart(&cfg) ) {
+            setSGCacheClockHandler( NULL );
+            return( -1 );
+        }
+        openHits = openReads = reHits = reReads = 0;
+        benchTicks = 0;
+        r = 1;
+        for (n = 0; n < 1000; n++){
+            for (pass = 0; pass < ((n % 2) ? 2 : 1); pass++){
+
+                // The new file, then (after odd ones) the one before it again
+                fileId = 3 + n - pass;
+                if ( pass == 1 ) {
+                    openSGCacheFile( fileId );
+                }
+                for (x = 0; x < 32; x++){
+                    blk = (uint64_t)(fileId - 3) * 32 + x + 1;
+                    benchTicks++;
+                    if ( getSGDataBlock(2, blk) != NULL ) {
+                        reHits += (pass == 1);
+                    } else {
+                        insertSGDataBlock( fileId, 2, blk, block, 0 );
+                    }
+                    reReads += (pass == 1);
+                    for (y = 0; y < 4; y++){
+                        hot = benchRandom( &r ) % 144 + 1;
+                        benchTicks++;
+                        openReads++;
+                        if ( getSGDataBlock(1, hot) != NULL ) {
+                            openHits++;
+                        } else {
+                            insertSGDataBlock( (hot > 72) ? 2 : 1, 1, hot, block, 0 );
+                        }
+                    }
+                }
+                if ( p != SG_CACHE_CLOSE_FLUSH ) {
+                    closeSGCacheFile( fileId, (p == SG_CACHE_CLOSE_KEEP) ? 170 : 0 );
+                }
+
+            }
+        }
+        sgGetCacheStats( &stats );
+        printf( "%10s %9.1f%% %9.1f%% %10lu\n", sgCacheCloseName(p), 100.0 * openHits / openReads,
+                100.0 * reHits / reReads, (unsigned long)stats.total.releases );
+        closeSGCache();
+    }
+    setSGCacheClockHandler( NULL );
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchConfig
+// Description  : Describe a cache of one shard with no other tiers,
+//                admission, partitioning or sizing, whatever sg_sim was
+//                given, for a table to adjust before starting it
+//
+// Inputs       : cfg - the configuration to fill in
+//                elements - blocks it holds
+//                policy - eviction policy
+// Outputs      : none
+
+static void benchConfig( SG_Cache_Config *cfg, uint32_t elements, SG_Cache_Policy policy ) {
+
+    *cfg = benchSaved;
+    cfg->maxElements = elements;
+    cfg->policy = policy;
+    cfg->writeBack = 0;
+    cfg->shards = 1;
+    cfg->admission = 0;
+    cfg->partitioned = 0;
+    cfg->l2Elements = 0;
+    cfg->shmElements = 0;
+    cfg->compressedElements = 0;
+    cfg->autoSizeElements = 0;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchStart
+// Description  : Start the cache a table described
+//
+// Inputs       : cfg - the configuration
+// Outputs      : 0 if successful, -1 if failure
+
+static int benchStart( const SG_Cache_Config *cfg ) {
+
+    if ( setSGCacheConfig(cfg) || initSGCache(SG_CACHE_CONFIGURED) ) {
+        logMessage( LOG_ERROR_LEVEL, "benchStart: cannot start a %u block cache", cfg->maxElements );
+        return( -1 );
+    }
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchNanoseconds
+// Description  : Read the monotonic clock in nanoseconds
+//
+// Inputs       : none
+// Outputs      : current time in nanoseconds
+
+static double benchNanoseconds( void ) {
+
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchRandom
+// Description  : Step a linear congruential generator
+//
+// Inputs       : r - random state
+// Outputs      : the next 31 bit random number
+
+static uint32_t benchRandom( uint64_t *r ) {
+
+    *r = *r * 6364136223846793005ULL + 1442695040888963407ULL;
+    return( (uint32_t)(*r >> 33) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchClock
+// Description  : Stand in for the close grace clock, ticking once per access
+//                so benchmark results do not depend on the machine's speed
+//
+// Inputs       : none
+// Outputs      : accesses made so far
+
+static uint64_t benchClock( void ) {
+
+    return( benchTicks );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchTraceBlock
+// Description  : Generate the next block of a synthetic access trace
+//
+// Inputs       : trace - 0 linear scans, 1 hot set, 2 hot set plus scans
+//                step - the access number
+//                r - random state
+// Outputs      : the block ID to access
+
+static SG_Block_ID benchTraceBlock( int trace, uint32_t step, uint64_t *r ) {
+
+    uint32_t v = benchRandom( r );
+
+    switch ( trace ) {
+    case 0: // WLT_LINEAR style: front to back over 512 blocks, repeatedly
+        return( (step % 512) + 1 );
+    case 1: // WLT_LOCALITY style: 90% of accesses to 96 hot blocks
+        return( ((v % 10) < 9) ? (v % 96) + 1 : (v % 4096) + 1 );
+    default: // Hot set interleaved with one-pass scans of cold objects
+        if ( (step / 64) % 2 ) {
+            return( 100000 + step );
+        }
+        return( (v % 96) + 1 );
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchFillBlock
+// Description  : Fill a block with one of the benchmark contents, the same
+//                for the same seed
+//
+// Inputs       : block - the block
+//                content - 0 random printable (like the workloads), 1 text
+//                          of common words, 2 printable first quarter and
+//                          zeros after
+//                seed - selects the block's data
+// Outputs      : none
+
+static void benchFillBlock( char *block, int content, uint64_t seed ) {
+
+    static const char *words[] = { "the", "block", "cache", "of", "node", "and", "read", "to",
+            "write", "a", "file", "is", "data", "in", "sequence", "server" };
+    uint64_t r = seed * 0x9E3779B97F4A7C15ULL + 1;
+    size_t x = 0, w;
+
+    while ( x < SG_BLOCK_SIZE ) {
+        r = r * 6364136223846793005ULL + 1442695040888963407ULL;
+        if ( content == 1 ) {
+            for (w = 0; (words[(r >> 33) % 16][w] != '\0') && (x < SG_BLOCK_SIZE); w++){
+                block[x++] = words[(r >> 33) % 16][w];
+            }
+            if ( x < SG_BLOCK_SIZE ) {
+                block[x++] = ((r >> 40) % 8) ? ' ' : '\n';
+            }
+        } else {
+            block[x] = ((content == 2) && (x >= SG_BLOCK_SIZE / 4)) ? 0 : (char)(' ' + (r >> 33) % 95);
+            x++;
+        }
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchCodec
+// Description  : Print the compression ratio, compression speed and
+//                decompression time of the codec on one kind of content,
+//                checking that every sample round trips
+//
+// Inputs       : content - the benchFillBlock content
+// Outputs      : 0 if successful, -1 if failure
+
+static int benchCodec( int content ) {
+
+    static const char *contents[] = { "printable", "text", "quarter" };
+    char samples[BENCH_CODEC_SAMPLES][SG_BLOCK_SIZE], expanded[SG_BLOCK_SIZE];
+    uint8_t packed[BENCH_CODEC_SAMPLES][SG_BLOCK_SIZE * 2];
+    int lens[BENCH_CODEC_SAMPLES];
+    double start, compressNs, decompressNs;
+    uint64_t stored = 0;
+    uint32_t x;
+
+    for (x = 0; x < BENCH_CODEC_SAMPLES; x++){
+        benchFillBlock( samples[x], content, x );
+        lens[x] = ztierCompress( samples[x], packed[x], sizeof(packed[x]) );
+        stored += lens[x];
+        if ( (lens[x] <= 0) || ztierDecompress(packed[x], lens[x], expanded) ||
+                memcmp(samples[x], expanded, SG_BLOCK_SIZE) ) {
+            logMessage( LOG_ERROR_LEVEL, "benchCodec: compressed block does not round trip" );
+            return( -1 );
+        }
+    }
+
+    start = benchNanoseconds();
+    for (x = 0; x < BENCH_CODEC_ROUNDS; x++){
+        ztierCompress( samples[x % BENCH_CODEC_SAMPLES], packed[x % BENCH_CODEC_SAMPLES], sizeof(packed[0]) );
+    }
+    compressNs = benchNanoseconds() - start;
+    start = benchNanoseconds();
+    for (x = 0; x < BENCH_CODEC_ROUNDS; x++){
+        ztierDecompress( packed[x % BENCH_CODEC_SAMPLES], lens[x % BENCH_CODEC_SAMPLES], expanded );
+    }
+    decompressNs = benchNanoseconds() - start;
+
+    printf( "%10s %10.2f %14.1f %14.0f", contents[content], (double)BENCH_CODEC_SAMPLES * SG_BLOCK_SIZE / stored,
+            (double)BENCH_CODEC_ROUNDS * SG_BLOCK_SIZE * 1000.0 / compressNs, decompressNs / BENCH_CODEC_ROUNDS );
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchCompressedHits
+// Description  : Hit rate of an LRU cache on the locality trace, with
+//                blocks of one kind of content, beside a compressed tier
+//
+// Inputs       : content - the benchFillBlock content
+//                elements - blocks in the cache
+//                compressed - blocks' worth of compressed tier (0 for none)
+//                rate - set to the hit rate in percent
+// Outputs      : 0 if successful, -1 if failure
+
+static int benchCompressedHits( int content, uint32_t elements, uint32_t compressed, double *rate ) {
+
+    SG_Cache_Config cfg;
+    char block[SG_BLOCK_SIZE];
+    uint32_t x, hits = 0;
+    uint64_t r = 1;
+    SG_Block_ID blk;
+
+    benchConfig( &cfg, elements, SG_CACHE_LRU );
+    cfg.compressedElements = compressed;
+    if ( benchStart(&cfg) ) {
+        return( -1 );
+    }
+    for (x = 0; x < BENCH_ZTIER_STEPS; x++){
+        blk = benchTraceBlock( 1, x, &r );
+        if ( getSGDataBlock(1, blk) != NULL ) {
+            hits++;
+        } else {
+            benchFillBlock( block, content, blk );
+            insertSGDataBlock( SG_CACHE_NO_OWNER, 1, blk, block, 0 );
+        }
+    }
+    closeSGCache();
+    *rate = 100.0 * hits / BENCH_ZTIER_STEPS;
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchWorker
+// Description  : One stress thread: random reads, inserting on a miss
+//
+// Inputs       : arg - the worker's struct benchworker
+// Outputs      : NULL
+
+static void *benchWorker( void *arg ) {
+
+    struct benchworker *w = arg;
+    char block[SG_BLOCK_SIZE], part[256];
+    SG_Block_ID blk;
+    uint32_t x;
+
+    memset( block, 0, SG_BLOCK_SIZE );
+    for (x = 0; x < w->ops; x++){
+        blk = benchRandom( &w->seed ) % w->keys + 1;
+        if ( readSGDataBlock(SG_CACHE_NO_OWNER, 1, blk, part, (x % 4) * 256, 256) == 0 ) {
+            w->hits++;
+        } else {
+            insertSGDataBlock( SG_CACHE_NO_OWNER, 1, blk, block, 0 );
+        }
+    }
+
+    return NULL;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : benchShmProcess
+// Description  : One shared tier process: random reads, publishing on a miss
+//                and rewriting one block in eight, every frame filled with a
+//                single byte so a torn read shows as mixed bytes
+//
+// Inputs       : name - the segment name
+//                keys - distinct blocks touched
+//                ops - accesses to make
+//                seed - random state
+//                result - set to hits and torn reads
+// Outputs      : 0 if successful, -1 if failure
+
+static int benchShmProcess( const char *name, uint32_t keys, uint32_t ops, uint64_t seed, uint64_t *result ) {
+
+    char block[SG_BLOCK_SIZE];
+    SG_Shm *t;
+    SG_Block_ID blk;
+    uint64_t seq;
+    uint32_t x, y;
+
+    if ( (t = openSGShm(name, keys)) == NULL ) {
+        return( -1 );
+    }
+    result[0] = result[1] = 0;
+    for (x = 0; x < ops; x++){
+        blk = benchRandom( &seed ) % keys + 1;
+        if ( (x % 8) != 0 ) {
+            if ( shmGet(t, 1, blk, &seq, block) == 0 ) {
+                result[0]++;
+                for (y = 1; (y < SG_BLOCK_SIZE) && (block[y] == block[0]); y++);
+                if ( y < SG_BLOCK_SIZE ) {
+                    result[1]++;
+                }
+                continue;
+            }
+        }
+        memset( block, (int)(seed >> 56), SG_BLOCK_SIZE );
+        shmPut( t, 1, blk, 1, block );
+    }
+    closeSGShm( t );
+
+    return( 0 );
+
+}
@@ -7,58 +7,588 @@
 //
 //   Author        : Yinan Lang
 //   Last Modified : 12/8/2020
-// 
+//
 
 // Include Files
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 #include <cmpsc311_log.h>
 
 // Project Includes
 #include <sg_cache.h>
+#include <sg_cache_policy.h>
+#include <sg_cache_l2.h>
+#include <sg_cache_shm.h>
+#include <sg_cache_ztier.h>
+#include <sg_cache_sketch.h>
+#include <sg_cache_arena.h>
+#include <sg_cache_sizer.h>
 
 // Defines
+#define SG_CACHE_NO_ENTRY -1        // Empty index slot / end of list
+#define SG_CACHE_INDEX_FACTOR 2     // Index slots per cache element (load <= 0.5)
+#define SG_CACHE_ALIGNMENT 64       // Alignment of the shards (cache line)
+#define SG_CACHE_TAG_GROUP 16       // Index tags compared per probe step
+#define SG_CACHE_TAG_EMPTY 0        // Tag of an empty index slot
+#define SG_CACHE_AUTOSIZE_PERIOD 1024 // Lookups between auto sizing decisions
+#define SG_CACHE_AUTOSIZE_SLACK 1   // Hits (percent of lookups) worth giving up to shrink
+#define SG_CACHE_STAT(field) offsetof(SG_Cache_Counters, field) // Counter selector
+#define SG_CACHE_RECLAIMED 1        // Victim taken back for a quota or share
+#define SG_CACHE_RELEASED 2         // Victim belongs to a closed file
+
+// Block Slab Structure
+struct blockslab{
+
+    SG_Arena arena;           // SG_BLOCK_SIZE frames, one mapping
+    char *frames;             // First frame (start of the arena)
+    int32_t *nextFree;        // Free list links, one per frame
+    int32_t freeHead;         // First free frame
+    uint32_t nframes;         // Number of frames
+
+};
+
+// Cache Key Structure (kept apart from the entries so probes touch only keys)
+struct cachekey{
+
+    SG_Node_ID nodeID;        // Node ID
+    SG_Block_ID blockID;      // Block ID
+
+};
 
 // Datacache Structure
 struct datacache{
 
-    char *buf;                // Data
-    SG_Block_ID blockID;      // Block ID
-    SG_Node_ID nodeID;        // Node ID
-    int timer;                // A timer
+    char *buf;                // Data (a frame in the cache slab)
+    int nextFree;             // Next unused entry (free list only)
+    int dirty;                // Modified since last written back
+    uint64_t seq;             // Its node's epoch when cached (0 if not versioned)
+    SgFHandle owner;          // File the block was cached for (or SG_CACHE_NO_OWNER)
+    int32_t partPrev;         // Links in the owner's recency list
+    int32_t partNext;
+
+};
+
+// File Partition Structure (one file's blocks in a cache)
+struct filepart{
+
+    uint32_t resident;        // Blocks cached for the file
+    uint32_t quota;           // Most blocks the file may hold (0 = no limit)
+    int32_t head;             // Its most recently used entry
+    int32_t tail;             // Its least recently used entry
+    uint64_t releaseAt;       // When a closed file's blocks go first (ms)
+    int32_t closedPrev;       // Links in the closed files list
+    int32_t closedNext;
+    uint8_t closed;           // On the closed files list
+    int32_t residentPrev;     // Links among the files with as many
+    int32_t residentNext;     //   blocks cached (resident > 0)
+
+};
+
+// Node Counters Structure
+struct nodecounters{
+
+    SG_Node_ID nodeID;            // Remote node
+    SG_Cache_Counters counters;   // Its counters
+
+};
+
+// Cache Statistics Structure
+struct cachestats{
+
+    SG_Cache_Counters total;      // Everything counted
+    SG_Cache_Counters *files;     // Per file, indexed by file number
+    uint32_t nfiles;              // Handles covered by files
+    struct nodecounters *nodes;   // Per remote node, open addressing table
+    uint32_t nnodes;              // Nodes in use
+    uint32_t nodeCap;             // Table size (power of two)
+
+};
+
+// Node Version Structure
+struct nodeversion{
+
+    SG_Node_ID nodeID;            // Remote node (SG_NODE_UNKNOWN if unused)
+    uint64_t epoch;               // Clean blocks tagged before this are stale
+
+};
+
+// Version Table Structure (open addressing, shared by the shards)
+struct versiontable{
+
+    pthread_mutex_t lock;         // Taken inside shard locks, never around them
+    struct nodeversion *nodes;    // Invalidated nodes
+    uint32_t count;               // Nodes in use
+    uint32_t cap;                 // Table size (power of two)
+
+};
+
+// Block Cache Structure
+struct blockcache{
+
+    struct datacache *entries;  // Cache entries
+    struct cachekey *keys;      // Key of each entry
+    struct blockslab slab;      // Block storage owned by the cache
+    uint16_t *tags;             // Hash tag of each index slot, the first
+                                // SG_CACHE_TAG_GROUP repeated past the end
+    int32_t *index;             // Open addressing index of entry numbers
+    uint32_t indexMask;         // Index size - 1 (size is a power of two)
+    uint32_t maxElements;       // Maximum number of entries
+    uint32_t count;             // Number of entries in use
+    uint32_t dirtyCount;        // Number of dirty entries
+    int freeList;               // Unused entries, chained through nextFree
+    SG_Policy *policy;          // Eviction policy
+    SG_Cache_Policy policyType; // Which policy it is
+    struct cachestats *stats;   // Where to count (NULL to not count)
+    SG_L2 *l2;                  // Second tier for evicted blocks (or NULL)
+    SG_Shm *shm;                // Tier shared with other processes (or NULL)
+    SG_ZTier *ztier;            // Compressed tier for evicted blocks (or NULL)
+    SG_Sketch *sketch;          // TinyLFU admission filter (or NULL)
+    SG_Sizer *sizer;            // Miss ratio curve estimator (or NULL)
+    struct filepart *parts;     // Per file, indexed by file number
+    uint32_t nparts;            // Handles covered by parts
+    uint32_t activeParts;       // Files with blocks in the cache
+    int32_t *byResident;        // Files by blocks cached (maxElements + 1
+                                // lists), so the largest is found at once
+    uint32_t maxResident;       // Most blocks any one file has cached
+    int partitioned;            // Guarantee each file an equal share
+    int32_t closedHead;         // Closed files, in the order they were
+    int32_t closedTail;         // closed (oldest first)
+
+};
+
+// Cache Shard Structure
+struct cacheshard{
+
+    pthread_mutex_t lock;       // Serializes access to the shard
+    struct blockcache cache;    // The shard's entries, index, storage, policy
+    struct cachestats stats;    // The shard's counters
+
+} __attribute__((aligned(SG_CACHE_ALIGNMENT)));
+
+// Sharded Cache Structure
+struct shardedcache{
+
+    struct cacheshard *shards;  // Independently locked shards
+    uint32_t nshards;           // Number of shards
+    uint32_t maxElements;       // Total entries over all shards
+
+};
+
+// Auto Sizing Structure
+struct autosizing{
+
+    pthread_mutex_t lock;       // Held while deciding and resizing
+    uint32_t ceiling;           // Largest size allowed (0 = auto sizing off)
+    uint32_t lookups;           // Lookups since the last decision (atomic)
 
 };
 
 // Global Variables
-struct datacache cache[128];
-int hit = 0;
-int miss = 0;
+struct shardedcache sgCache;
+SG_Cache_Config sgCacheConfig;
+int sgCacheConfigLoaded = 0;
+SG_Cache_Flush sgCacheFlush = NULL;
+SG_L2 *sgCacheL2 = NULL;
+SG_Shm *sgCacheShm = NULL;
+SG_ZTier *sgCacheZTier = NULL;
+SG_Cache_Version sgCacheVersion = NULL;
+SG_Cache_Resize sgCacheResize = NULL;
+struct versiontable sgCacheVersions = { PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0 };
+pthread_once_t sgCacheTagOnce = PTHREAD_ONCE_INIT;
+uint32_t (*sgCacheTagMatch)( const uint16_t *tags, uint16_t tag, uint32_t *empty ) = NULL;
+const char *sgCacheTagMatchName = "scalar";
+int sgCacheHugePages = 1;
+struct autosizing sgCacheSizing = { PTHREAD_MUTEX_INITIALIZER, 0, 0 };
+SG_Cache_Clock sgCacheClock = NULL;
+static const char *sgCacheCloseNames[SG_CACHE_MAX_CLOSE] = { "flush", "demote", "keep" };
 
 // Functional Prototypes
+static int parseCacheElements( const char *str, uint32_t *elements );   // Parse a capacity
+static int slabCreate( struct blockslab *s, uint32_t nframes, int hugePages ); // Map the frames
+static void slabDestroy( struct blockslab *s );                          // Free the frames
+static char *slabAlloc( struct blockslab *s );                           // Take a free frame
+static void slabFree( struct blockslab *s, char *frame );                // Return a frame
+static int cacheCreate( struct blockcache *c, uint32_t maxElements, SG_Cache_Policy policy ); // Allocate a cache
+static void cacheDestroy( struct blockcache *c );                        // Free a cache
+static int cacheFind( struct blockcache *c, SG_Node_ID nde, SG_Block_ID blk ); // Index lookup
+static void cacheIndexInsert( struct blockcache *c, int e );             // Add entry to index
+static void cacheIndexRemove( struct blockcache *c, int e );             // Remove entry from index
+static uint16_t cacheTag( uint64_t h );                                  // Tag of a key hash
+static void cacheTagSet( struct blockcache *c, uint32_t slot, uint16_t tag ); // Set a slot's tag
+static void tagSelect( void );                                           // Pick the tag matcher
+static uint32_t tagMatchScalar( const uint16_t *tags, uint16_t tag, uint32_t *empty ); // Portable
+#if defined(__x86_64__) || defined(__i386__)
+static uint32_t tagMatchSse2( const uint16_t *tags, uint16_t tag, uint32_t *empty ); // 8 tags per compare
+static uint32_t tagMatchAvx2( const uint16_t *tags, uint16_t tag, uint32_t *empty ); // 16 tags per compare
+#endif
+static int cachePut( struct blockcache *c, int fileId, SG_Node_ID nde, SG_Block_ID blk, char *block, int dirty, uint64_t seq, int admit ); // Insert
+static int cacheVictim( struct blockcache *c, int fileId, SG_Node_ID nde, SG_Block_ID blk, int *reclaim ); // Pick an eviction
+static int cacheEvict( struct blockcache *c, int e );                    // Push an entry out
+static void cacheDrop( struct blockcache *c, int e );                    // Remove an entry outright
+static void cacheFree( struct blockcache *c, int e );                    // Return an entry and frame
+static void cacheHit( struct blockcache *c, int e );                     // Tell policy and owner
+static void cacheSetDirty( struct blockcache *c, int e, int dirty );     // Track dirty entries
+static int cacheWriteBack( struct blockcache *c, int e, int deferred );  // Flush a dirty entry
+static int cacheWriteBackAll( struct blockcache *c );                    // Flush every dirty entry
+static int cacheResize( struct blockcache *c, uint32_t maxElements );    // Resize one cache
+static void cacheDemote( struct blockcache *c, int e );                  // Move an entry to the lower tiers
+static struct filepart *partFor( struct blockcache *c, int fileId );   // File's partition
+static void partInit( struct filepart *p, uint32_t quota );              // Empty partition
+static void partClose( struct blockcache *c, int fileId, uint64_t releaseAt ); // Queue for release
+static void partReopen( struct blockcache *c, int fileId );            // Take off the queue
+static int partReleased( struct blockcache *c, int fileId );           // Closed file's block to go
+static uint64_t cacheClock( void );                                      // Milliseconds, monotonic
+static void partLink( struct blockcache *c, int e );                     // Add to owner's list
+static void partUnlink( struct blockcache *c, int e );                   // Take off owner's list
+static void partCount( struct blockcache *c, int fileId, int delta );    // Change a file's resident count
+static uint32_t shardElements( uint32_t maxElements, uint32_t nshards, uint32_t s ); // Shard's share
+static int shardsCreate( struct shardedcache *sc, uint32_t maxElements, SG_Cache_Policy policy, uint32_t nshards ); // Allocate shards
+static void shardsDestroy( struct shardedcache *sc );                    // Free shards
+static struct cacheshard *shardFor( struct shardedcache *sc, SG_Node_ID nde, SG_Block_ID blk ); // Key to shard
+static int shardLookup( struct cacheshard *sh, int fileId, SG_Node_ID nde, SG_Block_ID blk ); // Find + count (locked)
+static int shardsRead( struct shardedcache *sc, int fileId, SG_Node_ID nde, SG_Block_ID blk, char *buf, size_t off, size_t len ); // Copy out
+static int shardsPut( struct shardedcache *sc, int fileId, SG_Node_ID nde, SG_Block_ID blk, char *block, int dirty ); // Copy in
+static void statsCount( struct cachestats *st, int fileId, SG_Node_ID nde, size_t field, uint64_t n ); // Bump a counter
+static void statsAdd( SG_Cache_Counters *to, const SG_Cache_Counters *from ); // Sum counters
+static void statsFree( struct cachestats *st );                          // Release breakdowns
+static uint64_t versionCurrent( SG_Node_ID nde );                        // Tag for new blocks
+static int versionStale( SG_Node_ID nde, uint64_t seq );                 // Tag out of date?
+static int versionMark( SG_Node_ID nde, uint64_t epoch );                // Raise a node's mark
+static void sizingCurve( uint64_t *hits, uint64_t *refs );               // Sum the shard curves
+static void sizingCheck( void );                                         // Resize to the curve
 
 //
 // Functions
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getSGCacheConfig
+// Description  : Get the cache configuration.  Defaults are overridden by the
+//                environment, which is overridden by setSGCacheConfig.
+//
+// Inputs       : cfg - place to put the configuration
+// Outputs      : none
+
+void getSGCacheConfig( SG_Cache_Config *cfg ) {
+
+    const char *env;
+    uint32_t elements;
+    int policy;
+
+    if ( !sgCacheConfigLoaded ) {
+
+        sgCacheConfig.maxElements = SG_MAX_CACHE_ELEMENTS;
+        sgCacheConfig.policy = SG_CACHE_LRU;
+        sgCacheConfig.writeBack = 0;
+        sgCacheConfig.shards = SG_CACHE_SHARDS;
+        sgCacheConfig.admission = 0;
+        sgCacheConfig.partitioned = 0;
+        sgCacheConfig.l2Elements = 0;
+        sgCacheConfig.l2Path = SG_CACHE_L2_PATH;
+        sgCacheConfig.shmElements = 0;
+        sgCacheConfig.shmName = SG_CACHE_SHM_NAME;
+        sgCacheConfig.compressedElements = 0;
+        sgCacheConfig.hugePages = 1;
+        sgCacheConfig.autoSizeElements = 0;
+        sgCacheConfig.closePolicy = SG_CACHE_CLOSE_FLUSH;
+        sgCacheConfig.closeGraceMs = SG_CACHE_CLOSE_GRACE;
+
+        if ( (env = getenv(SG_CACHE_ELEMENTS_ENV)) != NULL ) {
+            if ( parseCacheElements(env, &elements) == 0 ) {
+                sgCacheConfig.maxElements = elements;
+            } else {
+                logMessage( LOG_ERROR_LEVEL, "getSGCacheConfig: ignoring bad %s [%s]", SG_CACHE_ELEMENTS_ENV, env );
+            }
+        }
+
+        if ( (env = getenv(SG_CACHE_POLICY_ENV)) != NULL ) {
+            if ( (policy = parseSGCachePolicy(env)) >= 0 ) {
+                sgCacheConfig.policy = policy;
+            } else {
+                logMessage( LOG_ERROR_LEVEL, "getSGCacheConfig: ignoring bad %s [%s]", SG_CACHE_POLICY_ENV, env );
+            }
+        }
+
+        if ( (env = getenv(SG_CACHE_SHARDS_ENV)) != NULL ) {
+            if ( (parseCacheElements(env, &elements) == 0) && (elements <= SG_CACHE_SHARDS_LIMIT) ) {
+                sgCacheConfig.shards = elements;
+            } else {
+                logMessage( LOG_ERROR_LEVEL, "getSGCacheConfig: ignoring bad %s [%s]", SG_CACHE_SHARDS_ENV, env );
+            }
+        }
+
+        if ( (env = getenv(SG_CACHE_L2_ELEMENTS_ENV)) != NULL ) {
+            if ( (strcmp(env, "0") == 0) || (parseCacheElements(env, &elements) == 0) ) {
+                sgCacheConfig.l2Elements = (env[0] == '0') ? 0 : elements;
+            } else {
+                logMessage( LOG_ERROR_LEVEL, "getSGCacheConfig: ignoring bad %s [%s]", SG_CACHE_L2_ELEMENTS_ENV, env );
+            }
+        }
+
+        if ( ((env = getenv(SG_CACHE_L2_PATH_ENV)) != NULL) && (env[0] != '\0') ) {
+            sgCacheConfig.l2Path = env;
+        }
+
+        if ( (env = getenv(SG_CACHE_SHM_ELEMENTS_ENV)) != NULL ) {
+            if ( (strcmp(env, "0") == 0) || (parseCacheElements(env, &elements) == 0) ) {
+                sgCacheConfig.shmElements = (env[0] == '0') ? 0 : elements;
+            } else {
+                logMessage( LOG_ERROR_LEVEL, "getSGCacheConfig: ignoring bad %s [%s]", SG_CACHE_SHM_ELEMENTS_ENV, env );
+            }
+        }
+
+        if ( ((env = getenv(SG_CACHE_SHM_NAME_ENV)) != NULL) && (env[0] == '/') ) {
+            sgCacheConfig.shmName = env;
+        }
+
+        if ( (env = getenv(SG_CACHE_COMPRESSED_ENV)) != NULL ) {
+            if ( (strcmp(env, "0") == 0) || (parseCacheElements(env, &elements) == 0) ) {
+                sgCacheConfig.compressedElements = (env[0] == '0') ? 0 : elements;
+            } else {
+                logMessage( LOG_ERROR_LEVEL, "getSGCacheConfig: ignoring bad %s [%s]", SG_CACHE_COMPRESSED_ENV, env );
+            }
+        }
+
+        if ( (env = getenv(SG_CACHE_ADMISSION_ENV)) != NULL ) {
+            if ( (strcmp(env, "0") == 0) || (strcmp(env, "1") == 0) ) {
+                sgCacheConfig.admission = (env[0] == '1');
+            } else {
+                logMessage( LOG_ERROR_LEVEL, "getSGCacheConfig: ignoring bad %s [%s]", SG_CACHE_ADMISSION_ENV, env );
+            }
+        }
+
+        if ( (env = getenv(SG_CACHE_PARTITIONED_ENV)) != NULL ) {
+            if ( (strcmp(env, "0") == 0) || (strcmp(env, "1") == 0) ) {
+                sgCacheConfig.partitioned = (env[0] == '1');
+            } else {
+                logMessage( LOG_ERROR_LEVEL, "getSGCacheConfig: ignoring bad %s [%s]", SG_CACHE_PARTITIONED_ENV, env );
+            }
+        }
+
+        if ( (env = getenv(SG_CACHE_AUTOSIZE_ENV)) != NULL ) {
+            if ( (strcmp(env, "0") == 0) || (parseCacheElements(env, &elements) == 0) ) {
+                sgCacheConfig.autoSizeElements = (env[0] == '0') ? 0 : elements;
+            } else {
+                logMessage( LOG_ERROR_LEVEL, "getSGCacheConfig: ignoring bad %s [%s]", SG_CACHE_AUTOSIZE_ENV, env );
+            }
+        }
+
+        if ( (env = getenv(SG_CACHE_CLOSE_ENV)) != NULL ) {
+            if ( (policy = parseSGCacheClose(env)) >= 0 ) {
+                sgCacheConfig.closePolicy = policy;
+            } else {
+                logMessage( LOG_ERROR_LEVEL, "getSGCacheConfig: ignoring bad %s [%s]", SG_CACHE_CLOSE_ENV, env );
+            }
+        }
+
+        if ( (env = getenv(SG_CACHE_CLOSE_GRACE_ENV)) != NULL ) {
+            if ( (strcmp(env, "0") == 0) || (parseCacheElements(env, &elements) == 0) ) {
+                sgCacheConfig.closeGraceMs = (env[0] == '0') ? 0 : elements;
+            } else {
+                logMessage( LOG_ERROR_LEVEL, "getSGCacheConfig: ignoring bad %s [%s]", SG_CACHE_CLOSE_GRACE_ENV, env );
+            }
+        }
+
+        if ( (env = getenv(SG_CACHE_HUGEPAGES_ENV)) != NULL ) {
+            if ( (strcmp(env, "0") == 0) || (strcmp(env, "1") == 0) ) {
+                sgCacheConfig.hugePages = (env[0] == '1');
+            } else {
+                logMessage( LOG_ERROR_LEVEL, "getSGCacheConfig: ignoring bad %s [%s]", SG_CACHE_HUGEPAGES_ENV, env );
+            }
+        }
+
+        if ( (env = getenv(SG_CACHE_WRITEBACK_ENV)) != NULL ) {
+            if ( (strcmp(env, "0") == 0) || (strcmp(env, "1") == 0) ) {
+                sgCacheConfig.writeBack = (env[0] == '1');
+            } else {
+                logMessage( LOG_ERROR_LEVEL, "getSGCacheConfig: ignoring bad %s [%s]", SG_CACHE_WRITEBACK_ENV, env );
+            }
+        }
+
+        sgCacheConfigLoaded = 1;
+    }
+
+    *cfg = sgCacheConfig;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setSGCacheConfig
+// Description  : Set the configuration used by the next initSGCache
+//
+// Inputs       : cfg - the new configuration
+// Outputs      : 0 if successful, -1 if failure
+
+int setSGCacheConfig( const SG_Cache_Config *cfg ) {
+
+    if ( (cfg->maxElements == 0) || (cfg->maxElements > SG_CACHE_ELEMENTS_LIMIT) ) {
+        logMessage( LOG_ERROR_LEVEL, "setSGCacheConfig: bad cache size %u", cfg->maxElements );
+        return( -1 );
+    }
+    if ( (cfg->policy < 0) || (cfg->policy >= SG_CACHE_MAX_POLICY) ) {
+        logMessage( LOG_ERROR_LEVEL, "setSGCacheConfig: bad eviction policy %d", cfg->policy );
+        return( -1 );
+    }
+    if ( (cfg->shards == 0) || (cfg->shards > SG_CACHE_SHARDS_LIMIT) ) {
+        logMessage( LOG_ERROR_LEVEL, "setSGCacheConfig: bad shard count %u", cfg->shards );
+        return( -1 );
+    }
+    if ( (cfg->l2Elements > SG_CACHE_ELEMENTS_LIMIT) || ((cfg->l2Elements > 0) && (cfg->l2Path == NULL)) ) {
+        logMessage( LOG_ERROR_LEVEL, "setSGCacheConfig: bad L2 tier %u", cfg->l2Elements );
+        return( -1 );
+    }
+    if ( (cfg->shmElements > SG_CACHE_ELEMENTS_LIMIT) ||
+            ((cfg->shmElements > 0) && ((cfg->shmName == NULL) || (cfg->shmName[0] != '/'))) ) {
+        logMessage( LOG_ERROR_LEVEL, "setSGCacheConfig: bad shared tier %u", cfg->shmElements );
+        return( -1 );
+    }
+    if ( cfg->compressedElements > SG_CACHE_ELEMENTS_LIMIT / SG_ZTIER_MAX_RATIO ) {
+        logMessage( LOG_ERROR_LEVEL, "setSGCacheConfig: bad compressed tier %u", cfg->compressedElements );
+        return( -1 );
+    }
+    if ( cfg->autoSizeElements > SG_CACHE_ELEMENTS_LIMIT ) {
+        logMessage( LOG_ERROR_LEVEL, "setSGCacheConfig: bad auto sizing ceiling %u", cfg->autoSizeElements );
+        return( -1 );
+    }
+    if ( (cfg->closePolicy < 0) || (cfg->closePolicy >= SG_CACHE_MAX_CLOSE) ) {
+        logMessage( LOG_ERROR_LEVEL, "setSGCacheConfig: bad close policy %d", cfg->closePolicy );
+        return( -1 );
+    }
+
+    sgCacheConfig = *cfg;
+    sgCacheConfigLoaded = 1;
+
+    return( 0 );
+
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : initSGCache
-// Description  : Initialize the cache of block elements
+// Description  : Initialize the cache of block elements with the configured
+//                eviction policy and number of shards, and open the second
+//                tier if one is configured
 //
-// Inputs       : maxElements - maximum number of elements allowed
+// Inputs       : maxElements - maximum number of elements allowed, or
+//                              SG_CACHE_CONFIGURED for the configured size
 // Outputs      : 0 if successful, -1 if failure
 
-int initSGCache( uint16_t maxElements ) {
+int initSGCache( uint32_t maxElements ) {
+
+    SG_Cache_Config cfg;
+    SG_Cache_Stats stats;
+    size_t sketchBytesTotal = 0, sizerBytesTotal = 0;
+    uint32_t s;
+
+    getSGCacheConfig( &cfg );
+    if ( maxElements == SG_CACHE_CONFIGURED ) {
+        maxElements = cfg.maxElements;
+    }
+    if ( maxElements > SG_CACHE_ELEMENTS_LIMIT ) {
+        logMessage( LOG_ERROR_LEVEL, "initSGCache: cache size %u over limit %u", maxElements, SG_CACHE_ELEMENTS_LIMIT );
+        return( -1 );
+    }
+
+    if ( (cfg.autoSizeElements > 0) && (maxElements > cfg.autoSizeElements) ) {
+        maxElements = cfg.autoSizeElements;
+    }
+
+    // Release anything left from a previous run
+    shardsDestroy( &sgCache );
+    closeSGL2( sgCacheL2 );
+    sgCacheL2 = NULL;
+    closeSGShm( sgCacheShm );
+    sgCacheShm = NULL;
+    closeSGZTier( sgCacheZTier );
+    sgCacheZTier = NULL;
+    sgCacheHugePages = cfg.hugePages;
+    sgCacheSizing.ceiling = 0;
+
+    if ( shardsCreate(&sgCache, maxElements, cfg.policy, cfg.shards) ) {
+        logMessage( LOG_ERROR_LEVEL, "initSGCache: failed to allocate cache of %u elements", maxElements );
+        return( -1 );
+    }
+    sgGetCacheStats( &stats );
+    logMessage( LOG_INFO_LEVEL, "initSGCache: %u elements in %u shards, %lu bytes of block storage on %s pages, %s eviction, %s, %s on close%s",
+            maxElements, sgCache.nshards, (unsigned long)stats.slabBytes, arenaBackingName(stats.slabBacking),
+            sgCachePolicyName(cfg.policy), cfg.writeBack ? "write-back" : "write-through",
+            sgCacheCloseName(cfg.closePolicy), cfg.partitioned ? ", partitioned by file" : "" );
+
+    // Each shard splits its share between the files using it
+    for (s = 0; s < sgCache.nshards; s++){
+        sgCache.shards[s].cache.partitioned = cfg.partitioned;
+    }
+
+    // Each shard filters admissions with its own sketch
+    if ( cfg.admission ) {
+        for (s = 0; s < sgCache.nshards; s++){
+            if ( (sgCache.shards[s].cache.sketch = createSGSketch(sgCache.shards[s].cache.maxElements)) == NULL ) {
+                logMessage( LOG_ERROR_LEVEL, "initSGCache: failed to allocate admission sketch" );
+                shardsDestroy( &sgCache );
+                return( -1 );
+            }
+            sketchBytesTotal += sketchBytes( sgCache.shards[s].cache.sketch );
+        }
+        logMessage( LOG_INFO_LEVEL, "initSGCache: TinyLFU admission, %lu bytes of sketch", (unsigned long)sketchBytesTotal );
+    }
 
-    for (int x = 0; x < 128; x++){
+    // Each shard estimates its miss ratio curve over its share of the
+    // ceiling, the cache is resized to follow the combined curve
+    if ( cfg.autoSizeElements > 0 ) {
+        for (s = 0; s < sgCache.nshards; s++){
+            sgCache.shards[s].cache.sizer = createSGSizer( shardElements(cfg.autoSizeElements, sgCache.nshards, s) );
+            if ( sgCache.shards[s].cache.sizer == NULL ) {
+                logMessage( LOG_ERROR_LEVEL, "initSGCache: failed to allocate sizer for ceiling %u", cfg.autoSizeElements );
+                shardsDestroy( &sgCache );
+                return( -1 );
+            }
+            sizerBytesTotal += sizerBytes( sgCache.shards[s].cache.sizer );
+        }
+        sgCacheSizing.ceiling = cfg.autoSizeElements;
+        __atomic_store_n( &sgCacheSizing.lookups, 0, __ATOMIC_RELAXED );
+        logMessage( LOG_INFO_LEVEL, "initSGCache: auto sizing up to %u elements, %lu bytes of sizer",
+                cfg.autoSizeElements, (unsigned long)sizerBytesTotal );
+    }
 
-        cache[x].blockID = 0;
-        cache[x].nodeID = 0;
-        cache[x].buf = 0;
-        cache[x].timer = 0;
+    // The second tier is optional, the cache runs without it if it fails
+    if ( cfg.l2Elements > 0 ) {
+        if ( (sgCacheL2 = openSGL2(cfg.l2Path, cfg.l2Elements)) == NULL ) {
+            logMessage( LOG_ERROR_LEVEL, "initSGCache: continuing without L2 tier %s", cfg.l2Path );
+        }
+        for (s = 0; s < sgCache.nshards; s++){
+            sgCache.shards[s].cache.l2 = sgCacheL2;
+        }
+    }
 
+    // So is the tier shared with the other processes on the host
+    if ( cfg.shmElements > 0 ) {
+        if ( (sgCacheShm = openSGShm(cfg.shmName, cfg.shmElements)) == NULL ) {
+            logMessage( LOG_ERROR_LEVEL, "initSGCache: continuing without shared tier %s", cfg.shmName );
+        }
+        for (s = 0; s < sgCache.nshards; s++){
+            sgCache.shards[s].cache.shm = sgCacheShm;
+        }
     }
 
-    hit = 0;
-    miss = 0;
+    // And the compressed tier, which evicted blocks go to before the L2
+    if ( cfg.compressedElements > 0 ) {
+        if ( (sgCacheZTier = openSGZTier(cfg.compressedElements, cfg.hugePages)) == NULL ) {
+            logMessage( LOG_ERROR_LEVEL, "initSGCache: continuing without compressed tier" );
+        }
+        for (s = 0; s < sgCache.nshards; s++){
+            sgCache.shards[s].cache.ztier = sgCacheZTier;
+        }
+    }
 
     return( 0 );
 
@@ -68,16 +598,126 @@ int initSGCache( uint16_t maxElements ) {
 //
 // Function     : closeSGCache
 // Description  : Close the cache of block elements, clean up remaining data
+//                (no other thread may be using the cache).  Resident blocks
+//                are kept in the second tier for the next run.
 //
 // Inputs       : none
 // Outputs      : 0 if successful, -1 if failure
 
 int closeSGCache( void ) {
 
-    double num;
-    num = ((double)hit / ( (double)hit + (double)miss));
+    uint32_t s, e;
+    int ret = 0;
+
+    // Anything still dirty has to reach the node before the data goes away
+    if ( flushSGCache() ) {
+        logMessage( LOG_ERROR_LEVEL, "closeSGCache: failed to write back dirty blocks" );
+        ret = -1;
+    }
+    logSGCacheStats( LOG_INFO_LEVEL, 0 );
+
+    // The compressed tier does not outlive the process, only the L2 does
+    for (s = 0; s < sgCache.nshards; s++){
+        sgCache.shards[s].cache.ztier = NULL;
+    }
+    closeSGZTier( sgCacheZTier );
+    sgCacheZTier = NULL;
+    if ( sgCacheL2 != NULL ) {
+        for (s = 0; s < sgCache.nshards; s++){
+            for (e = 0; e < sgCache.shards[s].cache.maxElements; e++){
+                if ( sgCache.shards[s].cache.entries[e].buf != NULL ) {
+                    cacheDemote( &sgCache.shards[s].cache, e );
+                }
+            }
+        }
+        if ( closeSGL2(sgCacheL2) ) {
+            ret = -1;
+        }
+        sgCacheL2 = NULL;
+    }
+    closeSGShm( sgCacheShm );
+    sgCacheShm = NULL;
+    shardsDestroy( &sgCache );
+    sgCacheSizing.ceiling = 0;
+
+    pthread_mutex_lock( &sgCacheVersions.lock );
+    free( sgCacheVersions.nodes );
+    sgCacheVersions.nodes = NULL;
+    sgCacheVersions.cap = 0;
+    __atomic_store_n( &sgCacheVersions.count, 0, __ATOMIC_RELEASE );
+    pthread_mutex_unlock( &sgCacheVersions.lock );
+
+    return( ret );
 
-    printf("Cache hit: %d times, Cache miss %d times, Total Access: %d times, Hit Rate is: %.2lf.\n", hit, miss, (hit + miss), num);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : resizeSGCache
+// Description  : Grow or shrink the live cache.  Each shard keeps its share
+//                of the new size; the blocks its policy would keep longest
+//                are carried over and the rest are evicted.
+//
+// Inputs       : maxElements - new maximum number of elements
+// Outputs      : 0 if successful, -1 if failure
+
+int resizeSGCache( uint32_t maxElements ) {
+
+    uint32_t s, kept = 0;
+    int ret = 0;
+
+    if ( sgCache.shards == NULL ) {
+        logMessage( LOG_ERROR_LEVEL, "resizeSGCache: cache not initialized" );
+        return( -1 );
+    }
+    if ( (maxElements < sgCache.nshards) || (maxElements > SG_CACHE_ELEMENTS_LIMIT) ) {
+        logMessage( LOG_ERROR_LEVEL, "resizeSGCache: bad cache size %u (%u shards)", maxElements, sgCache.nshards );
+        return( -1 );
+    }
+    if ( maxElements == sgCache.maxElements ) {
+        return( 0 );
+    }
+
+    // Shards resize one at a time, the others stay usable meanwhile
+    for (s = 0; s < sgCache.nshards; s++){
+        pthread_mutex_lock( &sgCache.shards[s].lock );
+        if ( cacheResize(&sgCache.shards[s].cache, shardElements(maxElements, sgCache.nshards, s)) ) {
+            ret = -1;
+        }
+        kept += sgCache.shards[s].cache.count;
+        pthread_mutex_unlock( &sgCache.shards[s].lock );
+    }
+    if ( ret ) {
+        logMessage( LOG_ERROR_LEVEL, "resizeSGCache: failed to resize to %u elements", maxElements );
+        return( -1 );
+    }
+
+    logMessage( LOG_INFO_LEVEL, "resizeSGCache: %u -> %u elements, %u blocks kept",
+            sgCache.maxElements, maxElements, kept );
+    sgCache.maxElements = maxElements;
+
+    // Whoever sized things to the cache sizes them again
+    if ( sgCacheResize != NULL ) {
+        sgCacheResize( maxElements );
+    }
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setSGCacheResizeHandler
+// Description  : Set the function told the new size after each resize
+//                (from resizeSGCache, or the sizer calling it).  It is
+//                called with no shard locked.
+//
+// Inputs       : fn - the resize function (NULL to clear)
+// Outputs      : 0 if successful, -1 if failure
+
+int setSGCacheResizeHandler( SG_Cache_Resize fn ) {
+
+    sgCacheResize = fn;
 
     return( 0 );
 
@@ -86,7 +726,9 @@ int closeSGCache( void ) {
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : getSGDataBlock
-// Description  : Get the data block from the block cache
+// Description  : Get the data block from the block cache.  The pointer is
+//                not protected once returned, threaded callers should use
+//                readSGDataBlock/writeSGDataBlock instead.
 //
 // Inputs       : nde - node ID to find
 //                blk - block ID to find
@@ -94,78 +736,2698 @@ int closeSGCache( void ) {
 
 char *getSGDataBlock( SG_Node_ID nde, SG_Block_ID blk ) {
 
-    miss++;
-    hit++;
+    struct cacheshard *sh = shardFor( &sgCache, nde, blk );
+    char *buf = NULL;
+    int e;
+
+    if ( sh == NULL ) {
+        return NULL;
+    }
+
+    pthread_mutex_lock( &sh->lock );
+    if ( (e = shardLookup(sh, SG_CACHE_NO_OWNER, nde, blk)) != SG_CACHE_NO_ENTRY ) {
+        buf = sh->cache.entries[e].buf;
+        statsCount( &sh->stats, SG_CACHE_NO_OWNER, nde, SG_CACHE_STAT(bytesServed), SG_BLOCK_SIZE );
+    }
+    pthread_mutex_unlock( &sh->lock );
+
+    return buf;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : hasSGDataBlock
+// Description  : Check whether a current copy of a block is cached in
+//                any tier, without counting it or telling the policy
+//
+// Inputs       : nde - node ID to find
+//                blk - block ID to find
+// Outputs      : 1 if cached, 0 if not
+
+int hasSGDataBlock( SG_Node_ID nde, SG_Block_ID blk ) {
+
+    struct cacheshard *sh = shardFor( &sgCache, nde, blk );
+    char frame[SG_BLOCK_SIZE];
+    uint64_t seq;
+    int e, found;
+
+    if ( sh == NULL ) {
+        return( 0 );
+    }
+
+    pthread_mutex_lock( &sh->lock );
+    if ( (e = cacheFind(&sh->cache, nde, blk)) != SG_CACHE_NO_ENTRY ) {
+        found = sh->cache.entries[e].dirty || !versionStale(nde, sh->cache.entries[e].seq);
+    } else {
+        found = ((sh->cache.shm != NULL) && (shmGet(sh->cache.shm, nde, blk, &seq, frame) == 0) &&
+                !versionStale(nde, seq)) ||
+                ((sh->cache.ztier != NULL) && ztierContains(sh->cache.ztier, nde, blk, &seq) &&
+                !versionStale(nde, seq)) ||
+                ((sh->cache.l2 != NULL) && l2Contains(sh->cache.l2, nde, blk, &seq) &&
+                !versionStale(nde, seq));
+    }
+    pthread_mutex_unlock( &sh->lock );
+
+    return( found );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : readSGDataBlock
+// Description  : Copy part of a cached block out of the cache
+//
+// Inputs       : fileId - file number the read is for (or SG_CACHE_NO_OWNER)
+//                nde - node ID to find
+//                blk - block ID to find
+//                buf - place to put the data
+//                off - offset within the block
+//                len - number of bytes to copy
+// Outputs      : 0 if successful, -1 if failure (block not cached)
+
+int readSGDataBlock( int fileId, SG_Node_ID nde, SG_Block_ID blk, char *buf, size_t off, size_t len ) {
+
+    return( shardsRead(&sgCache, fileId, nde, blk, buf, off, len) );
+
+}
 
-    for (int x = 0; x < 128; x++){
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : writeSGDataBlock
+// Description  : Copy data into part of a cached block
+//
+// Inputs       : fileId - file number the write is for (or SG_CACHE_NO_OWNER)
+//                nde - node ID to find
+//                blk - block ID to find
+//                buf - the data to write
+//                off - offset within the block
+//                len - number of bytes to copy
+//                dirty - 1 to mark the block for write back, or
+//                        SG_CACHE_WRITE_THROUGH to send it now, with the
+//                        shard unlocked (not a flush; if it cannot be sent
+//                        it is dropped)
+// Outputs      : 0 if successful, -1 if failure (block not cached, or not
+//                written through)
 
-        cache[x].timer++;
+int writeSGDataBlock( int fileId, SG_Node_ID nde, SG_Block_ID blk, const char *buf, size_t off, size_t len, int dirty ) {
 
-        if (cache[x].blockID == blk && cache[x].nodeID == nde){
+    struct cacheshard *sh = shardFor( &sgCache, nde, blk );
+    char frame[SG_BLOCK_SIZE];
+    int e, sent;
 
-            cache[x].timer = 0;
-            hit++;
-            return cache[x].buf;
+    if ( (sh == NULL) || (off > SG_BLOCK_SIZE) || (len > SG_BLOCK_SIZE - off) ) {
+        return( -1 );
+    }
+    if ( dirty && (sgCacheFlush == NULL) ) {
+        logMessage( LOG_ERROR_LEVEL, "writeSGDataBlock: no flush handler set" );
+        return( -1 );
+    }
 
+    pthread_mutex_lock( &sh->lock );
+    if ( (e = shardLookup(sh, fileId, nde, blk)) != SG_CACHE_NO_ENTRY ) {
+        memcpy( sh->cache.entries[e].buf + off, buf, len );
+        if ( dirty == SG_CACHE_WRITE_THROUGH ) {
+            // Dirty until the node has it, sent from a copy below
+            cacheSetDirty( &sh->cache, e, 1 );
+            memcpy( frame, sh->cache.entries[e].buf, SG_BLOCK_SIZE );
+        } else if ( dirty ) {
+            cacheSetDirty( &sh->cache, e, 1 );
+        } else if ( sh->cache.shm != NULL ) {
+            shmPut( sh->cache.shm, nde, blk, sh->cache.entries[e].seq, sh->cache.entries[e].buf );
         }
+    }
+    pthread_mutex_unlock( &sh->lock );
+    if ( (e == SG_CACHE_NO_ENTRY) || (dirty != SG_CACHE_WRITE_THROUGH) ) {
+        return( (e != SG_CACHE_NO_ENTRY) ? 0 : -1 );
+    }
 
+    // Write through without the shard locked, the round trip is long.  The
+    // block is clean once sent, or dropped if it could not be; if another
+    // write changed it meanwhile the sends may have crossed, so it stays
+    // dirty and is written back whole later.
+    sent = (sgCacheFlush(nde, blk, frame) == 0);
+    pthread_mutex_lock( &sh->lock );
+    if ( (e = cacheFind(&sh->cache, nde, blk)) != SG_CACHE_NO_ENTRY ) {
+        if ( memcmp(sh->cache.entries[e].buf, frame, SG_BLOCK_SIZE) != 0 ) {
+            cacheSetDirty( &sh->cache, e, 1 );
+        } else if ( ! sent ) {
+            cacheDrop( &sh->cache, e );
+        } else if ( sh->cache.entries[e].dirty ) {
+            cacheSetDirty( &sh->cache, e, 0 );
+            sh->cache.entries[e].seq = versionCurrent( nde );
+            if ( sh->cache.shm != NULL ) {
+                shmPut( sh->cache.shm, nde, blk, sh->cache.entries[e].seq, frame );
+            }
+        }
     }
+    pthread_mutex_unlock( &sh->lock );
 
-    return NULL;
+    return( sent ? 0 : -1 );
 
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : putSGDataBlock
-// Description  : Get the data block from the block cache
+// Description  : Copy a data block into the block cache
 //
 // Inputs       : nde - node ID to find
 //                blk - block ID to find
-//                block - block to insert into cache
+//                block - block to insert into cache (copied)
 // Outputs      : 0 if successful, -1 if failure
 
 int putSGDataBlock( SG_Node_ID nde, SG_Block_ID blk, char *block ) {
 
-    int count = cache[0].timer;
-    int number = 0;
-    int z = 0;
-    miss++;
-
-    if (cache[127].nodeID != 0){
+    int ret = shardsPut( &sgCache, SG_CACHE_NO_OWNER, nde, blk, block, 0 );
 
-        for (int y = 0; y < (SG_MAX_CACHE_ELEMENTS - 1); y++){
+    sizingCheck();
 
-            if (count < cache[y+1].timer){
+    return( ret );
 
-                count = cache[y+1].timer;
-                number = y + 1;
-                cache[y].timer++;
+}
 
-            }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : insertSGDataBlock
+// Description  : Copy a data block into the block cache on behalf of a file
+//
+// Inputs       : fileId - file number the block belongs to (or SG_CACHE_NO_OWNER)
+//                nde - node ID
+//                blk - block ID
+//                block - block to insert into cache (copied)
+//                dirty - block has not been written back yet
+// Outputs      : 0 if successful, -1 if failure
 
-        }
+int insertSGDataBlock( int fileId, SG_Node_ID nde, SG_Block_ID blk, char *block, int dirty ) {
 
-        cache[number].nodeID = nde;
-        cache[number].blockID = blk;
-        cache[number].buf = block;
-        cache[number].timer = 0;
+    int ret;
 
+    if ( dirty && (sgCacheFlush == NULL) ) {
+        logMessage( LOG_ERROR_LEVEL, "insertSGDataBlock: no flush handler set" );
+        return( -1 );
     }
-    else{
-        
-        while(cache[z].nodeID != 0){
 
-            z++;
+    ret = shardsPut( &sgCache, fileId, nde, blk, block, dirty );
+    sizingCheck();
 
-        }
+    return( ret );
 
-        cache[z].nodeID = nde;
-        cache[z].blockID = blk;
-        cache[z].buf = block;
-        cache[z].timer = 0;
+}
 
-    }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setSGCacheFlushHandler
+// Description  : Set the function used to write dirty blocks back to their
+//                node (on eviction, resize, flush and close).  It is called
+//                with the block's shard locked, except for the write-through
+//                of writeSGDataBlock.
+//
+// Inputs       : fn - the write back function (NULL to clear)
+// Outputs      : 0 if successful, -1 if failure
+
+int setSGCacheFlushHandler( SG_Cache_Flush fn ) {
+
+    sgCacheFlush = fn;
 
     return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : markSGDataBlockDirty
+// Description  : Mark a cached block as modified; it is written back before
+//                it leaves the cache
+//
+// Inputs       : nde - node ID
+//                blk - block ID
+// Outputs      : 0 if successful, -1 if failure (block not cached)
+
+int markSGDataBlockDirty( SG_Node_ID nde, SG_Block_ID blk ) {
+
+    struct cacheshard *sh = shardFor( &sgCache, nde, blk );
+    int e;
+
+    if ( sh == NULL ) {
+        return( -1 );
+    }
+    if ( sgCacheFlush == NULL ) {
+        logMessage( LOG_ERROR_LEVEL, "markSGDataBlockDirty: no flush handler set" );
+        return( -1 );
+    }
+
+    pthread_mutex_lock( &sh->lock );
+    if ( (e = cacheFind(&sh->cache, nde, blk)) != SG_CACHE_NO_ENTRY ) {
+        cacheSetDirty( &sh->cache, e, 1 );
+    }
+    pthread_mutex_unlock( &sh->lock );
+
+    return( (e != SG_CACHE_NO_ENTRY) ? 0 : -1 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushSGDataBlock
+// Description  : Write a block back to its node if it is cached and dirty
+//
+// Inputs       : nde - node ID
+//                blk - block ID
+// Outputs      : 0 if successful, -1 if failure
+
+int flushSGDataBlock( SG_Node_ID nde, SG_Block_ID blk ) {
+
+    struct cacheshard *sh = shardFor( &sgCache, nde, blk );
+    int e, ret = 0;
+
+    if ( sh == NULL ) {
+        return( 0 );
+    }
+
+    pthread_mutex_lock( &sh->lock );
+    if ( (e = cacheFind(&sh->cache, nde, blk)) != SG_CACHE_NO_ENTRY ) {
+        ret = cacheWriteBack( &sh->cache, e, 1 );
+    }
+    pthread_mutex_unlock( &sh->lock );
+
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : evictSGDataBlock
+// Description  : Push a block out of the cache now, as if it were the
+//                policy's victim: written back if dirty, then moved to the
+//                lower tiers
+//
+// Inputs       : nde - node ID
+//                blk - block ID
+// Outputs      : 0 if successful, -1 if failure (dirty and not written back)
+
+int evictSGDataBlock( SG_Node_ID nde, SG_Block_ID blk ) {
+
+    struct cacheshard *sh = shardFor( &sgCache, nde, blk );
+    int e, ret = 0;
+
+    if ( sh == NULL ) {
+        return( 0 );
+    }
+
+    pthread_mutex_lock( &sh->lock );
+    if ( ((e = cacheFind(&sh->cache, nde, blk)) != SG_CACHE_NO_ENTRY) &&
+            ((ret = cacheEvict(&sh->cache, e)) == 0) ) {
+        cacheFree( &sh->cache, e );
+    }
+    pthread_mutex_unlock( &sh->lock );
+
+    return( ret );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : flushSGCache
+// Description  : Write every dirty block in the cache back to its node
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int flushSGCache( void ) {
+
+    uint32_t s;
+    int ret = 0;
+
+    for (s = 0; s < sgCache.nshards; s++){
+        pthread_mutex_lock( &sgCache.shards[s].lock );
+        if ( cacheWriteBackAll(&sgCache.shards[s].cache) ) {
+            ret = -1;
+        }
+        pthread_mutex_unlock( &sgCache.shards[s].lock );
+    }
+
+    return( ret );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setSGCacheQuota
+// Description  : Limit the blocks a file may hold in the cache.  The quota
+//                is split over the shards like the capacity, at least one
+//                block each, and a file over it is trimmed right away.
+//
+// Inputs       : fileId - the file number
+//                blocks - the most blocks the file may hold (0 = no limit)
+// Outputs      : 0 if successful, -1 if failure
+
+int setSGCacheQuota( int fileId, uint32_t blocks ) {
+
+    struct blockcache *c;
+    struct filepart *p;
+    uint32_t s;
+    int e, ret = 0;
+
+    if ( (sgCache.shards == NULL) || (fileId < 0) ) {
+        logMessage( LOG_ERROR_LEVEL, "setSGCacheQuota: bad file number %d or cache not initialized", fileId );
+        return( -1 );
+    }
+
+    for (s = 0; s < sgCache.nshards; s++){
+        pthread_mutex_lock( &sgCache.shards[s].lock );
+        c = &sgCache.shards[s].cache;
+        if ( (p = partFor(c, fileId)) == NULL ) {
+            ret = -1;
+        } else {
+            p->quota = shardElements( blocks, sgCache.nshards, s );
+            if ( (blocks > 0) && (p->quota == 0) ) {
+                p->quota = 1;
+            }
+            while ( (p->quota > 0) && (p->resident > p->quota) ) {
+                e = p->tail;
+                if ( cacheEvict(c, e) ) {
+                    ret = -1;
+                    break;
+                }
+                statsCount( c->stats, fileId, c->keys[e].nodeID, SG_CACHE_STAT(reclaims), 1 );
+                cacheFree( c, e );
+            }
+        }
+        pthread_mutex_unlock( &sgCache.shards[s].lock );
+    }
+
+    return( ret );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheCloseName
+// Description  : Get the name of a close policy
+//
+// Inputs       : policy - the close policy
+// Outputs      : the name ("unknown" if out of range)
+
+const char *sgCacheCloseName( SG_Cache_Close policy ) {
+
+    if ( (policy < 0) || (policy >= SG_CACHE_MAX_CLOSE) ) {
+        return( "unknown" );
+    }
+    return( sgCacheCloseNames[policy] );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parseSGCacheClose
+// Description  : Look up a close policy by name (case insensitive)
+//
+// Inputs       : name - the policy name
+// Outputs      : the policy or -1 if unknown
+
+int parseSGCacheClose( const char *name ) {
+
+    int x;
+
+    for (x = 0; x < SG_CACHE_MAX_CLOSE; x++){
+        if ( strcasecmp(name, sgCacheCloseNames[x]) == 0 ) {
+            return( x );
+        }
+    }
+
+    return( -1 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeSGCacheFile
+// Description  : Note that a file was closed.  Once the grace period is
+//                over its blocks are evicted ahead of the policy's victims,
+//                least recent first, files in the order they were closed,
+//                so the cache goes to the files still open.  Hits in the
+//                meantime count as usual.
+//
+// Inputs       : fileId - the file number
+//                graceMs - how long its blocks keep their place (0 = they
+//                          go first from now on)
+// Outputs      : 0 if successful, -1 if failure
+
+int closeSGCacheFile( int fileId, uint32_t graceMs ) {
+
+    uint64_t releaseAt;
+    uint32_t s;
+    int ret = 0;
+
+    if ( (sgCache.shards == NULL) || (fileId < 0) ) {
+        logMessage( LOG_ERROR_LEVEL, "closeSGCacheFile: bad file number %d or cache not initialized", fileId );
+        return( -1 );
+    }
+
+    releaseAt = ((sgCacheClock != NULL) ? sgCacheClock() : cacheClock()) + graceMs;
+    for (s = 0; s < sgCache.nshards; s++){
+        pthread_mutex_lock( &sgCache.shards[s].lock );
+        if ( partFor(&sgCache.shards[s].cache, fileId) == NULL ) {
+            ret = -1;
+        } else {
+            partClose( &sgCache.shards[s].cache, fileId, releaseAt );
+        }
+        pthread_mutex_unlock( &sgCache.shards[s].lock );
+    }
+
+    return( ret );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openSGCacheFile
+// Description  : Note that a file was opened (again), its blocks are no
+//                longer released ahead of the others
+//
+// Inputs       : fileId - the file number
+// Outputs      : 0 if successful, -1 if failure
+
+int openSGCacheFile( int fileId ) {
+
+    uint32_t s;
+
+    if ( (sgCache.shards == NULL) || (fileId < 0) ) {
+        logMessage( LOG_ERROR_LEVEL, "openSGCacheFile: bad file number %d or cache not initialized", fileId );
+        return( -1 );
+    }
+
+    for (s = 0; s < sgCache.nshards; s++){
+        pthread_mutex_lock( &sgCache.shards[s].lock );
+        if ( (uint32_t)fileId < sgCache.shards[s].cache.nparts ) {
+            partReopen( &sgCache.shards[s].cache, fileId );
+        }
+        pthread_mutex_unlock( &sgCache.shards[s].lock );
+    }
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setSGCacheVersionHandler
+// Description  : Set the function that gives a node's current epoch, a
+//                64 bit count its driver bumps whenever the node's blocks
+//                can no longer be trusted.  Blocks are tagged with it when
+//                they are cached or written back, and invalidateSGNode
+//                compares against the tags (they never wrap).
+//
+// Inputs       : fn - the version function (NULL tags every block 0)
+// Outputs      : 0 if successful, -1 if failure
+
+int setSGCacheVersionHandler( SG_Cache_Version fn ) {
+
+    sgCacheVersion = fn;
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setSGCacheClockHandler
+// Description  : Set the clock the close grace periods run on, so a test or
+//                benchmark can count accesses instead of milliseconds
+//
+// Inputs       : fn - the clock function (NULL for the monotonic clock in ms)
+// Outputs      : 0 if successful, -1 if failure
+
+int setSGCacheClockHandler( SG_Cache_Clock fn ) {
+
+    sgCacheClock = fn;
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : setSGCacheTagMatch
+// Description  : Choose how index tags are compared: with the vector
+//                instructions the CPU has (the default) or one at a time.
+//                Only for benchmarks, with no lookups running.
+//
+// Inputs       : portable - 1 for the plain loop, 0 for the CPU's best
+// Outputs      : name of the tag matcher now in use
+
+const char *setSGCacheTagMatch( int portable ) {
+
+    pthread_once( &sgCacheTagOnce, tagSelect );
+    if ( portable ) {
+        sgCacheTagMatch = tagMatchScalar;
+        sgCacheTagMatchName = "scalar";
+    } else {
+        tagSelect();
+    }
+
+    return( sgCacheTagMatchName );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : invalidateSGDataBlock
+// Description  : Drop a block from every tier because its copy on the node
+//                has changed or gone; a dirty copy is discarded
+//
+// Inputs       : nde - node ID
+//                blk - block ID
+// Outputs      : 0 if successful, -1 if failure
+
+int invalidateSGDataBlock( SG_Node_ID nde, SG_Block_ID blk ) {
+
+    struct cacheshard *sh = shardFor( &sgCache, nde, blk );
+    int e;
+
+    if ( sh == NULL ) {
+        return( 0 );
+    }
+
+    pthread_mutex_lock( &sh->lock );
+    if ( (e = cacheFind(&sh->cache, nde, blk)) != SG_CACHE_NO_ENTRY ) {
+        cacheDrop( &sh->cache, e );
+    }
+    if ( sh->cache.l2 != NULL ) {
+        l2Remove( sh->cache.l2, nde, blk );
+    }
+    if ( sh->cache.shm != NULL ) {
+        shmRemove( sh->cache.shm, nde, blk );
+    }
+    if ( sh->cache.ztier != NULL ) {
+        ztierRemove( sh->cache.ztier, nde, blk );
+    }
+    pthread_mutex_unlock( &sh->lock );
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : invalidateSGNode
+// Description  : Mark every clean block of a node tagged before epoch as
+//                stale.  Nothing is scanned; stale blocks are dropped when
+//                they are next looked up.  Dirty blocks are newer than the
+//                node's copy and are kept.
+//
+// Inputs       : nde - node ID
+//                epoch - the node's new epoch
+// Outputs      : 0 if successful, -1 if failure
+
+int invalidateSGNode( SG_Node_ID nde, uint64_t epoch ) {
+
+    if ( versionMark(nde, epoch) ) {
+        logMessage( LOG_ERROR_LEVEL, "invalidateSGNode: cannot record node %lu", nde );
+        return( -1 );
+    }
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgGetCacheStats
+// Description  : Get the cache totals, combined over the shards
+//
+// Inputs       : stats - place to put the statistics
+// Outputs      : 0 if successful, -1 if failure (cache not initialized)
+
+int sgGetCacheStats( SG_Cache_Stats *stats ) {
+
+    uint64_t hits[SG_CACHE_MRC_POINTS] = { 0 }, refs = 0;
+    SG_ZTier_Info info;
+    uint32_t s, x;
+
+    memset( stats, 0, sizeof(SG_Cache_Stats) );
+    if ( sgCache.shards == NULL ) {
+        return( -1 );
+    }
+
+    stats->maxElements = sgCache.maxElements;
+    stats->shards = sgCache.nshards;
+    stats->slabBacking = SG_ARENA_HUGETLB;
+    if ( sgCacheL2 != NULL ) {
+        l2Info( sgCacheL2, &stats->l2Elements, &stats->l2Resident );
+    }
+    if ( sgCacheShm != NULL ) {
+        shmInfo( sgCacheShm, &stats->shmElements, &stats->shmResident );
+    }
+    if ( sgCacheZTier != NULL ) {
+        ztierInfo( sgCacheZTier, &info );
+        stats->zElements = info.elements;
+        stats->zResident = info.resident;
+        stats->zStoredBytes = info.storedBytes;
+        stats->zMemoryBytes = info.memoryBytes;
+        stats->zIncompressible = info.incompressible;
+        stats->zDecompressNs = info.decompressions ? info.decompressNs / info.decompressions : 0;
+    }
+    for (s = 0; s < sgCache.nshards; s++){
+        pthread_mutex_lock( &sgCache.shards[s].lock );
+        stats->resident += sgCache.shards[s].cache.count;
+        stats->dirty += sgCache.shards[s].cache.dirtyCount;
+        stats->sketchBytes += sketchBytes( sgCache.shards[s].cache.sketch );
+        if ( sgCache.shards[s].cache.sizer != NULL ) {
+            sizerCurve( sgCache.shards[s].cache.sizer, hits, &refs );
+        }
+        stats->slabBytes += sgCache.shards[s].cache.slab.arena.length;
+        if ( sgCache.shards[s].cache.slab.arena.backing < stats->slabBacking ) {
+            stats->slabBacking = sgCache.shards[s].cache.slab.arena.backing;
+        }
+        statsAdd( &stats->total, &sgCache.shards[s].stats.total );
+        pthread_mutex_unlock( &sgCache.shards[s].lock );
+    }
+
+    // Every shard's curve covers its share of the ceiling, so their points
+    // line up and add
+    if ( sgCacheSizing.ceiling > 0 ) {
+        stats->mrcPoints = SG_CACHE_MRC_POINTS;
+        for (x = 0; x < SG_CACHE_MRC_POINTS; x++){
+            stats->mrc[x].elements = (uint32_t)(((uint64_t)sgCacheSizing.ceiling * (x + 1)) / SG_CACHE_MRC_POINTS);
+            stats->mrc[x].missRatio = (refs > 0) ? 1.0 - (double)hits[x] / refs : 1.0;
+        }
+    }
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgGetCacheFileStats
+// Description  : Get the counters of one file.  Evictions and
+//                flushes count against the file the block was cached for.
+//
+// Inputs       : fileId - the file number
+//                counters - place to put the counters
+// Outputs      : 0 if successful, -1 if failure
+
+int sgGetCacheFileStats( int fileId, SG_Cache_Counters *counters ) {
+
+    struct cachestats *st;
+    uint32_t s;
+
+    memset( counters, 0, sizeof(SG_Cache_Counters) );
+    if ( (sgCache.shards == NULL) || (fileId < 0) ) {
+        return( -1 );
+    }
+
+    for (s = 0; s < sgCache.nshards; s++){
+        pthread_mutex_lock( &sgCache.shards[s].lock );
+        st = &sgCache.shards[s].stats;
+        if ( (uint32_t)fileId < st->nfiles ) {
+            statsAdd( counters, &st->files[fileId] );
+        }
+        pthread_mutex_unlock( &sgCache.shards[s].lock );
+    }
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgGetCacheNodeStats
+// Description  : Get the counters of one remote node
+//
+// Inputs       : nde - the node ID
+//                counters - place to put the counters
+// Outputs      : 0 if successful, -1 if failure
+
+int sgGetCacheNodeStats( SG_Node_ID nde, SG_Cache_Counters *counters ) {
+
+    struct cachestats *st;
+    uint32_t s, n;
+
+    memset( counters, 0, sizeof(SG_Cache_Counters) );
+    if ( sgCache.shards == NULL ) {
+        return( -1 );
+    }
+
+    for (s = 0; s < sgCache.nshards; s++){
+        pthread_mutex_lock( &sgCache.shards[s].lock );
+        st = &sgCache.shards[s].stats;
+        if ( st->nodeCap > 0 ) {
+            n = (uint32_t)sgCacheHash(nde, 0) & (st->nodeCap - 1);
+            while ( st->nodes[n].nodeID != SG_NODE_UNKNOWN ) {
+                if ( st->nodes[n].nodeID == nde ) {
+                    statsAdd( counters, &st->nodes[n].counters );
+                    break;
+                }
+                n = (n + 1) & (st->nodeCap - 1);
+            }
+        }
+        pthread_mutex_unlock( &sgCache.shards[s].lock );
+    }
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgGetCacheNodes
+// Description  : List the remote nodes the cache has counters for
+//
+// Inputs       : nodes - place to put the node IDs
+//                max - room in nodes
+// Outputs      : number of nodes listed (at most max), -1 if failure
+
+int sgGetCacheNodes( SG_Node_ID *nodes, int max ) {
+
+    struct cachestats *st;
+    uint32_t s, n;
+    int count = 0, x;
+
+    if ( sgCache.shards == NULL ) {
+        return( -1 );
+    }
+
+    for (s = 0; s < sgCache.nshards; s++){
+        pthread_mutex_lock( &sgCache.shards[s].lock );
+        st = &sgCache.shards[s].stats;
+        for (n = 0; n < st->nodeCap; n++){
+
+            if ( st->nodes[n].nodeID == SG_NODE_UNKNOWN ) {
+                continue;
+            }
+
+            // Nodes show up in several shards, list each once
+            for (x = 0; x < count; x++){
+                if ( nodes[x] == st->nodes[n].nodeID ) {
+                    break;
+                }
+            }
+            if ( (x == count) && (count < max) ) {
+                nodes[count++] = st->nodes[n].nodeID;
+            }
+
+        }
+        pthread_mutex_unlock( &sgCache.shards[s].lock );
+    }
+
+    return( count );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : logSGCacheStats
+// Description  : Log the cache totals and optionally the per node and per
+//                file counters
+//
+// Inputs       : level - the log level to use
+//                detail - also log the breakdowns
+// Outputs      : none
+
+void logSGCacheStats( unsigned long level, int detail ) {
+
+    SG_Cache_Stats stats;
+    SG_Cache_Counters c;
+    SG_Node_ID *nodes;
+    uint32_t s, files = 0;
+    int n, x;
+
+    if ( sgGetCacheStats(&stats) ) {
+        return;
+    }
+    logMessage( level, "Cache: %u/%u blocks (%u dirty), %lu hits, %lu misses, hit rate %.2f, "
+            "%lu insertions, %lu evictions, %lu flushes, %lu invalidations, %lu bytes served",
+            stats.resident, stats.maxElements, stats.dirty, stats.total.hits, stats.total.misses,
+            (stats.total.hits + stats.total.misses) ? (double)stats.total.hits / (stats.total.hits + stats.total.misses) : 0.0,
+            stats.total.insertions, stats.total.evictions, stats.total.flushes, stats.total.invalidations,
+            stats.total.bytesServed );
+    if ( stats.sketchBytes > 0 ) {
+        logMessage( level, "Cache admission: %lu blocks rejected, %lu bytes of sketch",
+                stats.total.rejections, stats.sketchBytes );
+    }
+    if ( stats.total.reclaims > 0 ) {
+        logMessage( level, "Cache partitions: %lu blocks evicted to keep quotas and shares", stats.total.reclaims );
+    }
+    if ( stats.total.releases > 0 ) {
+        logMessage( level, "Cache close: %lu blocks of closed files evicted first", stats.total.releases );
+    }
+    if ( stats.l2Elements > 0 ) {
+        logMessage( level, "Cache L2: %u/%u blocks, %lu hits", stats.l2Resident, stats.l2Elements, stats.total.l2Hits );
+    }
+    if ( stats.shmElements > 0 ) {
+        logMessage( level, "Cache shared tier: %u/%u blocks, %lu hits", stats.shmResident, stats.shmElements,
+                stats.total.shmHits );
+    }
+    if ( stats.zElements > 0 ) {
+        logMessage( level, "Cache compressed tier: %u blocks in %u blocks of memory (%lu bytes with tables), "
+                "ratio %.2f, %lu hits, %lu ns per decompression, %lu incompressible",
+                stats.zResident, stats.zElements, stats.zMemoryBytes,
+                stats.zStoredBytes ? (double)stats.zResident * SG_BLOCK_SIZE / stats.zStoredBytes : 0.0,
+                stats.total.zHits, stats.zDecompressNs, stats.zIncompressible );
+    }
+    for (x = 0; x < (int)stats.mrcPoints; x++){
+        logMessage( level, "Cache estimated miss ratio at %u blocks: %.3f", stats.mrc[x].elements, stats.mrc[x].missRatio );
+    }
+    if ( !detail ) {
+        return;
+    }
+
+    // Room for every shard's nodes, duplicates and all
+    for (s = 0, n = 0; s < sgCache.nshards; s++){
+        pthread_mutex_lock( &sgCache.shards[s].lock );
+        n += sgCache.shards[s].stats.nnodes;
+        pthread_mutex_unlock( &sgCache.shards[s].lock );
+    }
+    if ( (n > 0) && ((nodes = malloc(n * sizeof(SG_Node_ID))) != NULL) ) {
+        n = sgGetCacheNodes( nodes, n );
+        for (x = 0; x < n; x++){
+            sgGetCacheNodeStats( nodes[x], &c );
+            logMessage( level, "Cache node %lu: %lu hits, %lu misses, %lu insertions, %lu evictions, %lu flushes",
+                    nodes[x], c.hits, c.misses, c.insertions, c.evictions, c.flushes );
+        }
+        free( nodes );
+    }
+
+    for (s = 0; s < sgCache.nshards; s++){
+        pthread_mutex_lock( &sgCache.shards[s].lock );
+        if ( sgCache.shards[s].stats.nfiles > files ) {
+            files = sgCache.shards[s].stats.nfiles;
+        }
+        pthread_mutex_unlock( &sgCache.shards[s].lock );
+    }
+    for (x = 0; (uint32_t)x < files; x++){
+        sgGetCacheFileStats( x, &c );
+        if ( c.hits + c.misses + c.insertions ) {
+            logMessage( level, "Cache file %d: %lu hits, %lu misses, %lu insertions, %lu evictions, %lu flushes",
+                    x, c.hits, c.misses, c.insertions, c.evictions, c.flushes );
+        }
+    }
+
+}
+
+//
+// Cache support functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parseCacheElements
+// Description  : Parse a cache size from a string
+//
+// Inputs       : str - the string holding the number of elements
+//                elements - place to put the parsed value
+// Outputs      : 0 if successful, -1 if failure
+
+static int parseCacheElements( const char *str, uint32_t *elements ) {
+
+    unsigned long long val;
+    char *end;
+
+    errno = 0;
+    val = strtoull( str, &end, 10 );
+    if ( (errno != 0) || (end == str) || (*end != '\0') || (val == 0) || (val > SG_CACHE_ELEMENTS_LIMIT) ) {
+        return( -1 );
+    }
+    *elements = (uint32_t)val;
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheHash
+// Description  : Hash the packed (node, block) key into 64 bits
+//
+// Inputs       : nde - node ID
+//                blk - block ID
+// Outputs      : the hash value
+
+uint64_t sgCacheHash( SG_Node_ID nde, SG_Block_ID blk ) {
+
+    uint64_t h;
+
+    // Fold the node into the block ID, then run a 64-bit finalizer
+    h = (nde * 0x9e3779b97f4a7c15ULL) ^ blk;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return( h );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabCreate
+// Description  : Map a slab of block frames in an arena and build its free
+//                list
+//
+// Inputs       : s - the slab to set up
+//                nframes - number of SG_BLOCK_SIZE frames
+//                hugePages - try to back the frames with huge pages
+// Outputs      : 0 if successful, -1 if failure
+
+static int slabCreate( struct blockslab *s, uint32_t nframes, int hugePages ) {
+
+    uint32_t x;
+
+    memset( s, 0, sizeof(struct blockslab) );
+    if ( arenaCreate(&s->arena, (size_t)nframes * SG_BLOCK_SIZE, hugePages) ) {
+        return( -1 );
+    }
+    s->frames = s->arena.base;
+
+    if ( (s->nextFree = malloc(nframes * sizeof(int32_t))) == NULL ) {
+        slabDestroy( s );
+        return( -1 );
+    }
+
+    for (x = 0; x < nframes; x++){
+        s->nextFree[x] = (x + 1 < nframes) ? (int32_t)(x + 1) : SG_CACHE_NO_ENTRY;
+    }
+    s->freeHead = (nframes > 0) ? 0 : SG_CACHE_NO_ENTRY;
+    s->nframes = nframes;
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabDestroy
+// Description  : Unmap a slab of block frames
+//
+// Inputs       : s - the slab to release
+// Outputs      : none
+
+static void slabDestroy( struct blockslab *s ) {
+
+    arenaDestroy( &s->arena );
+    free( s->nextFree );
+    memset( s, 0, sizeof(struct blockslab) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabAlloc
+// Description  : Take a frame off the slab free list
+//
+// Inputs       : s - the slab
+// Outputs      : pointer to the frame or NULL if none are free
+
+static char *slabAlloc( struct blockslab *s ) {
+
+    int32_t f = s->freeHead;
+
+    if ( f == SG_CACHE_NO_ENTRY ) {
+        return NULL;
+    }
+    s->freeHead = s->nextFree[f];
+
+    return( s->frames + ((size_t)f * SG_BLOCK_SIZE) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : slabFree
+// Description  : Put a frame back on the slab free list
+//
+// Inputs       : s - the slab
+//                frame - the frame (from slabAlloc)
+// Outputs      : none
+
+static void slabFree( struct blockslab *s, char *frame ) {
+
+    int32_t f = (int32_t)((frame - s->frames) / SG_BLOCK_SIZE);
+
+    s->nextFree[f] = s->freeHead;
+    s->freeHead = f;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheCreate
+// Description  : Allocate the entries, index, storage and policy for a cache
+//
+// Inputs       : c - the cache to set up
+//                maxElements - maximum number of elements allowed
+//                policy - the eviction policy
+// Outputs      : 0 if successful, -1 if failure
+
+static int cacheCreate( struct blockcache *c, uint32_t maxElements, SG_Cache_Policy policy ) {
+
+    uint64_t size = 1;
+    uint64_t x;
+
+    memset( c, 0, sizeof(struct blockcache) );
+    if ( (maxElements == 0) || (maxElements > SG_CACHE_ELEMENTS_LIMIT) ) {
+        return( -1 );
+    }
+
+    // The index is a power of two at least twice the element count, and
+    // at least one tag group
+    pthread_once( &sgCacheTagOnce, tagSelect );
+    while ( (size < ((uint64_t)maxElements * SG_CACHE_INDEX_FACTOR)) || (size < SG_CACHE_TAG_GROUP) ) {
+        size <<= 1;
+    }
+
+    c->entries = calloc( maxElements, sizeof(struct datacache) );
+    c->keys = calloc( maxElements, sizeof(struct cachekey) );
+    c->tags = calloc( size + SG_CACHE_TAG_GROUP, sizeof(uint16_t) );
+    c->index = malloc( size * sizeof(int32_t) );
+    c->byResident = malloc( ((uint64_t)maxElements + 1) * sizeof(int32_t) );
+    c->policy = createSGPolicy( policy, maxElements );
+    if ( (c->entries == NULL) || (c->keys == NULL) || (c->tags == NULL) || (c->index == NULL) ||
+            (c->byResident == NULL) ||
+            (c->policy == NULL) || slabCreate(&c->slab, maxElements, sgCacheHugePages) ) {
+        cacheDestroy( c );
+        return( -1 );
+    }
+
+    for (x = 0; x < size; x++){
+        c->index[x] = SG_CACHE_NO_ENTRY;
+    }
+    for (x = 0; x <= maxElements; x++){
+        c->byResident[x] = SG_CACHE_NO_ENTRY;
+    }
+
+    // Chain every entry onto the free list
+    for (x = 0; x < maxElements; x++){
+        c->entries[x].nextFree = (x + 1 < maxElements) ? (int)(x + 1) : SG_CACHE_NO_ENTRY;
+    }
+
+    c->indexMask = (uint32_t)(size - 1);
+    c->maxElements = maxElements;
+    c->count = 0;
+    c->freeList = 0;
+    c->policyType = policy;
+    c->closedHead = SG_CACHE_NO_ENTRY;
+    c->closedTail = SG_CACHE_NO_ENTRY;
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheDestroy
+// Description  : Free the entries, index and block storage of a cache
+//
+// Inputs       : c - the cache to release
+// Outputs      : none
+
+static void cacheDestroy( struct blockcache *c ) {
+
+    free( c->entries );
+    free( c->keys );
+    free( c->tags );
+    free( c->index );
+    destroySGPolicy( c->policy );
+    destroySGSketch( c->sketch );
+    destroySGSizer( c->sizer );
+    free( c->parts );
+    free( c->byResident );
+    slabDestroy( &c->slab );
+    memset( c, 0, sizeof(struct blockcache) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheFind
+// Description  : Find the entry holding (nde, blk) through the hash index.
+//                The probe compares a group of slot tags at a time and
+//                only reads the keys of slots whose tag matches.
+//
+// Inputs       : c - the cache
+//                nde - node ID to find
+//                blk - block ID to find
+// Outputs      : entry number or SG_CACHE_NO_ENTRY if not found
+
+static int cacheFind( struct blockcache *c, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    uint64_t h;
+    uint32_t slot, match, empty, i;
+    uint16_t tag;
+    int e;
+
+    if ( c->index == NULL ) {
+        return( SG_CACHE_NO_ENTRY );
+    }
+
+    // At half load most keys sit in their home slot, settle those first
+    h = sgCacheHash( nde, blk );
+    tag = cacheTag( h );
+    slot = (uint32_t)h & c->indexMask;
+    if ( c->tags[slot] == SG_CACHE_TAG_EMPTY ) {
+        return( SG_CACHE_NO_ENTRY );
+    }
+    e = c->index[slot];
+    if ( (c->tags[slot] == tag) && (c->keys[e].blockID == blk) && (c->keys[e].nodeID == nde) ) {
+        return( e );
+    }
+
+    // Linear probe a group at a time until we hit the key or an empty slot;
+    // match masks have two bits per slot
+    for (;;) {
+        match = sgCacheTagMatch( &c->tags[slot], tag, &empty );
+        if ( empty ) {
+            match &= (1U << __builtin_ctz(empty)) - 1;
+        }
+        while ( match ) {
+            i = __builtin_ctz( match ) / 2;
+            e = c->index[(slot + i) & c->indexMask];
+            if ( (c->keys[e].blockID == blk) && (c->keys[e].nodeID == nde) ) {
+                return( e );
+            }
+            match &= ~(3U << (i * 2));
+        }
+        if ( empty ) {
+            return( SG_CACHE_NO_ENTRY );
+        }
+        slot = (slot + SG_CACHE_TAG_GROUP) & c->indexMask;
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheIndexInsert
+// Description  : Add an entry (key already set) to the hash index
+//
+// Inputs       : c - the cache
+//                e - entry number
+// Outputs      : none
+
+static void cacheIndexInsert( struct blockcache *c, int e ) {
+
+    uint64_t h = sgCacheHash( c->keys[e].nodeID, c->keys[e].blockID );
+    uint32_t slot;
+
+    slot = (uint32_t)h & c->indexMask;
+    while ( c->index[slot] != SG_CACHE_NO_ENTRY ) {
+        slot = (slot + 1) & c->indexMask;
+    }
+    c->index[slot] = e;
+    cacheTagSet( c, slot, cacheTag(h) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheIndexRemove
+// Description  : Remove an entry from the hash index, shifting the rest of
+//                its probe run back so no tombstones are needed
+//
+// Inputs       : c - the cache
+//                e - entry number
+// Outputs      : none
+
+static void cacheIndexRemove( struct blockcache *c, int e ) {
+
+    uint32_t slot, next, home;
+
+    // Find the slot that points at the entry
+    slot = (uint32_t)sgCacheHash(c->keys[e].nodeID, c->keys[e].blockID) & c->indexMask;
+    while ( c->index[slot] != e ) {
+        slot = (slot + 1) & c->indexMask;
+    }
+
+    // Backward shift: pull later members of the run into the hole
+    next = (slot + 1) & c->indexMask;
+    while ( c->index[next] != SG_CACHE_NO_ENTRY ) {
+        home = (uint32_t)sgCacheHash(c->keys[c->index[next]].nodeID,
+                c->keys[c->index[next]].blockID) & c->indexMask;
+        if ( ((next - home) & c->indexMask) >= ((next - slot) & c->indexMask) ) {
+            c->index[slot] = c->index[next];
+            cacheTagSet( c, slot, c->tags[next] );
+            slot = next;
+        }
+        next = (next + 1) & c->indexMask;
+    }
+    c->index[slot] = SG_CACHE_NO_ENTRY;
+    cacheTagSet( c, slot, SG_CACHE_TAG_EMPTY );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheTag
+// Description  : Derive a slot tag from the top of a key hash (the slot comes
+//                from the bottom, the shard from the middle)
+//
+// Inputs       : h - the key hash
+// Outputs      : the tag, never SG_CACHE_TAG_EMPTY
+
+static uint16_t cacheTag( uint64_t h ) {
+
+    uint16_t tag = (uint16_t)(h >> 48);
+
+    return( (tag != SG_CACHE_TAG_EMPTY) ? tag : 1 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheTagSet
+// Description  : Set the tag of an index slot, keeping the copy of the first
+//                group past the end so a probe never has to wrap
+//
+// Inputs       : c - the cache
+//                slot - the index slot
+//                tag - the new tag (SG_CACHE_TAG_EMPTY when emptied)
+// Outputs      : none
+
+static void cacheTagSet( struct blockcache *c, uint32_t slot, uint16_t tag ) {
+
+    c->tags[slot] = tag;
+    if ( slot < SG_CACHE_TAG_GROUP ) {
+        c->tags[c->indexMask + 1 + slot] = tag;
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagSelect
+// Description  : Pick the widest tag matcher the CPU supports
+//
+// Inputs       : none
+// Outputs      : none
+
+static void tagSelect( void ) {
+
+    sgCacheTagMatch = tagMatchScalar;
+    sgCacheTagMatchName = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports("avx2") ) {
+        sgCacheTagMatch = tagMatchAvx2;
+        sgCacheTagMatchName = "avx2";
+    } else if ( __builtin_cpu_supports("sse2") ) {
+        sgCacheTagMatch = tagMatchSse2;
+        sgCacheTagMatchName = "sse2";
+    }
+#endif
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagMatchScalar
+// Description  : Compare a group of slot tags one at a time
+//
+// Inputs       : tags - SG_CACHE_TAG_GROUP slot tags
+//                tag - the tag wanted
+//                empty - set to the mask of empty slots
+// Outputs      : mask of matching slots (two bits per slot)
+
+static uint32_t tagMatchScalar( const uint16_t *tags, uint16_t tag, uint32_t *empty ) {
+
+    uint32_t match = 0, i;
+
+    *empty = 0;
+    for (i = 0; i < SG_CACHE_TAG_GROUP; i++){
+        if ( tags[i] == tag ) {
+            match |= 3U << (i * 2);
+        } else if ( tags[i] == SG_CACHE_TAG_EMPTY ) {
+            *empty |= 3U << (i * 2);
+        }
+    }
+
+    return( match );
+
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagMatchSse2
+// Description  : Compare a group of slot tags eight at a time
+//
+// Inputs       : tags - SG_CACHE_TAG_GROUP slot tags
+//                tag - the tag wanted
+//                empty - set to the mask of empty slots
+// Outputs      : mask of matching slots (two bits per slot)
+
+__attribute__((target("sse2")))
+static uint32_t tagMatchSse2( const uint16_t *tags, uint16_t tag, uint32_t *empty ) {
+
+    __m128i lo = _mm_loadu_si128( (const __m128i *)tags );
+    __m128i hi = _mm_loadu_si128( (const __m128i *)(tags + 8) );
+    __m128i want = _mm_set1_epi16( (short)tag );
+    __m128i none = _mm_setzero_si128();
+
+    *empty = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(lo, none)) |
+            ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(hi, none)) << 16);
+    return( (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(lo, want)) |
+            ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi16(hi, want)) << 16) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : tagMatchAvx2
+// Description  : Compare a group of slot tags sixteen at a time
+//
+// Inputs       : tags - SG_CACHE_TAG_GROUP slot tags
+//                tag - the tag wanted
+//                empty - set to the mask of empty slots
+// Outputs      : mask of matching slots (two bits per slot)
+
+__attribute__((target("avx2")))
+static uint32_t tagMatchAvx2( const uint16_t *tags, uint16_t tag, uint32_t *empty ) {
+
+    __m256i group = _mm256_loadu_si256( (const __m256i *)tags );
+
+    *empty = (uint32_t)_mm256_movemask_epi8( _mm256_cmpeq_epi16(group, _mm256_setzero_si256()) );
+    return( (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi16(group, _mm256_set1_epi16((short)tag))) );
+
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cachePut
+// Description  : Copy a block into the cache, evicting the policy's victim
+//                when the cache is full.  A file at its quota replaces its
+//                own least recent block instead, and in partitioned mode a
+//                file within its share keeps its blocks.  With an admission
+//                filter a clean block used less than the victim is turned
+//                away (to the second tier if there is one) and the victim
+//                stays.
+//
+// Inputs       : c - the cache
+//                fileId - file number the block is cached for
+//                nde - node ID
+//                blk - block ID
+//                block - block to insert into cache (copied)
+//                dirty - block has not been written back yet
+//                seq - version of the block
+//                admit - apply the admission filter (new references only)
+// Outputs      : 0 if successful (or turned away), -1 if failure
+
+static int cachePut( struct blockcache *c, int fileId, SG_Node_ID nde, SG_Block_ID blk, char *block, int dirty, uint64_t seq, int admit ) {
+
+    struct filepart *part = NULL;
+    SgFHandle owner;
+    int e, evict = 1, reclaim = 0;
+
+    if ( (c->entries == NULL) || (block == NULL) ) {
+        return( -1 );
+    }
+    admit = admit && (c->sketch != NULL);
+    if ( admit ) {
+        sketchRecord( c->sketch, nde, blk );
+    }
+
+    // Already cached, just refresh the data and touch it
+    if ( (e = cacheFind(c, nde, blk)) != SG_CACHE_NO_ENTRY ) {
+        if ( c->entries[e].buf != block ) {
+            memcpy( c->entries[e].buf, block, SG_BLOCK_SIZE );
+        }
+        c->entries[e].seq = seq;
+        cacheSetDirty( c, e, dirty );
+        cacheHit( c, e );
+        return( 0 );
+    }
+    if ( (fileId >= 0) && ((part = partFor(c, fileId)) == NULL) ) {
+        return( -1 );
+    }
+
+    if ( (part != NULL) && (part->quota > 0) && (part->resident >= part->quota) ) {
+
+        // At its quota, the file gives up its own least recent block
+        e = part->tail;
+        reclaim = SG_CACHE_RECLAIMED;
+
+    } else if ( c->freeList != SG_CACHE_NO_ENTRY ) {
+
+        // Take an unused entry and a frame for it
+        e = c->freeList;
+        c->freeList = c->entries[e].nextFree;
+        c->entries[e].buf = slabAlloc( &c->slab );
+        c->count++;
+        evict = 0;
+
+    } else {
+
+        e = cacheVictim( c, fileId, nde, blk, &reclaim );
+
+    }
+
+    // Evict the victim and reuse its frame; a dirty victim that cannot be
+    // written back stays put
+    if ( evict ) {
+        if ( admit && !dirty && !sketchAdmit(c->sketch, nde, blk, c->keys[e].nodeID, c->keys[e].blockID) ) {
+            if ( c->l2 != NULL ) {
+                l2Put( c->l2, nde, blk, seq, block );
+            }
+            if ( c->stats != NULL ) {
+                statsCount( c->stats, fileId, nde, SG_CACHE_STAT(rejections), 1 );
+            }
+            return( 0 );
+        }
+        owner = c->entries[e].owner;
+        if ( cacheEvict(c, e) ) {
+            return( -1 );
+        }
+        if ( reclaim && (c->stats != NULL) ) {
+            statsCount( c->stats, owner, c->keys[e].nodeID, (reclaim == SG_CACHE_RELEASED) ?
+                    SG_CACHE_STAT(releases) : SG_CACHE_STAT(reclaims), 1 );
+        }
+    }
+
+    c->keys[e].nodeID = nde;
+    c->keys[e].blockID = blk;
+    c->entries[e].owner = fileId;
+    c->entries[e].seq = seq;
+    c->entries[e].dirty = 0;
+    cacheSetDirty( c, e, dirty );
+    memcpy( c->entries[e].buf, block, SG_BLOCK_SIZE );
+    cacheIndexInsert( c, e );
+    policyInsert( c->policy, e, nde, blk );
+    partLink( c, e );
+    if ( c->l2 != NULL ) {
+        l2Remove( c->l2, nde, blk );
+    }
+    if ( c->stats != NULL ) {
+        statsCount( c->stats, fileId, nde, SG_CACHE_STAT(insertions), 1 );
+    }
+
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheVictim
+// Description  : Choose the entry to evict from a full cache.  Blocks of
+//                files closed past their grace period go first, least
+//                recent of the first closed file.  Otherwise this is the
+//                policy's victim, unless the cache is partitioned and the
+//                victim's file is within its guaranteed share (the cache
+//                split equally over the files with blocks in it).  Then a
+//                borrowed block goes instead: the inserting file's own if
+//                it is at its share, else the least recent block of the
+//                file furthest over its share.
+//
+// Inputs       : c - the cache (full)
+//                fileId - file number the new block is cached for
+//                nde - node ID of the new block
+//                blk - block ID of the new block
+//                reclaim - set to SG_CACHE_RELEASED or SG_CACHE_RECLAIMED
+//                          if the policy's victim was passed over
+// Outputs      : the entry number
+
+static int cacheVictim( struct blockcache *c, int fileId, SG_Node_ID nde, SG_Block_ID blk, int *reclaim ) {
+
+    uint32_t active, share;
+    int e, b = SG_CACHE_NO_ENTRY;
+    SgFHandle owner;
+
+    if ( (c->closedHead != SG_CACHE_NO_ENTRY) && ((e = partReleased(c, fileId)) != SG_CACHE_NO_ENTRY) ) {
+        *reclaim = SG_CACHE_RELEASED;
+        return( e );
+    }
+
+    e = policyVictim( c->policy, nde, blk );
+    owner = c->entries[e].owner;
+    *reclaim = 0;
+    if ( !c->partitioned || (owner < 0) ) {
+        return( e );
+    }
+
+    // The victim goes if its file is borrowing, or is the inserting file
+    // and has its share already
+    active = c->activeParts + (((fileId >= 0) && (c->parts[fileId].resident == 0)) ? 1 : 0);
+    share = c->maxElements / active;
+    if ( (c->parts[owner].resident > share) || ((owner == fileId) && (c->parts[fileId].resident >= share)) ) {
+        return( e );
+    }
+
+    if ( (fileId >= 0) && (fileId != owner) && (c->parts[fileId].resident > 0) && (c->parts[fileId].resident >= share) ) {
+        b = c->parts[fileId].tail;
+    } else if ( c->maxResident > share ) {
+        b = c->parts[c->byResident[c->maxResident]].tail;
+    }
+
+    // Nobody is borrowing (the rest is unowned), fall back to the policy
+    if ( b == SG_CACHE_NO_ENTRY ) {
+        return( e );
+    }
+    *reclaim = SG_CACHE_RECLAIMED;
+
+    return( b );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheEvict
+// Description  : Push an entry out of the cache, writing it back first if
+//                it is dirty and moving it to the second tier.  The entry
+//                keeps its frame for the caller to reuse.
+//
+// Inputs       : c - the cache
+//                e - entry number
+// Outputs      : 0 if successful, -1 if failure (dirty and not written back)
+
+static int cacheEvict( struct blockcache *c, int e ) {
+
+    if ( cacheWriteBack(c, e, 1) ) {
+        logMessage( LOG_ERROR_LEVEL, "cacheEvict: cannot evict dirty block [%lu/%lu]",
+                c->keys[e].nodeID, c->keys[e].blockID );
+        return( -1 );
+    }
+    policyEvict( c->policy, e, c->keys[e].nodeID, c->keys[e].blockID );
+    cacheIndexRemove( c, e );
+    cacheDemote( c, e );
+    partUnlink( c, e );
+    if ( c->stats != NULL ) {
+        statsCount( c->stats, c->entries[e].owner, c->keys[e].nodeID, SG_CACHE_STAT(evictions), 1 );
+    }
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheDrop
+// Description  : Remove an entry without writing it back or remembering it
+//                (the block is out of date), freeing its frame
+//
+// Inputs       : c - the cache
+//                e - entry number
+// Outputs      : none
+
+static void cacheDrop( struct blockcache *c, int e ) {
+
+    if ( c->stats != NULL ) {
+        statsCount( c->stats, c->entries[e].owner, c->keys[e].nodeID, SG_CACHE_STAT(invalidations), 1 );
+    }
+    cacheSetDirty( c, e, 0 );
+    policyRemove( c->policy, e );
+    cacheIndexRemove( c, e );
+    partUnlink( c, e );
+    cacheFree( c, e );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheFree
+// Description  : Put an entry that is out of the index and policy back on
+//                the free list, along with its frame
+//
+// Inputs       : c - the cache
+//                e - entry number
+// Outputs      : none
+
+static void cacheFree( struct blockcache *c, int e ) {
+
+    slabFree( &c->slab, c->entries[e].buf );
+    c->entries[e].buf = NULL;
+    c->entries[e].nextFree = c->freeList;
+    c->freeList = e;
+    c->count--;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheHit
+// Description  : Record a reference to an entry with the policy and in its
+//                file's recency order
+//
+// Inputs       : c - the cache
+//                e - entry number
+// Outputs      : none
+
+static void cacheHit( struct blockcache *c, int e ) {
+
+    policyHit( c->policy, e );
+    if ( (c->entries[e].owner >= 0) && (c->parts[c->entries[e].owner].head != e) ) {
+        partUnlink( c, e );
+        partLink( c, e );
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheSetDirty
+// Description  : Set or clear an entry's dirty flag, keeping the count
+//
+// Inputs       : c - the cache
+//                e - entry number
+//                dirty - new state
+// Outputs      : none
+
+static void cacheSetDirty( struct blockcache *c, int e, int dirty ) {
+
+    dirty = (dirty != 0);
+    if ( c->entries[e].dirty != dirty ) {
+        c->entries[e].dirty = dirty;
+        if ( dirty ) {
+            c->dirtyCount++;
+        } else {
+            c->dirtyCount--;
+        }
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheWriteBack
+// Description  : Write a dirty entry back through the flush handler
+//
+// Inputs       : c - the cache
+//                e - entry number
+//                deferred - 1 if the block was left dirty until now (a
+//                           flush), 0 if it is being written through
+// Outputs      : 0 if successful (or clean), -1 if failure
+
+static int cacheWriteBack( struct blockcache *c, int e, int deferred ) {
+
+    if ( !c->entries[e].dirty ) {
+        return( 0 );
+    }
+    if ( (sgCacheFlush == NULL) ||
+            sgCacheFlush(c->keys[e].nodeID, c->keys[e].blockID, c->entries[e].buf) ) {
+        return( -1 );
+    }
+    cacheSetDirty( c, e, 0 );
+    c->entries[e].seq = versionCurrent( c->keys[e].nodeID );
+    if ( c->shm != NULL ) {
+        shmPut( c->shm, c->keys[e].nodeID, c->keys[e].blockID, c->entries[e].seq, c->entries[e].buf );
+    }
+    if ( deferred && (c->stats != NULL) ) {
+        statsCount( c->stats, c->entries[e].owner, c->keys[e].nodeID, SG_CACHE_STAT(flushes), 1 );
+    }
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheWriteBackAll
+// Description  : Write back every dirty entry of a cache
+//
+// Inputs       : c - the cache
+// Outputs      : 0 if successful, -1 if any block failed
+
+static int cacheWriteBackAll( struct blockcache *c ) {
+
+    uint32_t e;
+    int ret = 0;
+
+    if ( c->entries == NULL ) {
+        return( 0 );
+    }
+
+    // Keep going past a failure so one bad block does not strand the rest
+    for (e = 0; e < c->maxElements; e++){
+        if ( (c->entries[e].buf != NULL) && cacheWriteBack(c, e, 1) ) {
+            ret = -1;
+        }
+    }
+
+    return( ret );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheResize
+// Description  : Grow or shrink a cache.  The blocks the policy would keep
+//                longest are carried over, coldest first, and the rest are
+//                evicted.
+//
+// Inputs       : c - the cache
+//                maxElements - new maximum number of elements
+// Outputs      : 0 if successful, -1 if failure
+
+static int cacheResize( struct blockcache *c, uint32_t maxElements ) {
+
+    struct blockcache resized;
+    SG_Sketch *sketch = NULL;
+    int32_t *order;
+    uint32_t n, x;
+    int e;
+
+    if ( maxElements == c->maxElements ) {
+        return( 0 );
+    }
+
+    // Dropped blocks must not take unwritten data with them; write back
+    // before touching anything so a failure leaves the cache as it was
+    if ( (maxElements < c->count) && cacheWriteBackAll(c) ) {
+        return( -1 );
+    }
+
+    // Allocate the new cache first, the old one stays valid on failure
+    order = malloc( (c->count + 1) * sizeof(int32_t) );
+    if ( (c->sketch != NULL) && ((sketch = createSGSketch(maxElements)) == NULL) ) {
+        free( order );
+        return( -1 );
+    }
+    if ( (order == NULL) || cacheCreate(&resized, maxElements, c->policyType) ) {
+        destroySGSketch( sketch );
+        free( order );
+        return( -1 );
+    }
+
+    // Files keep their quotas, their blocks are linked in as they go over
+    resized.partitioned = c->partitioned;
+    if ( c->nparts > 0 ) {
+        if ( (resized.parts = malloc(c->nparts * sizeof(struct filepart))) == NULL ) {
+            cacheDestroy( &resized );
+            destroySGSketch( sketch );
+            free( order );
+            return( -1 );
+        }
+        for (x = 0; x < c->nparts; x++){
+            partInit( &resized.parts[x], c->parts[x].quota );
+        }
+        resized.nparts = c->nparts;
+        for (e = c->closedHead; e != SG_CACHE_NO_ENTRY; e = c->parts[e].closedNext){
+            partClose( &resized, e, c->parts[e].releaseAt );
+        }
+    }
+
+    // Drain the old policy in eviction order, then re-insert the survivors
+    // coldest first so the hottest blocks end up in the hottest positions
+    for (n = 0; n < c->count; n++){
+        order[n] = policyVictim( c->policy, 0, 0 );
+        policyRemove( c->policy, order[n] );
+    }
+    for (x = 0; x < n; x++){
+        if ( x + maxElements < n ) {
+            cacheDemote( c, order[x] );
+            if ( c->stats != NULL ) {
+                statsCount( c->stats, c->entries[order[x]].owner, c->keys[order[x]].nodeID,
+                        SG_CACHE_STAT(evictions), 1 );
+            }
+            continue;
+        }
+        cachePut( &resized, c->entries[order[x]].owner, c->keys[order[x]].nodeID,
+                c->keys[order[x]].blockID, c->entries[order[x]].buf, c->entries[order[x]].dirty,
+                c->entries[order[x]].seq, 0 );
+    }
+    free( order );
+
+    // Carried over blocks were not new insertions, count from here on
+    resized.stats = c->stats;
+    resized.l2 = c->l2;
+    resized.shm = c->shm;
+    resized.ztier = c->ztier;
+    resized.sketch = sketch;
+    resized.sizer = c->sizer;
+    c->sizer = NULL;
+    cacheDestroy( c );
+    *c = resized;
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheDemote
+// Description  : Copy a clean entry that is leaving the cache into the
+//                compressed tier and the second tier (dirty entries must be
+//                written back first)
+//
+// Inputs       : c - the cache
+//                e - entry number
+// Outputs      : none
+
+static void cacheDemote( struct blockcache *c, int e ) {
+
+    if ( (c->ztier != NULL) && !c->entries[e].dirty ) {
+        ztierPut( c->ztier, c->keys[e].nodeID, c->keys[e].blockID, c->entries[e].seq, c->entries[e].buf );
+    }
+    if ( (c->l2 != NULL) && !c->entries[e].dirty ) {
+        l2Put( c->l2, c->keys[e].nodeID, c->keys[e].blockID, c->entries[e].seq, c->entries[e].buf );
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partFor
+// Description  : Get a file's partition, growing the table as new files
+//                appear
+//
+// Inputs       : c - the cache
+//                fileId - file number (not SG_CACHE_NO_OWNER)
+// Outputs      : the partition or NULL if failure
+
+static struct filepart *partFor( struct blockcache *c, int fileId ) {
+
+    struct filepart *grown;
+    uint32_t size, x;
+
+    if ( (uint32_t)fileId >= c->nparts ) {
+        size = (c->nparts * 2 > (uint32_t)fileId + 1) ? c->nparts * 2 : (uint32_t)fileId + 1;
+        if ( (grown = realloc(c->parts, size * sizeof(struct filepart))) == NULL ) {
+            logMessage( LOG_ERROR_LEVEL, "partFor: cannot track file %d", fileId );
+            return NULL;
+        }
+        for (x = c->nparts; x < size; x++){
+            partInit( &grown[x], 0 );
+        }
+        c->parts = grown;
+        c->nparts = size;
+    }
+
+    return( &c->parts[fileId] );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partInit
+// Description  : Set up an empty partition for a file that is open
+//
+// Inputs       : p - the partition
+//                quota - the most blocks the file may hold (0 = no limit)
+// Outputs      : none
+
+static void partInit( struct filepart *p, uint32_t quota ) {
+
+    p->resident = 0;
+    p->quota = quota;
+    p->head = SG_CACHE_NO_ENTRY;
+    p->tail = SG_CACHE_NO_ENTRY;
+    p->releaseAt = 0;
+    p->closedPrev = SG_CACHE_NO_ENTRY;
+    p->closedNext = SG_CACHE_NO_ENTRY;
+    p->closed = 0;
+    p->residentPrev = SG_CACHE_NO_ENTRY;
+    p->residentNext = SG_CACHE_NO_ENTRY;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partClose
+// Description  : Put a file on the closed files list, which is kept in
+//                release time order (files closed later go behind, so this
+//                is nearly always an append)
+//
+// Inputs       : c - the cache
+//                fileId - file number (partition already allocated)
+//                releaseAt - when its blocks start going first (ms)
+// Outputs      : none
+
+static void partClose( struct blockcache *c, int fileId, uint64_t releaseAt ) {
+
+    struct filepart *p = &c->parts[fileId];
+    int32_t after = c->closedTail;
+
+    partReopen( c, fileId );
+    while ( (after != SG_CACHE_NO_ENTRY) && (c->parts[after].releaseAt > releaseAt) ) {
+        after = c->parts[after].closedPrev;
+    }
+    p->releaseAt = releaseAt;
+    p->closedPrev = after;
+    p->closedNext = (after != SG_CACHE_NO_ENTRY) ? c->parts[after].closedNext : c->closedHead;
+    if ( p->closedNext != SG_CACHE_NO_ENTRY ) {
+        c->parts[p->closedNext].closedPrev = fileId;
+    } else {
+        c->closedTail = fileId;
+    }
+    if ( after != SG_CACHE_NO_ENTRY ) {
+        c->parts[after].closedNext = fileId;
+    } else {
+        c->closedHead = fileId;
+    }
+    p->closed = 1;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partReopen
+// Description  : Take a file off the closed files list (if it is on it)
+//
+// Inputs       : c - the cache
+//                fileId - file number (partition already allocated)
+// Outputs      : none
+
+static void partReopen( struct blockcache *c, int fileId ) {
+
+    struct filepart *p = &c->parts[fileId];
+
+    if ( !p->closed ) {
+        return;
+    }
+    if ( p->closedPrev != SG_CACHE_NO_ENTRY ) {
+        c->parts[p->closedPrev].closedNext = p->closedNext;
+    } else {
+        c->closedHead = p->closedNext;
+    }
+    if ( p->closedNext != SG_CACHE_NO_ENTRY ) {
+        c->parts[p->closedNext].closedPrev = p->closedPrev;
+    } else {
+        c->closedTail = p->closedPrev;
+    }
+    p->closedPrev = SG_CACHE_NO_ENTRY;
+    p->closedNext = SG_CACHE_NO_ENTRY;
+    p->closed = 0;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partReleased
+// Description  : Find the block of a closed file to evict, the least recent
+//                of the first file whose grace period is over.  Files with
+//                nothing left in the cache are dropped from the list.
+//
+// Inputs       : c - the cache
+//                fileId - file number the new block is cached for (its own
+//                     blocks are not released to make room for it)
+// Outputs      : the entry number or SG_CACHE_NO_ENTRY if none is due
+
+static int partReleased( struct blockcache *c, int fileId ) {
+
+    uint64_t now = (sgCacheClock != NULL) ? sgCacheClock() : cacheClock();
+    int32_t x = c->closedHead, next;
+
+    while ( (x != SG_CACHE_NO_ENTRY) && (c->parts[x].releaseAt <= now) ) {
+        next = c->parts[x].closedNext;
+        if ( c->parts[x].resident == 0 ) {
+            partReopen( c, x );
+        } else if ( x != fileId ) {
+            return( c->parts[x].tail );
+        }
+        x = next;
+    }
+
+    return( SG_CACHE_NO_ENTRY );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : cacheClock
+// Description  : Read the monotonic clock the close grace periods run on
+//
+// Inputs       : none
+// Outputs      : milliseconds since an arbitrary start
+
+static uint64_t cacheClock( void ) {
+
+    struct timespec ts;
+
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partLink
+// Description  : Put an entry at the front of its file's recency list
+//
+// Inputs       : c - the cache
+//                e - entry number (owner's partition already allocated)
+// Outputs      : none
+
+static void partLink( struct blockcache *c, int e ) {
+
+    struct filepart *p;
+
+    if ( c->entries[e].owner < 0 ) {
+        return;
+    }
+    p = &c->parts[c->entries[e].owner];
+    c->entries[e].partPrev = SG_CACHE_NO_ENTRY;
+    c->entries[e].partNext = p->head;
+    if ( p->head != SG_CACHE_NO_ENTRY ) {
+        c->entries[p->head].partPrev = e;
+    } else {
+        p->tail = e;
+    }
+    p->head = e;
+    partCount( c, c->entries[e].owner, 1 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partUnlink
+// Description  : Take an entry off its file's recency list
+//
+// Inputs       : c - the cache
+//                e - entry number
+// Outputs      : none
+
+static void partUnlink( struct blockcache *c, int e ) {
+
+    struct filepart *p;
+
+    if ( c->entries[e].owner < 0 ) {
+        return;
+    }
+    p = &c->parts[c->entries[e].owner];
+    if ( c->entries[e].partPrev != SG_CACHE_NO_ENTRY ) {
+        c->entries[c->entries[e].partPrev].partNext = c->entries[e].partNext;
+    } else {
+        p->head = c->entries[e].partNext;
+    }
+    if ( c->entries[e].partNext != SG_CACHE_NO_ENTRY ) {
+        c->entries[c->entries[e].partNext].partPrev = c->entries[e].partPrev;
+    } else {
+        p->tail = c->entries[e].partPrev;
+    }
+    partCount( c, c->entries[e].owner, -1 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : partCount
+// Description  : Add or take one block from a file's resident count, moving
+//                it to the list of files with its new count.  Counts change
+//                one at a time, so the largest is kept up to date in O(1).
+//
+// Inputs       : c - the cache
+//                fileId - the file (partition allocated)
+//                delta - 1 or -1
+// Outputs      : none
+
+static void partCount( struct blockcache *c, int fileId, int delta ) {
+
+    struct filepart *p = &c->parts[fileId];
+
+    // Off the list for its current count
+    if ( p->resident > 0 ) {
+        if ( p->residentPrev != SG_CACHE_NO_ENTRY ) {
+            c->parts[p->residentPrev].residentNext = p->residentNext;
+        } else {
+            c->byResident[p->resident] = p->residentNext;
+        }
+        if ( p->residentNext != SG_CACHE_NO_ENTRY ) {
+            c->parts[p->residentNext].residentPrev = p->residentPrev;
+        }
+        if ( (delta < 0) && (p->resident == c->maxResident) && (c->byResident[p->resident] == SG_CACHE_NO_ENTRY) ) {
+            c->maxResident--;
+        }
+    } else {
+        c->activeParts++;
+    }
+
+    p->resident += delta;
+    if ( p->resident == 0 ) {
+        c->activeParts--;
+        p->residentPrev = p->residentNext = SG_CACHE_NO_ENTRY;
+        return;
+    }
+
+    // Onto the list for the new one
+    p->residentPrev = SG_CACHE_NO_ENTRY;
+    p->residentNext = c->byResident[p->resident];
+    if ( p->residentNext != SG_CACHE_NO_ENTRY ) {
+        c->parts[p->residentNext].residentPrev = fileId;
+    }
+    c->byResident[p->resident] = fileId;
+    if ( p->resident > c->maxResident ) {
+        c->maxResident = p->resident;
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shardElements
+// Description  : Work out a shard's share of the cache capacity
+//
+// Inputs       : maxElements - total entries
+//                nshards - number of shards
+//                s - the shard
+// Outputs      : number of entries for shard s
+
+static uint32_t shardElements( uint32_t maxElements, uint32_t nshards, uint32_t s ) {
+
+    return( (maxElements / nshards) + ((s < (maxElements % nshards)) ? 1 : 0) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shardsCreate
+// Description  : Allocate a sharded cache.  There are never more shards than
+//                entries, so every shard holds at least one block.
+//
+// Inputs       : sc - the sharded cache to set up
+//                maxElements - total entries
+//                policy - the eviction policy
+//                nshards - requested number of shards
+// Outputs      : 0 if successful, -1 if failure
+
+static int shardsCreate( struct shardedcache *sc, uint32_t maxElements, SG_Cache_Policy policy, uint32_t nshards ) {
+
+    void *mem;
+    uint32_t s;
+
+    memset( sc, 0, sizeof(struct shardedcache) );
+    if ( (maxElements == 0) || (nshards == 0) ) {
+        return( -1 );
+    }
+    if ( nshards > maxElements ) {
+        nshards = maxElements;
+    }
+
+    // Shards are cache line aligned so their locks do not share lines
+    if ( posix_memalign(&mem, SG_CACHE_ALIGNMENT, nshards * sizeof(struct cacheshard)) ) {
+        return( -1 );
+    }
+    sc->shards = mem;
+    memset( sc->shards, 0, nshards * sizeof(struct cacheshard) );
+
+    for (s = 0; s < nshards; s++){
+        if ( cacheCreate(&sc->shards[s].cache, shardElements(maxElements, nshards, s), policy) ) {
+            sc->nshards = s;
+            shardsDestroy( sc );
+            return( -1 );
+        }
+        pthread_mutex_init( &sc->shards[s].lock, NULL );
+        sc->shards[s].cache.stats = &sc->shards[s].stats;
+    }
+    sc->nshards = nshards;
+    sc->maxElements = maxElements;
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shardsDestroy
+// Description  : Free a sharded cache
+//
+// Inputs       : sc - the sharded cache to release
+// Outputs      : none
+
+static void shardsDestroy( struct shardedcache *sc ) {
+
+    uint32_t s;
+
+    for (s = 0; s < sc->nshards; s++){
+        cacheDestroy( &sc->shards[s].cache );
+        statsFree( &sc->shards[s].stats );
+        pthread_mutex_destroy( &sc->shards[s].lock );
+    }
+    free( sc->shards );
+    memset( sc, 0, sizeof(struct shardedcache) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shardFor
+// Description  : Find the shard that owns a key.  The shard comes from the
+//                top of the hash, the index inside it uses the bottom.
+//
+// Inputs       : sc - the sharded cache
+//                nde - node ID
+//                blk - block ID
+// Outputs      : the shard or NULL if the cache is not initialized
+
+static struct cacheshard *shardFor( struct shardedcache *sc, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    if ( sc->shards == NULL ) {
+        return NULL;
+    }
+
+    return( &sc->shards[(uint32_t)(sgCacheHash(nde, blk) >> 32) % sc->nshards] );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shardLookup
+// Description  : Look up a key in a locked shard and count the access
+//
+// Inputs       : sh - the shard (locked)
+//                fileId - file number the access is for
+//                nde - node ID
+//                blk - block ID
+// Outputs      : entry number or SG_CACHE_NO_ENTRY if not found
+
+static int shardLookup( struct cacheshard *sh, int fileId, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    char frame[SG_BLOCK_SIZE];
+    uint64_t seq;
+    int e;
+
+    if ( sh->cache.sketch != NULL ) {
+        sketchRecord( sh->cache.sketch, nde, blk );
+    }
+    if ( sh->cache.sizer != NULL ) {
+        sizerAccess( sh->cache.sizer, nde, blk );
+        __atomic_add_fetch( &sgCacheSizing.lookups, 1, __ATOMIC_RELAXED );
+    }
+
+    // A clean block older than its node's invalidation mark is dropped
+    if ( (e = cacheFind(&sh->cache, nde, blk)) != SG_CACHE_NO_ENTRY ) {
+        if ( sh->cache.entries[e].dirty || !versionStale(nde, sh->cache.entries[e].seq) ) {
+            cacheHit( &sh->cache, e );
+            statsCount( &sh->stats, fileId, nde, SG_CACHE_STAT(hits), 1 );
+            return( e );
+        }
+        cacheDrop( &sh->cache, e );
+    }
+
+    // Another process may have fetched it into the shared tier, which
+    // keeps its copy
+    if ( (sh->cache.shm != NULL) && (shmGet(sh->cache.shm, nde, blk, &seq, frame) == 0) ) {
+        if ( versionStale(nde, seq) ) {
+            shmRemove( sh->cache.shm, nde, blk );
+            statsCount( &sh->stats, fileId, nde, SG_CACHE_STAT(invalidations), 1 );
+        } else if ( cachePut(&sh->cache, fileId, nde, blk, frame, 0, seq, 0) == 0 ) {
+            statsCount( &sh->stats, fileId, nde, SG_CACHE_STAT(hits), 1 );
+            statsCount( &sh->stats, fileId, nde, SG_CACHE_STAT(shmHits), 1 );
+            return( cacheFind(&sh->cache, nde, blk) );
+        }
+    }
+
+    // Promote from the compressed tier, the second tier's copy of the block
+    // goes too as the cache holds the only one again; if there is no room
+    // (a dirty victim could not be written back) the block goes back where
+    // it was
+    if ( (sh->cache.ztier != NULL) && (ztierTake(sh->cache.ztier, nde, blk, &seq, frame) == 0) ) {
+        if ( versionStale(nde, seq) ) {
+            statsCount( &sh->stats, fileId, nde, SG_CACHE_STAT(invalidations), 1 );
+        } else if ( cachePut(&sh->cache, fileId, nde, blk, frame, 0, seq, 0) == 0 ) {
+            if ( sh->cache.l2 != NULL ) {
+                l2Remove( sh->cache.l2, nde, blk );
+            }
+            statsCount( &sh->stats, fileId, nde, SG_CACHE_STAT(hits), 1 );
+            statsCount( &sh->stats, fileId, nde, SG_CACHE_STAT(zHits), 1 );
+            return( cacheFind(&sh->cache, nde, blk) );
+        } else {
+            ztierPut( sh->cache.ztier, nde, blk, seq, frame );
+        }
+    }
+
+    // Likewise from the second tier
+    if ( (sh->cache.l2 != NULL) && (l2Take(sh->cache.l2, nde, blk, &seq, frame) == 0) ) {
+        if ( versionStale(nde, seq) ) {
+            statsCount( &sh->stats, fileId, nde, SG_CACHE_STAT(invalidations), 1 );
+        } else if ( cachePut(&sh->cache, fileId, nde, blk, frame, 0, seq, 0) == 0 ) {
+            statsCount( &sh->stats, fileId, nde, SG_CACHE_STAT(hits), 1 );
+            statsCount( &sh->stats, fileId, nde, SG_CACHE_STAT(l2Hits), 1 );
+            return( cacheFind(&sh->cache, nde, blk) );
+        } else {
+            l2Put( sh->cache.l2, nde, blk, seq, frame );
+        }
+    }
+    statsCount( &sh->stats, fileId, nde, SG_CACHE_STAT(misses), 1 );
+
+    return( SG_CACHE_NO_ENTRY );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shardsRead
+// Description  : Copy part of a cached block out of a sharded cache
+//
+// Inputs       : sc - the sharded cache
+//                fileId - file number the read is for
+//                nde - node ID
+//                blk - block ID
+//                buf - place to put the data
+//                off - offset within the block
+//                len - number of bytes to copy
+// Outputs      : 0 if successful, -1 if failure (block not cached)
+
+static int shardsRead( struct shardedcache *sc, int fileId, SG_Node_ID nde, SG_Block_ID blk, char *buf, size_t off, size_t len ) {
+
+    struct cacheshard *sh = shardFor( sc, nde, blk );
+    int e;
+
+    if ( (sh == NULL) || (off > SG_BLOCK_SIZE) || (len > SG_BLOCK_SIZE - off) ) {
+        return( -1 );
+    }
+
+    pthread_mutex_lock( &sh->lock );
+    if ( (e = shardLookup(sh, fileId, nde, blk)) != SG_CACHE_NO_ENTRY ) {
+        memcpy( buf, sh->cache.entries[e].buf + off, len );
+        statsCount( &sh->stats, fileId, nde, SG_CACHE_STAT(bytesServed), len );
+    }
+    pthread_mutex_unlock( &sh->lock );
+
+    return( (e != SG_CACHE_NO_ENTRY) ? 0 : -1 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shardsPut
+// Description  : Copy a block into a sharded cache
+//
+// Inputs       : sc - the sharded cache
+//                fileId - file number the block is cached for
+//                nde - node ID
+//                blk - block ID
+//                block - block to insert into cache (copied)
+//                dirty - block has not been written back yet
+// Outputs      : 0 if successful, -1 if failure
+
+static int shardsPut( struct shardedcache *sc, int fileId, SG_Node_ID nde, SG_Block_ID blk, char *block, int dirty ) {
+
+    struct cacheshard *sh = shardFor( sc, nde, blk );
+    uint64_t seq = versionCurrent( nde );
+    int ret;
+
+    if ( sh == NULL ) {
+        return( -1 );
+    }
+
+    // A clean block is the node's copy, publish it to the other processes
+    pthread_mutex_lock( &sh->lock );
+    ret = cachePut( &sh->cache, fileId, nde, blk, block, dirty, seq, 1 );
+    if ( (ret == 0) && !dirty && (sh->cache.shm != NULL) ) {
+        shmPut( sh->cache.shm, nde, blk, seq, block );
+    }
+    pthread_mutex_unlock( &sh->lock );
+
+    return( ret );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : statsCount
+// Description  : Add to one counter in the totals and in the file and node
+//                breakdowns, growing those as new files and nodes appear
+//
+// Inputs       : st - the statistics (shard locked)
+//                fileId - file number (or SG_CACHE_NO_OWNER)
+//                nde - node ID
+//                field - SG_CACHE_STAT(counter)
+//                n - amount to add
+// Outputs      : none
+
+static void statsCount( struct cachestats *st, int fileId, SG_Node_ID nde, size_t field, uint64_t n ) {
+
+    SG_Cache_Counters *grown;
+    struct nodecounters *nodes;
+    uint32_t size, x, y;
+
+    *(uint64_t *)((char *)&st->total + field) += n;
+
+    // Per file, indexed directly by the file number
+    if ( fileId >= 0 ) {
+        if ( (uint32_t)fileId >= st->nfiles ) {
+            size = (st->nfiles * 2 > (uint32_t)fileId + 1) ? st->nfiles * 2 : (uint32_t)fileId + 1;
+            if ( (grown = realloc(st->files, size * sizeof(SG_Cache_Counters))) != NULL ) {
+                memset( grown + st->nfiles, 0, (size - st->nfiles) * sizeof(SG_Cache_Counters) );
+                st->files = grown;
+                st->nfiles = size;
+            }
+        }
+        if ( (uint32_t)fileId < st->nfiles ) {
+            *(uint64_t *)((char *)&st->files[fileId] + field) += n;
+        }
+    }
+
+    // Per node, hashed; the table doubles at half full
+    if ( nde == SG_NODE_UNKNOWN ) {
+        return;
+    }
+    if ( (st->nnodes + 1) * 2 > st->nodeCap ) {
+        size = (st->nodeCap > 0) ? st->nodeCap * 2 : 64;
+        if ( (nodes = calloc(size, sizeof(struct nodecounters))) == NULL ) {
+            return;
+        }
+        for (x = 0; x < size; x++){
+            nodes[x].nodeID = SG_NODE_UNKNOWN;
+        }
+        for (x = 0; x < st->nodeCap; x++){
+            if ( st->nodes[x].nodeID != SG_NODE_UNKNOWN ) {
+                y = (uint32_t)sgCacheHash(st->nodes[x].nodeID, 0) & (size - 1);
+                while ( nodes[y].nodeID != SG_NODE_UNKNOWN ) {
+                    y = (y + 1) & (size - 1);
+                }
+                nodes[y] = st->nodes[x];
+            }
+        }
+        free( st->nodes );
+        st->nodes = nodes;
+        st->nodeCap = size;
+    }
+    x = (uint32_t)sgCacheHash(nde, 0) & (st->nodeCap - 1);
+    while ( (st->nodes[x].nodeID != nde) && (st->nodes[x].nodeID != SG_NODE_UNKNOWN) ) {
+        x = (x + 1) & (st->nodeCap - 1);
+    }
+    if ( st->nodes[x].nodeID == SG_NODE_UNKNOWN ) {
+        st->nodes[x].nodeID = nde;
+        st->nnodes++;
+    }
+    *(uint64_t *)((char *)&st->nodes[x].counters + field) += n;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : statsAdd
+// Description  : Add one set of counters into another
+//
+// Inputs       : to - the running sum
+//                from - counters to add
+// Outputs      : none
+
+static void statsAdd( SG_Cache_Counters *to, const SG_Cache_Counters *from ) {
+
+    to->hits += from->hits;
+    to->l2Hits += from->l2Hits;
+    to->shmHits += from->shmHits;
+    to->zHits += from->zHits;
+    to->misses += from->misses;
+    to->insertions += from->insertions;
+    to->evictions += from->evictions;
+    to->flushes += from->flushes;
+    to->invalidations += from->invalidations;
+    to->rejections += from->rejections;
+    to->reclaims += from->reclaims;
+    to->releases += from->releases;
+    to->bytesServed += from->bytesServed;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : statsFree
+// Description  : Release the file and node breakdowns
+//
+// Inputs       : st - the statistics
+// Outputs      : none
+
+static void statsFree( struct cachestats *st ) {
+
+    free( st->files );
+    free( st->nodes );
+    memset( st, 0, sizeof(struct cachestats) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : versionCurrent
+// Description  : Get the version a block of a node is tagged with now
+//
+// Inputs       : nde - node ID
+// Outputs      : the node's epoch (0 with no handler)
+
+static uint64_t versionCurrent( SG_Node_ID nde ) {
+
+    return( (sgCacheVersion != NULL) ? sgCacheVersion(nde) : 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : versionStale
+// Description  : Check a block's tag against its node's invalidation mark.
+//                Nodes that were never invalidated cost one load.
+//
+// Inputs       : nde - node ID
+//                seq - the block's tag
+// Outputs      : 1 if stale, 0 if current
+
+static int versionStale( SG_Node_ID nde, uint64_t seq ) {
+
+    struct versiontable *vt = &sgCacheVersions;
+    uint32_t n;
+    int stale = 0;
+
+    if ( __atomic_load_n(&vt->count, __ATOMIC_ACQUIRE) == 0 ) {
+        return( 0 );
+    }
+
+    pthread_mutex_lock( &vt->lock );
+    if ( vt->cap > 0 ) {
+        n = (uint32_t)sgCacheHash(nde, 0) & (vt->cap - 1);
+        while ( vt->nodes[n].nodeID != SG_NODE_UNKNOWN ) {
+            if ( vt->nodes[n].nodeID == nde ) {
+                stale = (seq < vt->nodes[n].epoch);
+                break;
+            }
+            n = (n + 1) & (vt->cap - 1);
+        }
+    }
+    pthread_mutex_unlock( &vt->lock );
+
+    return( stale );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : versionMark
+// Description  : Raise a node's invalidation mark to epoch, growing the
+//                table when it is half full
+//
+// Inputs       : nde - node ID
+//                epoch - blocks tagged before this are stale
+// Outputs      : 0 if successful, -1 if failure
+
+static int versionMark( SG_Node_ID nde, uint64_t epoch ) {
+
+    struct versiontable *vt = &sgCacheVersions;
+    struct nodeversion *nodes;
+    uint32_t size, x, n;
+
+    pthread_mutex_lock( &vt->lock );
+
+    if ( (vt->count + 1) * 2 > vt->cap ) {
+        size = (vt->cap > 0) ? vt->cap * 2 : 16;
+        if ( (nodes = malloc(size * sizeof(struct nodeversion))) == NULL ) {
+            pthread_mutex_unlock( &vt->lock );
+            return( -1 );
+        }
+        for (x = 0; x < size; x++){
+            nodes[x].nodeID = SG_NODE_UNKNOWN;
+        }
+        for (x = 0; x < vt->cap; x++){
+            if ( vt->nodes[x].nodeID != SG_NODE_UNKNOWN ) {
+                n = (uint32_t)sgCacheHash(vt->nodes[x].nodeID, 0) & (size - 1);
+                while ( nodes[n].nodeID != SG_NODE_UNKNOWN ) {
+                    n = (n + 1) & (size - 1);
+                }
+                nodes[n] = vt->nodes[x];
+            }
+        }
+        free( vt->nodes );
+        vt->nodes = nodes;
+        vt->cap = size;
+    }
+
+    n = (uint32_t)sgCacheHash(nde, 0) & (vt->cap - 1);
+    while ( (vt->nodes[n].nodeID != SG_NODE_UNKNOWN) && (vt->nodes[n].nodeID != nde) ) {
+        n = (n + 1) & (vt->cap - 1);
+    }
+    if ( vt->nodes[n].nodeID == SG_NODE_UNKNOWN ) {
+        vt->nodes[n].nodeID = nde;
+        vt->nodes[n].epoch = epoch;
+        __atomic_store_n( &vt->count, vt->count + 1, __ATOMIC_RELEASE );
+    } else if ( epoch > vt->nodes[n].epoch ) {
+        vt->nodes[n].epoch = epoch;
+    }
+
+    pthread_mutex_unlock( &vt->lock );
+    return( 0 );
+
+}
+
+//
+// Benchmark
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sizingCurve
+// Description  : Add up the shards' estimated hits at each curve point
+//
+// Inputs       : hits - SG_CACHE_MRC_POINTS hit counts to add to
+//                refs - reference count to add to
+// Outputs      : none
+
+static void sizingCurve( uint64_t *hits, uint64_t *refs ) {
+
+    uint32_t s;
+
+    for (s = 0; s < sgCache.nshards; s++){
+        pthread_mutex_lock( &sgCache.shards[s].lock );
+        if ( sgCache.shards[s].cache.sizer != NULL ) {
+            sizerCurve( sgCache.shards[s].cache.sizer, hits, refs );
+        }
+        pthread_mutex_unlock( &sgCache.shards[s].lock );
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sizingCheck
+// Description  : Every SG_CACHE_AUTOSIZE_PERIOD lookups, resize the cache to
+//                the smallest curve point whose hits are within
+//                SG_CACHE_AUTOSIZE_SLACK percent of lookups of the hits at
+//                the ceiling.  Called with no shard locked; one thread
+//                decides at a time and the others carry on.
+//
+// Inputs       : none
+// Outputs      : none
+
+static void sizingCheck( void ) {
+
+    uint64_t hits[SG_CACHE_MRC_POINTS] = { 0 }, refs = 0;
+    uint32_t x, target;
+
+    if ( (sgCacheSizing.ceiling == 0) ||
+            (__atomic_load_n(&sgCacheSizing.lookups, __ATOMIC_RELAXED) < SG_CACHE_AUTOSIZE_PERIOD) ||
+            pthread_mutex_trylock(&sgCacheSizing.lock) ) {
+        return;
+    }
+
+    // Another thread may have decided between the check and the lock
+    if ( __atomic_load_n(&sgCacheSizing.lookups, __ATOMIC_RELAXED) >= SG_CACHE_AUTOSIZE_PERIOD ) {
+
+        __atomic_store_n( &sgCacheSizing.lookups, 0, __ATOMIC_RELAXED );
+        sizingCurve( hits, &refs );
+        for (x = 0; (x + 1 < SG_CACHE_MRC_POINTS) &&
+                ((hits[SG_CACHE_MRC_POINTS - 1] - hits[x]) * 100 > refs * SG_CACHE_AUTOSIZE_SLACK); x++){
+        }
+        target = (uint32_t)(((uint64_t)sgCacheSizing.ceiling * (x + 1)) / SG_CACHE_MRC_POINTS);
+        if ( target < sgCache.nshards ) {
+            target = sgCache.nshards;
+        }
+
+        if ( target != sgCache.maxElements ) {
+            logMessage( LOG_INFO_LEVEL, "sizingCheck: estimated miss ratio %.3f at %u elements, %.3f at ceiling %u",
+                    1.0 - (double)hits[x] / refs, target,
+                    1.0 - (double)hits[SG_CACHE_MRC_POINTS - 1] / refs, sgCacheSizing.ceiling );
+            resizeSGCache( target );
+        }
+
+    }
+    pthread_mutex_unlock( &sgCacheSizing.lock );
+
 }
@@ -13,24 +13,262 @@
 
 // Includes
 #include <sg_defs.h>
+#include <sg_cache_arena.h>
 
 //
 // Defines
-#define SG_MAX_CACHE_ELEMENTS 128
+#define SG_MAX_CACHE_ELEMENTS 128               // Default number of cached blocks
+#define SG_CACHE_ELEMENTS_LIMIT (1U << 30)      // Largest supported capacity
+#define SG_CACHE_CONFIGURED 0                   // initSGCache: use configured size
+#define SG_CACHE_SHARDS 8                       // Default number of locked shards
+#define SG_CACHE_SHARDS_LIMIT 1024              // Most shards supported
+#define SG_CACHE_NO_OWNER -1                    // Block not cached for a file
+#define SG_CACHE_WRITE_THROUGH 2                // writeSGDataBlock: send the block now
+#define SG_CACHE_ELEMENTS_ENV "SG_CACHE_ELEMENTS" // Environment override of size
+#define SG_CACHE_POLICY_ENV "SG_CACHE_POLICY"     // Environment override of policy
+#define SG_CACHE_WRITEBACK_ENV "SG_CACHE_WRITEBACK" // Environment write-back switch (0/1)
+#define SG_CACHE_SHARDS_ENV "SG_CACHE_SHARDS"     // Environment override of shards
+#define SG_CACHE_ADMISSION_ENV "SG_CACHE_ADMISSION" // Environment TinyLFU switch (0/1)
+#define SG_CACHE_PARTITIONED_ENV "SG_CACHE_PARTITIONED" // Environment file share switch (0/1)
+#define SG_CACHE_L2_ELEMENTS_ENV "SG_CACHE_L2_ELEMENTS" // Environment size of the L2 tier
+#define SG_CACHE_L2_PATH_ENV "SG_CACHE_L2_PATH"   // Environment file of the L2 tier
+#define SG_CACHE_L2_PATH "sg_cache_l2.dat"        // Default file of the L2 tier
+#define SG_CACHE_HUGEPAGES_ENV "SG_CACHE_HUGEPAGES" // Environment huge page switch (0/1)
+#define SG_CACHE_SHM_ELEMENTS_ENV "SG_CACHE_SHM_ELEMENTS" // Environment size of the shared tier
+#define SG_CACHE_SHM_NAME_ENV "SG_CACHE_SHM_NAME" // Environment segment of the shared tier
+#define SG_CACHE_SHM_NAME "/sg_cache"           // Default segment of the shared tier
+#define SG_CACHE_COMPRESSED_ENV "SG_CACHE_COMPRESSED" // Environment size of the compressed tier
+#define SG_CACHE_CLOSE_ENV "SG_CACHE_CLOSE"     // Environment close policy (flush, demote, keep)
+#define SG_CACHE_CLOSE_GRACE_ENV "SG_CACHE_CLOSE_GRACE" // Environment keep grace period (ms)
+#define SG_CACHE_CLOSE_GRACE 1000               // Default keep grace period (ms)
+#define SG_CACHE_AUTOSIZE_ENV "SG_CACHE_AUTOSIZE" // Environment auto sizing ceiling (blocks)
+#define SG_CACHE_MRC_POINTS 16                  // Cache sizes on the miss ratio curve
+
+//
+// Type definitions
+
+// Eviction policies
+typedef enum {
+    SG_CACHE_LRU       = 0,   // Least recently used
+    SG_CACHE_LFU       = 1,   // Least frequently used
+    SG_CACHE_CLOCK     = 2,   // Second chance clock
+    SG_CACHE_ARC       = 3,   // Adaptive replacement cache
+    SG_CACHE_2Q        = 4,   // Two queue (A1in/A1out/Am)
+    SG_CACHE_MAX_POLICY = 5   // Number of policies
+} SG_Cache_Policy;
+
+// What closing a file does with its cached blocks
+typedef enum {
+    SG_CACHE_CLOSE_FLUSH  = 0, // Write them back, they keep their place
+    SG_CACHE_CLOSE_DEMOTE = 1, // Write them back, they are evicted first
+    SG_CACHE_CLOSE_KEEP   = 2, // Leave them as they are (dirty ones too)
+                               // for a grace period, then demote them
+    SG_CACHE_MAX_CLOSE    = 3  // Number of close policies
+} SG_Cache_Close;
+
+// Cache configuration, applied by the next initSGCache
+typedef struct {
+    uint32_t maxElements;     // Number of cached blocks
+    SG_Cache_Policy policy;   // Eviction policy
+    int writeBack;            // Hold writes in dirty blocks until flushed
+    uint32_t shards;          // Independently locked shards (capped by size)
+    int admission;            // TinyLFU admission filter in front of eviction
+    int partitioned;          // Guarantee every file an equal share, which
+                              // others may borrow while it is unused
+    uint32_t l2Elements;      // Blocks in the on-disk second tier (0 = off)
+    const char *l2Path;       // File backing the second tier
+    int hugePages;            // Put block storage on huge pages if possible
+    uint32_t shmElements;     // Blocks in the tier shared between processes (0 = off)
+    const char *shmName;      // Shared memory segment of that tier
+    uint32_t compressedElements; // Memory of the compressed tier in blocks' worth
+                              // (0 = off)
+    uint32_t autoSizeElements; // Grow and shrink the cache up to this many
+                              // blocks (0 = fixed size)
+    SG_Cache_Close closePolicy; // What closing a file does with its blocks
+    uint32_t closeGraceMs;    // How long SG_CACHE_CLOSE_KEEP keeps them hot
+} SG_Cache_Config;
+
+// Cache counters (totals, or one file's or node's share)
+typedef struct {
+    uint64_t hits;            // Lookups served from the cache (any tier)
+    uint64_t l2Hits;          // Lookups served from the second tier
+    uint64_t shmHits;         // Lookups served from the shared tier
+    uint64_t zHits;           // Lookups served from the compressed tier
+    uint64_t misses;          // Lookups that had to go to the node
+    uint64_t insertions;      // Blocks added to the cache
+    uint64_t evictions;       // Blocks pushed out to make room
+    uint64_t flushes;         // Dirty blocks written back
+    uint64_t invalidations;   // Blocks dropped as stale or invalidated
+    uint64_t rejections;      // Clean blocks kept out by the admission filter
+    uint64_t reclaims;        // Evictions to keep a quota or take back a share
+    uint64_t releases;        // Evictions of closed files' blocks ahead of
+                              // the policy's victim
+    uint64_t bytesServed;     // Bytes copied out of the cache
+} SG_Cache_Counters;
+
+// Point of the estimated miss ratio curve
+typedef struct {
+    uint32_t elements;        // Cache size in blocks
+    double missRatio;         // Share of lookups an LRU cache of that size would miss
+} SG_Cache_MRC_Point;
+
+// Cache statistics
+typedef struct {
+    uint32_t maxElements;     // Capacity in blocks
+    uint32_t resident;        // Blocks in the cache
+    uint32_t dirty;           // Blocks waiting to be written back
+    uint32_t shards;          // Number of shards
+    uint32_t l2Elements;      // Capacity of the second tier (0 = off)
+    uint32_t l2Resident;      // Blocks in the second tier
+    uint32_t shmElements;     // Capacity of the shared tier (0 = off)
+    uint32_t shmResident;     // Blocks in the shared tier (all processes)
+    uint32_t zElements;       // Memory of the compressed tier in blocks (0 = off)
+    uint32_t zResident;       // Blocks in the compressed tier
+    uint64_t zStoredBytes;    // Their compressed size
+    uint64_t zMemoryBytes;    // Memory of the compressed tier and its tables
+    uint64_t zIncompressible; // Blocks it turned away as too big compressed
+    uint64_t zDecompressNs;   // Average time to decompress a block
+    uint64_t sketchBytes;     // Memory of the admission sketches (0 = off)
+    uint64_t slabBytes;       // Memory mapped for block storage
+    SG_Arena_Backing slabBacking; // Pages under the block storage (the
+                              // smallest kind if the shards differ)
+    uint32_t mrcPoints;       // Points on the curve (0 = auto sizing off)
+    SG_Cache_MRC_Point mrc[SG_CACHE_MRC_POINTS]; // Estimated miss ratio by size
+    SG_Cache_Counters total;  // Counters since initSGCache
+} SG_Cache_Stats;
+
+// Write a dirty block back to its node (0 if successful, -1 if failure)
+typedef int (*SG_Cache_Flush)( SG_Node_ID nde, SG_Block_ID blk, char *block );
+
+// Get a node's current epoch (the version blocks are tagged with; it only grows)
+typedef uint64_t (*SG_Cache_Version)( SG_Node_ID nde );
+
+// Hear that the cache now holds maxElements blocks (after a resize)
+typedef void (*SG_Cache_Resize)( uint32_t maxElements );
+
+// Get the time the close grace periods are measured in (milliseconds by default)
+typedef uint64_t (*SG_Cache_Clock)( void );
 
 // 
 // Cache functions
 
-int initSGCache( uint16_t maxElements );
-    // Initialize the cache of block elements
+void getSGCacheConfig( SG_Cache_Config *cfg );
+    // Get the configuration (defaults, then environment, then set values)
+
+int setSGCacheConfig( const SG_Cache_Config *cfg );
+    // Set the configuration used by the next initSGCache
+
+int initSGCache( uint32_t maxElements );
+    // Initialize the cache of block elements (SG_CACHE_CONFIGURED for the
+    // configured size)
+
+int resizeSGCache( uint32_t maxElements );
+    // Grow or shrink the live cache, evicting the policy's victims
+
+int setSGCacheResizeHandler( SG_Cache_Resize fn );
+    // Set the function told the new size whenever the cache is resized
 
 int closeSGCache( void );
     // Close the cache of block elements, clean up remaining data
 
+const char *sgCachePolicyName( SG_Cache_Policy policy );
+    // Get the name of an eviction policy
+
+int parseSGCachePolicy( const char *name );
+    // Look up an eviction policy by name (-1 if unknown)
+
+const char *sgCacheCloseName( SG_Cache_Close policy );
+    // Get the name of a close policy
+
+int parseSGCacheClose( const char *name );
+    // Look up a close policy by name (-1 if unknown)
+
 char *getSGDataBlock( SG_Node_ID nde, SG_Block_ID blk );
-    // Get the data block from the block cache
+    // Get the data block from the block cache (points into cache storage,
+    // valid until the next put or resize; single threaded callers only)
+
+int hasSGDataBlock( SG_Node_ID nde, SG_Block_ID blk );
+    // Check whether a block is cached in any tier (not counted, not a
+    // reference)
+
+// File numbers (fileId) are the driver's, fixed for a file's life and
+// not its handle; with a handle use sgsetquota() and sgfilestats()
+
+int readSGDataBlock( int fileId, SG_Node_ID nde, SG_Block_ID blk, char *buf, size_t off, size_t len );
+    // Copy len bytes at off out of a cached block for file fileId (-1 if not
+    // cached)
+
+int writeSGDataBlock( int fileId, SG_Node_ID nde, SG_Block_ID blk, const char *buf, size_t off, size_t len, int dirty );
+    // Copy len bytes into a cached block at off for file fileId, optionally
+    // marking it dirty or writing it through (-1 if not cached, or dropped
+    // because it could not be written through)
 
 int putSGDataBlock( SG_Node_ID nde, SG_Block_ID blk, char *block );
-    // Get the data block from the block cache
+    // Copy a (clean) data block into the block cache
+
+int insertSGDataBlock( int fileId, SG_Node_ID nde, SG_Block_ID blk, char *block, int dirty );
+    // Copy a data block into the block cache for file fileId
+
+int setSGCacheFlushHandler( SG_Cache_Flush fn );
+    // Set the function that writes dirty blocks back
+
+int markSGDataBlockDirty( SG_Node_ID nde, SG_Block_ID blk );
+    // Mark a cached block modified, it is written back before it leaves
+
+int flushSGDataBlock( SG_Node_ID nde, SG_Block_ID blk );
+    // Write back a block if it is cached and dirty
+
+int evictSGDataBlock( SG_Node_ID nde, SG_Block_ID blk );
+    // Write back a cached block if it is dirty and push it out to the lower
+    // tiers now, freeing its place (0 if it was not cached)
+
+int flushSGCache( void );
+    // Write back every dirty block
+
+int setSGCacheQuota( int fileId, uint32_t blocks );
+    // Limit the blocks cached for file fileId (0 for no limit), evicting its
+    // least recently used blocks if it is over
+
+int closeSGCacheFile( int fileId, uint32_t graceMs );
+    // File fileId was closed: once graceMs have passed its blocks are evicted
+    // before the policy's victims, oldest closed file first
+
+int openSGCacheFile( int fileId );
+    // File fileId was opened again: its blocks are ordinary blocks again
+
+int setSGCacheVersionHandler( SG_Cache_Version fn );
+    // Set the function that gives the version cached blocks are tagged with
+
+int setSGCacheClockHandler( SG_Cache_Clock fn );
+    // Set the clock close grace periods run on (NULL for milliseconds)
+
+const char *setSGCacheTagMatch( int portable );
+    // Compare index tags one at a time (portable) or with the CPU's vector
+    // instructions, returns the matcher's name (benchmarks only)
+
+int invalidateSGDataBlock( SG_Node_ID nde, SG_Block_ID blk );
+    // Drop a block from every tier now (unwritten changes are discarded)
+
+int invalidateSGNode( SG_Node_ID nde, uint64_t epoch );
+    // The node moved to epoch: its clean blocks tagged before it are stale
+    // and dropped when next looked up
+
+//
+// Statistics
+
+int sgGetCacheStats( SG_Cache_Stats *stats );
+    // Get the cache totals (any time while the cache is up)
+
+int sgGetCacheFileStats( int fileId, SG_Cache_Counters *counters );
+    // Get the counters for one file
+
+int sgGetCacheNodeStats( SG_Node_ID nde, SG_Cache_Counters *counters );
+    // Get the counters for one remote node
+
+int sgGetCacheNodes( SG_Node_ID *nodes, int max );
+    // List up to max nodes with counters, returns how many were listed
+
+void logSGCacheStats( unsigned long level, int detail );
+    // Log the totals (and with detail the per node and per file counters)
 
 #endif
\ No newline at end of file
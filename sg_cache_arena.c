@@ -0,0 +1,135 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_cache_arena.c
+//  Description    : This file contains the block arena.  An arena is one
+//                   anonymous mapping, taken from the reserved huge page
+//                   pool if possible, else advised for transparent huge
+//                   pages on a huge page boundary, else left on base pages.
+//
+//   Author        : Yinan Lang
+//   Last Modified : 10/17/2026
+//
+
+// Include Files
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <sg_cache_arena.h>
+
+// Defines
+#define ARENA_ROUND(n, to) ((((n) + (to) - 1) / (to)) * (to)) // Round up to a multiple
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : arenaCreate
+// Description  : Map an arena.  Huge pages are only tried for arenas of at
+//                least one huge page, smaller ones would just waste memory.
+//
+// Inputs       : a - the arena to set up
+//                bytes - usable size wanted
+//                hugePages - try huge pages first (0 for base pages only)
+// Outputs      : 0 if successful, -1 if failure
+
+int arenaCreate( SG_Arena *a, size_t bytes, int hugePages ) {
+
+    size_t length, page = (size_t)sysconf( _SC_PAGESIZE );
+    char *map, *base;
+
+    memset( a, 0, sizeof(SG_Arena) );
+    if ( bytes == 0 ) {
+        return( -1 );
+    }
+
+    if ( hugePages && (bytes >= SG_ARENA_HUGE_PAGE) ) {
+
+        length = ARENA_ROUND( bytes, SG_ARENA_HUGE_PAGE );
+
+#ifdef MAP_HUGETLB
+        // Reserved pool, fails unless the administrator set pages aside
+        map = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+        if ( map != MAP_FAILED ) {
+            a->base = map;
+            a->length = length;
+            a->backing = SG_ARENA_HUGETLB;
+            return( 0 );
+        }
+#endif
+
+#ifdef MADV_HUGEPAGE
+        // Map a huge page extra, keep the aligned part and advise it
+        map = mmap( NULL, length + SG_ARENA_HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if ( map != MAP_FAILED ) {
+            base = (char *)ARENA_ROUND( (uintptr_t)map, SG_ARENA_HUGE_PAGE );
+            if ( base > map ) {
+                munmap( map, base - map );
+            }
+            if ( base + length < map + length + SG_ARENA_HUGE_PAGE ) {
+                munmap( base + length, (map + length + SG_ARENA_HUGE_PAGE) - (base + length) );
+            }
+            a->base = base;
+            a->length = length;
+            a->backing = (madvise(base, length, MADV_HUGEPAGE) == 0) ? SG_ARENA_THP : SG_ARENA_NORMAL;
+            return( 0 );
+        }
+#endif
+
+    }
+
+    length = ARENA_ROUND( bytes, page );
+    map = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( map == MAP_FAILED ) {
+        logMessage( LOG_ERROR_LEVEL, "arenaCreate: mmap of %lu bytes failed", (unsigned long)length );
+        return( -1 );
+    }
+    a->base = map;
+    a->length = length;
+    a->backing = SG_ARENA_NORMAL;
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : arenaDestroy
+// Description  : Unmap an arena
+//
+// Inputs       : a - the arena (an empty one is ignored)
+// Outputs      : none
+
+void arenaDestroy( SG_Arena *a ) {
+
+    if ( a->base != NULL ) {
+        munmap( a->base, a->length );
+    }
+    memset( a, 0, sizeof(SG_Arena) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : arenaBackingName
+// Description  : Get the name of a page backing
+//
+// Inputs       : backing - the backing
+// Outputs      : the name
+
+const char *arenaBackingName( SG_Arena_Backing backing ) {
+
+    switch ( backing ) {
+    case SG_ARENA_HUGETLB:
+        return( "hugetlb" );
+    case SG_ARENA_THP:
+        return( "thp" );
+    default:
+        return( "normal" );
+    }
+
+}
@@ -0,0 +1,51 @@
+#ifndef SG_CACHE_ARENA_INCLUDED
+#define SG_CACHE_ARENA_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_cache_arena.h
+//  Description    : This is the declaration of the block arena, the single
+//                   mapping that holds a cache's block frames.  It is backed
+//                   by huge pages when the system has them, to keep random
+//                   block reads from missing in the TLB.
+//
+//   Author        : Yinan Lang
+//   Last Modified : 10/17/2026
+//
+
+// Includes
+#include <stddef.h>
+
+// Defines
+#define SG_ARENA_HUGE_PAGE (2UL * 1024 * 1024) // Huge page size (x86-64 and arm64)
+
+// Type definitions
+
+// Pages behind an arena
+typedef enum {
+    SG_ARENA_NORMAL    = 0,   // Base pages
+    SG_ARENA_THP       = 1,   // Transparent huge pages (madvise)
+    SG_ARENA_HUGETLB   = 2    // Reserved huge pages (MAP_HUGETLB)
+} SG_Arena_Backing;
+
+// Arena Structure
+typedef struct {
+    char *base;               // Start of the mapping
+    size_t length;            // Bytes mapped
+    SG_Arena_Backing backing; // Pages the memory is on
+} SG_Arena;
+
+//
+// Arena functions
+
+int arenaCreate( SG_Arena *a, size_t bytes, int hugePages );
+    // Map at least bytes of zeroed memory, on huge pages if asked and
+    // available, falling back to base pages
+
+void arenaDestroy( SG_Arena *a );
+    // Unmap an arena
+
+const char *arenaBackingName( SG_Arena_Backing backing );
+    // Get the name of a page backing
+
+#endif
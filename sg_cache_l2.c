@@ -0,0 +1,414 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_cache_l2.c
+//  Description    : This file contains the second cache tier.  Blocks evicted
+//                   from the RAM cache are kept in a memory mapped local file
+//                   laid out as a header, a set associative table of frame
+//                   descriptors and the page aligned frames themselves.  The
+//                   file is reused when it is reopened with the same layout,
+//                   so the tier is warm after a restart.
+//
+//   Author        : Yinan Lang
+//   Last Modified : 10/17/2026
+//
+
+// Include Files
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <sg_cache_l2.h>
+#include <sg_cache_policy.h>
+
+// Defines
+#define L2_PAGE_SIZE 4096             // Alignment of the slot table and frames
+
+// File Header Structure (first page of the file)
+struct l2header{
+
+    uint32_t magic;           // SG_L2_MAGIC
+    uint32_t version;         // SG_L2_VERSION
+    uint32_t blockSize;       // SG_BLOCK_SIZE of the writer
+    uint32_t ways;            // Frames per set
+    uint32_t nsets;           // Number of sets
+    uint32_t resident;        // Frames in use
+    uint64_t clock;           // Last stamp handed out
+
+};
+
+// Frame Descriptor Structure
+struct l2slot{
+
+    SG_Node_ID nodeID;        // Node ID of the block
+    SG_Block_ID blockID;      // Block ID of the block
+    uint64_t stamp;           // Time of the last store (0 = free)
+    uint64_t seq;             // Version of the block
+    uint16_t valid;           // The frame holds the block
+
+};
+
+// Tier Structure
+struct sgl2{
+
+    pthread_mutex_t lock;     // Serializes every operation
+    struct l2header *header;  // Start of the mapping
+    struct l2slot *slots;     // nsets * ways descriptors
+    char *frames;             // nsets * ways block frames
+    size_t length;            // Bytes mapped
+    int fd;                   // Backing file
+
+};
+
+//
+// Functional Prototypes
+
+static size_t l2Layout( uint32_t nsets, size_t *slotBytes ); // Bytes needed for nsets
+static struct l2slot *l2Set( SG_L2 *t, SG_Node_ID nde, SG_Block_ID blk ); // First slot of a key's set
+static int32_t l2Find( SG_L2 *t, SG_Node_ID nde, SG_Block_ID blk ); // Locate a frame
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openSGL2
+// Description  : Map the tier file, creating or re-initializing it unless it
+//                already holds a tier of the same layout.  The file is
+//                locked while open, so only one process maps it.
+//
+// Inputs       : path - the backing file
+//                elements - the minimum number of frames
+// Outputs      : the tier or NULL if failure
+
+SG_L2 *openSGL2( const char *path, uint32_t elements ) {
+
+    struct l2header *h;
+    struct stat st;
+    size_t length, slotBytes;
+    uint32_t nsets;
+    SG_L2 *t;
+    void *map;
+    int fd, warm;
+
+    // Round the capacity up to whole sets
+    if ( (path == NULL) || (elements == 0) ) {
+        logMessage( LOG_ERROR_LEVEL, "L2 cache needs a path and a capacity" );
+        return( NULL );
+    }
+    nsets = (elements + SG_L2_WAYS - 1) / SG_L2_WAYS;
+    length = l2Layout( nsets, &slotBytes );
+
+    // Open the file and see whether it already holds this layout
+    if ( (fd = open(path, O_RDWR | O_CREAT, 0600)) == -1 ) {
+        logMessage( LOG_ERROR_LEVEL, "L2 cache open of %s failed [%s]",
+                path, strerror(errno) );
+        return( NULL );
+    }
+
+    // The file is one process's at a time (the lock goes with the fd at
+    // close); a second process goes without the tier
+    if ( flock(fd, LOCK_EX | LOCK_NB) == -1 ) {
+        logMessage( LOG_ERROR_LEVEL, "L2 cache %s is in use by another process [%s]",
+                path, strerror(errno) );
+        close( fd );
+        return( NULL );
+    }
+    if ( fstat(fd, &st) == -1 ) {
+        logMessage( LOG_ERROR_LEVEL, "L2 cache stat of %s failed [%s]",
+                path, strerror(errno) );
+        close( fd );
+        return( NULL );
+    }
+    warm = ((size_t)st.st_size == length);
+    if ( (! warm) && (ftruncate(fd, (off_t)length) == -1) ) {
+        logMessage( LOG_ERROR_LEVEL, "L2 cache resize of %s failed [%s]",
+                path, strerror(errno) );
+        close( fd );
+        return( NULL );
+    }
+    map = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    if ( map == MAP_FAILED ) {
+        logMessage( LOG_ERROR_LEVEL, "L2 cache mmap of %s failed [%s]",
+                path, strerror(errno) );
+        close( fd );
+        return( NULL );
+    }
+
+    // Validate the header, starting over if anything differs
+    h = map;
+    if ( (! warm) || (h->magic != SG_L2_MAGIC) || (h->version != SG_L2_VERSION) ||
+            (h->blockSize != SG_BLOCK_SIZE) || (h->ways != SG_L2_WAYS) ||
+            (h->nsets != nsets) ) {
+        memset( map, 0x0, L2_PAGE_SIZE + slotBytes );
+        h->version = SG_L2_VERSION;
+        h->blockSize = SG_BLOCK_SIZE;
+        h->ways = SG_L2_WAYS;
+        h->nsets = nsets;
+        h->magic = SG_L2_MAGIC;
+        warm = 0;
+    }
+
+    // Set up the instance
+    if ( (t = calloc(1, sizeof(SG_L2))) == NULL ) {
+        logMessage( LOG_ERROR_LEVEL, "L2 cache allocation failed" );
+        munmap( map, length );
+        close( fd );
+        return( NULL );
+    }
+    pthread_mutex_init( &t->lock, NULL );
+    t->header = h;
+    t->slots = (struct l2slot *)((char *)map + L2_PAGE_SIZE);
+    t->frames = (char *)map + L2_PAGE_SIZE + slotBytes;
+    t->length = length;
+    t->fd = fd;
+
+    logMessage( LOG_INFO_LEVEL, "L2 cache %s: %u frames, %u resident (%s start)",
+            path, nsets * SG_L2_WAYS, h->resident, warm ? "warm" : "cold" );
+    return( t );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeSGL2
+// Description  : Write the tier back to its file and unmap it
+//
+// Inputs       : t - the tier
+// Outputs      : 0 if successful, -1 if failure
+
+int closeSGL2( SG_L2 *t ) {
+
+    int ret = 0;
+
+    if ( t == NULL ) {
+        return( 0 );
+    }
+    if ( msync(t->header, t->length, MS_SYNC) == -1 ) {
+        logMessage( LOG_ERROR_LEVEL, "L2 cache msync failed [%s]", strerror(errno) );
+        ret = -1;
+    }
+    munmap( t->header, t->length );
+    close( t->fd );
+    pthread_mutex_destroy( &t->lock );
+    free( t );
+    return( ret );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2Put
+// Description  : Store a block, replacing any older version of it or the
+//                least recently stored frame of its set
+//
+// Inputs       : t - the tier
+//                nde - the node ID
+//                blk - the block ID
+//                seq - the version of the block
+//                block - the block data
+// Outputs      : 0 if successful, -1 if failure
+
+int l2Put( SG_L2 *t, SG_Node_ID nde, SG_Block_ID blk, uint64_t seq, const char *block ) {
+
+    struct l2slot *set, *s = NULL;
+    uint32_t i;
+
+    pthread_mutex_lock( &t->lock );
+
+    // Reuse the block's own frame, then a free one, then the oldest
+    set = l2Set( t, nde, blk );
+    for ( i = 0; i < SG_L2_WAYS; i++ ) {
+        if ( set[i].valid && (set[i].nodeID == nde) && (set[i].blockID == blk) ) {
+            s = &set[i];
+            break;
+        }
+        if ( (s == NULL) || (s->valid && ((! set[i].valid) || (set[i].stamp < s->stamp))) ) {
+            s = &set[i];
+        }
+    }
+    if ( ! s->valid ) {
+        t->header->resident++;
+    }
+
+    // Invalidate the frame while it is rewritten so a crash never leaves a
+    // descriptor pointing at a partial block
+    s->valid = 0;
+    memcpy( t->frames + (size_t)(s - t->slots) * SG_BLOCK_SIZE, block, SG_BLOCK_SIZE );
+    s->nodeID = nde;
+    s->blockID = blk;
+    s->seq = seq;
+    s->stamp = ++t->header->clock;
+    s->valid = 1;
+
+    pthread_mutex_unlock( &t->lock );
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2Take
+// Description  : Copy a block out of the tier and drop its frame (the block
+//                moves back to the RAM cache)
+//
+// Inputs       : t - the tier
+//                nde - the node ID
+//                blk - the block ID
+//                seq - set to the version of the block
+//                block - buffer for the block data
+// Outputs      : 0 if found, -1 if not
+
+int l2Take( SG_L2 *t, SG_Node_ID nde, SG_Block_ID blk, uint64_t *seq, char *block ) {
+
+    int32_t e;
+
+    pthread_mutex_lock( &t->lock );
+    if ( (e = l2Find(t, nde, blk)) == -1 ) {
+        pthread_mutex_unlock( &t->lock );
+        return( -1 );
+    }
+    *seq = t->slots[e].seq;
+    memcpy( block, t->frames + (size_t)e * SG_BLOCK_SIZE, SG_BLOCK_SIZE );
+    t->slots[e].valid = 0;
+    t->header->resident--;
+    pthread_mutex_unlock( &t->lock );
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2Contains
+// Description  : Check whether the tier holds a block
+//
+// Inputs       : t - the tier
+//                nde - the node ID
+//                blk - the block ID
+//                seq - set to the version of the block if present
+// Outputs      : 1 if present, 0 if not
+
+int l2Contains( SG_L2 *t, SG_Node_ID nde, SG_Block_ID blk, uint64_t *seq ) {
+
+    int32_t e;
+
+    pthread_mutex_lock( &t->lock );
+    if ( (e = l2Find(t, nde, blk)) != -1 ) {
+        *seq = t->slots[e].seq;
+    }
+    pthread_mutex_unlock( &t->lock );
+    return( e != -1 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2Remove
+// Description  : Drop a block from the tier whatever its version
+//
+// Inputs       : t - the tier
+//                nde - the node ID
+//                blk - the block ID
+// Outputs      : none
+
+void l2Remove( SG_L2 *t, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    struct l2slot *set;
+    uint32_t i;
+
+    pthread_mutex_lock( &t->lock );
+    set = l2Set( t, nde, blk );
+    for ( i = 0; i < SG_L2_WAYS; i++ ) {
+        if ( set[i].valid && (set[i].nodeID == nde) && (set[i].blockID == blk) ) {
+            set[i].valid = 0;
+            t->header->resident--;
+        }
+    }
+    pthread_mutex_unlock( &t->lock );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2Info
+// Description  : Get the capacity and occupancy of the tier
+//
+// Inputs       : t - the tier
+//                elements - set to the number of frames
+//                resident - set to the number of frames in use
+// Outputs      : none
+
+void l2Info( SG_L2 *t, uint32_t *elements, uint32_t *resident ) {
+
+    pthread_mutex_lock( &t->lock );
+    *elements = t->header->nsets * t->header->ways;
+    *resident = t->header->resident;
+    pthread_mutex_unlock( &t->lock );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2Layout
+// Description  : Compute the file size of a tier with nsets sets
+//
+// Inputs       : nsets - the number of sets
+//                slotBytes - set to the page rounded size of the slot table
+// Outputs      : the file size in bytes
+
+static size_t l2Layout( uint32_t nsets, size_t *slotBytes ) {
+
+    size_t frames = (size_t)nsets * SG_L2_WAYS;
+
+    *slotBytes = (frames * sizeof(struct l2slot) + L2_PAGE_SIZE - 1) &
+            ~((size_t)L2_PAGE_SIZE - 1);
+    return( L2_PAGE_SIZE + *slotBytes + frames * SG_BLOCK_SIZE );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2Set
+// Description  : Find the set a block maps to
+//
+// Inputs       : t - the tier
+//                nde - the node ID
+//                blk - the block ID
+// Outputs      : the first descriptor of the set
+
+static struct l2slot *l2Set( SG_L2 *t, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    return( &t->slots[(sgCacheHash(nde, blk) % t->header->nsets) * SG_L2_WAYS] );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : l2Find
+// Description  : Locate the frame holding a block (lock held)
+//
+// Inputs       : t - the tier
+//                nde - the node ID
+//                blk - the block ID
+// Outputs      : the frame number or -1 if not present
+
+static int32_t l2Find( SG_L2 *t, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    struct l2slot *set = l2Set( t, nde, blk );
+    uint32_t i;
+
+    for ( i = 0; i < SG_L2_WAYS; i++ ) {
+        if ( set[i].valid && (set[i].nodeID == nde) && (set[i].blockID == blk) ) {
+            return( (int32_t)(&set[i] - t->slots) );
+        }
+    }
+    return( -1 );
+
+}
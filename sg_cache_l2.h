@@ -0,0 +1,50 @@
+#ifndef SG_CACHE_L2_INCLUDED
+#define SG_CACHE_L2_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_cache_l2.h
+//  Description    : This is the declaration of the second cache tier, a
+//                   memory mapped local file of block frames that holds
+//                   blocks evicted from the RAM cache and survives restarts.
+//
+//   Author        : Yinan Lang
+//   Last Modified : 10/17/2026
+//
+
+// Includes
+#include <sg_defs.h>
+
+// Defines
+#define SG_L2_WAYS 8                  // Frames per set
+#define SG_L2_MAGIC 0x53474c32        // "SGL2", start of the file
+#define SG_L2_VERSION 2               // File layout version
+
+// Type definitions
+typedef struct sgl2 SG_L2;            // Tier instance (opaque)
+
+//
+// Tier functions
+
+SG_L2 *openSGL2( const char *path, uint32_t elements );
+    // Map (creating or reusing) a tier file of at least elements frames
+
+int closeSGL2( SG_L2 *t );
+    // Write the tier back to its file and unmap it
+
+int l2Put( SG_L2 *t, SG_Node_ID nde, SG_Block_ID blk, uint64_t seq, const char *block );
+    // Store a block, replacing the oldest frame of its set if full
+
+int l2Take( SG_L2 *t, SG_Node_ID nde, SG_Block_ID blk, uint64_t *seq, char *block );
+    // Copy out and drop a block and its version (-1 if absent)
+
+int l2Contains( SG_L2 *t, SG_Node_ID nde, SG_Block_ID blk, uint64_t *seq );
+    // Check for a block, getting its version
+
+void l2Remove( SG_L2 *t, SG_Node_ID nde, SG_Block_ID blk );
+    // Drop every version of a block
+
+void l2Info( SG_L2 *t, uint32_t *elements, uint32_t *resident );
+    // Get the capacity and the number of frames in use
+
+#endif
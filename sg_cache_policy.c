@@ -0,0 +1,946 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_cache_policy.c
+//  Description    : This file contains the eviction policies for the block
+//                   cache: LRU, LFU, CLOCK, ARC and 2Q.  Every operation is
+//                   O(1) (LFU and CLOCK are bounded by constants).
+//
+//   Author        : Yinan Lang
+//   Last Modified : 10/17/2026
+//
+
+// Include Files
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <sg_cache_policy.h>
+
+// Defines
+#define SG_LFU_MAX_FREQ 64            // Frequency classes tracked by LFU
+#define SG_2Q_KIN_DIVISOR 4           // 2Q: A1in holds 1/4 of the cache
+#define SG_2Q_KOUT_DIVISOR 2          // 2Q: A1out remembers 1/2 of the cache
+#define SG_GHOST_INDEX_FACTOR 2       // Ghost index slots per ghost entry
+
+// Resident list identifiers (0 means not on a list)
+#define LIST_NONE 0
+#define LIST_LRU  1                   // LRU: the recency list
+#define LIST_AM   1                   // 2Q: the main LRU queue
+#define LIST_A1IN 2                   // 2Q: the FIFO of first references
+#define LIST_T1   1                   // ARC: seen once recently
+#define LIST_T2   2                   // ARC: seen at least twice recently
+#define LIST_CLOCK 1                  // CLOCK: resident in the ring
+
+// Ghost list identifiers
+#define GHOST_B1    0                 // ARC: evicted from T1
+#define GHOST_B2    1                 // ARC: evicted from T2
+#define GHOST_A1OUT 0                 // 2Q: evicted from A1in
+
+// List Structure
+struct plist{
+
+    int32_t head;             // Most recent member
+    int32_t tail;             // Least recent member
+    uint32_t size;            // Number of members
+
+};
+
+// Ghost Table Structure (keys of recently evicted blocks)
+struct ghosttable{
+
+    SG_Node_ID *nodeID;       // Node IDs
+    SG_Block_ID *blockID;     // Block IDs
+    int32_t *prev;            // List links
+    int32_t *next;
+    uint8_t *list;            // Ghost list the entry is on
+    int32_t *index;           // Open addressing index of ghost entries
+    uint32_t indexMask;       // Index size - 1
+    int32_t freeHead;         // Unused ghost entries, chained through next
+    uint32_t capacity;        // Number of ghost entries
+    struct plist lists[2];    // Ghost lists
+
+};
+
+// Policy Operations Structure
+struct policyops{
+
+    const char *name;
+    void (*hit)( SG_Policy *p, int32_t e );
+    void (*insert)( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk );
+    int32_t (*victim)( SG_Policy *p, SG_Node_ID nde, SG_Block_ID blk );
+    void (*evict)( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk );
+    void (*remove)( SG_Policy *p, int32_t e );
+
+};
+
+// Policy Structure
+struct sgpolicy{
+
+    const struct policyops *ops;    // The policy implementation
+    uint32_t maxElements;           // Cache capacity
+    uint32_t resident;              // Entries currently tracked
+
+    // Per-entry state, indexed by cache entry number
+    int32_t *prev;                  // List links
+    int32_t *next;
+    uint8_t *list;                  // List the entry is on
+    uint8_t *ref;                   // CLOCK reference bit
+    uint8_t *freq;                  // LFU frequency class
+
+    // Resident lists (LFU uses one per frequency class)
+    struct plist lists[SG_LFU_MAX_FREQ + 1];
+    uint32_t minFreq;               // LFU: lowest non-empty class
+    uint32_t hand;                  // CLOCK: the clock hand
+
+    // ARC adaptation state
+    uint32_t target;                // Target size of T1 (ARC's p)
+    int pendingValid;               // A victim call classified the next insert
+    uint8_t pendingList;            // List the pending insert goes to
+    SG_Node_ID pendingNode;         // Key of the pending insert
+    SG_Block_ID pendingBlock;
+    int dropGhost;                  // Next eviction leaves no ghost
+
+    struct ghosttable ghosts;       // ARC and 2Q eviction history
+
+};
+
+// Functional Prototypes
+static void listInit( struct plist *l );
+static void listPushFront( struct plist *l, int32_t *prev, int32_t *next, int32_t e );
+static void listUnlink( struct plist *l, int32_t *prev, int32_t *next, int32_t e );
+static int ghostCreate( struct ghosttable *g, uint32_t capacity );
+static void ghostDestroy( struct ghosttable *g );
+static int32_t ghostFind( struct ghosttable *g, SG_Node_ID nde, SG_Block_ID blk );
+static void ghostRemove( struct ghosttable *g, int32_t x );
+static void ghostPopTail( struct ghosttable *g, int l );
+static void ghostAdd( struct ghosttable *g, int l, SG_Node_ID nde, SG_Block_ID blk );
+static void residentUnlink( SG_Policy *p, int32_t e );
+
+// LRU
+static void lruHit( SG_Policy *p, int32_t e );
+static void lruInsert( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk );
+static int32_t lruVictim( SG_Policy *p, SG_Node_ID nde, SG_Block_ID blk );
+static void lruEvict( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk );
+
+// LFU
+static void lfuHit( SG_Policy *p, int32_t e );
+static void lfuInsert( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk );
+static int32_t lfuVictim( SG_Policy *p, SG_Node_ID nde, SG_Block_ID blk );
+
+// CLOCK
+static void clockHit( SG_Policy *p, int32_t e );
+static void clockInsert( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk );
+static int32_t clockVictim( SG_Policy *p, SG_Node_ID nde, SG_Block_ID blk );
+static void clockRemove( SG_Policy *p, int32_t e );
+static void clockEvict( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk );
+
+// ARC
+static void arcHit( SG_Policy *p, int32_t e );
+static void arcInsert( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk );
+static int32_t arcVictim( SG_Policy *p, SG_Node_ID nde, SG_Block_ID blk );
+static void arcEvict( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk );
+
+// 2Q
+static void twoqHit( SG_Policy *p, int32_t e );
+static void twoqInsert( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk );
+static int32_t twoqVictim( SG_Policy *p, SG_Node_ID nde, SG_Block_ID blk );
+static void twoqEvict( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk );
+
+// Policy table, in SG_Cache_Policy order
+static const struct policyops sgPolicies[SG_CACHE_MAX_POLICY] = {
+    { "lru",   lruHit,   lruInsert,   lruVictim,   lruEvict,   residentUnlink },
+    { "lfu",   lfuHit,   lfuInsert,   lfuVictim,   lruEvict,   residentUnlink },
+    { "clock", clockHit, clockInsert, clockVictim, clockEvict, clockRemove },
+    { "arc",   arcHit,   arcInsert,   arcVictim,   arcEvict,   residentUnlink },
+    { "2q",    twoqHit,  twoqInsert,  twoqVictim,  twoqEvict,  residentUnlink },
+};
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCachePolicyName
+// Description  : Get the name of an eviction policy
+//
+// Inputs       : policy - the policy
+// Outputs      : the name, or "unknown"
+
+const char *sgCachePolicyName( SG_Cache_Policy policy ) {
+
+    if ( (policy < 0) || (policy >= SG_CACHE_MAX_POLICY) ) {
+        return( "unknown" );
+    }
+    return( sgPolicies[policy].name );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : parseSGCachePolicy
+// Description  : Look up an eviction policy by name
+//
+// Inputs       : name - the policy name (lru, lfu, clock, arc or 2q)
+// Outputs      : the policy, or -1 if the name is unknown
+
+int parseSGCachePolicy( const char *name ) {
+
+    int x;
+
+    for (x = 0; x < SG_CACHE_MAX_POLICY; x++){
+        if ( strcasecmp(name, sgPolicies[x].name) == 0 ) {
+            return( x );
+        }
+    }
+
+    return( -1 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : createSGPolicy
+// Description  : Create a policy instance for a cache of maxElements entries
+//
+// Inputs       : type - the eviction policy
+//                maxElements - the cache capacity
+// Outputs      : the policy, or NULL if failure
+
+SG_Policy *createSGPolicy( SG_Cache_Policy type, uint32_t maxElements ) {
+
+    SG_Policy *p;
+    uint32_t x;
+
+    if ( (type < 0) || (type >= SG_CACHE_MAX_POLICY) || (maxElements == 0) ) {
+        return( NULL );
+    }
+    if ( (p = calloc(1, sizeof(SG_Policy))) == NULL ) {
+        return( NULL );
+    }
+
+    p->ops = &sgPolicies[type];
+    p->maxElements = maxElements;
+    p->prev = malloc( maxElements * sizeof(int32_t) );
+    p->next = malloc( maxElements * sizeof(int32_t) );
+    p->list = calloc( maxElements, sizeof(uint8_t) );
+    p->ref = calloc( maxElements, sizeof(uint8_t) );
+    p->freq = calloc( maxElements, sizeof(uint8_t) );
+    if ( (p->prev == NULL) || (p->next == NULL) || (p->list == NULL) ||
+            (p->ref == NULL) || (p->freq == NULL) ) {
+        destroySGPolicy( p );
+        return( NULL );
+    }
+
+    for (x = 0; x <= SG_LFU_MAX_FREQ; x++){
+        listInit( &p->lists[x] );
+    }
+    p->minFreq = 1;
+
+    // Only ARC and 2Q remember evicted keys
+    if ( ((type == SG_CACHE_ARC) || (type == SG_CACHE_2Q)) && ghostCreate(&p->ghosts, maxElements) ) {
+        destroySGPolicy( p );
+        return( NULL );
+    }
+
+    return( p );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : destroySGPolicy
+// Description  : Release a policy instance
+//
+// Inputs       : p - the policy (may be NULL)
+// Outputs      : none
+
+void destroySGPolicy( SG_Policy *p ) {
+
+    if ( p == NULL ) {
+        return;
+    }
+
+    ghostDestroy( &p->ghosts );
+    free( p->prev );
+    free( p->next );
+    free( p->list );
+    free( p->ref );
+    free( p->freq );
+    free( p );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : policyHit
+// Description  : Entry e was referenced
+//
+// Inputs       : p - the policy
+//                e - the entry number
+// Outputs      : none
+
+void policyHit( SG_Policy *p, int32_t e ) {
+
+    p->ops->hit( p, e );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : policyInsert
+// Description  : Entry e now holds (nde, blk)
+//
+// Inputs       : p - the policy
+//                e - the entry number
+//                nde - node ID
+//                blk - block ID
+// Outputs      : none
+
+void policyInsert( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    p->ops->insert( p, e, nde, blk );
+    p->resident++;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : policyVictim
+// Description  : Choose the entry to evict so (nde, blk) can be inserted
+//
+// Inputs       : p - the policy
+//                nde - node ID about to be inserted
+//                blk - block ID about to be inserted
+// Outputs      : the entry number, or SG_POLICY_NO_ENTRY if none
+
+int32_t policyVictim( SG_Policy *p, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    if ( p->resident == 0 ) {
+        return( SG_POLICY_NO_ENTRY );
+    }
+    return( p->ops->victim(p, nde, blk) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : policyEvict
+// Description  : Entry e (holding nde, blk) is being evicted
+//
+// Inputs       : p - the policy
+//                e - the entry number
+//                nde - node ID held by the entry
+//                blk - block ID held by the entry
+// Outputs      : none
+
+void policyEvict( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    p->ops->evict( p, e, nde, blk );
+    p->resident--;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : policyRemove
+// Description  : Entry e is being dropped without eviction history
+//
+// Inputs       : p - the policy
+//                e - the entry number
+// Outputs      : none
+
+void policyRemove( SG_Policy *p, int32_t e ) {
+
+    p->ops->remove( p, e );
+    p->resident--;
+
+}
+
+//
+// List support functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : listInit
+// Description  : Make a list empty
+//
+// Inputs       : l - the list
+// Outputs      : none
+
+static void listInit( struct plist *l ) {
+
+    l->head = SG_POLICY_NO_ENTRY;
+    l->tail = SG_POLICY_NO_ENTRY;
+    l->size = 0;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : listPushFront
+// Description  : Add a member at the most recent end of a list
+//
+// Inputs       : l - the list
+//                prev, next - the link arrays the list uses
+//                e - the member
+// Outputs      : none
+
+static void listPushFront( struct plist *l, int32_t *prev, int32_t *next, int32_t e ) {
+
+    prev[e] = SG_POLICY_NO_ENTRY;
+    next[e] = l->head;
+    if ( l->head != SG_POLICY_NO_ENTRY ) {
+        prev[l->head] = e;
+    } else {
+        l->tail = e;
+    }
+    l->head = e;
+    l->size++;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : listUnlink
+// Description  : Remove a member from a list
+//
+// Inputs       : l - the list
+//                prev, next - the link arrays the list uses
+//                e - the member
+// Outputs      : none
+
+static void listUnlink( struct plist *l, int32_t *prev, int32_t *next, int32_t e ) {
+
+    if ( prev[e] != SG_POLICY_NO_ENTRY ) {
+        next[prev[e]] = next[e];
+    } else {
+        l->head = next[e];
+    }
+
+    if ( next[e] != SG_POLICY_NO_ENTRY ) {
+        prev[next[e]] = prev[e];
+    } else {
+        l->tail = prev[e];
+    }
+
+    prev[e] = SG_POLICY_NO_ENTRY;
+    next[e] = SG_POLICY_NO_ENTRY;
+    l->size--;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : residentUnlink
+// Description  : Take an entry off whatever resident list it is on
+//
+// Inputs       : p - the policy
+//                e - the entry number
+// Outputs      : none
+
+static void residentUnlink( SG_Policy *p, int32_t e ) {
+
+    if ( p->list[e] != LIST_NONE ) {
+        listUnlink( &p->lists[p->list[e]], p->prev, p->next, e );
+        p->list[e] = LIST_NONE;
+    }
+
+}
+
+//
+// Ghost table support functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ghostCreate
+// Description  : Allocate a ghost table
+//
+// Inputs       : g - the table to set up
+//                capacity - number of keys it can remember
+// Outputs      : 0 if successful, -1 if failure
+
+static int ghostCreate( struct ghosttable *g, uint32_t capacity ) {
+
+    uint64_t size = 1;
+    uint64_t x;
+
+    memset( g, 0, sizeof(struct ghosttable) );
+    while ( size < ((uint64_t)capacity * SG_GHOST_INDEX_FACTOR) ) {
+        size <<= 1;
+    }
+
+    g->nodeID = malloc( capacity * sizeof(SG_Node_ID) );
+    g->blockID = malloc( capacity * sizeof(SG_Block_ID) );
+    g->prev = malloc( capacity * sizeof(int32_t) );
+    g->next = malloc( capacity * sizeof(int32_t) );
+    g->list = malloc( capacity * sizeof(uint8_t) );
+    g->index = malloc( size * sizeof(int32_t) );
+    if ( (g->nodeID == NULL) || (g->blockID == NULL) || (g->prev == NULL) ||
+            (g->next == NULL) || (g->list == NULL) || (g->index == NULL) ) {
+        ghostDestroy( g );
+        return( -1 );
+    }
+
+    for (x = 0; x < size; x++){
+        g->index[x] = SG_POLICY_NO_ENTRY;
+    }
+    for (x = 0; x < capacity; x++){
+        g->next[x] = (x + 1 < capacity) ? (int32_t)(x + 1) : SG_POLICY_NO_ENTRY;
+    }
+    g->freeHead = 0;
+    g->indexMask = (uint32_t)(size - 1);
+    g->capacity = capacity;
+    listInit( &g->lists[0] );
+    listInit( &g->lists[1] );
+
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ghostDestroy
+// Description  : Free a ghost table
+//
+// Inputs       : g - the table
+// Outputs      : none
+
+static void ghostDestroy( struct ghosttable *g ) {
+
+    free( g->nodeID );
+    free( g->blockID );
+    free( g->prev );
+    free( g->next );
+    free( g->list );
+    free( g->index );
+    memset( g, 0, sizeof(struct ghosttable) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ghostFind
+// Description  : Find a remembered key
+//
+// Inputs       : g - the table
+//                nde - node ID
+//                blk - block ID
+// Outputs      : the ghost entry, or SG_POLICY_NO_ENTRY if not remembered
+
+static int32_t ghostFind( struct ghosttable *g, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    uint32_t slot;
+    int32_t x;
+
+    if ( g->index == NULL ) {
+        return( SG_POLICY_NO_ENTRY );
+    }
+
+    slot = (uint32_t)sgCacheHash(nde, blk) & g->indexMask;
+    while ( (x = g->index[slot]) != SG_POLICY_NO_ENTRY ) {
+        if ( (g->blockID[x] == blk) && (g->nodeID[x] == nde) ) {
+            return( x );
+        }
+        slot = (slot + 1) & g->indexMask;
+    }
+
+    return( SG_POLICY_NO_ENTRY );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ghostRemove
+// Description  : Forget a remembered key
+//
+// Inputs       : g - the table
+//                x - the ghost entry
+// Outputs      : none
+
+static void ghostRemove( struct ghosttable *g, int32_t x ) {
+
+    uint32_t slot, next, home;
+
+    listUnlink( &g->lists[g->list[x]], g->prev, g->next, x );
+
+    // Drop it from the index with a backward shift
+    slot = (uint32_t)sgCacheHash(g->nodeID[x], g->blockID[x]) & g->indexMask;
+    while ( g->index[slot] != x ) {
+        slot = (slot + 1) & g->indexMask;
+    }
+    next = (slot + 1) & g->indexMask;
+    while ( g->index[next] != SG_POLICY_NO_ENTRY ) {
+        home = (uint32_t)sgCacheHash(g->nodeID[g->index[next]], g->blockID[g->index[next]]) & g->indexMask;
+        if ( ((next - home) & g->indexMask) >= ((next - slot) & g->indexMask) ) {
+            g->index[slot] = g->index[next];
+            slot = next;
+        }
+        next = (next + 1) & g->indexMask;
+    }
+    g->index[slot] = SG_POLICY_NO_ENTRY;
+
+    g->next[x] = g->freeHead;
+    g->freeHead = x;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ghostPopTail
+// Description  : Forget the oldest key on a ghost list
+//
+// Inputs       : g - the table
+//                l - the ghost list
+// Outputs      : none
+
+static void ghostPopTail( struct ghosttable *g, int l ) {
+
+    if ( g->lists[l].tail != SG_POLICY_NO_ENTRY ) {
+        ghostRemove( g, g->lists[l].tail );
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ghostAdd
+// Description  : Remember a key at the recent end of a ghost list, dropping
+//                the oldest key of the longest list if the table is full
+//
+// Inputs       : g - the table
+//                l - the ghost list
+//                nde - node ID
+//                blk - block ID
+// Outputs      : none
+
+static void ghostAdd( struct ghosttable *g, int l, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    uint32_t slot;
+    int32_t x;
+
+    if ( g->freeHead == SG_POLICY_NO_ENTRY ) {
+        ghostPopTail( g, (g->lists[0].size >= g->lists[1].size) ? 0 : 1 );
+    }
+
+    x = g->freeHead;
+    g->freeHead = g->next[x];
+    g->nodeID[x] = nde;
+    g->blockID[x] = blk;
+    g->list[x] = (uint8_t)l;
+    listPushFront( &g->lists[l], g->prev, g->next, x );
+
+    slot = (uint32_t)sgCacheHash(nde, blk) & g->indexMask;
+    while ( g->index[slot] != SG_POLICY_NO_ENTRY ) {
+        slot = (slot + 1) & g->indexMask;
+    }
+    g->index[slot] = x;
+
+}
+
+//
+// LRU: evict the least recently used entry
+
+static void lruHit( SG_Policy *p, int32_t e ) {
+
+    if ( p->lists[LIST_LRU].head != e ) {
+        listUnlink( &p->lists[LIST_LRU], p->prev, p->next, e );
+        listPushFront( &p->lists[LIST_LRU], p->prev, p->next, e );
+    }
+
+}
+
+static void lruInsert( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    p->list[e] = LIST_LRU;
+    listPushFront( &p->lists[LIST_LRU], p->prev, p->next, e );
+
+}
+
+static int32_t lruVictim( SG_Policy *p, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    return( p->lists[LIST_LRU].tail );
+
+}
+
+static void lruEvict( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    residentUnlink( p, e );
+
+}
+
+//
+// LFU: evict from the lowest frequency class, least recent first.  Counts
+// saturate at SG_LFU_MAX_FREQ so finding the lowest class is bounded.
+
+static void lfuHit( SG_Policy *p, int32_t e ) {
+
+    uint8_t f = p->freq[e];
+
+    listUnlink( &p->lists[f], p->prev, p->next, e );
+    if ( (p->lists[f].size == 0) && (p->minFreq == f) && (f < SG_LFU_MAX_FREQ) ) {
+        p->minFreq = f + 1;
+    }
+    if ( f < SG_LFU_MAX_FREQ ) {
+        f++;
+    }
+    p->freq[e] = f;
+    p->list[e] = f;
+    listPushFront( &p->lists[f], p->prev, p->next, e );
+
+}
+
+static void lfuInsert( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    p->freq[e] = 1;
+    p->list[e] = 1;
+    p->minFreq = 1;
+    listPushFront( &p->lists[1], p->prev, p->next, e );
+
+}
+
+static int32_t lfuVictim( SG_Policy *p, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    // Removals can leave minFreq low, never high, so only search upward
+    while ( (p->minFreq < SG_LFU_MAX_FREQ) && (p->lists[p->minFreq].size == 0) ) {
+        p->minFreq++;
+    }
+
+    return( p->lists[p->minFreq].tail );
+
+}
+
+//
+// CLOCK: sweep the entries in a ring, giving referenced ones a second chance
+
+static void clockHit( SG_Policy *p, int32_t e ) {
+
+    p->ref[e] = 1;
+
+}
+
+static void clockInsert( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    p->list[e] = LIST_CLOCK;
+    p->ref[e] = 0;
+
+}
+
+static int32_t clockVictim( SG_Policy *p, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    int32_t e;
+
+    // At most two sweeps: the first clears every reference bit
+    for (;;) {
+        e = (int32_t)p->hand;
+        p->hand = (p->hand + 1 == p->maxElements) ? 0 : p->hand + 1;
+        if ( p->list[e] == LIST_NONE ) {
+            continue;
+        }
+        if ( p->ref[e] ) {
+            p->ref[e] = 0;
+            continue;
+        }
+        return( e );
+    }
+
+}
+
+static void clockRemove( SG_Policy *p, int32_t e ) {
+
+    p->list[e] = LIST_NONE;
+    p->ref[e] = 0;
+
+}
+
+static void clockEvict( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    clockRemove( p, e );
+
+}
+
+//
+// ARC: balance recency (T1) against frequency (T2), adapting the T1 target
+// from hits on the ghost lists B1 and B2 (Megiddo and Modha, FAST '03)
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : arcAdapt
+// Description  : Handle a reference to a key that may be on a ghost list,
+//                adapting the T1 target and trimming the directory
+//
+// Inputs       : p - the policy
+//                nde - node ID
+//                blk - block ID
+//                inB2 - set to 1 if the key was on B2
+// Outputs      : the resident list the key goes to
+
+static uint8_t arcAdapt( SG_Policy *p, SG_Node_ID nde, SG_Block_ID blk, int *inB2 ) {
+
+    struct ghosttable *g = &p->ghosts;
+    uint32_t b1 = g->lists[GHOST_B1].size, b2 = g->lists[GHOST_B2].size;
+    uint32_t t1 = p->lists[LIST_T1].size, t2 = p->lists[LIST_T2].size;
+    uint32_t c = p->maxElements, delta;
+    int32_t x;
+
+    *inB2 = 0;
+    if ( (x = ghostFind(g, nde, blk)) != SG_POLICY_NO_ENTRY ) {
+
+        // A ghost hit says the list it came from should have been larger
+        if ( g->list[x] == GHOST_B1 ) {
+            delta = (b2 > b1) ? (b2 / b1) : 1;
+            p->target = (p->target + delta > c) ? c : p->target + delta;
+        } else {
+            delta = (b1 > b2) ? (b1 / b2) : 1;
+            p->target = (p->target > delta) ? p->target - delta : 0;
+            *inB2 = 1;
+        }
+        ghostRemove( g, x );
+        return( LIST_T2 );
+
+    }
+
+    // New key, keep |T1| + |B1| <= c and the whole directory <= 2c
+    if ( t1 + b1 >= c ) {
+        if ( t1 < c ) {
+            ghostPopTail( g, GHOST_B1 );
+        } else {
+            p->dropGhost = 1;
+        }
+    } else if ( t1 + t2 + b1 + b2 >= 2 * c ) {
+        ghostPopTail( g, GHOST_B2 );
+    }
+
+    return( LIST_T1 );
+
+}
+
+static void arcHit( SG_Policy *p, int32_t e ) {
+
+    listUnlink( &p->lists[p->list[e]], p->prev, p->next, e );
+    p->list[e] = LIST_T2;
+    listPushFront( &p->lists[LIST_T2], p->prev, p->next, e );
+
+}
+
+static void arcInsert( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    uint8_t l;
+    int inB2;
+
+    // Use the classification from the victim call, or do it now if the
+    // cache had room and no victim was needed
+    if ( p->pendingValid && (p->pendingNode == nde) && (p->pendingBlock == blk) ) {
+        l = p->pendingList;
+    } else {
+        l = arcAdapt( p, nde, blk, &inB2 );
+        p->dropGhost = 0;
+    }
+    p->pendingValid = 0;
+
+    p->list[e] = l;
+    listPushFront( &p->lists[l], p->prev, p->next, e );
+
+}
+
+static int32_t arcVictim( SG_Policy *p, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    uint32_t t1, t2;
+    int inB2;
+
+    p->dropGhost = 0;
+    p->pendingList = arcAdapt( p, nde, blk, &inB2 );
+    p->pendingNode = nde;
+    p->pendingBlock = blk;
+    p->pendingValid = 1;
+
+    t1 = p->lists[LIST_T1].size;
+    t2 = p->lists[LIST_T2].size;
+
+    // T1 is the whole directory: its oldest entry leaves without a ghost
+    if ( p->dropGhost ) {
+        return( p->lists[LIST_T1].tail );
+    }
+
+    // REPLACE(x, p)
+    if ( (t1 > 0) && ((inB2 && (t1 == p->target)) || (t1 > p->target)) ) {
+        return( p->lists[LIST_T1].tail );
+    }
+    if ( t2 > 0 ) {
+        return( p->lists[LIST_T2].tail );
+    }
+    return( p->lists[LIST_T1].tail );
+
+}
+
+static void arcEvict( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    uint8_t l = p->list[e];
+
+    residentUnlink( p, e );
+    if ( p->dropGhost ) {
+        p->dropGhost = 0;
+        return;
+    }
+    ghostAdd( &p->ghosts, (l == LIST_T1) ? GHOST_B1 : GHOST_B2, nde, blk );
+
+}
+
+//
+// 2Q: first references wait in the A1in FIFO; blocks referenced again after
+// falling out of it (found on A1out) go to the Am LRU (Johnson and Shasha,
+// VLDB '94)
+
+static void twoqHit( SG_Policy *p, int32_t e ) {
+
+    // Hits in A1in are deliberately ignored (correlated references)
+    if ( (p->list[e] == LIST_AM) && (p->lists[LIST_AM].head != e) ) {
+        listUnlink( &p->lists[LIST_AM], p->prev, p->next, e );
+        listPushFront( &p->lists[LIST_AM], p->prev, p->next, e );
+    }
+
+}
+
+static void twoqInsert( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    int32_t x;
+
+    if ( (x = ghostFind(&p->ghosts, nde, blk)) != SG_POLICY_NO_ENTRY ) {
+        ghostRemove( &p->ghosts, x );
+        p->list[e] = LIST_AM;
+    } else {
+        p->list[e] = LIST_A1IN;
+    }
+    listPushFront( &p->lists[p->list[e]], p->prev, p->next, e );
+
+}
+
+static int32_t twoqVictim( SG_Policy *p, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    uint32_t kin = p->maxElements / SG_2Q_KIN_DIVISOR;
+
+    if ( (p->lists[LIST_A1IN].size > 0) &&
+            ((p->lists[LIST_A1IN].size > kin) || (p->lists[LIST_AM].size == 0)) ) {
+        return( p->lists[LIST_A1IN].tail );
+    }
+    return( p->lists[LIST_AM].tail );
+
+}
+
+static void twoqEvict( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    uint32_t kout = p->maxElements / SG_2Q_KOUT_DIVISOR;
+
+    if ( p->list[e] == LIST_A1IN ) {
+        if ( kout == 0 ) {
+            kout = 1;
+        }
+        while ( p->ghosts.lists[GHOST_A1OUT].size >= kout ) {
+            ghostPopTail( &p->ghosts, GHOST_A1OUT );
+        }
+        ghostAdd( &p->ghosts, GHOST_A1OUT, nde, blk );
+    }
+    residentUnlink( p, e );
+
+}
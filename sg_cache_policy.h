@@ -0,0 +1,54 @@
+#ifndef SG_CACHE_POLICY_INCLUDED
+#define SG_CACHE_POLICY_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_cache_policy.h
+//  Description    : This is the declaration of the eviction policies used by
+//                   the block cache.  A policy tracks cache entries by their
+//                   entry number and picks the victim when the cache is full.
+//
+//   Author        : Yinan Lang
+//   Last Modified : 10/17/2026
+//
+
+// Includes
+#include <sg_cache.h>
+
+// Defines
+#define SG_POLICY_NO_ENTRY -1         // No entry / end of list
+
+// Type definitions
+typedef struct sgpolicy SG_Policy;    // Policy instance (opaque)
+
+//
+// Policy functions
+
+SG_Policy *createSGPolicy( SG_Cache_Policy type, uint32_t maxElements );
+    // Create a policy instance for a cache of maxElements entries
+
+void destroySGPolicy( SG_Policy *p );
+    // Release a policy instance
+
+void policyHit( SG_Policy *p, int32_t e );
+    // Entry e was referenced
+
+void policyInsert( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk );
+    // Entry e now holds (nde, blk)
+
+int32_t policyVictim( SG_Policy *p, SG_Node_ID nde, SG_Block_ID blk );
+    // Choose the entry to evict so (nde, blk) can be inserted
+
+void policyEvict( SG_Policy *p, int32_t e, SG_Node_ID nde, SG_Block_ID blk );
+    // Entry e (holding nde, blk) is being evicted
+
+void policyRemove( SG_Policy *p, int32_t e );
+    // Entry e is being dropped without eviction history
+
+//
+// Shared support (sg_cache.c)
+
+uint64_t sgCacheHash( SG_Node_ID nde, SG_Block_ID blk );
+    // Hash the packed (node, block) key
+
+#endif
@@ -0,0 +1,507 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_cache_shm.c
+//  Description    : This file contains the shared cache tier.  The segment is
+//                   a header page, a table of buckets of SG_SHM_WAYS frame
+//                   descriptors and the page aligned frames.  Readers never
+//                   lock: each bucket carries a sequence count that writers
+//                   make odd while they change it, and a read that saw it
+//                   odd or changed is retried.  Writers take the bucket's
+//                   robust process shared mutex, so a process that dies
+//                   holding one only costs the next writer a recovery (the
+//                   bucket is emptied if the write was cut short).
+//
+//   Author        : Yinan Lang
+//   Last Modified : 10/17/2026
+//
+
+// Include Files
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <sg_cache_shm.h>
+#include <sg_cache_policy.h>
+
+// Defines
+#define SHM_PAGE_SIZE 4096            // Alignment of the bucket table and frames
+
+// Segment Header Structure (first page of the segment)
+struct shmheader{
+
+    uint32_t magic;           // SG_SHM_MAGIC, set once the segment is ready
+    uint32_t version;         // SG_SHM_VERSION
+    uint32_t blockSize;       // SG_BLOCK_SIZE of the creator
+    uint32_t ways;            // Frames per bucket
+    uint32_t nsets;           // Number of buckets
+    uint32_t resident;        // Frames in use (atomic)
+    uint64_t clock;           // Last stamp handed out (atomic)
+
+};
+
+// Frame Descriptor Structure
+struct shmslot{
+
+    SG_Node_ID nodeID;        // Node ID of the block
+    SG_Block_ID blockID;      // Block ID of the block
+    uint64_t stamp;           // Time of the last store or hit
+    uint64_t seq;             // Version of the block
+    uint16_t valid;           // The frame holds the block
+
+};
+
+// Bucket Structure
+struct shmbucket{
+
+    pthread_mutex_t lock;     // Robust, process shared, writers only
+    uint32_t count;           // Sequence count, odd while being written
+    struct shmslot slots[SG_SHM_WAYS]; // The bucket's frame descriptors
+
+} __attribute__((aligned(64)));
+
+// Tier Structure
+struct sgshm{
+
+    struct shmheader *header; // Start of the mapping
+    struct shmbucket *buckets;// nsets buckets
+    char *frames;             // nsets * ways block frames
+    size_t length;            // Bytes mapped
+
+};
+
+//
+// Functional Prototypes
+
+static size_t shmLayout( uint32_t nsets, size_t *bucketBytes ); // Bytes needed for nsets
+static struct shmbucket *shmBucket( SG_Shm *t, SG_Node_ID nde, SG_Block_ID blk ); // Key's bucket
+static int shmLock( SG_Shm *t, struct shmbucket *b );    // Take a bucket, recovering it
+static void shmBeginWrite( struct shmbucket *b );        // Make the count odd
+static void shmEndWrite( struct shmbucket *b );          // Make the count even
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openSGShm
+// Description  : Map the shared segment, creating and initializing it if it
+//                does not exist yet or a creator died before finishing.  A
+//                file lock on the segment serializes this between processes
+//                and is dropped by the kernel if the holder dies.
+//
+// Inputs       : name - the segment name ("/name")
+//                elements - the minimum number of frames for a new segment
+// Outputs      : the tier or NULL if failure
+
+SG_Shm *openSGShm( const char *name, uint32_t elements ) {
+
+    pthread_mutexattr_t attr;
+    struct shmheader *h;
+    struct stat st;
+    size_t length, bucketBytes;
+    uint32_t nsets, i;
+    SG_Shm *t;
+    void *map = MAP_FAILED;
+    int fd, ready;
+
+    if ( (name == NULL) || (elements == 0) ) {
+        logMessage( LOG_ERROR_LEVEL, "Shared cache needs a name and a capacity" );
+        return( NULL );
+    }
+    if ( (fd = shm_open(name, O_RDWR | O_CREAT, 0600)) == -1 ) {
+        logMessage( LOG_ERROR_LEVEL, "Shared cache shm_open of %s failed [%s]",
+                name, strerror(errno) );
+        return( NULL );
+    }
+    if ( (flock(fd, LOCK_EX) == -1) || (fstat(fd, &st) == -1) ) {
+        logMessage( LOG_ERROR_LEVEL, "Shared cache lock of %s failed [%s]",
+                name, strerror(errno) );
+        close( fd );
+        return( NULL );
+    }
+
+    // A segment some process finished setting up keeps its geometry
+    ready = 0;
+    if ( (size_t)st.st_size >= SHM_PAGE_SIZE ) {
+        map = mmap( NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+        if ( map == MAP_FAILED ) {
+            logMessage( LOG_ERROR_LEVEL, "Shared cache mmap of %s failed [%s]",
+                    name, strerror(errno) );
+            close( fd );
+            return( NULL );
+        }
+        h = map;
+        if ( __atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) == SG_SHM_MAGIC ) {
+            if ( (h->version != SG_SHM_VERSION) || (h->blockSize != SG_BLOCK_SIZE) ||
+                    (h->ways != SG_SHM_WAYS) || (shmLayout(h->nsets, &bucketBytes) != (size_t)st.st_size) ) {
+                logMessage( LOG_ERROR_LEVEL, "Shared cache %s has a different layout, not using it", name );
+                munmap( map, (size_t)st.st_size );
+                close( fd );
+                return( NULL );
+            }
+            ready = 1;
+        } else {
+            munmap( map, (size_t)st.st_size );
+            map = MAP_FAILED;
+        }
+    }
+
+    // Otherwise build it; truncating to zero first clears any partial one
+    if ( ! ready ) {
+        nsets = (elements + SG_SHM_WAYS - 1) / SG_SHM_WAYS;
+        length = shmLayout( nsets, &bucketBytes );
+        if ( (ftruncate(fd, 0) == -1) || (ftruncate(fd, (off_t)length) == -1) ||
+                ((map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) ) {
+            logMessage( LOG_ERROR_LEVEL, "Shared cache setup of %s failed [%s]",
+                    name, strerror(errno) );
+            close( fd );
+            return( NULL );
+        }
+        h = map;
+        pthread_mutexattr_init( &attr );
+        pthread_mutexattr_setpshared( &attr, PTHREAD_PROCESS_SHARED );
+        pthread_mutexattr_setrobust( &attr, PTHREAD_MUTEX_ROBUST );
+        for ( i = 0; i < nsets; i++ ) {
+            pthread_mutex_init( &((struct shmbucket *)((char *)map + SHM_PAGE_SIZE))[i].lock, &attr );
+        }
+        pthread_mutexattr_destroy( &attr );
+        h->version = SG_SHM_VERSION;
+        h->blockSize = SG_BLOCK_SIZE;
+        h->ways = SG_SHM_WAYS;
+        h->nsets = nsets;
+        __atomic_store_n( &h->magic, SG_SHM_MAGIC, __ATOMIC_RELEASE );
+    }
+    length = shmLayout( h->nsets, &bucketBytes );
+    flock( fd, LOCK_UN );
+    close( fd );
+
+    // Set up the instance
+    if ( (t = calloc(1, sizeof(SG_Shm))) == NULL ) {
+        logMessage( LOG_ERROR_LEVEL, "Shared cache allocation failed" );
+        munmap( map, length );
+        return( NULL );
+    }
+    t->header = h;
+    t->buckets = (struct shmbucket *)((char *)map + SHM_PAGE_SIZE);
+    t->frames = (char *)map + SHM_PAGE_SIZE + bucketBytes;
+    t->length = length;
+
+    logMessage( LOG_INFO_LEVEL, "Shared cache %s: %u frames, %u resident (%s)",
+            name, h->nsets * SG_SHM_WAYS, __atomic_load_n(&h->resident, __ATOMIC_RELAXED),
+            ready ? "attached" : "created" );
+    return( t );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeSGShm
+// Description  : Unmap the segment, leaving it to the other processes
+//
+// Inputs       : t - the tier (NULL is ignored)
+// Outputs      : none
+
+void closeSGShm( SG_Shm *t ) {
+
+    if ( t == NULL ) {
+        return;
+    }
+    munmap( t->header, t->length );
+    free( t );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unlinkSGShm
+// Description  : Remove the segment name, the memory goes once the last
+//                process unmaps it
+//
+// Inputs       : name - the segment name
+// Outputs      : 0 if successful, -1 if failure
+
+int unlinkSGShm( const char *name ) {
+
+    if ( (shm_unlink(name) == -1) && (errno != ENOENT) ) {
+        logMessage( LOG_ERROR_LEVEL, "Shared cache unlink of %s failed [%s]",
+                name, strerror(errno) );
+        return( -1 );
+    }
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmGet
+// Description  : Copy a block out of the segment.  The bucket is read
+//                between two loads of its sequence count and the read is
+//                repeated if a writer got in between.
+//
+// Inputs       : t - the tier
+//                nde - the node ID
+//                blk - the block ID
+//                seq - set to the version of the block
+//                block - buffer for the block data
+// Outputs      : 0 if found, -1 if not (or never read untorn)
+
+int shmGet( SG_Shm *t, SG_Node_ID nde, SG_Block_ID blk, uint64_t *seq, char *block ) {
+
+    struct shmbucket *b = shmBucket( t, nde, blk );
+    uint32_t before, i, tries;
+    int found;
+
+    for ( tries = 0; tries < SG_SHM_READ_RETRIES; tries++ ) {
+
+        if ( (before = __atomic_load_n(&b->count, __ATOMIC_ACQUIRE)) & 1 ) {
+            sched_yield();
+            continue;
+        }
+        found = -1;
+        for ( i = 0; i < SG_SHM_WAYS; i++ ) {
+            if ( b->slots[i].valid && (b->slots[i].nodeID == nde) && (b->slots[i].blockID == blk) ) {
+                *seq = b->slots[i].seq;
+                memcpy( block, t->frames + ((size_t)(b - t->buckets) * SG_SHM_WAYS + i) * SG_BLOCK_SIZE,
+                        SG_BLOCK_SIZE );
+                found = (int)i;
+                break;
+            }
+        }
+        __atomic_thread_fence( __ATOMIC_ACQUIRE );
+        if ( __atomic_load_n(&b->count, __ATOMIC_RELAXED) == before ) {
+            if ( found >= 0 ) {
+                // Recency hint only, a racing writer may overwrite it
+                __atomic_store_n( &b->slots[found].stamp,
+                        __atomic_add_fetch(&t->header->clock, 1, __ATOMIC_RELAXED), __ATOMIC_RELAXED );
+                return( 0 );
+            }
+            return( -1 );
+        }
+
+    }
+    return( -1 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmPut
+// Description  : Store a block, replacing the copy of it already there,
+//                else a free frame, else the least recently used frame of
+//                its bucket.  The last publish wins: versions come from each
+//                process's own sequence numbers and do not order publishes.
+//
+// Inputs       : t - the tier
+//                nde - the node ID
+//                blk - the block ID
+//                seq - the version of the block
+//                block - the block data
+// Outputs      : 0 if successful, -1 if failure
+
+int shmPut( SG_Shm *t, SG_Node_ID nde, SG_Block_ID blk, uint64_t seq, const char *block ) {
+
+    struct shmbucket *b = shmBucket( t, nde, blk );
+    struct shmslot *s = NULL;
+    uint32_t i;
+
+    if ( shmLock(t, b) ) {
+        return( -1 );
+    }
+    for ( i = 0; i < SG_SHM_WAYS; i++ ) {
+        if ( b->slots[i].valid && (b->slots[i].nodeID == nde) && (b->slots[i].blockID == blk) ) {
+            s = &b->slots[i];
+            break;
+        }
+        if ( (s == NULL) || (s->valid && ((! b->slots[i].valid) || (b->slots[i].stamp < s->stamp))) ) {
+            s = &b->slots[i];
+        }
+    }
+    if ( ! s->valid ) {
+        __atomic_add_fetch( &t->header->resident, 1, __ATOMIC_RELAXED );
+    }
+
+    shmBeginWrite( b );
+    memcpy( t->frames + ((size_t)(b - t->buckets) * SG_SHM_WAYS + (s - b->slots)) * SG_BLOCK_SIZE,
+            block, SG_BLOCK_SIZE );
+    s->nodeID = nde;
+    s->blockID = blk;
+    s->seq = seq;
+    s->stamp = __atomic_add_fetch( &t->header->clock, 1, __ATOMIC_RELAXED );
+    s->valid = 1;
+    shmEndWrite( b );
+
+    pthread_mutex_unlock( &b->lock );
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmRemove
+// Description  : Drop a block from the segment whatever its version
+//
+// Inputs       : t - the tier
+//                nde - the node ID
+//                blk - the block ID
+// Outputs      : none
+
+void shmRemove( SG_Shm *t, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    struct shmbucket *b = shmBucket( t, nde, blk );
+    uint32_t i;
+
+    if ( shmLock(t, b) ) {
+        return;
+    }
+    shmBeginWrite( b );
+    for ( i = 0; i < SG_SHM_WAYS; i++ ) {
+        if ( b->slots[i].valid && (b->slots[i].nodeID == nde) && (b->slots[i].blockID == blk) ) {
+            b->slots[i].valid = 0;
+            __atomic_sub_fetch( &t->header->resident, 1, __ATOMIC_RELAXED );
+        }
+    }
+    shmEndWrite( b );
+    pthread_mutex_unlock( &b->lock );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmInfo
+// Description  : Get the capacity and occupancy of the segment
+//
+// Inputs       : t - the tier
+//                elements - set to the number of frames
+//                resident - set to the number of frames in use
+// Outputs      : none
+
+void shmInfo( SG_Shm *t, uint32_t *elements, uint32_t *resident ) {
+
+    *elements = t->header->nsets * t->header->ways;
+    *resident = __atomic_load_n( &t->header->resident, __ATOMIC_RELAXED );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmBytes
+// Description  : Get the size of the segment
+//
+// Inputs       : t - the tier
+// Outputs      : the bytes mapped
+
+size_t shmBytes( SG_Shm *t ) {
+
+    return( t->length );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmLayout
+// Description  : Compute the size of a segment with nsets buckets
+//
+// Inputs       : nsets - the number of buckets
+//                bucketBytes - set to the page rounded size of the buckets
+// Outputs      : the segment size in bytes
+
+static size_t shmLayout( uint32_t nsets, size_t *bucketBytes ) {
+
+    *bucketBytes = ((size_t)nsets * sizeof(struct shmbucket) + SHM_PAGE_SIZE - 1) &
+            ~((size_t)SHM_PAGE_SIZE - 1);
+    return( SHM_PAGE_SIZE + *bucketBytes + (size_t)nsets * SG_SHM_WAYS * SG_BLOCK_SIZE );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmBucket
+// Description  : Find the bucket a block maps to
+//
+// Inputs       : t - the tier
+//                nde - the node ID
+//                blk - the block ID
+// Outputs      : the bucket
+
+static struct shmbucket *shmBucket( SG_Shm *t, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    return( &t->buckets[sgCacheHash(nde, blk) % t->header->nsets] );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmLock
+// Description  : Lock a bucket for writing.  If the last holder died, a
+//                write it left half done (odd count) empties the bucket,
+//                since any of its frames may be torn.
+//
+// Inputs       : t - the tier
+//                b - the bucket
+// Outputs      : 0 if locked, -1 if failure
+
+static int shmLock( SG_Shm *t, struct shmbucket *b ) {
+
+    uint32_t i;
+    int ret;
+
+    if ( (ret = pthread_mutex_lock(&b->lock)) == EOWNERDEAD ) {
+        if ( __atomic_load_n(&b->count, __ATOMIC_RELAXED) & 1 ) {
+            for ( i = 0; i < SG_SHM_WAYS; i++ ) {
+                if ( b->slots[i].valid ) {
+                    b->slots[i].valid = 0;
+                    __atomic_sub_fetch( &t->header->resident, 1, __ATOMIC_RELAXED );
+                }
+            }
+            shmEndWrite( b );
+        }
+        pthread_mutex_consistent( &b->lock );
+        logMessage( LOG_WARNING_LEVEL, "Shared cache recovered bucket %lu from a dead process",
+                (unsigned long)(b - t->buckets) );
+        ret = 0;
+    }
+    if ( ret != 0 ) {
+        logMessage( LOG_ERROR_LEVEL, "Shared cache bucket lock failed [%s]", strerror(ret) );
+        return( -1 );
+    }
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmBeginWrite
+// Description  : Start changing a bucket (lock held), readers now retry
+//
+// Inputs       : b - the bucket
+// Outputs      : none
+
+static void shmBeginWrite( struct shmbucket *b ) {
+
+    __atomic_store_n( &b->count, b->count + 1, __ATOMIC_RELAXED );
+    __atomic_thread_fence( __ATOMIC_RELEASE );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmEndWrite
+// Description  : Finish changing a bucket (lock held)
+//
+// Inputs       : b - the bucket
+// Outputs      : none
+
+static void shmEndWrite( struct shmbucket *b ) {
+
+    __atomic_store_n( &b->count, b->count + 1, __ATOMIC_RELEASE );
+
+}
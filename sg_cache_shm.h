@@ -0,0 +1,57 @@
+#ifndef SG_CACHE_SHM_INCLUDED
+#define SG_CACHE_SHM_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_cache_shm.h
+//  Description    : This is the declaration of the shared cache tier, a POSIX
+//                   shared memory segment of block frames mapped by every
+//                   client process on the host, so a block fetched by one
+//                   process is a hit for the others.
+//
+//   Author        : Yinan Lang
+//   Last Modified : 10/17/2026
+//
+
+// Includes
+#include <sg_defs.h>
+
+// Defines
+#define SG_SHM_WAYS 8                 // Frames per bucket
+#define SG_SHM_MAGIC 0x53475348       // "SGSH", start of the segment
+#define SG_SHM_VERSION 2              // Segment layout version
+#define SG_SHM_READ_RETRIES 64        // Torn reads retried before giving up
+
+// Type definitions
+typedef struct sgshm SG_Shm;          // Tier instance (opaque)
+
+//
+// Tier functions
+
+SG_Shm *openSGShm( const char *name, uint32_t elements );
+    // Map the named segment, creating it with at least elements frames if
+    // no process has yet (an existing segment keeps its size)
+
+void closeSGShm( SG_Shm *t );
+    // Unmap the segment, it stays for the other processes
+
+int unlinkSGShm( const char *name );
+    // Remove the segment name (mapped processes keep their mapping)
+
+int shmGet( SG_Shm *t, SG_Node_ID nde, SG_Block_ID blk, uint64_t *seq, char *block );
+    // Copy out a block and its version without locking (-1 if absent)
+
+int shmPut( SG_Shm *t, SG_Node_ID nde, SG_Block_ID blk, uint64_t seq, const char *block );
+    // Store a block, replacing the copy there or the stalest frame (the
+    // last publish wins)
+
+void shmRemove( SG_Shm *t, SG_Node_ID nde, SG_Block_ID blk );
+    // Drop every version of a block
+
+void shmInfo( SG_Shm *t, uint32_t *elements, uint32_t *resident );
+    // Get the capacity and the number of frames in use
+
+size_t shmBytes( SG_Shm *t );
+    // Get the size of the segment
+
+#endif
@@ -0,0 +1,397 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_cache_sizer.c
+//  Description    : This file contains the cache sizer.  Every referenced key
+//                   is kept, up to the capacity, on a recency list and in
+//                   one of SG_SIZER_BUCKETS recency groups.  A reference to a
+//                   remembered key is the number of keys in newer groups
+//                   (plus half its own group) away from the front, which is
+//                   the smallest LRU cache it would have hit in; those
+//                   distances make up the miss ratio curve.  The oldest
+//                   groups are merged as new ones are opened, so the
+//                   estimate is finest for small distances.
+//
+//   Author        : Yinan Lang
+//   Last Modified : 10/17/2026
+//
+
+// Include Files
+#include <stdlib.h>
+#include <string.h>
+
+// Project Includes
+#include <sg_cache_sizer.h>
+#include <sg_cache_policy.h>
+
+// Defines
+#define SIZER_NO_ENTRY -1             // Empty index slot / end of list
+#define SIZER_INDEX_FACTOR 2          // Index slots per key
+
+// Sizer Structure
+struct sgsizer{
+
+    SG_Node_ID *nodeID;       // Node IDs
+    SG_Block_ID *blockID;     // Block IDs
+    uint32_t *group;          // Recency group a key joined last
+    int32_t *prev;            // Recency list links
+    int32_t *next;
+    int32_t head;             // Most recently referenced key
+    int32_t tail;             // Least recently referenced key
+    int32_t freeHead;         // Unused keys, chained through next
+    int32_t *index;           // Open addressing index of keys
+    uint32_t indexMask;       // Index size - 1
+    uint32_t capacity;        // Keys remembered at most
+    uint32_t groupLimit;      // Keys in the newest group before a new one
+    uint32_t newest;          // Number of the newest group
+    uint32_t oldest;          // Number of the oldest group (older ones merged)
+    uint32_t groups[SG_SIZER_BUCKETS]; // Keys in each group (by number % BUCKETS)
+    uint64_t bins[SG_SIZER_POINTS];    // Hits by distance, capacity / POINTS wide
+    uint64_t cold;            // References to keys not remembered
+    uint32_t additions;       // References counted since the last halving
+    uint32_t sampleSize;      // References between halvings
+
+};
+
+//
+// Functional Prototypes
+
+static int32_t sizerFind( SG_Sizer *z, SG_Node_ID nde, SG_Block_ID blk ); // Locate a key
+static void sizerForget( SG_Sizer *z, int32_t x );                      // Drop a key
+static void sizerUnlink( SG_Sizer *z, int32_t x );                      // Take a key off the list
+static void sizerPushFront( SG_Sizer *z, int32_t x );                   // Make a key most recent
+static uint32_t *sizerGroup( SG_Sizer *z, int32_t x );                  // Group count a key is in
+static void sizerNewGroup( SG_Sizer *z );                               // Open a group
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : createSGSizer
+// Description  : Create a sizer for cache sizes up to capacity blocks
+//
+// Inputs       : capacity - keys remembered (largest cache size estimated)
+// Outputs      : the sizer or NULL if failure
+
+SG_Sizer *createSGSizer( uint32_t capacity ) {
+
+    uint64_t size = 1;
+    uint64_t x;
+    SG_Sizer *z;
+
+    if ( (capacity == 0) || ((z = calloc(1, sizeof(SG_Sizer))) == NULL) ) {
+        return( NULL );
+    }
+    while ( size < ((uint64_t)capacity * SIZER_INDEX_FACTOR) ) {
+        size <<= 1;
+    }
+
+    z->nodeID = malloc( capacity * sizeof(SG_Node_ID) );
+    z->blockID = malloc( capacity * sizeof(SG_Block_ID) );
+    z->group = malloc( capacity * sizeof(uint32_t) );
+    z->prev = malloc( capacity * sizeof(int32_t) );
+    z->next = malloc( capacity * sizeof(int32_t) );
+    z->index = malloc( size * sizeof(int32_t) );
+    if ( (z->nodeID == NULL) || (z->blockID == NULL) || (z->group == NULL) ||
+            (z->prev == NULL) || (z->next == NULL) || (z->index == NULL) ) {
+        destroySGSizer( z );
+        return( NULL );
+    }
+
+    for (x = 0; x < size; x++){
+        z->index[x] = SIZER_NO_ENTRY;
+    }
+    for (x = 0; x < capacity; x++){
+        z->next[x] = (x + 1 < capacity) ? (int32_t)(x + 1) : SIZER_NO_ENTRY;
+    }
+    z->freeHead = 0;
+    z->head = z->tail = SIZER_NO_ENTRY;
+    z->indexMask = (uint32_t)(size - 1);
+    z->capacity = capacity;
+    z->groupLimit = (capacity / (SG_SIZER_BUCKETS / 2) > 0) ? capacity / (SG_SIZER_BUCKETS / 2) : 1;
+    z->sampleSize = (capacity > UINT32_MAX / SG_SIZER_SAMPLE_FACTOR) ?
+            UINT32_MAX : capacity * SG_SIZER_SAMPLE_FACTOR;
+
+    return( z );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : destroySGSizer
+// Description  : Release a sizer
+//
+// Inputs       : z - the sizer (NULL is ignored)
+// Outputs      : none
+
+void destroySGSizer( SG_Sizer *z ) {
+
+    if ( z != NULL ) {
+        free( z->nodeID );
+        free( z->blockID );
+        free( z->group );
+        free( z->prev );
+        free( z->next );
+        free( z->index );
+        free( z );
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sizerAccess
+// Description  : Count a reference to a block and move it to the front
+//
+// Inputs       : z - the sizer
+//                nde - node ID
+//                blk - block ID
+// Outputs      : none
+
+void sizerAccess( SG_Sizer *z, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    uint64_t distance;
+    uint32_t *own, g, slot, x;
+    int32_t k;
+
+    if ( (k = sizerFind(z, nde, blk)) != SIZER_NO_ENTRY ) {
+
+        // Keys in the groups newer than its own, and half of its own
+        own = sizerGroup( z, k );
+        g = (z->group[k] > z->oldest) ? z->group[k] : z->oldest;
+        distance = (*own - 1) / 2;
+        for (g = g + 1; g <= z->newest; g++){
+            distance += z->groups[g % SG_SIZER_BUCKETS];
+        }
+        x = (uint32_t)((distance * SG_SIZER_POINTS) / z->capacity);
+        z->bins[(x < SG_SIZER_POINTS) ? x : SG_SIZER_POINTS - 1]++;
+        (*own)--;
+        sizerUnlink( z, k );
+
+    } else {
+
+        // Not remembered, make room by forgetting the least recent key
+        z->cold++;
+        if ( z->freeHead == SIZER_NO_ENTRY ) {
+            sizerForget( z, z->tail );
+        }
+        k = z->freeHead;
+        z->freeHead = z->next[k];
+        z->nodeID[k] = nde;
+        z->blockID[k] = blk;
+
+        slot = (uint32_t)sgCacheHash(nde, blk) & z->indexMask;
+        while ( z->index[slot] != SIZER_NO_ENTRY ) {
+            slot = (slot + 1) & z->indexMask;
+        }
+        z->index[slot] = k;
+
+    }
+
+    // Into the newest group, opening a new one when it is full
+    if ( z->groups[z->newest % SG_SIZER_BUCKETS] >= z->groupLimit ) {
+        sizerNewGroup( z );
+    }
+    z->group[k] = z->newest;
+    z->groups[z->newest % SG_SIZER_BUCKETS]++;
+    sizerPushFront( z, k );
+
+    // Age the counts so the curve follows the recent workload
+    if ( ++z->additions >= z->sampleSize ) {
+        for (x = 0; x < SG_SIZER_POINTS; x++){
+            z->bins[x] /= 2;
+        }
+        z->cold /= 2;
+        z->additions = 0;
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sizerCurve
+// Description  : Add a sizer's estimated hits at each curve point (hits at a
+//                size are those at every smaller distance)
+//
+// Inputs       : z - the sizer
+//                hits - SG_SIZER_POINTS hit counts to add to
+//                refs - reference count to add to
+// Outputs      : none
+
+void sizerCurve( SG_Sizer *z, uint64_t *hits, uint64_t *refs ) {
+
+    uint64_t sum = 0;
+    uint32_t x;
+
+    for (x = 0; x < SG_SIZER_POINTS; x++){
+        sum += z->bins[x];
+        hits[x] += sum;
+    }
+    *refs += sum + z->cold;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sizerBytes
+// Description  : Get the memory used by a sizer
+//
+// Inputs       : z - the sizer
+// Outputs      : bytes allocated (0 for NULL)
+
+size_t sizerBytes( SG_Sizer *z ) {
+
+    if ( z == NULL ) {
+        return( 0 );
+    }
+    return( sizeof(SG_Sizer) + (size_t)z->capacity * (sizeof(SG_Node_ID) + sizeof(SG_Block_ID) +
+            sizeof(uint32_t) + 2 * sizeof(int32_t)) + (size_t)(z->indexMask + 1) * sizeof(int32_t) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sizerFind
+// Description  : Find a remembered key
+//
+// Inputs       : z - the sizer
+//                nde - node ID
+//                blk - block ID
+// Outputs      : the key's entry, or SIZER_NO_ENTRY if not remembered
+
+static int32_t sizerFind( SG_Sizer *z, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    uint32_t slot = (uint32_t)sgCacheHash(nde, blk) & z->indexMask;
+    int32_t x;
+
+    while ( (x = z->index[slot]) != SIZER_NO_ENTRY ) {
+        if ( (z->blockID[x] == blk) && (z->nodeID[x] == nde) ) {
+            return( x );
+        }
+        slot = (slot + 1) & z->indexMask;
+    }
+
+    return( SIZER_NO_ENTRY );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sizerForget
+// Description  : Drop a key from the list, its group and the index
+//
+// Inputs       : z - the sizer
+//                x - the key's entry
+// Outputs      : none
+
+static void sizerForget( SG_Sizer *z, int32_t x ) {
+
+    uint32_t slot, next, home;
+
+    (*sizerGroup( z, x ))--;
+    sizerUnlink( z, x );
+
+    // Drop it from the index with a backward shift
+    slot = (uint32_t)sgCacheHash(z->nodeID[x], z->blockID[x]) & z->indexMask;
+    while ( z->index[slot] != x ) {
+        slot = (slot + 1) & z->indexMask;
+    }
+    next = (slot + 1) & z->indexMask;
+    while ( z->index[next] != SIZER_NO_ENTRY ) {
+        home = (uint32_t)sgCacheHash(z->nodeID[z->index[next]], z->blockID[z->index[next]]) & z->indexMask;
+        if ( ((next - home) & z->indexMask) >= ((next - slot) & z->indexMask) ) {
+            z->index[slot] = z->index[next];
+            slot = next;
+        }
+        next = (next + 1) & z->indexMask;
+    }
+    z->index[slot] = SIZER_NO_ENTRY;
+
+    z->next[x] = z->freeHead;
+    z->freeHead = x;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sizerUnlink
+// Description  : Take a key off the recency list
+//
+// Inputs       : z - the sizer
+//                x - the key's entry
+// Outputs      : none
+
+static void sizerUnlink( SG_Sizer *z, int32_t x ) {
+
+    if ( z->prev[x] != SIZER_NO_ENTRY ) {
+        z->next[z->prev[x]] = z->next[x];
+    } else {
+        z->head = z->next[x];
+    }
+    if ( z->next[x] != SIZER_NO_ENTRY ) {
+        z->prev[z->next[x]] = z->prev[x];
+    } else {
+        z->tail = z->prev[x];
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sizerPushFront
+// Description  : Put a key at the most recent end of the list
+//
+// Inputs       : z - the sizer
+//                x - the key's entry
+// Outputs      : none
+
+static void sizerPushFront( SG_Sizer *z, int32_t x ) {
+
+    z->prev[x] = SIZER_NO_ENTRY;
+    z->next[x] = z->head;
+    if ( z->head != SIZER_NO_ENTRY ) {
+        z->prev[z->head] = x;
+    } else {
+        z->tail = x;
+    }
+    z->head = x;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sizerGroup
+// Description  : Get the count of the group a key is in (keys of merged
+//                groups are in the oldest one)
+//
+// Inputs       : z - the sizer
+//                x - the key's entry
+// Outputs      : pointer to the group's key count
+
+static uint32_t *sizerGroup( SG_Sizer *z, int32_t x ) {
+
+    uint32_t g = (z->group[x] > z->oldest) ? z->group[x] : z->oldest;
+
+    return( &z->groups[g % SG_SIZER_BUCKETS] );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sizerNewGroup
+// Description  : Open a new newest group, merging the two oldest if every
+//                group is in use
+//
+// Inputs       : z - the sizer
+// Outputs      : none
+
+static void sizerNewGroup( SG_Sizer *z ) {
+
+    if ( z->newest + 1 - z->oldest >= SG_SIZER_BUCKETS ) {
+        z->groups[(z->oldest + 1) % SG_SIZER_BUCKETS] += z->groups[z->oldest % SG_SIZER_BUCKETS];
+        z->oldest++;
+    }
+    z->newest++;
+    z->groups[z->newest % SG_SIZER_BUCKETS] = 0;
+
+}
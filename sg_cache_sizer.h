@@ -0,0 +1,48 @@
+#ifndef SG_CACHE_SIZER_INCLUDED
+#define SG_CACHE_SIZER_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_cache_sizer.h
+//  Description    : This is the declaration of the cache sizer, which keeps
+//                   the keys of recently referenced blocks (resident ones and
+//                   ghosts of evicted ones) in recency order and estimates
+//                   the miss ratio of every cache size up to a ceiling.
+//
+//   Author        : Yinan Lang
+//   Last Modified : 10/17/2026
+//
+
+// Includes
+#include <sg_cache.h>
+
+// Defines
+#define SG_SIZER_POINTS SG_CACHE_MRC_POINTS // Cache sizes on the miss ratio curve
+#define SG_SIZER_BUCKETS 64           // Recency groups the keys are kept in
+#define SG_SIZER_SAMPLE_FACTOR 8      // Age after 8 references per tracked key
+
+// Type definitions
+typedef struct sgsizer SG_Sizer;      // Sizer instance (opaque)
+
+//
+// Sizer functions
+
+SG_Sizer *createSGSizer( uint32_t capacity );
+    // Create a sizer that remembers up to capacity keys (the largest cache
+    // size it estimates)
+
+void destroySGSizer( SG_Sizer *z );
+    // Release a sizer
+
+void sizerAccess( SG_Sizer *z, SG_Node_ID nde, SG_Block_ID blk );
+    // Count a reference to a block at its distance from the most recent
+    // end, halving the counts once a sample worth has been counted
+
+void sizerCurve( SG_Sizer *z, uint64_t *hits, uint64_t *refs );
+    // Add the references counted and, for the cache sizes (x + 1) /
+    // SG_SIZER_POINTS of the capacity, the hits an LRU cache would have got
+
+size_t sizerBytes( SG_Sizer *z );
+    // Get the memory used by a sizer
+
+#endif
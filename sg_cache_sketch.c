@@ -0,0 +1,243 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_cache_sketch.c
+//  Description    : This file contains the TinyLFU admission filter.  Block
+//                   references are counted in a count-min sketch of 4-bit
+//                   counters, SG_SKETCH_DEPTH rows of them packed sixteen to
+//                   a word.  Every counter is halved after a sample of
+//                   references so the estimates follow recent use.
+//
+//   Author        : Yinan Lang
+//   Last Modified : 10/17/2026
+//
+
+// Include Files
+#include <stdlib.h>
+#include <string.h>
+
+// Project Includes
+#include <sg_cache_sketch.h>
+#include <sg_cache_policy.h>
+
+// Defines
+#define SKETCH_COUNTERS_PER_WORD 16   // 4-bit counters in a uint64_t
+#define SKETCH_WIDTH_FACTOR 4         // Counters per row for each cached block
+#define SKETCH_MIN_WIDTH 64           // Smallest row
+#define SKETCH_HALF_MASK 0x7777777777777777ULL // Clears the bits shifted across counters
+
+// Sketch Structure
+struct sgsketch{
+
+    uint64_t *table;          // SG_SKETCH_DEPTH rows of width counters
+    uint32_t width;           // Counters per row (power of two)
+    uint32_t rowWords;        // Words per row
+    uint32_t additions;       // References counted since the last halving
+    uint32_t sampleSize;      // References between halvings
+
+};
+
+//
+// Functional Prototypes
+
+static uint32_t sketchIndex( SG_Sketch *s, uint64_t h, int row ); // Counter of a key in a row
+static uint32_t sketchGet( SG_Sketch *s, int row, uint32_t idx );  // Read a counter
+static void sketchHalve( SG_Sketch *s );                          // Age every counter
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : createSGSketch
+// Description  : Create a sketch with SKETCH_WIDTH_FACTOR counters per row
+//                for each block the cache holds
+//
+// Inputs       : maxElements - number of blocks in the cache
+// Outputs      : the sketch or NULL if failure
+
+SG_Sketch *createSGSketch( uint32_t maxElements ) {
+
+    uint64_t width = SKETCH_MIN_WIDTH;
+    SG_Sketch *s;
+
+    while ( width < (uint64_t)maxElements * SKETCH_WIDTH_FACTOR ) {
+        width <<= 1;
+    }
+
+    if ( (s = calloc(1, sizeof(SG_Sketch))) == NULL ) {
+        return( NULL );
+    }
+    s->width = (uint32_t)width;
+    s->rowWords = (uint32_t)(width / SKETCH_COUNTERS_PER_WORD);
+    s->sampleSize = (maxElements > UINT32_MAX / SG_SKETCH_SAMPLE_FACTOR) ?
+            UINT32_MAX : maxElements * SG_SKETCH_SAMPLE_FACTOR;
+    if ( (s->table = calloc((size_t)s->rowWords * SG_SKETCH_DEPTH, sizeof(uint64_t))) == NULL ) {
+        free( s );
+        return( NULL );
+    }
+
+    return( s );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : destroySGSketch
+// Description  : Release a sketch
+//
+// Inputs       : s - the sketch (NULL is ignored)
+// Outputs      : none
+
+void destroySGSketch( SG_Sketch *s ) {
+
+    if ( s != NULL ) {
+        free( s->table );
+        free( s );
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sketchRecord
+// Description  : Count a reference to a block in every row
+//
+// Inputs       : s - the sketch
+//                nde - node ID
+//                blk - block ID
+// Outputs      : none
+
+void sketchRecord( SG_Sketch *s, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    uint64_t h = sgCacheHash( nde, blk );
+    uint32_t idx;
+    int row, added = 0;
+
+    for (row = 0; row < SG_SKETCH_DEPTH; row++){
+        idx = sketchIndex( s, h, row );
+        if ( sketchGet(s, row, idx) < SG_SKETCH_MAX_COUNT ) {
+            s->table[(size_t)row * s->rowWords + idx / SKETCH_COUNTERS_PER_WORD] +=
+                    1ULL << ((idx % SKETCH_COUNTERS_PER_WORD) * 4);
+            added = 1;
+        }
+    }
+
+    if ( added && (++s->additions >= s->sampleSize) ) {
+        sketchHalve( s );
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sketchEstimate
+// Description  : Estimate a block's recent references (the smallest of its
+//                counters, which can only overcount)
+//
+// Inputs       : s - the sketch
+//                nde - node ID
+//                blk - block ID
+// Outputs      : the estimate, 0 to SG_SKETCH_MAX_COUNT
+
+uint32_t sketchEstimate( SG_Sketch *s, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    uint64_t h = sgCacheHash( nde, blk );
+    uint32_t est = SG_SKETCH_MAX_COUNT, c;
+    int row;
+
+    for (row = 0; row < SG_SKETCH_DEPTH; row++){
+        if ( (c = sketchGet(s, row, sketchIndex(s, h, row))) < est ) {
+            est = c;
+        }
+    }
+
+    return( est );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sketchAdmit
+// Description  : Admit a new block only if it is used more than the victim
+//                (ties keep the block already cached)
+//
+// Inputs       : s - the sketch
+//                nde, blk - the block being inserted
+//                vnde, vblk - the block it would evict
+// Outputs      : 1 to admit, 0 to keep the victim
+
+int sketchAdmit( SG_Sketch *s, SG_Node_ID nde, SG_Block_ID blk, SG_Node_ID vnde, SG_Block_ID vblk ) {
+
+    return( sketchEstimate(s, nde, blk) > sketchEstimate(s, vnde, vblk) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sketchBytes
+// Description  : Get the memory used by a sketch
+//
+// Inputs       : s - the sketch
+// Outputs      : bytes allocated (0 for NULL)
+
+size_t sketchBytes( SG_Sketch *s ) {
+
+    if ( s == NULL ) {
+        return( 0 );
+    }
+    return( sizeof(SG_Sketch) + (size_t)s->rowWords * SG_SKETCH_DEPTH * sizeof(uint64_t) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sketchIndex
+// Description  : Pick a key's counter in one row (double hashing on the two
+//                halves of the key hash)
+//
+// Inputs       : s - the sketch
+//                h - hash of the key
+//                row - the row
+// Outputs      : counter index within the row
+
+static uint32_t sketchIndex( SG_Sketch *s, uint64_t h, int row ) {
+
+    return( ((uint32_t)h + (uint32_t)row * ((uint32_t)(h >> 32) | 1)) & (s->width - 1) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sketchGet
+// Description  : Read one 4-bit counter
+//
+// Inputs       : s - the sketch
+//                row - the row
+//                idx - counter index within the row
+// Outputs      : the counter value
+
+static uint32_t sketchGet( SG_Sketch *s, int row, uint32_t idx ) {
+
+    return( (uint32_t)(s->table[(size_t)row * s->rowWords + idx / SKETCH_COUNTERS_PER_WORD] >>
+            ((idx % SKETCH_COUNTERS_PER_WORD) * 4)) & 0xf );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sketchHalve
+// Description  : Halve every counter, sixteen at a time
+//
+// Inputs       : s - the sketch
+// Outputs      : none
+
+static void sketchHalve( SG_Sketch *s ) {
+
+    size_t x, words = (size_t)s->rowWords * SG_SKETCH_DEPTH;
+
+    for (x = 0; x < words; x++){
+        s->table[x] = (s->table[x] >> 1) & SKETCH_HALF_MASK;
+    }
+    s->additions /= 2;
+
+}
@@ -0,0 +1,49 @@
+#ifndef SG_CACHE_SKETCH_INCLUDED
+#define SG_CACHE_SKETCH_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_cache_sketch.h
+//  Description    : This is the declaration of the TinyLFU admission filter,
+//                   a count-min sketch of recent block references that lets
+//                   a new block into a full cache only if it has been used
+//                   more often than the block it would replace.
+//
+//   Author        : Yinan Lang
+//   Last Modified : 10/17/2026
+//
+
+// Includes
+#include <sg_defs.h>
+
+// Defines
+#define SG_SKETCH_DEPTH 4             // Counters per key (one per row)
+#define SG_SKETCH_MAX_COUNT 15        // 4-bit counters saturate here
+#define SG_SKETCH_SAMPLE_FACTOR 10    // Age after 10 references per counter column
+
+// Type definitions
+typedef struct sgsketch SG_Sketch;    // Sketch instance (opaque)
+
+//
+// Sketch functions
+
+SG_Sketch *createSGSketch( uint32_t maxElements );
+    // Create a sketch sized for a cache of maxElements blocks
+
+void destroySGSketch( SG_Sketch *s );
+    // Release a sketch
+
+void sketchRecord( SG_Sketch *s, SG_Node_ID nde, SG_Block_ID blk );
+    // Count a reference to a block, halving every counter once a sample
+    // worth of references has been counted
+
+uint32_t sketchEstimate( SG_Sketch *s, SG_Node_ID nde, SG_Block_ID blk );
+    // Estimate how often a block was referenced recently
+
+int sketchAdmit( SG_Sketch *s, SG_Node_ID nde, SG_Block_ID blk, SG_Node_ID vnde, SG_Block_ID vblk );
+    // Decide whether (nde, blk) should replace the victim (vnde, vblk)
+
+size_t sketchBytes( SG_Sketch *s );
+    // Get the memory used by a sketch
+
+#endif
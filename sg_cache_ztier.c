@@ -0,0 +1,822 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_cache_ztier.c
+//  Description    : This file contains the compressed cache tier and its
+//                   codec.  Blocks are compressed with a byte oriented LZ77
+//                   (literal runs and back references, like LZ4) whose
+//                   literals are packed into 7 bits when they are all ASCII,
+//                   then stored in chunks of the smallest slab class that
+//                   fits.  Each slab page is carved into one class's chunks
+//                   and goes back to the free pages once it is empty, so the
+//                   classes follow the mix of compressed sizes.
+//
+//   Author        : Yinan Lang
+//   Last Modified : 10/17/2026
+//
+
+// Include Files
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <sg_cache_ztier.h>
+#include <sg_cache_arena.h>
+#include <sg_cache_policy.h>
+
+// Defines
+#define ZT_NO_ENTRY -1                // End of a list or chain
+#define ZT_NO_CHUNK 0xffffffffU       // No chunk
+#define ZT_EVICT_LIMIT 64             // Blocks evicted at most to make room for one
+#define ZT_MIN_MATCH 4                // Shortest back reference
+#define ZT_HASH_BITS 10               // Match finder table of 1024 positions
+#define ZT_RUN_MASK 15                // Length nibble saturates here
+#define ZT_HEADER 3                   // Flags and the sequence stream length
+#define ZT_SEQ_BOUND 2048             // Largest sequence stream of a block
+#define ZT_PACKED 0x1                 // Flag: literals packed into 7 bits
+
+// Entry Structure (one compressed block)
+struct ztentry{
+
+    SG_Node_ID nodeID;        // Node ID of the block
+    SG_Block_ID blockID;      // Block ID of the block
+    uint32_t chunk;           // Offset of its chunk in the arena
+    uint16_t length;          // Compressed bytes
+    uint64_t seq;             // Version of the block
+    uint8_t cls;              // Slab class (chunk size / SG_ZTIER_CLASS_STEP)
+    int32_t prev;             // Links in the recency list (next also chains
+    int32_t next;             //   the free entries)
+    int32_t chain;            // Next entry in the same index bucket
+
+};
+
+// Slab Page Structure
+struct ztpage{
+
+    int32_t prev;             // Links in its class's list of pages with
+    int32_t next;             //   room, or in the free pages
+    uint32_t freeChunk;       // First freed chunk, linked through the chunks
+    uint16_t used;            // Chunks in use
+    uint16_t carved;          // Chunks handed out at least once
+    uint8_t cls;              // Slab class (0 = free page)
+    uint8_t listed;           // On one of the lists
+
+};
+
+// Tier Structure
+struct sgztier{
+
+    pthread_mutex_t lock;     // Serializes the tables (not the codec)
+    SG_Arena arena;           // The slab pages
+    struct ztpage *pages;     // One per page
+    uint32_t npages;          // Number of pages
+    int32_t freePages;        // Pages not given to a class
+    int32_t partial[SG_ZTIER_CLASSES + 1]; // Per class, its pages with room
+    struct ztentry *entries;  // Entry pool
+    uint32_t nentries;        // Pool size
+    int32_t freeEntries;      // Unused entries, chained through next
+    int32_t *index;           // Hash buckets of entry chains
+    uint32_t indexMask;       // Buckets - 1 (a power of two)
+    int32_t head;             // Most recently stored entry
+    int32_t tail;             // Least recently stored entry
+    uint32_t elements;        // Memory in blocks' worth
+    uint32_t resident;        // Entries in use
+    uint64_t storedBytes;     // Compressed bytes held
+    uint64_t chunkBytes;      // Chunk bytes held
+    uint64_t incompressible;  // Blocks turned away as too big
+    uint64_t decompressions;  // Blocks decompressed (atomic)
+    uint64_t decompressNs;    // Time decompressing (atomic)
+
+};
+
+//
+// Functional Prototypes
+
+static int32_t ztFind( SG_ZTier *z, SG_Node_ID nde, SG_Block_ID blk ); // Look up a block
+static void ztDrop( SG_ZTier *z, int32_t e );                 // Free an entry and its chunk
+static uint32_t ztAlloc( SG_ZTier *z, uint8_t cls );          // Take a chunk of a class
+static void ztRelease( SG_ZTier *z, uint32_t chunk );         // Give a chunk back
+static void ztPagePush( SG_ZTier *z, int32_t *list, int32_t p ); // Put a page on a list
+static void ztPageUnlink( SG_ZTier *z, int32_t *list, int32_t p ); // Take a page off a list
+static uint32_t ztHash( const uint8_t *p );                   // Hash 4 bytes for the match finder
+static uint32_t ztPutLength( uint8_t *out, uint32_t n, uint32_t len ); // Extend a length
+static int ztGetLength( const uint8_t *in, size_t n, size_t *at, uint32_t *len ); // Read one back
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : openSGZTier
+// Description  : Create a compressed tier.  The chunk memory is one arena
+//                of elements blocks' worth of slab pages; at most
+//                SG_ZTIER_MAX_RATIO blocks per block of memory are tracked.
+//
+// Inputs       : elements - memory of the tier in blocks
+//                hugePages - try to back the pages with huge pages
+// Outputs      : the tier or NULL if failure
+
+SG_ZTier *openSGZTier( uint32_t elements, int hugePages ) {
+
+    SG_ZTier *z;
+    uint64_t buckets = 1;
+    uint32_t x;
+
+    if ( elements == 0 ) {
+        logMessage( LOG_ERROR_LEVEL, "Compressed tier needs a capacity" );
+        return( NULL );
+    }
+    if ( (z = calloc(1, sizeof(SG_ZTier))) == NULL ) {
+        logMessage( LOG_ERROR_LEVEL, "Compressed tier allocation failed" );
+        return( NULL );
+    }
+    z->elements = elements;
+    z->npages = (uint32_t)(((uint64_t)elements * SG_BLOCK_SIZE + SG_ZTIER_PAGE_BYTES - 1) / SG_ZTIER_PAGE_BYTES);
+    z->nentries = elements * SG_ZTIER_MAX_RATIO;
+    while ( buckets < z->nentries ) {
+        buckets <<= 1;
+    }
+
+    z->pages = calloc( z->npages, sizeof(struct ztpage) );
+    z->entries = calloc( z->nentries, sizeof(struct ztentry) );
+    z->index = malloc( buckets * sizeof(int32_t) );
+    if ( (z->pages == NULL) || (z->entries == NULL) || (z->index == NULL) ||
+            arenaCreate(&z->arena, (size_t)z->npages * SG_ZTIER_PAGE_BYTES, hugePages) ) {
+        logMessage( LOG_ERROR_LEVEL, "Compressed tier allocation of %u blocks failed", elements );
+        closeSGZTier( z );
+        return( NULL );
+    }
+    pthread_mutex_init( &z->lock, NULL );
+    z->indexMask = (uint32_t)(buckets - 1);
+
+    for ( x = 0; x <= z->indexMask; x++ ) {
+        z->index[x] = ZT_NO_ENTRY;
+    }
+    for ( x = 0; x <= SG_ZTIER_CLASSES; x++ ) {
+        z->partial[x] = ZT_NO_ENTRY;
+    }
+    z->freePages = ZT_NO_ENTRY;
+    for ( x = z->npages; x > 0; x-- ) {
+        ztPagePush( z, &z->freePages, (int32_t)(x - 1) );
+    }
+    for ( x = 0; x < z->nentries; x++ ) {
+        z->entries[x].next = (x + 1 < z->nentries) ? (int32_t)(x + 1) : ZT_NO_ENTRY;
+    }
+    z->freeEntries = 0;
+    z->head = ZT_NO_ENTRY;
+    z->tail = ZT_NO_ENTRY;
+
+    logMessage( LOG_INFO_LEVEL, "Compressed tier: %u pages of %u bytes, up to %u blocks",
+            z->npages, SG_ZTIER_PAGE_BYTES, z->nentries );
+    return( z );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : closeSGZTier
+// Description  : Release a compressed tier
+//
+// Inputs       : z - the tier (NULL is ignored)
+// Outputs      : none
+
+void closeSGZTier( SG_ZTier *z ) {
+
+    if ( z == NULL ) {
+        return;
+    }
+    if ( z->arena.base != NULL ) {
+        pthread_mutex_destroy( &z->lock );
+    }
+    arenaDestroy( &z->arena );
+    free( z->pages );
+    free( z->entries );
+    free( z->index );
+    free( z );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ztierPut
+// Description  : Compress a block and store it, replacing any older version.
+//                Blocks that do not compress below SG_ZTIER_MAX_STORED are
+//                not kept.  The least recently stored blocks are evicted
+//                until the block's class has a chunk, up to ZT_EVICT_LIMIT.
+//
+// Inputs       : z - the tier
+//                nde - the node ID
+//                blk - the block ID
+//                seq - the version of the block
+//                block - the block data
+// Outputs      : 0 if stored, -1 if not
+
+int ztierPut( SG_ZTier *z, SG_Node_ID nde, SG_Block_ID blk, uint64_t seq, const char *block ) {
+
+    uint8_t packed[SG_ZTIER_MAX_STORED];
+    uint32_t chunk = ZT_NO_CHUNK, n, bucket;
+    uint8_t cls;
+    int32_t e;
+    int len;
+
+    // Compress outside the lock, it is the expensive part
+    len = ztierCompress( block, packed, SG_ZTIER_MAX_STORED );
+
+    pthread_mutex_lock( &z->lock );
+    if ( (e = ztFind(z, nde, blk)) != ZT_NO_ENTRY ) {
+        ztDrop( z, e );
+    }
+    if ( len < 0 ) {
+        z->incompressible++;
+        pthread_mutex_unlock( &z->lock );
+        return( -1 );
+    }
+
+    cls = (uint8_t)((len + SG_ZTIER_CLASS_STEP - 1) / SG_ZTIER_CLASS_STEP);
+    for ( n = 0; (z->freeEntries == ZT_NO_ENTRY) || ((chunk = ztAlloc(z, cls)) == ZT_NO_CHUNK); n++ ) {
+        if ( (z->tail == ZT_NO_ENTRY) || (n == ZT_EVICT_LIMIT) ) {
+            pthread_mutex_unlock( &z->lock );
+            return( -1 );
+        }
+        ztDrop( z, z->tail );
+    }
+
+    e = z->freeEntries;
+    z->freeEntries = z->entries[e].next;
+    memcpy( z->arena.base + chunk, packed, len );
+    z->entries[e].nodeID = nde;
+    z->entries[e].blockID = blk;
+    z->entries[e].chunk = chunk;
+    z->entries[e].length = (uint16_t)len;
+    z->entries[e].seq = seq;
+    z->entries[e].cls = cls;
+
+    bucket = (uint32_t)sgCacheHash( nde, blk ) & z->indexMask;
+    z->entries[e].chain = z->index[bucket];
+    z->index[bucket] = e;
+    z->entries[e].prev = ZT_NO_ENTRY;
+    z->entries[e].next = z->head;
+    if ( z->head != ZT_NO_ENTRY ) {
+        z->entries[z->head].prev = e;
+    } else {
+        z->tail = e;
+    }
+    z->head = e;
+
+    z->resident++;
+    z->storedBytes += len;
+    z->chunkBytes += (uint64_t)cls * SG_ZTIER_CLASS_STEP;
+    pthread_mutex_unlock( &z->lock );
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ztierTake
+// Description  : Copy a block's compressed data out of the tier, drop it
+//                (the block moves back to the RAM cache) and decompress it
+//
+// Inputs       : z - the tier
+//                nde - the node ID
+//                blk - the block ID
+//                seq - set to the version of the block
+//                block - buffer for the block data
+// Outputs      : 0 if found, -1 if not (or corrupt)
+
+int ztierTake( SG_ZTier *z, SG_Node_ID nde, SG_Block_ID blk, uint64_t *seq, char *block ) {
+
+    uint8_t packed[SG_ZTIER_MAX_STORED];
+    struct timespec start, end;
+    uint16_t len;
+    int32_t e;
+    int ret;
+
+    pthread_mutex_lock( &z->lock );
+    if ( (e = ztFind(z, nde, blk)) == ZT_NO_ENTRY ) {
+        pthread_mutex_unlock( &z->lock );
+        return( -1 );
+    }
+    *seq = z->entries[e].seq;
+    len = z->entries[e].length;
+    memcpy( packed, z->arena.base + z->entries[e].chunk, len );
+    ztDrop( z, e );
+    pthread_mutex_unlock( &z->lock );
+
+    clock_gettime( CLOCK_MONOTONIC, &start );
+    ret = ztierDecompress( packed, len, block );
+    clock_gettime( CLOCK_MONOTONIC, &end );
+    __atomic_add_fetch( &z->decompressions, 1, __ATOMIC_RELAXED );
+    __atomic_add_fetch( &z->decompressNs, (uint64_t)((end.tv_sec - start.tv_sec) * 1000000000LL +
+            (end.tv_nsec - start.tv_nsec)), __ATOMIC_RELAXED );
+    if ( ret ) {
+        logMessage( LOG_ERROR_LEVEL, "Compressed tier block [%lu/%lu] is corrupt", nde, blk );
+    }
+    return( ret );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ztierContains
+// Description  : Check whether the tier holds a block
+//
+// Inputs       : z - the tier
+//                nde - the node ID
+//                blk - the block ID
+//                seq - set to the version of the block if present
+// Outputs      : 1 if present, 0 if not
+
+int ztierContains( SG_ZTier *z, SG_Node_ID nde, SG_Block_ID blk, uint64_t *seq ) {
+
+    int32_t e;
+
+    pthread_mutex_lock( &z->lock );
+    if ( (e = ztFind(z, nde, blk)) != ZT_NO_ENTRY ) {
+        *seq = z->entries[e].seq;
+    }
+    pthread_mutex_unlock( &z->lock );
+    return( e != ZT_NO_ENTRY );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ztierRemove
+// Description  : Drop a block from the tier
+//
+// Inputs       : z - the tier
+//                nde - the node ID
+//                blk - the block ID
+// Outputs      : none
+
+void ztierRemove( SG_ZTier *z, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    int32_t e;
+
+    pthread_mutex_lock( &z->lock );
+    if ( (e = ztFind(z, nde, blk)) != ZT_NO_ENTRY ) {
+        ztDrop( z, e );
+    }
+    pthread_mutex_unlock( &z->lock );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ztierInfo
+// Description  : Get the occupancy of the tier and the codec figures
+//
+// Inputs       : z - the tier
+//                info - place to put them
+// Outputs      : none
+
+void ztierInfo( SG_ZTier *z, SG_ZTier_Info *info ) {
+
+    pthread_mutex_lock( &z->lock );
+    info->elements = z->elements;
+    info->resident = z->resident;
+    info->storedBytes = z->storedBytes;
+    info->chunkBytes = z->chunkBytes;
+    info->memoryBytes = z->arena.length + (uint64_t)z->npages * sizeof(struct ztpage) +
+            (uint64_t)z->nentries * sizeof(struct ztentry) + ((uint64_t)z->indexMask + 1) * sizeof(int32_t);
+    info->incompressible = z->incompressible;
+    pthread_mutex_unlock( &z->lock );
+    info->decompressions = __atomic_load_n( &z->decompressions, __ATOMIC_RELAXED );
+    info->decompressNs = __atomic_load_n( &z->decompressNs, __ATOMIC_RELAXED );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ztierCompress
+// Description  : Compress a block.  The output is a flags byte, the length
+//                of the sequence stream, the sequence stream and the
+//                literals.  Each sequence is a token (literal run and match
+//                length nibbles, 15 meaning more length bytes follow), then
+//                for all but the last one the match offset (2 bytes).  The
+//                literals are packed 8 into 7 bytes if they are all ASCII.
+//
+// Inputs       : block - the block (SG_BLOCK_SIZE bytes)
+//                out - buffer for the compressed data
+//                cap - room in out
+// Outputs      : compressed length, -1 if it would not fit in cap
+
+int ztierCompress( const char *block, uint8_t *out, size_t cap ) {
+
+    const uint8_t *src = (const uint8_t *)block;
+    uint8_t seqs[ZT_SEQ_BOUND], lits[SG_BLOCK_SIZE], high = 0;
+    uint16_t table[1 << ZT_HASH_BITS];
+    uint32_t ip = 0, anchor = 0, ref, len, run, nseq = 0, nlit = 0, bits = 0, acc = 0, x;
+    size_t total, n;
+
+    // Greedy parse: take the match at the last position with the same hash
+    memset( table, 0, sizeof(table) );
+    for (;;) {
+        len = 0;
+        if ( ip + ZT_MIN_MATCH <= SG_BLOCK_SIZE ) {
+            x = ztHash( src + ip );
+            ref = table[x];
+            table[x] = (uint16_t)(ip + 1);
+            if ( (ref > 0) && (memcmp(src + ref - 1, src + ip, ZT_MIN_MATCH) == 0) ) {
+                ref--;
+                for ( len = ZT_MIN_MATCH; (ip + len < SG_BLOCK_SIZE) && (src[ref + len] == src[ip + len]); len++ );
+            } else {
+                ip++;
+                continue;
+            }
+        } else {
+            ip = SG_BLOCK_SIZE;
+        }
+
+        // Emit the literals since the last match, then the match (if any)
+        run = ip - anchor;
+        seqs[nseq++] = (uint8_t)(((run < ZT_RUN_MASK) ? run : ZT_RUN_MASK) << 4 |
+                ((len == 0) ? 0 : ((len - ZT_MIN_MATCH < ZT_RUN_MASK) ? len - ZT_MIN_MATCH : ZT_RUN_MASK)));
+        if ( run >= ZT_RUN_MASK ) {
+            nseq = ztPutLength( seqs, nseq, run - ZT_RUN_MASK );
+        }
+        for ( x = anchor; x < ip; x++ ) {
+            high |= src[x];
+            lits[nlit++] = src[x];
+        }
+        if ( len == 0 ) {
+            break;
+        }
+        seqs[nseq++] = (uint8_t)((ip - ref) & 0xff);
+        seqs[nseq++] = (uint8_t)((ip - ref) >> 8);
+        if ( len - ZT_MIN_MATCH >= ZT_RUN_MASK ) {
+            nseq = ztPutLength( seqs, nseq, len - ZT_MIN_MATCH - ZT_RUN_MASK );
+        }
+        ip += len;
+        anchor = ip;
+    }
+
+    total = ZT_HEADER + nseq + ((high & 0x80) ? nlit : (nlit * 7 + 7) / 8);
+    if ( total > cap ) {
+        return( -1 );
+    }
+    out[0] = (high & 0x80) ? 0 : ZT_PACKED;
+    out[1] = (uint8_t)(nseq & 0xff);
+    out[2] = (uint8_t)(nseq >> 8);
+    memcpy( out + ZT_HEADER, seqs, nseq );
+    n = ZT_HEADER + nseq;
+    if ( high & 0x80 ) {
+        memcpy( out + n, lits, nlit );
+        return( (int)total );
+    }
+    for ( x = 0; x < nlit; x++ ) {
+        acc |= (uint32_t)lits[x] << bits;
+        bits += 7;
+        if ( bits >= 8 ) {
+            out[n++] = (uint8_t)(acc & 0xff);
+            acc >>= 8;
+            bits -= 8;
+        }
+    }
+    if ( bits > 0 ) {
+        out[n++] = (uint8_t)acc;
+    }
+    return( (int)total );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ztierDecompress
+// Description  : Expand a block compressed by ztierCompress, checking every
+//                length and offset against the input and the block
+//
+// Inputs       : in - the compressed data
+//                len - its length
+//                block - buffer for the block (SG_BLOCK_SIZE bytes)
+// Outputs      : 0 if successful, -1 if the data is corrupt
+
+int ztierDecompress( const uint8_t *in, size_t len, char *block ) {
+
+    uint8_t *dst = (uint8_t *)block, token, plain[SG_BLOCK_SIZE];
+    const uint8_t *seqs, *lits;
+    size_t nseq, nlit, s = 0, l = 0, g;
+    uint32_t op = 0, run, mlen, off, x;
+    uint64_t v;
+
+    if ( len < ZT_HEADER ) {
+        return( -1 );
+    }
+    nseq = (size_t)in[1] | ((size_t)in[2] << 8);
+    if ( ZT_HEADER + nseq > len ) {
+        return( -1 );
+    }
+    seqs = in + ZT_HEADER;
+    lits = seqs + nseq;
+    nlit = len - ZT_HEADER - nseq;
+
+    // Unpack 7 bit literals up front, 8 from every 7 bytes
+    if ( in[0] & ZT_PACKED ) {
+        for ( g = 0; (g * 7 < nlit) && (g * 8 < SG_BLOCK_SIZE); g++ ) {
+            for ( v = 0, x = 0; x < 7; x++ ) {
+                v |= (uint64_t)((g * 7 + x < nlit) ? lits[g * 7 + x] : 0) << (x * 8);
+            }
+            for ( x = 0; x < 8; x++ ) {
+                plain[g * 8 + x] = (uint8_t)((v >> (x * 7)) & 0x7f);
+            }
+        }
+        nlit = (nlit * 8 / 7 < SG_BLOCK_SIZE) ? nlit * 8 / 7 : SG_BLOCK_SIZE;
+        lits = plain;
+    }
+
+    while ( s < nseq ) {
+
+        token = seqs[s++];
+        run = token >> 4;
+        if ( (run == ZT_RUN_MASK) && ztGetLength(seqs, nseq, &s, &run) ) {
+            return( -1 );
+        }
+        if ( run > SG_BLOCK_SIZE - op ) {
+            return( -1 );
+        }
+        if ( run > nlit - l ) {
+            return( -1 );
+        }
+        memcpy( dst + op, lits + l, run );
+        l += run;
+        op += run;
+
+        // The last sequence is literals only
+        if ( s == nseq ) {
+            break;
+        }
+        if ( s + 2 > nseq ) {
+            return( -1 );
+        }
+        off = (uint32_t)seqs[s] | ((uint32_t)seqs[s + 1] << 8);
+        s += 2;
+        mlen = token & ZT_RUN_MASK;
+        if ( (mlen == ZT_RUN_MASK) && ztGetLength(seqs, nseq, &s, &mlen) ) {
+            return( -1 );
+        }
+        mlen += ZT_MIN_MATCH;
+        if ( (off == 0) || (off > op) || (mlen > SG_BLOCK_SIZE - op) ) {
+            return( -1 );
+        }
+
+        // A match overlapping what it copies repeats it, so once a whole
+        // period is copied the source can reach back twice as far
+        while ( mlen > 0 ) {
+            x = (off < mlen) ? off : mlen;
+            memcpy( dst + op, dst + op - off, x );
+            op += x;
+            mlen -= x;
+            off += x;
+        }
+
+    }
+    return( (op == SG_BLOCK_SIZE) ? 0 : -1 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ztFind
+// Description  : Find the entry of a block (lock held)
+//
+// Inputs       : z - the tier
+//                nde - the node ID
+//                blk - the block ID
+// Outputs      : the entry or ZT_NO_ENTRY
+
+static int32_t ztFind( SG_ZTier *z, SG_Node_ID nde, SG_Block_ID blk ) {
+
+    int32_t e = z->index[(uint32_t)sgCacheHash(nde, blk) & z->indexMask];
+
+    while ( (e != ZT_NO_ENTRY) && ((z->entries[e].blockID != blk) || (z->entries[e].nodeID != nde)) ) {
+        e = z->entries[e].chain;
+    }
+    return( e );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ztDrop
+// Description  : Remove an entry from the index and recency list and free
+//                it and its chunk (lock held)
+//
+// Inputs       : z - the tier
+//                e - the entry
+// Outputs      : none
+
+static void ztDrop( SG_ZTier *z, int32_t e ) {
+
+    struct ztentry *t = &z->entries[e];
+    int32_t *link = &z->index[(uint32_t)sgCacheHash(t->nodeID, t->blockID) & z->indexMask];
+
+    while ( *link != e ) {
+        link = &z->entries[*link].chain;
+    }
+    *link = t->chain;
+    if ( t->prev != ZT_NO_ENTRY ) {
+        z->entries[t->prev].next = t->next;
+    } else {
+        z->head = t->next;
+    }
+    if ( t->next != ZT_NO_ENTRY ) {
+        z->entries[t->next].prev = t->prev;
+    } else {
+        z->tail = t->prev;
+    }
+
+    ztRelease( z, t->chunk );
+    z->resident--;
+    z->storedBytes -= t->length;
+    z->chunkBytes -= (uint64_t)t->cls * SG_ZTIER_CLASS_STEP;
+    t->next = z->freeEntries;
+    z->freeEntries = e;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ztAlloc
+// Description  : Take a chunk of a slab class, from a page of the class with
+//                room or else a free page given to the class (lock held)
+//
+// Inputs       : z - the tier
+//                cls - the slab class
+// Outputs      : the chunk's offset in the arena, ZT_NO_CHUNK if none
+
+static uint32_t ztAlloc( SG_ZTier *z, uint8_t cls ) {
+
+    uint32_t size = (uint32_t)cls * SG_ZTIER_CLASS_STEP, chunk;
+    int32_t p = z->partial[cls];
+    struct ztpage *pg;
+
+    if ( p == ZT_NO_ENTRY ) {
+        if ( (p = z->freePages) == ZT_NO_ENTRY ) {
+            return( ZT_NO_CHUNK );
+        }
+        ztPageUnlink( z, &z->freePages, p );
+        z->pages[p].cls = cls;
+        z->pages[p].used = 0;
+        z->pages[p].carved = 0;
+        z->pages[p].freeChunk = ZT_NO_CHUNK;
+        ztPagePush( z, &z->partial[cls], p );
+    }
+    pg = &z->pages[p];
+
+    if ( pg->freeChunk != ZT_NO_CHUNK ) {
+        chunk = pg->freeChunk;
+        memcpy( &pg->freeChunk, z->arena.base + chunk, sizeof(uint32_t) );
+    } else {
+        chunk = (uint32_t)p * SG_ZTIER_PAGE_BYTES + pg->carved * size;
+        pg->carved++;
+    }
+    pg->used++;
+    if ( (pg->freeChunk == ZT_NO_CHUNK) && ((pg->carved + 1) * size > SG_ZTIER_PAGE_BYTES) ) {
+        ztPageUnlink( z, &z->partial[cls], p );
+    }
+    return( chunk );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ztRelease
+// Description  : Give a chunk back to its page; an empty page goes back to
+//                the free pages for any class (lock held)
+//
+// Inputs       : z - the tier
+//                chunk - the chunk's offset in the arena
+// Outputs      : none
+
+static void ztRelease( SG_ZTier *z, uint32_t chunk ) {
+
+    int32_t p = (int32_t)(chunk / SG_ZTIER_PAGE_BYTES);
+    struct ztpage *pg = &z->pages[p];
+
+    memcpy( z->arena.base + chunk, &pg->freeChunk, sizeof(uint32_t) );
+    pg->freeChunk = chunk;
+    if ( --pg->used == 0 ) {
+        if ( pg->listed ) {
+            ztPageUnlink( z, &z->partial[pg->cls], p );
+        }
+        pg->cls = 0;
+        ztPagePush( z, &z->freePages, p );
+    } else if ( ! pg->listed ) {
+        ztPagePush( z, &z->partial[pg->cls], p );
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ztPagePush
+// Description  : Put a page at the front of a page list
+//
+// Inputs       : z - the tier
+//                list - the list head
+//                p - the page
+// Outputs      : none
+
+static void ztPagePush( SG_ZTier *z, int32_t *list, int32_t p ) {
+
+    z->pages[p].prev = ZT_NO_ENTRY;
+    z->pages[p].next = *list;
+    if ( *list != ZT_NO_ENTRY ) {
+        z->pages[*list].prev = p;
+    }
+    *list = p;
+    z->pages[p].listed = 1;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ztPageUnlink
+// Description  : Take a page off a page list
+//
+// Inputs       : z - the tier
+//                list - the list head
+//                p - the page
+// Outputs      : none
+
+static void ztPageUnlink( SG_ZTier *z, int32_t *list, int32_t p ) {
+
+    if ( z->pages[p].prev != ZT_NO_ENTRY ) {
+        z->pages[z->pages[p].prev].next = z->pages[p].next;
+    } else {
+        *list = z->pages[p].next;
+    }
+    if ( z->pages[p].next != ZT_NO_ENTRY ) {
+        z->pages[z->pages[p].next].prev = z->pages[p].prev;
+    }
+    z->pages[p].listed = 0;
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ztHash
+// Description  : Hash the 4 bytes at a position for the match finder
+//
+// Inputs       : p - the bytes
+// Outputs      : a ZT_HASH_BITS bit hash
+
+static uint32_t ztHash( const uint8_t *p ) {
+
+    uint32_t v;
+
+    memcpy( &v, p, sizeof(v) );
+    return( (v * 2654435761U) >> (32 - ZT_HASH_BITS) );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ztPutLength
+// Description  : Write the part of a length past its token nibble, as 255s
+//                and a final byte below 255
+//
+// Inputs       : out - the sequence stream
+//                n - bytes in it so far
+//                len - the length left over
+// Outputs      : bytes in the stream after the length
+
+static uint32_t ztPutLength( uint8_t *out, uint32_t n, uint32_t len ) {
+
+    while ( len >= 255 ) {
+        out[n++] = 255;
+        len -= 255;
+    }
+    out[n++] = (uint8_t)len;
+    return( n );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : ztGetLength
+// Description  : Read the part of a length past its token nibble
+//
+// Inputs       : in - the sequence stream
+//                n - its length
+//                at - position in it, advanced past the length
+//                len - the length, added to
+// Outputs      : 0 if successful, -1 if the stream ends first
+
+static int ztGetLength( const uint8_t *in, size_t n, size_t *at, uint32_t *len ) {
+
+    uint8_t b;
+
+    do {
+        if ( *at >= n ) {
+            return( -1 );
+        }
+        b = in[(*at)++];
+        *len += b;
+    } while ( (b == 255) && (*len <= SG_BLOCK_SIZE) );
+    return( 0 );
+
+}
@@ -0,0 +1,75 @@
+#ifndef SG_CACHE_ZTIER_INCLUDED
+#define SG_CACHE_ZTIER_INCLUDED
+
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_cache_ztier.h
+//  Description    : This is the declaration of the compressed cache tier,
+//                   which keeps blocks evicted from the RAM cache compressed
+//                   in slab classes of chunk sizes, so a given amount of
+//                   memory holds more of them.
+//
+//   Author        : Yinan Lang
+//   Last Modified : 10/17/2026
+//
+
+// Includes
+#include <sg_defs.h>
+
+// Defines
+#define SG_ZTIER_CLASS_STEP 32        // Chunk sizes are multiples of this
+#define SG_ZTIER_MAX_STORED 992       // Largest compressed block worth keeping
+#define SG_ZTIER_CLASSES (SG_ZTIER_MAX_STORED / SG_ZTIER_CLASS_STEP) // Slab classes
+#define SG_ZTIER_PAGE_BYTES 4096      // Slab page, carved into one class's chunks
+#define SG_ZTIER_MAX_RATIO 4          // Most blocks held per block of memory
+
+// Type definitions
+typedef struct sgztier SG_ZTier;      // Tier instance (opaque)
+
+// Compressed Tier Information
+typedef struct {
+    uint32_t elements;        // Memory in blocks' worth
+    uint32_t resident;        // Blocks held
+    uint64_t storedBytes;     // Their compressed size
+    uint64_t chunkBytes;      // Chunk space they take (sizes rounded to classes)
+    uint64_t memoryBytes;     // Chunk memory plus the tier's tables
+    uint64_t incompressible;  // Blocks not kept, too big compressed
+    uint64_t decompressions;  // Blocks decompressed
+    uint64_t decompressNs;    // Time spent decompressing them
+} SG_ZTier_Info;
+
+//
+// Tier functions
+
+SG_ZTier *openSGZTier( uint32_t elements, int hugePages );
+    // Create a tier with elements blocks' worth of chunk memory
+
+void closeSGZTier( SG_ZTier *z );
+    // Release a tier
+
+int ztierPut( SG_ZTier *z, SG_Node_ID nde, SG_Block_ID blk, uint64_t seq, const char *block );
+    // Compress and store a block, evicting the least recently stored
+    // blocks for room (-1 if it was not kept)
+
+int ztierTake( SG_ZTier *z, SG_Node_ID nde, SG_Block_ID blk, uint64_t *seq, char *block );
+    // Decompress and drop a block and its version (-1 if absent)
+
+int ztierContains( SG_ZTier *z, SG_Node_ID nde, SG_Block_ID blk, uint64_t *seq );
+    // Check for a block, getting its version
+
+void ztierRemove( SG_ZTier *z, SG_Node_ID nde, SG_Block_ID blk );
+    // Drop a block
+
+void ztierInfo( SG_ZTier *z, SG_ZTier_Info *info );
+    // Get the occupancy and codec figures
+
+//
+// Codec functions
+
+int ztierCompress( const char *block, uint8_t *out, size_t cap );
+    // Compress a block into at most cap bytes (-1 if it does not fit)
+
+int ztierDecompress( const uint8_t *in, size_t len, char *block );
+    // Expand a compressed block (-1 if the data is corrupt)
+
+#endif
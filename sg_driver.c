@@ -14,9 +14,26 @@
 // Project Includes
 #include <sg_driver.h>
 #include <sg_service.h>
+#include <sg_cache.h>
 #include <string.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <pthread.h>
 
 // Defines
+#define SG_READAHEAD_MAX 8        // Largest read-ahead window (blocks)
+#define SG_READAHEAD_RUN 2        // Sequential blocks before reading ahead
+#define SG_FILE_TABLE_INITIAL 64  // Handles (and files) before the tables grow
+#define SG_BLOCK_MAP_INITIAL 4    // Blocks in a file's first block map
+#define SG_ASYNC_READ 0           // Queued request kinds
+#define SG_ASYNC_WRITE 1
+#define SG_ASYNC_WILLNEED 2       //   (fetch blocks, no completion)
+#define SG_HANDLE_SLOT_BITS 20    // Low handle bits index files, the rest
+                                  //   count how often the slot was reused
+#define SG_HANDLE_SLOT_MASK ((1 << SG_HANDLE_SLOT_BITS) - 1)
+#define SG_HANDLE_GEN_MASK (INT32_MAX >> SG_HANDLE_SLOT_BITS)
+#define SG_FILE(fh) (files[(fh) & SG_HANDLE_SLOT_MASK]) // Open file of a valid handle
+
 //
 // File system interface implementation
 
@@ -24,14 +41,79 @@
 
 struct archive{
 
-    SgFHandle fhandle;           // Filehandle
+    SgFHandle fhandle;           // Filehandle (-1 while closed)
     int status;                  // Open or closed
-    char *addr;                  // Where it is located
-    SG_Block_ID blocks[999];     // List of blocks
+    char *addr;                  // Where it is located (own copy)
+    int id;                      // File number, fixed for the file's life
+                                 //   (the cache keeps its blocks under it)
+    SG_Block_ID *blocks;         // List of blocks
     int blockcount;              // # of blocks
-    SG_Node_ID nodeID[999];      // Node ID
+    int blockcap;                // Room in blocks and nodeID
+    SG_Node_ID *nodeID;          // Node ID
     int size;                    // File size
     int pos;                     // Read / Write position
+    int raLast;                  // Block of the last read (-1 none)
+    int raRun;                   // Consecutive blocks read in order
+    int raWindow;                // Read-ahead window (blocks, 0 off)
+    int raAhead;                 // Furthest block read ahead (-1 none)
+    int advice;                  // Access pattern (SG_ADVICE_NORMAL,
+                                 //   _SEQUENTIAL or _RANDOM)
+    int nrFirst;                 // Blocks read once, not kept in the
+    int nrLast;                  //   cache (-1 none)
+    struct archive *pathNext;    // Next file in the same path bucket
+    pthread_rwlock_t lock;       // Shared while the file is read, alone to
+                                 //   change its blocks or size (writes, close)
+
+};
+
+// Block Segment Structure (one block's part of a range)
+
+struct segment{
+
+    int blk;                     // Block (index in the file)
+    size_t off;                  // Offset in the block
+    size_t len;                  // Length of the segment
+    char *buf;                   // The caller's data for it
+    int order;                   // Place in the request
+
+};
+
+// Async Request Structure
+
+struct asyncrequest{
+
+    int token;                   // Handed back to the caller
+    SgFHandle fh;                // File
+    char *buf;                   // The caller's data
+    size_t len;                  // Length of the transfer
+    size_t off;                  // Offset in the file
+    int first;                   // Blocks it reads or writes (WILLNEED:
+    int last;                    //   fetches), blocking calls on them wait
+    int op;                      // SG_ASYNC_READ, _WRITE or _WILLNEED
+    int result;                  // Bytes transferred, -1 if failure
+    int next;                    // Next slot in its queue (-1 none)
+
+};
+
+// Async Queue Structure (slots move free -> submitted -> done -> free)
+
+struct asyncqueue{
+
+    pthread_mutex_t lock;        // Protects the queues and counts
+    pthread_cond_t work;         // Signalled on submission or stop
+    pthread_cond_t done;         // Signalled on completion
+    struct asyncrequest *reqs;   // depth slots (NULL until first use)
+    int depth;                   // Queue depth
+    int freeList;                // Unused slots
+    int subHead, subTail;        // Submitted, oldest first
+    int doneHead, doneTail;      // Finished, not collected yet
+    int active;                  // Slot being run (-1 none)
+    int outstanding;             // Slots in use
+    int pending;                 // Submitted or running
+    int nextToken;               // Token of the next request
+    int running;                 // I/O thread started
+    int stop;                    // I/O thread told to finish
+    pthread_t worker;            // The I/O thread
 
 };
 
@@ -41,16 +123,35 @@ struct nodeArray{
 
     SG_Node_ID nodeID;           // Node ID
     SG_SeqNum rseq;              // Remote Sequence #
+    uint64_t epoch;              // Bumped when its cached blocks go stale
 
 };
 
 // Global Variables
 
-struct archive files[999];
-int filecount = 0;
+struct archive **files = NULL;    // Open files, by handle slot (NULL if free)
+int filecount = 0;                // Handle slots handed out so far
+int filecap = 0;                  // Room in files
+int *freeHandles = NULL;          // Closed handles, their slots reused first
+int freecount = 0;                // # of free handles
+struct archive **archives = NULL; // Every file opened, by file number
+int archivecount = 0;             // # of files
+int archivecap = 0;               // Room in archives
+struct archive **pathIndex = NULL; // Files by hashed path
+int pathbuckets = 0;              // # of path buckets
 struct nodeArray nArray[999];
 int nodecount = 0;
 SG_SeqNum remote = SG_INITIAL_SEQNO;
+int sgWriteBack = 0;              // Hold writes in the cache until flushed
+int sgReadAheadMax = 0;           // Read-ahead window limit (blocks)
+int sgWillNeedMax = 0;            // Most blocks fetched for one WILLNEED
+int sgClosePolicy = SG_CACHE_CLOSE_FLUSH; // What sgclose does with the file's blocks
+uint32_t sgCloseGrace = 0;        // How long a kept file's blocks stay hot (ms)
+pthread_mutex_t sgDriverLock = PTHREAD_MUTEX_INITIALIZER; // File tables, positions and read-ahead
+pthread_mutex_t sgBusLock = PTHREAD_MUTEX_INITIALIZER;    // One packet exchange at a time, in order
+pthread_mutex_t sgNodeLock = PTHREAD_MUTEX_INITIALIZER;   // Node table (read by the cache under its shard locks)
+struct asyncqueue sgAsync = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+        PTHREAD_COND_INITIALIZER, NULL, SG_ASYNC_DEPTH, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0, 0 };
 
 
 // Driver file entry
@@ -63,11 +164,38 @@ SG_SeqNum sgLocalSeqno;           // The local sequence number
 // Driver support functions
 int searchFh ( SgFHandle fh );                          // Search for the filehandle 
 int sgInitEndpoint( void );                             // Initialize the endpoint
-int sgCblock( SgFHandle fh, char *buf, size_t len );    // Create a new block
-int sgOblock( SgFHandle fh, char *buf, size_t len );    // Obtain a block
-int sgUblock( SgFHandle fh, char *buf, size_t len );    // Update a block
+int sgCblock( struct archive *file, char *buf, size_t len ); // Create a new block
+struct archive *sgNewArchive( const char *path );       // Add a file
+SgFHandle sgNewHandle( struct archive *file );          // Give a file a handle
+struct archive *sgFindPath( const char *path );         // Look up a file by path
+int sgIndexPath( struct archive *file );                // Add a file to the path index
+uint32_t sgPathHash( const char *path );                // Hash a path
+int sgGrowBlocks( struct archive *file );               // Room for one more block
+struct archive *sgLockFile( SgFHandle fh, int write );  // Find an open file, lock its blocks
+int sgRange( struct archive *file, char *buf, size_t pos, size_t len, int write, int ahead ); // Read or write across blocks
+int sgVector( SgFHandle fh, const struct iovec *iov, int iovcnt, int write ); // Buffers at the position
+int sgRanges( struct archive *file, const SG_Range *ranges, int count, int write, int ahead ); // Several ranges, one pass
+int sgSegmentCompare( const void *a, const void *b );   // Order segments by block
+int sgBlockSegments( struct archive *file, struct segment *segs, int n, int write, int ahead ); // One block's segments
+int sgAsyncSubmit( SgFHandle fh, char *buf, size_t len, size_t off, int first, int last, int op ); // Queue a request
+void *sgAsyncWorker( void *arg );                       // Run queued requests
+int sgAsyncCollect( SG_Completion *done, int min, int max ); // Take finished requests
+void sgAsyncDrain( SgFHandle fh, size_t off, size_t len, int write ); // Wait for queued requests on a range
+int sgAsyncConflict( SgFHandle fh, size_t first, size_t last, int write ); // Check for one
+void sgAsyncStop( void );                               // Stop the I/O thread
+int sgWillNeed( struct archive *file, int first, int last ); // Fetch blocks not cached
+int sgFlushFile( struct archive *file );                // Write back a file's dirty blocks
+int sgOblock( struct archive *file, int blk, char *buf, size_t off, size_t len, int ahead ); // Obtain part of a block
+int sgUblock( struct archive *file, int blk, char *buf, size_t off, size_t len ); // Update part of a block
+int sgFetchBlock( SG_Node_ID nid, SG_Block_ID bid, char *data ); // Obtain a whole block
+int sgFlushBlock( SG_Node_ID nid, SG_Block_ID bid, char *data ); // Write a whole block back
+void sgReadAhead( struct archive *file, int blk );      // Prefetch after a read of block blk
+void sgCacheResized( uint32_t maxElements );            // Size prefetching to the cache
+int sgNoReuse( struct archive *file, int blk );         // Check if a block is read once
 int updateRseq ( SG_Node_ID nid, SG_SeqNum s );         // Update Remote Sequence #
 SG_SeqNum getLastRseq ( SG_Node_ID nid);                // Get the Last used Remote Sequence #
+uint64_t getNodeEpoch ( SG_Node_ID nid );               // Get the node's epoch
+void sgNewEpoch ( SG_Node_ID nid );                     // Stop trusting a node's cached blocks
 
 //
 // Functions
@@ -75,7 +203,8 @@ SG_SeqNum getLastRseq ( SG_Node_ID nid);                // Get the Last used Rem
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : sgopen
-// Description  : Open the file for for reading and writing
+// Description  : Open the file for for reading and writing; a path opened
+//                before gets its file back (found by name, not pointer)
 //
 // Inputs       : path - the path/filename of the file to be read
 // Outputs      : file handle if successful test, -1 if failure
@@ -83,16 +212,43 @@ SG_SeqNum getLastRseq ( SG_Node_ID nid);                // Get the Last used Rem
 SgFHandle sgopen (const char *path) {
 
     SgFHandle refh;             // The filehandle for return
+    struct archive *file;       // The file opened
+    SG_Cache_Config cfg;        // Cache configuration
+
+    // The tables change one call at a time
+    pthread_mutex_lock(&sgDriverLock);
 
     // First check to see if we have been initialized
     if (!sgDriverInitialized) {
 
-        // Initialize Cache
-            initSGCache(32);
+        // Initialize Cache (size from SG_CACHE_ELEMENTS or sg_sim -c)
+        if ( initSGCache(SG_CACHE_CONFIGURED) ) {
+            logMessage( LOG_ERROR_LEVEL, "sgopen: Scatter/Gather cache initialization failed." );
+            pthread_mutex_unlock(&sgDriverLock);
+            return( -1 );
+        }
+
+        // Dirty blocks leave the cache through an update to their node
+        getSGCacheConfig( &cfg );
+        sgWriteBack = cfg.writeBack;
+        setSGCacheFlushHandler( sgFlushBlock );
+
+        // Cached blocks are tagged with their node's remote sequence number
+        setSGCacheVersionHandler( getNodeEpoch );
+
+        // Read-ahead and WILLNEED are held to a part of the cache, again
+        // whenever it is resized
+        sgCacheResized( cfg.maxElements );
+        setSGCacheResizeHandler( sgCacheResized );
+
+        // Closed files give up their blocks to the open ones
+        sgClosePolicy = cfg.closePolicy;
+        sgCloseGrace = cfg.closeGraceMs;
 
         // Call the endpoint initialization 
         if ( sgInitEndpoint() ) {
             logMessage( LOG_ERROR_LEVEL, "sgopen: Scatter/Gather endpoint initialization failed." );
+            pthread_mutex_unlock(&sgDriverLock);
             return( -1 );
         }
 
@@ -101,34 +257,49 @@ SgFHandle sgopen (const char *path) {
 
     }
 
-    for (int x = 0; x < filecount; x++){
+    // Already open, start it over from the front
+    if (((file = sgFindPath(path)) != NULL) && (file->status == 1)){
+        file->pos = 0;
+        refh = file->fhandle;
+        pthread_mutex_unlock(&sgDriverLock);
+        return( refh );
+    }
 
-        if (files[filecount].addr == path){
-            files[filecount].pos = 0;
-            return files[filecount].fhandle;
-        }
+    if (file != NULL){
 
-    }
+        // Opened again, with its blocks where it left them
+        if ((refh = sgNewHandle(file)) == -1){
+            logMessage( LOG_ERROR_LEVEL, "sgopen: no handle left to open %s", path );
+            pthread_mutex_unlock(&sgDriverLock);
+            return( -1 );
+        }
+        openSGCacheFile( file->id );
 
-    for(int x = 0; x < 999; x++){
+    } else {
 
-        files[filecount].blocks[x] = 0;
-        nArray[x].rseq = SG_INITIAL_SEQNO;
-        nArray[x].nodeID = 0;
+        // Add the file and give it a handle (a closed one if there is one)
+        if ( ((file = sgNewArchive(path)) == NULL) || ((refh = sgNewHandle(file)) == -1) ) {
+            logMessage( LOG_ERROR_LEVEL, "sgopen: no room to open %s", path );
+            pthread_mutex_unlock(&sgDriverLock);
+            return( -1 );
+        }
+        file->size = 0;
 
     }
 
     // Initialize the structure
-    refh = filecount;
-    files[filecount].fhandle = filecount;
-    files[filecount].size = 0;
-    files[filecount].addr = path;
-    files[filecount].status = 1;
-    files[filecount].pos = 0;
-    files[filecount].blockcount = 0;
-    filecount++;
+    file->status = 1;
+    file->pos = 0;
+    file->raLast = -1;
+    file->raRun = 0;
+    file->raWindow = 0;
+    file->raAhead = -1;
+    file->advice = SG_ADVICE_NORMAL;
+    file->nrFirst = -1;
+    file->nrLast = -1;
     
     // Return the file handle 
+    pthread_mutex_unlock(&sgDriverLock);
     return( refh );
 }
 
@@ -144,26 +315,39 @@ SgFHandle sgopen (const char *path) {
 
 int sgread (SgFHandle fh, char *buf, size_t len) {
 
-    // Check if filehandle is bad
-    if (searchFh(fh) == 0){
-        return -1;
-    }
+    struct archive *file;
+    size_t pos;
+    int ret;
 
-    // Check if the file is opened
-    if (files[fh].status == 0){
+    // Queued writes and prefetches of the file go first, then the file is
+    // read alongside other readers
+    sgAsyncDrain(fh, 0, SIZE_MAX, 0);
+    if ((file = sgLockFile(fh, 0)) == NULL){
         return -1;
     }
 
     // Check if the pointer is at the end of the file
-    if (files[fh].pos == files[fh].size){
+    pthread_mutex_lock(&sgDriverLock);
+    pos = file->pos;
+    pthread_mutex_unlock(&sgDriverLock);
+    if (pos >= (size_t)file->size){
+        pthread_rwlock_unlock(&file->lock);
         return -1;
     }
-    
-    sgOblock(fh, buf, len);
-    files[fh].pos = files[fh].pos + len;
+
+    // Read up to the end of the file, a block at a time
+    if (len > file->size - pos){
+        len = file->size - pos;
+    }
+    if ((ret = sgRange(file, buf, pos, len, 0, 1)) > 0){
+        pthread_mutex_lock(&sgDriverLock);
+        file->pos = pos + ret;
+        pthread_mutex_unlock(&sgDriverLock);
+    }
 
     // Return the bytes processed
-    return( len );
+    pthread_rwlock_unlock(&file->lock);
+    return( ret );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -178,43 +362,315 @@ int sgread (SgFHandle fh, char *buf, size_t len) {
 
 int sgwrite (SgFHandle fh, char *buf, size_t len) {
 
-    // Check if filehandle is bad
-    if (searchFh(fh) == 0){
+    struct archive *file;
+    size_t pos;
+    int ret;
+
+    // Queued requests on the file go first, then one writer at a time
+    sgAsyncDrain(fh, 0, SIZE_MAX, 1);
+    if ((file = sgLockFile(fh, 1)) == NULL){
         return -1;
     }
+    pthread_mutex_lock(&sgDriverLock);
+    pos = file->pos;
+    pthread_mutex_unlock(&sgDriverLock);
 
-    // Check if the file is opened
-    if (files[fh].status == 0){
+    // Update the blocks the write covers, creating those past the end
+    if ((ret = sgRange(file, buf, pos, len, 1, 0)) < 0){
+        pthread_rwlock_unlock(&file->lock);
         return -1;
     }
+    pthread_mutex_lock(&sgDriverLock);
+    file->pos = pos + ret;
+    pthread_mutex_unlock(&sgDriverLock);
+    if (pos + ret > (size_t)file->size){
+        file->size = pos + ret;
+    }
 
-    if (files[fh].pos == files[fh].size){
+    // Log the write, return bytes written
+    pthread_rwlock_unlock(&file->lock);
+    return( ret );
+}
 
-        if (files[fh].pos % 1024 == 0){
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgpread
+// Description  : Read data from the file at an offset, leaving the file
+//                position alone (so readers do not contend for it)
+//
+// Inputs       : fh - file handle for the file to read from
+//                buf - place to put the data
+//                len - the length of the read
+//                off - offset in the file to read at
+// Outputs      : number of bytes read (0 at the end of the file), -1 if
+//                failure
 
-            sgCblock(fh, buf, len);
-            files[fh].size = files[fh].size + len;
-            files[fh].pos = files[fh].pos + len;
+int sgpread (SgFHandle fh, char *buf, size_t len, size_t off) {
 
-        }
-        else{
+    struct archive *file;
+    int ret;
 
-            sgUblock(fh, buf, len);
-            files[fh].size = files[fh].size + len;
-            files[fh].pos = files[fh].pos + len;
+    // Queued writes and prefetches of these blocks go first, then the
+    // file is read alongside other readers
+    sgAsyncDrain(fh, off, len, 0);
+    if ((file = sgLockFile(fh, 0)) == NULL){
+        return -1;
+    }
 
-        }
+    // Read up to the end of the file
+    if (off >= (size_t)file->size){
+        pthread_rwlock_unlock(&file->lock);
+        return( 0 );
+    }
+    if (len > file->size - off){
+        len = file->size - off;
     }
-    else{
 
-            sgUblock(fh, buf, len);
-            files[fh].size = files[fh].size + len;
-            files[fh].pos = files[fh].pos + len;
-  
-        }
+    // Readers at offsets do not feed the read-ahead, which follows one
+    // reader through the file
+    ret = sgRange(file, buf, off, len, 0, 0);
+    pthread_rwlock_unlock(&file->lock);
+    return( ret );
+}
 
-    // Log the write, return bytes written
-    return( len );
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgpwrite
+// Description  : Write data to the file at an offset, leaving the file
+//                position alone
+//
+// Inputs       : fh - file handle for the file to write to
+//                buf - pointer to data to write
+//                len - the length of the write
+//                off - offset in the file to write at (at most its size)
+// Outputs      : number of bytes written, -1 if failure
+
+int sgpwrite (SgFHandle fh, char *buf, size_t len, size_t off) {
+
+    struct archive *file;
+    int ret;
+
+    // Queued requests on these blocks go first, then one writer at a time
+    sgAsyncDrain(fh, off, len, 1);
+    if ((file = sgLockFile(fh, 1)) == NULL){
+        return -1;
+    }
+
+    // Check the write leaves no hole
+    if (off > (size_t)file->size){
+        pthread_rwlock_unlock(&file->lock);
+        return -1;
+    }
+
+    if ((ret = sgRange(file, buf, off, len, 1, 0)) < 0){
+        pthread_rwlock_unlock(&file->lock);
+        return -1;
+    }
+    if ((int)off + ret > file->size){
+        file->size = off + ret;
+    }
+
+    pthread_rwlock_unlock(&file->lock);
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgreadv
+// Description  : Read data from the file into several buffers, filling each
+//                in turn from the current position
+//
+// Inputs       : fh - file handle for the file to read from
+//                iov - the buffers
+//                iovcnt - number of buffers
+// Outputs      : number of bytes read, -1 if failure
+
+int sgreadv (SgFHandle fh, const struct iovec *iov, int iovcnt) {
+
+    return( sgVector(fh, iov, iovcnt, 0) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgwritev
+// Description  : Write data from several buffers to the file, one after the
+//                other from the current position
+//
+// Inputs       : fh - file handle for the file to write to
+//                iov - the buffers
+//                iovcnt - number of buffers
+// Outputs      : number of bytes written, -1 if failure
+
+int sgwritev (SgFHandle fh, const struct iovec *iov, int iovcnt) {
+
+    return( sgVector(fh, iov, iovcnt, 1) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgreadranges
+// Description  : Read several ranges of the file, each into its own buffer,
+//                in one pass over the blocks (the position is not moved)
+//
+// Inputs       : fh - file handle for the file to read from
+//                ranges - the ranges and their buffers
+//                count - number of ranges
+// Outputs      : number of bytes read (ranges are cut at the end of the
+//                file), -1 if failure
+
+int sgreadranges (SgFHandle fh, const SG_Range *ranges, int count) {
+
+    struct archive *file;
+    int ret;
+
+    // Queued writes and prefetches of the file go first, then the file is
+    // read alongside other readers
+    sgAsyncDrain(fh, 0, SIZE_MAX, 0);
+    if ((file = sgLockFile(fh, 0)) == NULL){
+        return -1;
+    }
+
+    // Ranges are at offsets, like sgpread they leave the read-ahead alone
+    ret = sgRanges(file, ranges, count, 0, 0);
+    pthread_rwlock_unlock(&file->lock);
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgwriteranges
+// Description  : Write several ranges of the file, each from its own
+//                buffer, in one pass over the blocks (the position is not
+//                moved).  Each range must start within the file as the
+//                ranges before it leave it; later ranges win where they
+//                overlap.
+//
+// Inputs       : fh - file handle for the file to write to
+//                ranges - the ranges and their data
+//                count - number of ranges
+// Outputs      : number of bytes written, -1 if failure
+
+int sgwriteranges (SgFHandle fh, const SG_Range *ranges, int count) {
+
+    struct archive *file;
+    int ret;
+
+    // Queued requests on the file go first, then one writer at a time
+    sgAsyncDrain(fh, 0, SIZE_MAX, 1);
+    if ((file = sgLockFile(fh, 1)) == NULL){
+        return -1;
+    }
+
+    ret = sgRanges(file, ranges, count, 1, 0);
+    pthread_rwlock_unlock(&file->lock);
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgread_async
+// Description  : Queue a read at an offset and return without waiting for
+//                it; the result is collected with sgpoll_async or
+//                sgwait_async
+//
+// Inputs       : fh - file handle for the file to read from
+//                buf - place to put the data (valid until the read is
+//                      collected)
+//                len - the length of the read
+//                off - offset in the file to read at
+// Outputs      : the request token, -1 if failure (or the queue is full)
+
+int sgread_async (SgFHandle fh, char *buf, size_t len, size_t off) {
+
+    return( sgAsyncSubmit(fh, buf, len, off, 0, 0, SG_ASYNC_READ) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgwrite_async
+// Description  : Queue a write at an offset and return without waiting for
+//                it.  Requests run in the order they are queued, so a later
+//                read sees the write.
+//
+// Inputs       : fh - file handle for the file to write to
+//                buf - the data to write (valid until the write is
+//                      collected)
+//                len - the length of the write
+//                off - offset in the file to write at
+// Outputs      : the request token, -1 if failure (or the queue is full)
+
+int sgwrite_async (SgFHandle fh, char *buf, size_t len, size_t off) {
+
+    return( sgAsyncSubmit(fh, buf, len, off, 0, 0, SG_ASYNC_WRITE) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgpoll_async
+// Description  : Collect finished requests without waiting
+//
+// Inputs       : done - place to put them
+//                max - most to collect
+// Outputs      : number collected
+
+int sgpoll_async (SG_Completion *done, int max) {
+
+    return( sgAsyncCollect(done, 0, max) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgwait_async
+// Description  : Wait until at least min requests have finished (fewer if
+//                fewer are queued), and collect up to max of them
+//
+// Inputs       : done - place to put them
+//                min - least to wait for
+//                max - most to collect
+// Outputs      : number collected, -1 if failure
+
+int sgwait_async (SG_Completion *done, int min, int max) {
+
+    if ((min < 0) || (min > max)){
+        return -1;
+    }
+    return( sgAsyncCollect(done, min, max) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgdepth_async
+// Description  : Set the queue depth, the most requests queued, running or
+//                finished but not collected at once
+//
+// Inputs       : depth - the queue depth
+// Outputs      : 0 if successful, -1 if failure (bad depth, or requests
+//                outstanding)
+
+int sgdepth_async (int depth) {
+
+    int ret = 0;
+
+    if ((depth <= 0) || (depth > SG_ASYNC_DEPTH_LIMIT)){
+        logMessage( LOG_ERROR_LEVEL, "sgdepth_async: bad queue depth %d", depth );
+        return -1;
+    }
+
+    // Prefetches hold slots until they have run
+    sgAsyncDrain(-1, 0, SIZE_MAX, 1);
+
+    pthread_mutex_lock(&sgAsync.lock);
+    if (sgAsync.outstanding > 0){
+        ret = -1;
+    }
+    else if (depth != sgAsync.depth){
+        free(sgAsync.reqs);
+        sgAsync.reqs = NULL;
+        sgAsync.depth = depth;
+    }
+    pthread_mutex_unlock(&sgAsync.lock);
+
+    return( ret );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -228,51 +684,245 @@ int sgwrite (SgFHandle fh, char *buf, size_t len) {
 
 int sgseek (SgFHandle fh, size_t off) {
 
-    // Check if filehandle is bad
-    if (searchFh(fh) == 0){
-        return -1;
-    }
+    struct archive *file;
 
-    // Check if the file is opened
-    if (files[fh].status == 0){
+    // The size holds still under the file lock, the position moves under
+    // the driver lock
+    if ((file = sgLockFile(fh, 0)) == NULL){
         return -1;
     }
 
-    if (off <= files[fh].size){
-        files[fh].pos = off;
+    if (off <= file->size){
+        pthread_mutex_lock(&sgDriverLock);
+        file->pos = off;
+        pthread_mutex_unlock(&sgDriverLock);
     }
 
     // Return new position
+    pthread_rwlock_unlock(&file->lock);
     return( off );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgadvise
+// Description  : Take a hint on how a range of the file will be used, like
+//                posix_fadvise.  SEQUENTIAL and RANDOM set the read-ahead of
+//                the whole file, WILLNEED has the I/O thread fetch the range
+//                into the cache in the background, DONTNEED writes it back
+//                and pushes it out of the cache, and NOREUSE pushes each
+//                block of the range out once the reader has moved past it.
+//
+// Inputs       : fh - the file handle of the file
+//                off - start of the range
+//                len - length of the range (0 for the rest of the file)
+//                hint - the SG_ADVICE_ value
+// Outputs      : 0 if successful, -1 if failure
+
+int sgadvise (SgFHandle fh, size_t off, size_t len, int hint) {
+
+    struct archive *file;
+    int x, first, last, ret = 0;
+
+    // Queued requests on the range go first before it is pushed out,
+    // then the advice is taken alongside readers of the file
+    if (hint == SG_ADVICE_DONTNEED){
+        sgAsyncDrain(fh, off, (len == 0) ? SIZE_MAX : len, 1);
+    }
+    if ((file = sgLockFile(fh, 0)) == NULL){
+        return -1;
+    }
+
+    // The blocks of the range that exist
+    first = off / SG_BLOCK_SIZE;
+    last = ((len == 0) || (off + len > file->size)) ? file->blockcount - 1 : (off + len - 1) / SG_BLOCK_SIZE;
+
+    // The advice and read-ahead change under the driver lock
+    pthread_mutex_lock(&sgDriverLock);
+    switch (hint){
+
+        case SG_ADVICE_NORMAL: // Back to the default read-ahead, keep everything
+            file->advice = SG_ADVICE_NORMAL;
+            file->nrFirst = -1;
+            file->nrLast = -1;
+            break;
+
+        case SG_ADVICE_SEQUENTIAL: // Read ahead the full window from the start
+            file->advice = SG_ADVICE_SEQUENTIAL;
+            file->raWindow = sgReadAheadMax;
+            break;
+
+        case SG_ADVICE_RANDOM: // No read-ahead at all
+            file->advice = SG_ADVICE_RANDOM;
+            file->raRun = 0;
+            file->raWindow = 0;
+            file->raAhead = -1;
+            break;
+
+        case SG_ADVICE_WILLNEED: // Fetch what is not cached, within reason
+            if (last - first + 1 > sgWillNeedMax){
+                last = first + sgWillNeedMax - 1;
+            }
+            break;
+
+        case SG_ADVICE_DONTNEED: // Written back and out of the cache below
+            break;
+
+        case SG_ADVICE_NOREUSE: // Read once, let go after (one range per file)
+            file->nrFirst = first;
+            file->nrLast = last;
+            break;
+
+        default:
+            logMessage( LOG_ERROR_LEVEL, "sgadvise: bad hint %d for file %d", hint, fh );
+            ret = -1;
+
+    }
+    pthread_mutex_unlock(&sgDriverLock);
+
+    // On the I/O thread, or right here if the queue is full
+    if ((hint == SG_ADVICE_WILLNEED) && (first <= last) &&
+            (sgAsyncSubmit(fh, NULL, 0, 0, first, last, SG_ASYNC_WILLNEED) == -1)){
+        ret = sgWillNeed(file, first, last);
+    }
+
+    // Written back and out of the cache now
+    if (hint == SG_ADVICE_DONTNEED){
+        for (x = first; x <= last; x++){
+            if ( evictSGDataBlock(file->nodeID[x], file->blocks[x]) ) {
+                logMessage( LOG_ERROR_LEVEL, "sgadvise: failed to write back block %d of file %d", x, fh );
+                ret = -1;
+                break;
+            }
+        }
+    }
+
+    // Return successfully
+    pthread_rwlock_unlock(&file->lock);
+    return( ret );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgflush
+// Description  : Write back the file's dirty cached blocks
+//
+// Inputs       : fh - the file handle of the file to flush
+// Outputs      : 0 if successful test, -1 if failure
+
+int sgflush (SgFHandle fh) {
+
+    struct archive *file;
+    int ret;
+
+    // Queued writes and prefetches of the file go first, then the blocks
+    // are written back alongside readers of the file
+    sgAsyncDrain(fh, 0, SIZE_MAX, 0);
+    if ((file = sgLockFile(fh, 0)) == NULL){
+        return -1;
+    }
+
+    ret = sgFlushFile(file);
+    pthread_rwlock_unlock(&file->lock);
+    return( ret );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : sgclose
-// Description  : Close the file
+// Description  : Close the file and apply the cache close policy: flush
+//                writes back its dirty blocks, demote also has its blocks
+//                evicted before any others, keep leaves them alone (dirty
+//                or not) until the grace period is over, then demotes them
 //
 // Inputs       : fh - the file handle of the file to close
 // Outputs      : 0 if successful test, -1 if failure
 
 int sgclose (SgFHandle fh) {
 
-    // Check if filehandle is bad
-    if (searchFh(fh) == 0){
+    struct archive *file;
+
+    // Queued requests on the file go first, then the file is closed with
+    // nobody else in it
+    sgAsyncDrain(fh, 0, SIZE_MAX, 1);
+    if ((file = sgLockFile(fh, 1)) == NULL){
         return -1;
     }
 
-    // Check if the file is opened
-    if (files[fh].status == 0){
+    // Nothing written to the file may stay only in the cache, unless it
+    // is kept for a reopen; those blocks are written back when evicted
+    if ( (sgClosePolicy != SG_CACHE_CLOSE_KEEP) && sgFlushFile(file) ) {
+        pthread_rwlock_unlock(&file->lock);
         return -1;
     }
+    if ( sgClosePolicy != SG_CACHE_CLOSE_FLUSH ) {
+        closeSGCacheFile( file->id, (sgClosePolicy == SG_CACHE_CLOSE_KEEP) ? sgCloseGrace : 0 );
+    }
 
-    files[fh].pos = 0;
-    files[fh].status = 0;
+    // The file stays, its handle goes back for the next open
+    pthread_mutex_lock(&sgDriverLock);
+    file->pos = 0;
+    file->status = 0;
+    file->fhandle = -1;
+    SG_FILE(fh) = NULL;
+    freeHandles[freecount++] = fh;       // Stale copies of fh stop matching
+    pthread_mutex_unlock(&sgDriverLock);
 
     // Return successfully
+    pthread_rwlock_unlock(&file->lock);
     return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgsetquota
+// Description  : Limit the blocks the cache keeps for a file, evicting its
+//                least recently used blocks if it is over
+//
+// Inputs       : fh - the file handle
+//                blocks - most blocks cached for the file (0 for no limit)
+// Outputs      : 0 if successful, -1 if failure
+
+int sgsetquota (SgFHandle fh, uint32_t blocks) {
+
+    int id = -1;
+
+    // Queued writes and prefetches of the file go first
+    sgAsyncDrain(fh, 0, SIZE_MAX, 0);
+
+    // The cache knows the file by its number, not the handle
+    pthread_mutex_lock(&sgDriverLock);
+    if (searchFh(fh) == 1){
+        id = SG_FILE(fh)->id;
+    }
+    pthread_mutex_unlock(&sgDriverLock);
+    return( (id == -1) ? -1 : setSGCacheQuota(id, blocks) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgfilestats
+// Description  : Get the cache counters of a file (all its opens so far)
+//
+// Inputs       : fh - the file handle
+//                counters - where to put the counters
+// Outputs      : 0 if successful, -1 if failure
+
+int sgfilestats (SgFHandle fh, SG_Cache_Counters *counters) {
+
+    int id = -1;
+
+    // Queued writes and prefetches of the file go first
+    sgAsyncDrain(fh, 0, SIZE_MAX, 0);
+
+    pthread_mutex_lock(&sgDriverLock);
+    if (searchFh(fh) == 1){
+        id = SG_FILE(fh)->id;
+    }
+    pthread_mutex_unlock(&sgDriverLock);
+    return( (id == -1) ? -1 : sgGetCacheFileStats(id, counters) );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : sgshutdown
@@ -283,8 +933,41 @@ int sgclose (SgFHandle fh) {
 
 int sgshutdown (void) {
 
-    // Log, return successfully
+    // Finish what is queued first
+    sgAsyncStop();
+    pthread_mutex_lock(&sgDriverLock);
+
+    // Write back what is still dirty, then drop the cache
+    if ( flushSGCache() ) {
+        logMessage( LOG_ERROR_LEVEL, "sgshutdown: failed to write back dirty blocks" );
+        closeSGCache();
+        pthread_mutex_unlock(&sgDriverLock);
+        return( -1 );
+    }
     closeSGCache();
+
+    // Release the file and handle tables
+    for (int x = 0; x < archivecount; x++){
+        free(archives[x]->addr);
+        free(archives[x]->blocks);
+        free(archives[x]->nodeID);
+        pthread_rwlock_destroy(&archives[x]->lock);
+        free(archives[x]);
+    }
+    free(archives);
+    free(files);
+    free(freeHandles);
+    free(pathIndex);
+    archives = NULL;
+    files = NULL;
+    freeHandles = NULL;
+    pathIndex = NULL;
+    pathbuckets = 0;
+    archivecount = archivecap = 0;
+    filecount = filecap = freecount = 0;
+    pthread_mutex_unlock(&sgDriverLock);
+
+    // Log, return successfully
     logMessage( LOG_INFO_LEVEL, "Shut down Scatter/Gather driver." );
     return( 0 );
 }
@@ -452,21 +1135,20 @@ SG_Packet_Status deserialize_sg_packet (SG_Node_ID *loc, SG_Node_ID *rem, SG_Blo
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : searchFh
-// Description  : Search if a filehandle exist
+// Description  : Search if a filehandle exist; its slot must hold an open
+//                file that was given this very handle, so a handle kept
+//                after its close does not reach whoever reuses the slot
 //
 // Inputs       : fh - filehandle to search for
 // Outputs      : 1 if exist, 0 if doesn't
 
 int searchFh ( SgFHandle fh ){
 
-    int tmpcount = 0;
+    if ((fh >= 0) && ((fh & SG_HANDLE_SLOT_MASK) < filecount) &&
+            (SG_FILE(fh) != NULL) && (SG_FILE(fh)->fhandle == fh)){
 
-    for (tmpcount = 0; tmpcount < 1000; tmpcount++){
-        if (files[tmpcount].fhandle == fh){
+        return 1;       // There exist
 
-            return 1;       // There exist
-
-        }
     }
 
     return 0;               // Doesn't exist
@@ -474,26 +1156,287 @@ int searchFh ( SgFHandle fh ){
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : sgInitEndpoint
-// Description  : Initialize the endpoint
+// Function     : sgNewArchive
+// Description  : Add a file to the path index and the file table, with an
+//                empty block map
 //
-// Inputs       : none
-// Outputs      : 0 if successfull, -1 if failure
+// Inputs       : path - the path/filename of the file
+// Outputs      : the new file, NULL if failure
 
-int sgInitEndpoint (void){
+struct archive *sgNewArchive (const char *path){
 
-    // Local variables
-    char initPacket[SG_BASE_PACKET_SIZE], recvPacket[SG_BASE_PACKET_SIZE];
-    size_t pktlen, rpktlen;
-    SG_Node_ID loc, rem;
-    SG_Block_ID blkid;
-    SG_SeqNum sloc, srem;
-    SG_System_OP op;
-    SG_Packet_Status ret;
+    struct archive *file, **grown;
+    int size;
 
-    // Local and do some initial setup
-    logMessage( LOG_INFO_LEVEL, "Initializing local endpoint ..." );
-    sgLocalSeqno = SG_INITIAL_SEQNO;
+    // Grow the table by doubling
+    if (archivecount == archivecap){
+        size = (archivecap > 0) ? archivecap * 2 : SG_FILE_TABLE_INITIAL;
+        if ((grown = realloc(archives, size * sizeof(struct archive *))) == NULL){
+            return( NULL );
+        }
+        archives = grown;
+        archivecap = size;
+    }
+
+    // The path is copied, callers may reuse their buffer
+    if ((file = calloc(1, sizeof(struct archive))) == NULL){
+        return( NULL );
+    }
+    if ((file->addr = strdup(path)) == NULL){
+        free(file);
+        return( NULL );
+    }
+    file->fhandle = -1;
+    file->id = archivecount;
+    pthread_rwlock_init(&file->lock, NULL);
+
+    // Findable by path before it is in the table, or it could be added twice
+    if (sgIndexPath(file)){
+        pthread_rwlock_destroy(&file->lock);
+        free(file->addr);
+        free(file);
+        return( NULL );
+    }
+    archives[archivecount++] = file;
+    return( file );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgNewHandle
+// Description  : Give a file a handle, reusing a closed one's slot first;
+//                the reused handle moves on to the slot's next generation
+//
+// Inputs       : file - the file being opened
+// Outputs      : the handle, -1 if failure
+
+SgFHandle sgNewHandle (struct archive *file){
+
+    struct archive **grown;
+    int *spare;
+    int size;
+    SgFHandle fh;
+
+    if (freecount > 0){
+        fh = freeHandles[--freecount];
+        fh = ((((fh >> SG_HANDLE_SLOT_BITS) + 1) & SG_HANDLE_GEN_MASK) << SG_HANDLE_SLOT_BITS) |
+                (fh & SG_HANDLE_SLOT_MASK);
+    } else {
+
+        // Grow the handle table (and the free list with it) by doubling
+        if (filecount > SG_HANDLE_SLOT_MASK){
+            return( -1 );
+        }
+        if (filecount == filecap){
+            size = (filecap > 0) ? filecap * 2 : SG_FILE_TABLE_INITIAL;
+            if ((grown = realloc(files, size * sizeof(struct archive *))) == NULL){
+                return( -1 );
+            }
+            files = grown;
+            if ((spare = realloc(freeHandles, size * sizeof(int))) == NULL){
+                return( -1 );
+            }
+            freeHandles = spare;
+            filecap = size;
+        }
+        fh = filecount++;
+
+    }
+
+    SG_FILE(fh) = file;
+    file->fhandle = fh;
+    return( fh );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgFindPath
+// Description  : Look up a file by its path in the path index
+//
+// Inputs       : path - the path/filename of the file
+// Outputs      : the file, NULL if it was never opened
+
+struct archive *sgFindPath (const char *path){
+
+    struct archive *file;
+
+    if (pathbuckets == 0){
+        return( NULL );
+    }
+    for (file = pathIndex[sgPathHash(path) % pathbuckets]; file != NULL; file = file->pathNext){
+        if (strcmp(file->addr, path) == 0){
+            return( file );
+        }
+    }
+    return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgIndexPath
+// Description  : Add a file to the path index, doubling the buckets (and
+//                rehashing) once there would be more files than buckets
+//
+// Inputs       : file - the file to add
+// Outputs      : 0 if successful, -1 if failure
+
+int sgIndexPath (struct archive *file){
+
+    struct archive **buckets, *next;
+    uint32_t b;
+    int size;
+
+    if (archivecount >= pathbuckets){
+        size = (pathbuckets > 0) ? pathbuckets * 2 : SG_FILE_TABLE_INITIAL;
+        if ((buckets = calloc(size, sizeof(struct archive *))) == NULL){
+            return( -1 );
+        }
+        for (int x = 0; x < pathbuckets; x++){
+            for (struct archive *moved = pathIndex[x]; moved != NULL; moved = next){
+                next = moved->pathNext;
+                b = sgPathHash(moved->addr) % size;
+                moved->pathNext = buckets[b];
+                buckets[b] = moved;
+            }
+        }
+        free(pathIndex);
+        pathIndex = buckets;
+        pathbuckets = size;
+    }
+
+    b = sgPathHash(file->addr) % pathbuckets;
+    file->pathNext = pathIndex[b];
+    pathIndex[b] = file;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgPathHash
+// Description  : Hash a path (FNV-1a)
+//
+// Inputs       : path - the path/filename
+// Outputs      : the hash
+
+uint32_t sgPathHash (const char *path){
+
+    uint32_t hash = 2166136261u;
+
+    while (*path != '\0'){
+        hash = (hash ^ (unsigned char)*path++) * 16777619u;
+    }
+    return( hash );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgGrowBlocks
+// Description  : Make room in a file's block map for one more block; the
+//                map starts empty and doubles up to SG_MAX_BLOCKS_PER_FILE
+//                (called with the file locked alone, readers use the map)
+//
+// Inputs       : file - the file to grow
+// Outputs      : 0 if successful, -1 if failure
+
+int sgGrowBlocks (struct archive *file){
+
+    SG_Block_ID *blocks;
+    SG_Node_ID *nodes;
+    int size;
+
+    if (file->blockcount < file->blockcap){
+        return( 0 );
+    }
+    if (file->blockcap >= SG_MAX_BLOCKS_PER_FILE){
+        return( -1 );
+    }
+    size = (file->blockcap > 0) ? file->blockcap * 2 : SG_BLOCK_MAP_INITIAL;
+    if (size > SG_MAX_BLOCKS_PER_FILE){
+        size = SG_MAX_BLOCKS_PER_FILE;
+    }
+
+    if ((blocks = realloc(file->blocks, size * sizeof(SG_Block_ID))) == NULL){
+        return( -1 );
+    }
+    file->blocks = blocks;
+    if ((nodes = realloc(file->nodeID, size * sizeof(SG_Node_ID))) == NULL){
+        return( -1 );
+    }
+    file->nodeID = nodes;
+    file->blockcap = size;
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgLockFile
+// Description  : Find the open file of a handle and lock it: shared to read
+//                it (readers go on together, the cache locks its own
+//                shards), alone to change its blocks or size.  The file
+//                cannot be closed while it is locked.
+//
+// Inputs       : fh - filehandle
+//                write - 1 to lock the file alone, 0 to share it
+// Outputs      : the file, NULL if the handle is bad or the file was closed
+
+struct archive *sgLockFile (SgFHandle fh, int write){
+
+    struct archive *file = NULL;
+    int open;
+
+    // Check if filehandle is bad, and if the file is opened
+    pthread_mutex_lock(&sgDriverLock);
+    if ((searchFh(fh) == 1) && (SG_FILE(fh)->status == 1)){
+        file = SG_FILE(fh);
+    }
+    pthread_mutex_unlock(&sgDriverLock);
+    if (file == NULL){
+        return( NULL );
+    }
+
+    if (write){
+        pthread_rwlock_wrlock(&file->lock);
+    }
+    else{
+        pthread_rwlock_rdlock(&file->lock);
+    }
+
+    // It may have been closed while we waited (files are never freed)
+    pthread_mutex_lock(&sgDriverLock);
+    open = (file->fhandle == fh);
+    pthread_mutex_unlock(&sgDriverLock);
+    if (!open){
+        pthread_rwlock_unlock(&file->lock);
+        return( NULL );
+    }
+    return( file );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgInitEndpoint
+// Description  : Initialize the endpoint
+//
+// Inputs       : none
+// Outputs      : 0 if successfull, -1 if failure
+
+int sgInitEndpoint (void){
+
+    // Local variables
+    char initPacket[SG_BASE_PACKET_SIZE], recvPacket[SG_BASE_PACKET_SIZE];
+    size_t pktlen, rpktlen;
+    SG_Node_ID loc, rem;
+    SG_Block_ID blkid;
+    SG_SeqNum sloc, srem;
+    SG_System_OP op;
+    SG_Packet_Status ret;
+
+    // Local and do some initial setup
+    logMessage( LOG_INFO_LEVEL, "Initializing local endpoint ..." );
+
+    // The first packet, numbered before any other
+    pthread_mutex_lock(&sgBusLock);
+    sgLocalSeqno = SG_INITIAL_SEQNO;
 
     // Setup the packet
     pktlen = SG_BASE_PACKET_SIZE;
@@ -505,6 +1448,7 @@ int sgInitEndpoint (void){
                                     SG_SEQNO_UNKNOWN,  // Receiver sequence number
                                     NULL, initPacket, &pktlen)) != SG_PACKT_OK ) {
         logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed serialization of packet [%d].", ret );
+        pthread_mutex_unlock(&sgBusLock);
         return( -1 );
     }
 
@@ -512,6 +1456,7 @@ int sgInitEndpoint (void){
     rpktlen = SG_BASE_PACKET_SIZE;
     if ( sgServicePost(initPacket, &pktlen, recvPacket, &rpktlen) ) {
         logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed packet post" );
+        pthread_mutex_unlock(&sgBusLock);
         return( -1 );
     }
 
@@ -519,35 +1464,39 @@ int sgInitEndpoint (void){
     if ( (ret = deserialize_sg_packet(&loc, &rem, &blkid, &op, &sloc, 
                                     &srem, NULL, recvPacket, rpktlen)) != SG_PACKT_OK ) {
         logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed deserialization of packet [%d]", ret );
+        pthread_mutex_unlock(&sgBusLock);
         return( -1 );
     }
 
     // Sanity check the return value
     if ( loc == SG_NODE_UNKNOWN ) {
         logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: bad local ID returned [%ul]", loc );
+        pthread_mutex_unlock(&sgBusLock);
         return( -1 );
     }
 
     // Set the local node ID, log and return successfully
     sgLocalNodeId = loc;
     logMessage( LOG_INFO_LEVEL, "Completed initialization of node (local node ID %lu", sgLocalNodeId );
+    pthread_mutex_unlock(&sgBusLock);
     return( 0 );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : sgCblock
-// Description  : Create a new block
+// Description  : Create a new block (called with the file locked alone)
 //
-// Inputs       : fh - filehandle
+// Inputs       : file - the file (open)
 //                buf - character buffer
 //                len - length of the operation
 // Outputs      : 0 if successful, -1 if failure
 
-int sgCblock (SgFHandle fh, char *buf, size_t len){
+int sgCblock (struct archive *file, char *buf, size_t len){
 
     // Local variables
     char initPacket[SG_DATA_PACKET_SIZE], recvPacket[SG_DATA_PACKET_SIZE];
+    char reply[SG_BLOCK_SIZE];
     size_t pktlen, rpktlen;
     SG_Node_ID loc, rem;
     SG_Block_ID blkid;
@@ -555,6 +1504,15 @@ int sgCblock (SgFHandle fh, char *buf, size_t len){
     SG_System_OP op;
     SG_Packet_Status ret;
 
+    // Make room for the block before the service creates it
+    if ( sgGrowBlocks(file) ) {
+        logMessage( LOG_ERROR_LEVEL, "sgCblock: no room for block %d of file %d", file->blockcount, file->id );
+        return( -1 );
+    }
+
+    // One exchange on the bus at a time
+    pthread_mutex_lock(&sgBusLock);
+
     // Setup the packet
     pktlen = SG_DATA_PACKET_SIZE;
     if ( (ret = serialize_sg_packet( sgLocalNodeId,    // Local ID
@@ -565,6 +1523,7 @@ int sgCblock (SgFHandle fh, char *buf, size_t len){
                                     SG_SEQNO_UNKNOWN,  // Receiver sequence number
                                     buf, initPacket, &pktlen)) != SG_PACKT_OK ) {
         logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed serialization of packet [%d].", ret );
+        pthread_mutex_unlock(&sgBusLock);
         return( -1 );
     }
 
@@ -572,13 +1531,15 @@ int sgCblock (SgFHandle fh, char *buf, size_t len){
     rpktlen = SG_DATA_PACKET_SIZE;
     if ( sgServicePost(initPacket, &pktlen, recvPacket, &rpktlen) ) {
         logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed packet post" );
+        pthread_mutex_unlock(&sgBusLock);
         return( -1 );
     } 
 
-    // Unpack the recieived data
+    // Unpack the recieived data (keep buf intact, it is what gets cached)
     if ( (ret = deserialize_sg_packet(&loc, &rem, &blkid, &op, &sloc, 
-                                    &srem, buf, recvPacket, rpktlen)) != SG_PACKT_OK ) {
+                                    &srem, reply, recvPacket, rpktlen)) != SG_PACKT_OK ) {
         logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed deserialization of packet [%d]", ret );
+        pthread_mutex_unlock(&sgBusLock);
         return( -1 );
     }
 
@@ -591,436 +1552,1069 @@ int sgCblock (SgFHandle fh, char *buf, size_t len){
     // Sanity check the return value
     if ( loc == SG_NODE_UNKNOWN ) {
         logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: bad local ID returned [%ul]", loc );
+        pthread_mutex_unlock(&sgBusLock);
         return( -1 );
     }
-
-    // Set the local node ID, log and return successfully
-    putSGDataBlock(rem, blkid, buf);
     sgLocalNodeId = rem;
-    files[fh].nodeID[files[fh].blockcount] = rem;
-    files[fh].blocks[files[fh].blockcount] = blkid;  
-    files[fh].blockcount++;
+    pthread_mutex_unlock(&sgBusLock);
+
+    // Cache the block and add it to the file
+    insertSGDataBlock(file->id, rem, blkid, buf, 0);
+    file->nodeID[file->blockcount] = rem;
+    file->blocks[file->blockcount] = blkid;  
+    file->blockcount++;
     return ( 0 );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : sgOblock
-// Description  : Obtain a block
+// Function     : sgRange
+// Description  : Split a transfer at (pos, len) in the file into per-block
+//                segments and read or write each one, so every touched
+//                block is fetched or updated once whatever the alignment
 //
-// Inputs       : fh - filehandle
-//                buf - character buffer
-//                len - length of the operation
-// Outputs      : 0 if successful, -1 if failure
+// Inputs       : file - the file (locked)
+//                buf - the caller's data
+//                pos - offset in the file
+//                len - length of the transfer
+//                write - 1 to write buf to the file, 0 to read into it
+//                ahead - 1 to read ahead after the blocks read
+// Outputs      : bytes transferred (short if a block failed part way),
+//                -1 if the first block failed
 
-int sgOblock (SgFHandle fh, char *buf, size_t len){
+int sgRange (struct archive *file, char *buf, size_t pos, size_t len, int write, int ahead){
 
-    char *tmp;
-    char a[1024];
-    tmp = &a[0];
+    size_t done = 0, off, seg;
+    int blk, ret;
 
-    char initPacket[SG_DATA_PACKET_SIZE], recvPacket[SG_DATA_PACKET_SIZE];
-    size_t pktlen, rpktlen;
-    SG_Node_ID loc, rem;
-    SG_Block_ID blkid;
-    SG_SeqNum sloc, srem;
-    SG_System_OP op;
-    SG_Packet_Status ret;
-    int destblock = (files[fh].pos / 1024);
+    while (done < len){
 
-    pktlen = SG_DATA_PACKET_SIZE;
-    rpktlen = SG_DATA_PACKET_SIZE;
+        blk = (pos + done) / SG_BLOCK_SIZE;
+        off = (pos + done) % SG_BLOCK_SIZE;
+        seg = (len - done < SG_BLOCK_SIZE - off) ? len - done : SG_BLOCK_SIZE - off;
 
-    if (getSGDataBlock(files[fh].nodeID[destblock], files[fh].blocks[destblock] != NULL)){
+        ret = write ? sgUblock(file, blk, buf + done, off, seg) : sgOblock(file, blk, buf + done, off, seg, ahead);
+        if (ret){
+            return( (done > 0) ? (int)done : -1 );
+        }
+        done += seg;
 
-        tmp = getSGDataBlock(files[fh].nodeID[destblock], files[fh].blocks[destblock]);
+    }
 
-        if (files[fh].pos % 1024 == 0){
-            memcpy(buf, tmp, 256);
-        }
-        if (files[fh].pos % 1024 == 256){
-            memcpy(buf, tmp + 256, 256);
-        }        
-        if (files[fh].pos % 1024 == 512){
-            memcpy(buf, tmp + 512, 256);
-        }
-        if (files[fh].pos % 1024 == 768){
-            memcpy(buf, tmp + 768, 256);
-        }
+    return( (int)done );
+}
 
-        return ( 0 );
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgVector
+// Description  : Read or write a list of buffers at the current position,
+//                as consecutive ranges of the file, and move past them
+//
+// Inputs       : fh - filehandle
+//                iov - the buffers
+//                iovcnt - number of buffers
+//                write - 1 to write them, 0 to read into them
+// Outputs      : bytes transferred, -1 if failure
+
+int sgVector (SgFHandle fh, const struct iovec *iov, int iovcnt, int write){
+
+    struct archive *file;
+    SG_Range *ranges;
+    size_t pos, start;
+    int x, ret;
+
+    // Queued writes and prefetches of the file go first (all queued
+    // requests on it for a write), then one writer at a time
+    sgAsyncDrain(fh, 0, SIZE_MAX, write);
+    if ((iovcnt < 0) || ((iovcnt > 0) && (iov == NULL)) || ((file = sgLockFile(fh, write)) == NULL)){
+        return -1;
+    }
 
+    // Check for reads not at the end
+    pthread_mutex_lock(&sgDriverLock);
+    start = file->pos;
+    pthread_mutex_unlock(&sgDriverLock);
+    if ((!write && (start >= (size_t)file->size)) ||
+            ((ranges = malloc((iovcnt + 1) * sizeof(SG_Range))) == NULL)){
+        pthread_rwlock_unlock(&file->lock);
+        return -1;
     }
-    else{
 
-        remote = getLastRseq(files[fh].nodeID[destblock]) + 1;
-
-        // Setup the packet
-        if ( (ret = serialize_sg_packet( sgLocalNodeId,    // Local ID
-                        (files[fh].nodeID[destblock]),     // Remote ID
-                        (files[fh].blocks[destblock]),     // Block ID
-                                        SG_OBTAIN_BLOCK,   // Operation
-                                        sgLocalSeqno++,    // Sender sequence number
-                                             remote,     // Receiver sequence number
-                                        NULL, initPacket, &pktlen)) != SG_PACKT_OK ) {
-            logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed serialization of packet [%d].", ret );
-            return( -1 );
-        }
+    pos = start;
+    for (x = 0; x < iovcnt; x++){
+        ranges[x].off = pos;
+        ranges[x].buf = iov[x].iov_base;
+        ranges[x].len = iov[x].iov_len;
+        pos += iov[x].iov_len;
+    }
 
-        // Send the packet
-        if ( sgServicePost(initPacket, &pktlen, recvPacket, &rpktlen) ) {
-            logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed packet post" );
-            return( -1 );
-        }
+    // Reads at the position feed the read-ahead, like sgread
+    ret = sgRanges(file, ranges, iovcnt, write, !write);
+    free(ranges);
 
-        // Unpack the recieived data
-        if ( (ret = deserialize_sg_packet(&loc, &rem, &blkid, &op, &sloc, 
-                                        &srem, tmp, recvPacket, rpktlen)) != SG_PACKT_OK ) {
-            logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed deserialization of packet [%d]", ret );
-            return( -1 );
-        }
-        
-        updateRseq(rem, srem);
+    if (ret > 0){
+        pthread_mutex_lock(&sgDriverLock);
+        file->pos = start + ret;
+        pthread_mutex_unlock(&sgDriverLock);
+    }
+    pthread_rwlock_unlock(&file->lock);
+    return( ret );
+}
 
-        if (files[fh].pos % 1024 == 0){
-            memcpy(buf, tmp, 256);
-        }
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgRanges
+// Description  : Read or write several ranges of the file.  All the block
+//                segments are planned first and sorted by block, so each
+//                block is fetched or updated once however many ranges
+//                touch it, in one pass from the first block to the last.
+//
+// Inputs       : file - the file (locked)
+//                ranges - the ranges and their buffers
+//                count - number of ranges
+//                write - 1 to write the ranges, 0 to read them
+//                ahead - 1 to read ahead after the blocks read
+// Outputs      : bytes transferred, which are short if a block failed: they
+//                count the segments of the blocks before it (for ranges in
+//                file order, as sgVector makes, a prefix), -1 if the first
+//                block failed or the ranges add up to more than INT_MAX
+//                bytes (then nothing is done)
+
+int sgRanges (struct archive *file, const SG_Range *ranges, int count, int write, int ahead){
+
+    struct segment *segs;
+    size_t end = file->size, len, done, total = 0, off, nsegs = 0;
+    int x, y, n = 0, first, ret = 0;
+
+    if ((count < 0) || ((count > 0) && (ranges == NULL))){
+        return -1;
+    }
 
-        if (files[fh].pos % 1024 == 256){
-            memcpy(buf, tmp + 256, 256);
+    // Size the plan; reads stop at the end of the file, writes may not
+    // leave a hole past it
+    for (x = 0; x < count; x++){
+        len = ranges[x].len;
+        if (!write){
+            len = (ranges[x].off >= end) ? 0 : (len > end - ranges[x].off) ? end - ranges[x].off : len;
         }
-
-        if (files[fh].pos % 1024 == 512){    
-            memcpy(buf, tmp + 512, 256);
+        else if (ranges[x].off > end){
+            logMessage( LOG_ERROR_LEVEL, "sgRanges: range at %lu is past the end of file %d", (unsigned long)ranges[x].off, file->id );
+            return -1;
         }
 
-        if (files[fh].pos % 1024 == 768){
-            memcpy(buf, tmp + 768, 256);
+        // The count goes back as an int, so must the total (and there are
+        // never more segments than bytes)
+        if (len > (size_t)INT_MAX - total){
+            logMessage( LOG_ERROR_LEVEL, "sgRanges: ranges of file %d add up to more than %d bytes", file->id, INT_MAX );
+            return -1;
         }
+        if (write && (ranges[x].off + len > end)){
+            end = ranges[x].off + len;
+        }
+        if (len > 0){
+            nsegs += (ranges[x].off + len - 1) / SG_BLOCK_SIZE - ranges[x].off / SG_BLOCK_SIZE + 1;
+        }
+        total += len;
+    }
+    if (total == 0){
+        return( 0 );
+    }
+    if ((segs = malloc(nsegs * sizeof(struct segment))) == NULL){
+        return -1;
+    }
 
-        putSGDataBlock(files[fh].nodeID[destblock], files[fh].blocks[destblock], tmp);
-
-        // Sanity check the return value
-        if ( loc == SG_NODE_UNKNOWN ) {
-            logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: bad local ID returned [%ul]", loc );
-            return( -1 );
+    // Cut every range into its block segments
+    for (x = 0; x < count; x++){
+        len = ranges[x].len;
+        if (!write){
+            len = (ranges[x].off >= (size_t)file->size) ? 0 :
+                    (len > file->size - ranges[x].off) ? file->size - ranges[x].off : len;
+        }
+        for (done = 0; done < len; done += segs[n++].len){
+            off = ranges[x].off + done;
+            segs[n].blk = off / SG_BLOCK_SIZE;
+            segs[n].off = off % SG_BLOCK_SIZE;
+            segs[n].len = (len - done < SG_BLOCK_SIZE - segs[n].off) ? len - done : SG_BLOCK_SIZE - segs[n].off;
+            segs[n].buf = ranges[x].buf + done;
+            segs[n].order = n;
+        }
+    }
+    qsort(segs, n, sizeof(struct segment), sgSegmentCompare);
+
+    // One pass over the blocks, a run of segments at a time, counting
+    // what the blocks done so far hold
+    total = end = 0;
+    for (first = 0; first < n; first = x){
+        for (x = first + 1; (x < n) && (segs[x].blk == segs[first].blk); x++);
+        if ((ret = sgBlockSegments(file, segs + first, x - first, write, ahead)) != 0){
+            break;
+        }
+        for (y = first; y < x; y++){
+            total += segs[y].len;
+            off = (size_t)segs[y].blk * SG_BLOCK_SIZE + segs[y].off + segs[y].len;
+            end = (off > end) ? off : end;
         }
+    }
+    free(segs);
 
-        sgLocalNodeId = rem;
-        return ( 0 );
+    // Blocks written before a failure stay written, and in the size
+    if (write && ((int)end > file->size)){
+        file->size = end;
     }
+    return( (ret && (total == 0)) ? -1 : (int)total );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
-// Function     : sgUblock
-// Description  : Update a block
+// Function     : sgSegmentCompare
+// Description  : Order block segments by block, then as they were asked for
+//                (qsort comparison)
 //
-// Inputs       : fh - filehandle
-//                buf - character buffer
-//                len - length of the operation
-// Outputs      : 0 if successful, -1 if failure
+// Inputs       : a - first segment
+//                b - second segment
+// Outputs      : <0, 0 or >0 as a goes before, with or after b
 
-int sgUblock (SgFHandle fh, char *buf, size_t len){
+int sgSegmentCompare (const void *a, const void *b){
 
-    char *tmp;
-    char a[1024];
-    tmp = &a[0];
+    const struct segment *x = a, *y = b;
 
-    char initPacket[SG_DATA_PACKET_SIZE], recvPacket[SG_DATA_PACKET_SIZE];
-    size_t pktlen, rpktlen;
-    SG_Node_ID loc, rem;
-    SG_Block_ID blkid;
-    SG_SeqNum sloc, srem;
-    SG_System_OP op;
-    SG_Packet_Status ret;
+    if (x->blk != y->blk){
+        return( (x->blk < y->blk) ? -1 : 1 );
+    }
+    return( x->order - y->order );
+}
 
-    pktlen = SG_DATA_PACKET_SIZE;
-    rpktlen = SG_DATA_PACKET_SIZE;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgBlockSegments
+// Description  : Read or write all the segments of one block.  A lone
+//                segment goes through sgOblock or sgUblock.  Several are
+//                gathered from (or scattered into) one copy of the block,
+//                which is fetched once and for writes sent once.
+//
+// Inputs       : file - the file (locked)
+//                segs - the block's segments, in request order
+//                n - number of segments
+//                write - 1 to write them, 0 to read them
+//                ahead - 1 to read ahead after a read
+// Outputs      : 0 if successful, -1 if failure
 
-    int destblock = (files[fh].pos / 1024);
+int sgBlockSegments (struct archive *file, struct segment *segs, int n, int write, int ahead){
 
-    if (getSGDataBlock(files[fh].nodeID[destblock], files[fh].blocks[destblock] != NULL)){
+    char frame[SG_BLOCK_SIZE];
+    int x, blk = segs[0].blk;
+    SG_Node_ID nid;
+    SG_Block_ID bid;
 
-        tmp = getSGDataBlock(files[fh].nodeID[destblock], files[fh].blocks[destblock]);
+    if (n == 1){
+        return( write ? sgUblock(file, blk, segs[0].buf, segs[0].off, segs[0].len) :
+                sgOblock(file, blk, segs[0].buf, segs[0].off, segs[0].len, ahead) );
+    }
 
-        if (files[fh].pos % 1024 == 0){
-            memcpy(buf, tmp, 256);
+    // The block as it stands (a new one starts zeroed)
+    if (blk >= file->blockcount){
+        memset(frame, 0, SG_BLOCK_SIZE);
+    }
+    else{
+        nid = file->nodeID[blk];
+        bid = file->blocks[blk];
+        if (readSGDataBlock(file->id, nid, bid, frame, 0, SG_BLOCK_SIZE)){
+            if ( sgFetchBlock(nid, bid, frame) ) {
+                return( -1 );
+            }
+            if (!write){
+                insertSGDataBlock(file->id, nid, bid, frame, 0);
+            }
         }
-        if (files[fh].pos % 1024 == 256){
-            memcpy(buf, tmp + 256, 256);
-        }        
-        if (files[fh].pos % 1024 == 512){
-            memcpy(buf, tmp + 512, 256);
+    }
+
+    // Gather the reads out of it, or patch the writes in and send it once
+    for (x = 0; x < n; x++){
+        if (write){
+            memcpy(frame + segs[x].off, segs[x].buf, segs[x].len);
         }
-        if (files[fh].pos % 1024 == 768){
-            memcpy(buf, tmp + 768, 256);
+        else{
+            memcpy(segs[x].buf, frame + segs[x].off, segs[x].len);
         }
-
     }
-    else{
 
-        if (files[fh].pos % 1024 == 0){
+    if (write){
+        return( sgUblock(file, blk, frame, 0, SG_BLOCK_SIZE) );
+    }
+    if (ahead){
+        sgReadAhead(file, blk);
+    }
+    return( 0 );
+}
 
-            remote = getLastRseq(files[fh].nodeID[destblock]) + 1;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgAsyncSubmit
+// Description  : Put a request on the submission queue, starting the I/O
+//                thread and allocating the request slots on first use
+//
+// Inputs       : fh - filehandle
+//                buf - the caller's data
+//                len - length of the transfer
+//                off - offset in the file
+//                first - first block to fetch (WILLNEED only, reads and
+//                        writes cover the blocks of off and len)
+//                last - last block to fetch (WILLNEED only)
+//                op - SG_ASYNC_READ, _WRITE or _WILLNEED
+// Outputs      : the request token, -1 if failure (or the queue is full)
+
+int sgAsyncSubmit (SgFHandle fh, char *buf, size_t len, size_t off, int first, int last, int op){
+
+    struct asyncrequest *req;
+    int x, open, token = -1;
+
+    // Check if filehandle is bad, and if the file is opened
+    pthread_mutex_lock(&sgDriverLock);
+    open = (searchFh(fh) == 1) && (SG_FILE(fh)->status == 1);
+    pthread_mutex_unlock(&sgDriverLock);
+    if (!open){
+        return -1;
+    }
 
-            // Setup the packet
-            if ( (ret = serialize_sg_packet( sgLocalNodeId,    // Local ID
-                            (files[fh].nodeID[destblock]),     // Remote ID
-                            (files[fh].blocks[destblock]),     // Block ID
-                                            SG_OBTAIN_BLOCK,   // Operation
-                                            sgLocalSeqno++,    // Sender sequence number
-                                                    remote,  // Receiver sequence number
-                                            NULL, initPacket, &pktlen)) != SG_PACKT_OK ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed serialization of packet [%d].", ret );
-                return( -1 );
-            }
+    pthread_mutex_lock(&sgAsync.lock);
 
-            // Send the packet
-            if ( sgServicePost(initPacket, &pktlen, recvPacket, &rpktlen) ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed packet post" );
-                return( -1 );
-            } 
+    if (sgAsync.reqs == NULL){
+        if ((sgAsync.reqs = calloc(sgAsync.depth, sizeof(struct asyncrequest))) == NULL){
+            pthread_mutex_unlock(&sgAsync.lock);
+            return -1;
+        }
+        for (x = 0; x < sgAsync.depth; x++){
+            sgAsync.reqs[x].next = (x + 1 < sgAsync.depth) ? x + 1 : -1;
+        }
+        sgAsync.freeList = 0;
+        sgAsync.subHead = sgAsync.subTail = -1;
+        sgAsync.doneHead = sgAsync.doneTail = -1;
+    }
+    if (!sgAsync.running){
+        sgAsync.stop = 0;
+        if (pthread_create(&sgAsync.worker, NULL, sgAsyncWorker, NULL)){
+            logMessage( LOG_ERROR_LEVEL, "sgAsyncSubmit: failed to start the I/O thread" );
+            pthread_mutex_unlock(&sgAsync.lock);
+            return -1;
+        }
+        sgAsync.running = 1;
+    }
 
-            // Unpack the recieived data
-            if ( (ret = deserialize_sg_packet(&loc, &rem, &blkid, &op, &sloc, 
-                                            &srem, tmp, recvPacket, rpktlen)) != SG_PACKT_OK ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed deserialization of packet [%d]", ret );
-                return( -1 );
-            }
+    // Take a free slot, the queue is full without one
+    if ((x = sgAsync.freeList) != -1){
+        req = &sgAsync.reqs[x];
+        sgAsync.freeList = req->next;
+        token = sgAsync.nextToken;
+        sgAsync.nextToken = (sgAsync.nextToken == INT_MAX) ? 0 : sgAsync.nextToken + 1;
+        req->token = token;
+        req->fh = fh;
+        req->buf = buf;
+        req->len = len;
+        req->off = off;
+        if (op != SG_ASYNC_WILLNEED){
+            first = (off / SG_BLOCK_SIZE > INT_MAX) ? INT_MAX : off / SG_BLOCK_SIZE;
+            last = (len == 0) ? first - 1 : (len - 1 > SIZE_MAX - off) ? INT_MAX :
+                    ((off + len - 1) / SG_BLOCK_SIZE > INT_MAX) ? INT_MAX : (off + len - 1) / SG_BLOCK_SIZE;
+        }
+        req->first = first;
+        req->last = last;
+        req->op = op;
+        req->result = -1;
+        req->next = -1;
+        if (sgAsync.subTail != -1){
+            sgAsync.reqs[sgAsync.subTail].next = x;
+        }
+        else{
+            sgAsync.subHead = x;
+        }
+        sgAsync.subTail = x;
+        sgAsync.outstanding++;
+        sgAsync.pending++;
+        pthread_cond_signal(&sgAsync.work);
+    }
 
-            updateRseq(rem, srem);
-            memcpy(tmp, buf, 256);
-
-            remote = getLastRseq(files[fh].nodeID[destblock]) + 1;
-            // Setup the packet
-            if ( (ret = serialize_sg_packet( sgLocalNodeId,    // Local ID
-                            (files[fh].nodeID[destblock]),     // Remote ID
-                            (files[fh].blocks[destblock]),     // Block ID
-                                            SG_UPDATE_BLOCK,   // Operation
-                                            sgLocalSeqno++,    // Sender sequence number
-                                                    remote++,  // Receiver sequence number
-                                            tmp, initPacket, &pktlen)) != SG_PACKT_OK ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed serialization of packet [%d].", ret );
-                return( -1 );
-            }
+    pthread_mutex_unlock(&sgAsync.lock);
+    return( token );
+}
 
-            // Send the packet
-            if ( sgServicePost(initPacket, &pktlen, recvPacket, &rpktlen) ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed packet post" );
-                return( -1 );
-            } 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgAsyncWorker
+// Description  : The I/O thread: run queued requests in order and move them
+//                to the completion queue (WILLNEED fetches just free their
+//                slot).  One thread is enough, the bus takes one request at
+//                a time in sequence number order.
+//
+// Inputs       : arg - unused
+// Outputs      : NULL
 
-            // Unpack the recieived data
-            if ( (ret = deserialize_sg_packet(&loc, &rem, &blkid, &op, &sloc, 
-                                            &srem, buf, recvPacket, rpktlen)) != SG_PACKT_OK ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed deserialization of packet [%d]", ret );
-                return( -1 );
-            }
+void *sgAsyncWorker (void *arg){
 
-            updateRseq(rem, srem);
- 
-        }
+    struct asyncrequest *req;
+    struct archive *file;
+    int x, result;
 
-        if (files[fh].pos % 1024 == 256){
+    pthread_mutex_lock(&sgAsync.lock);
+    while (1){
 
-            remote = getLastRseq(files[fh].nodeID[destblock]) + 1;
+        while ((sgAsync.subHead == -1) && !sgAsync.stop){
+            pthread_cond_wait(&sgAsync.work, &sgAsync.lock);
+        }
+        if (sgAsync.subHead == -1){
+            break;
+        }
 
-            // Setup the packet
-            if ( (ret = serialize_sg_packet( sgLocalNodeId,    // Local ID
-                            (files[fh].nodeID[destblock]),     // Remote ID
-                            (files[fh].blocks[destblock]),     // Block ID
-                                            SG_OBTAIN_BLOCK,   // Operation
-                                            sgLocalSeqno++,    // Sender sequence number
-                                                    remote,  // Receiver sequence number
-                                            NULL, initPacket, &pktlen)) != SG_PACKT_OK ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed serialization of packet [%d].", ret );
-                return( -1 );
-            }
+        // Take the oldest request, run it without the queue locked
+        x = sgAsync.subHead;
+        req = &sgAsync.reqs[x];
+        if ((sgAsync.subHead = req->next) == -1){
+            sgAsync.subTail = -1;
+        }
+        sgAsync.active = x;
+        pthread_mutex_unlock(&sgAsync.lock);
+        switch (req->op){
+            case SG_ASYNC_WRITE:
+                result = sgpwrite(req->fh, req->buf, req->len, req->off);
+                break;
+            case SG_ASYNC_WILLNEED:
+                result = -1;
+                if ((file = sgLockFile(req->fh, 0)) != NULL){
+                    result = sgWillNeed(file, req->first, req->last);
+                    pthread_rwlock_unlock(&file->lock);
+                }
+                break;
+            default:
+                result = sgpread(req->fh, req->buf, req->len, req->off);
+                break;
+        }
+        pthread_mutex_lock(&sgAsync.lock);
+        sgAsync.active = -1;
+
+        // Nobody collects a prefetch, its slot is free now
+        if (req->op == SG_ASYNC_WILLNEED){
+            req->next = sgAsync.freeList;
+            sgAsync.freeList = x;
+            sgAsync.outstanding--;
+            sgAsync.pending--;
+            pthread_cond_broadcast(&sgAsync.done);
+            continue;
+        }
 
-            // Send the packet
-            if ( sgServicePost(initPacket, &pktlen, recvPacket, &rpktlen) ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed packet post" );
-                return( -1 );
-            } 
+        req->result = result;
+        req->next = -1;
+        if (sgAsync.doneTail != -1){
+            sgAsync.reqs[sgAsync.doneTail].next = x;
+        }
+        else{
+            sgAsync.doneHead = x;
+        }
+        sgAsync.doneTail = x;
+        sgAsync.pending--;
+        pthread_cond_broadcast(&sgAsync.done);
 
-            // Unpack the recieived data
-            if ( (ret = deserialize_sg_packet(&loc, &rem, &blkid, &op, &sloc, 
-                                            &srem, tmp, recvPacket, rpktlen)) != SG_PACKT_OK ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed deserialization of packet [%d]", ret );
-                return( -1 );
-            }
+    }
+    pthread_mutex_unlock(&sgAsync.lock);
 
-            updateRseq(rem, srem);
-            memcpy(tmp + 256, buf, 256);
-            remote = getLastRseq(files[fh].nodeID[destblock]) + 1;
-
-            // Setup the packet
-            if ( (ret = serialize_sg_packet( sgLocalNodeId,    // Local ID
-                            (files[fh].nodeID[destblock]),     // Remote ID
-                            (files[fh].blocks[destblock]),     // Block ID
-                                            SG_UPDATE_BLOCK,   // Operation
-                                            sgLocalSeqno++,    // Sender sequence number
-                                                    remote,  // Receiver sequence number
-                                            tmp, initPacket, &pktlen)) != SG_PACKT_OK ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed serialization of packet [%d].", ret );
-                return( -1 );
+    return( NULL );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgAsyncCollect
+// Description  : Take finished requests off the completion queue, waiting
+//                for min of them (or for all that are queued, if fewer)
+//
+// Inputs       : done - place to put them
+//                min - least to wait for
+//                max - most to collect
+// Outputs      : number collected
+
+int sgAsyncCollect (SG_Completion *done, int min, int max){
+
+    int x, n = 0;
+
+    pthread_mutex_lock(&sgAsync.lock);
+    while (n < max){
+
+        if (sgAsync.doneHead == -1){
+            if ((n >= min) || (sgAsync.pending == 0)){
+                break;
             }
+            pthread_cond_wait(&sgAsync.done, &sgAsync.lock);
+            continue;
+        }
 
-            // Send the packet
-            if ( sgServicePost(initPacket, &pktlen, recvPacket, &rpktlen) ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed packet post" );
-                return( -1 );
-            } 
+        // Hand it back and free the slot
+        x = sgAsync.doneHead;
+        if ((sgAsync.doneHead = sgAsync.reqs[x].next) == -1){
+            sgAsync.doneTail = -1;
+        }
+        done[n].token = sgAsync.reqs[x].token;
+        done[n].result = sgAsync.reqs[x].result;
+        n++;
+        sgAsync.reqs[x].next = sgAsync.freeList;
+        sgAsync.freeList = x;
+        sgAsync.outstanding--;
 
-            // Unpack the recieived data
-            if ( (ret = deserialize_sg_packet(&loc, &rem, &blkid, &op, &sloc, 
-                                            &srem, buf, recvPacket, rpktlen)) != SG_PACKT_OK ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed deserialization of packet [%d]", ret );
-                return( -1 );
-            }  
+    }
+    pthread_mutex_unlock(&sgAsync.lock);
+
+    return( n );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgAsyncDrain
+// Description  : Wait for the queued requests a blocking call depends on,
+//                so it sees its blocks as they leave them (their results
+//                stay on the completion queue).  A read waits for the
+//                writes and prefetches of its blocks, a write also for the
+//                reads; requests on other files or blocks go on.
+//
+// Inputs       : fh - filehandle (-1 for every request)
+//                off - start of the range
+//                len - length of the range (SIZE_MAX for the whole file)
+//                write - 1 if the caller changes the range, 0 if it
+//                        reads it
+// Outputs      : none
+
+void sgAsyncDrain (SgFHandle fh, size_t off, size_t len, int write){
+
+    size_t first = off / SG_BLOCK_SIZE, last;
 
-            updateRseq(rem, srem);
+    if (len == 0){
+        return;
+    }
+    last = (len - 1 > SIZE_MAX - off) ? SIZE_MAX : (off + len - 1) / SG_BLOCK_SIZE;
 
+    // The I/O thread's own calls go ahead, the request they run is theirs
+    pthread_mutex_lock(&sgAsync.lock);
+    if (sgAsync.running && !pthread_equal(pthread_self(), sgAsync.worker)){
+        while (sgAsyncConflict(fh, first, last, write)){
+            pthread_cond_wait(&sgAsync.done, &sgAsync.lock);
         }
+    }
+    pthread_mutex_unlock(&sgAsync.lock);
+}
 
-        if (files[fh].pos % 1024 == 512){
-            
-            remote = getLastRseq(files[fh].nodeID[destblock]) + 1;
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgAsyncConflict
+// Description  : Check for a queued or running request a blocking call
+//                must wait for (called with the queue locked)
+//
+// Inputs       : fh - filehandle (-1 for every request)
+//                first - first block of the call
+//                last - last block of the call
+//                write - 1 if the call changes the blocks, 0 if it reads
+//                        them
+// Outputs      : 1 if there is one, 0 if not
 
-            // Setup the packet
-            if ( (ret = serialize_sg_packet( sgLocalNodeId,    // Local ID
-                            (files[fh].nodeID[destblock]),     // Remote ID
-                            (files[fh].blocks[destblock]),     // Block ID
-                                            SG_OBTAIN_BLOCK,   // Operation
-                                            sgLocalSeqno++,    // Sender sequence number
-                                                    remote,  // Receiver sequence number
-                                            NULL, initPacket, &pktlen)) != SG_PACKT_OK ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed serialization of packet [%d].", ret );
-                return( -1 );
-            }
-            // Send the packet
-            if ( sgServicePost(initPacket, &pktlen, recvPacket, &rpktlen) ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed packet post" );
-                return( -1 );
-            } 
-            // Unpack the recieived data
-            if ( (ret = deserialize_sg_packet(&loc, &rem, &blkid, &op, &sloc, 
-                                            &srem, tmp, recvPacket, rpktlen)) != SG_PACKT_OK ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed deserialization of packet [%d]", ret );
-                return( -1 );
-            } 
-
-            updateRseq(rem, srem);
-            memcpy(tmp + 512, buf, 256);
-            remote = getLastRseq(files[fh].nodeID[destblock]) + 1;
-
-            // Setup the packet
-            if ( (ret = serialize_sg_packet( sgLocalNodeId,    // Local ID
-                            (files[fh].nodeID[destblock]),     // Remote ID
-                            (files[fh].blocks[destblock]),     // Block ID
-                                            SG_UPDATE_BLOCK,   // Operation
-                                            sgLocalSeqno++,    // Sender sequence number
-                                                    remote,  // Receiver sequence number
-                                            tmp, initPacket, &pktlen)) != SG_PACKT_OK ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed serialization of packet [%d].", ret );
-                return( -1 );
-            }
+int sgAsyncConflict (SgFHandle fh, size_t first, size_t last, int write){
 
-            // Send the packet
-            if ( sgServicePost(initPacket, &pktlen, recvPacket, &rpktlen) ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed packet post" );
-                return( -1 );
-            } 
+    struct asyncrequest *req;
+    int x;
+
+    for (x = (sgAsync.active != -1) ? sgAsync.active : sgAsync.subHead; x != -1;
+            x = (x == sgAsync.active) ? sgAsync.subHead : req->next){
+        req = &sgAsync.reqs[x];
+        if ( (fh == -1) || ((req->fh == fh) && (write || (req->op != SG_ASYNC_READ)) &&
+                (req->first <= req->last) && ((size_t)req->first <= last) && ((size_t)req->last >= first)) ) {
+            return( 1 );
+        }
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgAsyncStop
+// Description  : Run what is queued, stop the I/O thread and drop the
+//                request slots (results not collected are lost)
+//
+// Inputs       : none
+// Outputs      : none
+
+void sgAsyncStop (void){
+
+    if (sgAsync.running){
+        pthread_mutex_lock(&sgAsync.lock);
+        sgAsync.stop = 1;
+        pthread_cond_signal(&sgAsync.work);
+        pthread_mutex_unlock(&sgAsync.lock);
+        pthread_join(sgAsync.worker, NULL);
+        pthread_mutex_lock(&sgAsync.lock);
+        sgAsync.running = 0;
+        pthread_mutex_unlock(&sgAsync.lock);
+    }
 
-            // Unpack the recieived data
-            if ( (ret = deserialize_sg_packet(&loc, &rem, &blkid, &op, &sloc, 
-                                            &srem, buf, recvPacket, rpktlen)) != SG_PACKT_OK ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed deserialization of packet [%d]", ret );
+    free(sgAsync.reqs);
+    sgAsync.reqs = NULL;
+    sgAsync.outstanding = 0;
+    sgAsync.pending = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgWillNeed
+// Description  : Fetch the blocks of a range that are not cached, for a
+//                WILLNEED hint (usually on the I/O thread; called with the
+//                file locked)
+//
+// Inputs       : file - the file
+//                first - first block of the range
+//                last - last block of the range
+// Outputs      : 0 if successful, -1 if failure
+
+int sgWillNeed (struct archive *file, int first, int last){
+
+    char data[SG_BLOCK_SIZE];
+    int x;
+
+    for (x = first; (x <= last) && (x < file->blockcount); x++){
+        if ( !hasSGDataBlock(file->nodeID[x], file->blocks[x]) ) {
+            if ( sgFetchBlock(file->nodeID[x], file->blocks[x], data) ||
+                    insertSGDataBlock(file->id, file->nodeID[x], file->blocks[x], data, 0) ) {
+                logMessage( LOG_ERROR_LEVEL, "sgWillNeed: failed to fetch block %d of file %d", x, file->id );
                 return( -1 );
             }
+        }
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgFlushFile
+// Description  : Write back the dirty cached blocks of an open file
+//
+// Inputs       : file - the file (locked)
+// Outputs      : 0 if successful, -1 if failure
 
-            updateRseq(rem, srem);
+int sgFlushFile (struct archive *file){
 
+    int x;
+
+    for (x = 0; x < file->blockcount; x++){
+
+        if ( flushSGDataBlock(file->nodeID[x], file->blocks[x]) ) {
+            logMessage( LOG_ERROR_LEVEL, "sgflush: failed to write back block %d of file %d", x, file->id );
+            return( -1 );
         }
 
-        if (files[fh].pos % 1024 == 768){
+    }
 
-            remote = getLastRseq(files[fh].nodeID[destblock]) + 1;
-            // Setup the packet
-            if ( (ret = serialize_sg_packet( sgLocalNodeId,    // Local ID
-                            (files[fh].nodeID[destblock]),     // Remote ID
-                            (files[fh].blocks[destblock]),     // Block ID
-                                            SG_OBTAIN_BLOCK,   // Operation
-                                            sgLocalSeqno++,    // Sender sequence number
-                                                    remote,  // Receiver sequence number
-                                            NULL, initPacket, &pktlen)) != SG_PACKT_OK ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed serialization of packet [%d].", ret );
-                return( -1 );
-            }
+    return( 0 );
+}
 
-            // Send the packet
-            if ( sgServicePost(initPacket, &pktlen, recvPacket, &rpktlen) ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed packet post" );
-                return( -1 );
-            } 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgOblock
+// Description  : Obtain part of a block, from the cache or else from its
+//                node (then cached), and read ahead after it
+//
+// Inputs       : file - the file (locked)
+//                blk - block (index in the file)
+//                buf - place to put the data
+//                off - offset in the block
+//                len - length of the segment (off + len <= SG_BLOCK_SIZE)
+//                ahead - 1 to read ahead, 0 to leave the read-ahead alone
+// Outputs      : 0 if successful, -1 if failure
 
-            // Unpack the recieived data
-            if ( (ret = deserialize_sg_packet(&loc, &rem, &blkid, &op, &sloc, 
-                                            &srem, tmp, recvPacket, rpktlen)) != SG_PACKT_OK ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed deserialization of packet [%d]", ret );
-                return( -1 );
-            }
+int sgOblock (struct archive *file, int blk, char *buf, size_t off, size_t len, int ahead){
 
-            updateRseq(rem, srem);
-            memcpy(tmp + 768, buf, 256);
-            remote = getLastRseq(files[fh].nodeID[destblock]) + 1;
-
-            // Setup the packet
-            if ( (ret = serialize_sg_packet( sgLocalNodeId,    // Local ID
-                            (files[fh].nodeID[destblock]),     // Remote ID
-                            (files[fh].blocks[destblock]),     // Block ID
-                                            SG_UPDATE_BLOCK,   // Operation
-                                            sgLocalSeqno++,    // Sender sequence number
-                                            remote,  // Receiver sequence number
-                                            tmp, initPacket, &pktlen)) != SG_PACKT_OK ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed serialization of packet [%d].", ret );
-                return( -1 );
-            }
+    char tmp[SG_BLOCK_SIZE];
+    char *data;
+    SG_Node_ID nid = file->nodeID[blk];
+    SG_Block_ID bid = file->blocks[blk];
 
-            // Send the packet
-            if ( sgServicePost(initPacket, &pktlen, recvPacket, &rpktlen) ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed packet post" );
-                return( -1 );
-            } 
+    // Served from the cache, copied out under the shard lock alone
+    if (readSGDataBlock(file->id, nid, bid, buf, off, len) == 0){
+        if (ahead){
+            sgReadAhead(file, blk);
+        }
+        return( 0 );
+    }
 
-            // Unpack the recieived data
-            if ( (ret = deserialize_sg_packet(&loc, &rem, &blkid, &op, &sloc, 
-                                            &srem, buf, recvPacket, rpktlen)) != SG_PACKT_OK ) {
-                logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: failed deserialization of packet [%d]", ret );
-                return( -1 );
+    // A whole block goes straight into the caller's buffer
+    data = (len == SG_BLOCK_SIZE) ? buf : tmp;
+    if ( sgFetchBlock(nid, bid, data) ) {
+        return( -1 );
+    }
+    if (data == tmp){
+        memcpy(buf, tmp + off, len);
+    }
+    insertSGDataBlock(file->id, nid, bid, data, 0);
+
+    if (ahead){
+        sgReadAhead(file, blk);
+    }
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgUblock
+// Description  : Update part of a block.  A block past the end of the file
+//                is created (the rest of it zeroed).  Otherwise the cached
+//                copy is patched, or the block is fetched and patched, unless
+//                the whole block is replaced; it is then sent right away, or
+//                left dirty in the cache in write-back mode.  Called with the
+//                file locked alone, so no reader fills the cache from the
+//                node in between.
+//
+// Inputs       : file - the file
+//                blk - block (index in the file)
+//                buf - the data to write
+//                off - offset in the block
+//                len - length of the segment (off + len <= SG_BLOCK_SIZE)
+// Outputs      : 0 if successful, -1 if failure
+
+int sgUblock (struct archive *file, int blk, char *buf, size_t off, size_t len){
+
+    char tmp[SG_BLOCK_SIZE];
+    SG_Node_ID nid;
+    SG_Block_ID bid;
+
+    // Appending a new block
+    if (blk >= file->blockcount){
+
+        if (blk >= SG_MAX_BLOCKS_PER_FILE){
+            logMessage( LOG_ERROR_LEVEL, "sgUblock: file %d is full at %d blocks", file->id, blk );
+            return( -1 );
+        }
+        memset(tmp, 0, SG_BLOCK_SIZE);
+        memcpy(tmp + off, buf, len);
+        return( sgCblock(file, tmp, SG_BLOCK_SIZE) );
+
+    }
+
+    nid = file->nodeID[blk];
+    bid = file->blocks[blk];
+
+    // The cache holds the current block, patch it and write it through
+    // (or leave it dirty for the flush)
+    if (writeSGDataBlock(file->id, nid, bid, buf, off, len, sgWriteBack ? 1 : SG_CACHE_WRITE_THROUGH) == 0){
+        return( 0 );
+    }
+
+    // Otherwise (or if writing it through failed and it was dropped) start
+    // from the node's copy, unless all of it is replaced
+    if ( (len < SG_BLOCK_SIZE) && sgFetchBlock(nid, bid, tmp) ) {
+        return( -1 );
+    }
+    memcpy(tmp + off, buf, len);
+
+    // Write-back: cache it dirty; with no room for another dirty block,
+    // write this one through and make sure no older copy of it is left
+    if ( sgWriteBack ) {
+        if ( insertSGDataBlock(file->id, nid, bid, tmp, 1) ) {
+            invalidateSGDataBlock( nid, bid );
+            return( sgFlushBlock(nid, bid, tmp) );
+        }
+        return( 0 );
+    }
+
+    // The block now matches the remote copy, keep it (or at least make
+    // sure no older copy of it is left in the cache)
+    if ( sgFlushBlock(nid, bid, tmp) ) {
+        return( -1 );
+    }
+    if ( insertSGDataBlock(file->id, nid, bid, tmp, 0) ) {
+        invalidateSGDataBlock( nid, bid );
+    }
+
+    return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgReadAhead
+// Description  : Track the reader and prefetch the next blocks of the file
+//                into the cache.  The window opens once the reader has gone
+//                through SG_READAHEAD_RUN blocks in order, doubles with each
+//                further block and collapses on a jump.  Advice overrides
+//                it: SEQUENTIAL keeps the full window open, RANDOM keeps it
+//                shut, and a NOREUSE block is pushed out when left behind.
+//                All of it is best effort, the read itself has already been
+//                served, so failures are only logged.  The window moves
+//                under the driver lock, the blocks are fetched without it.
+//
+// Inputs       : file - the file (locked)
+//                blk - block (index in the file) just read
+// Outputs      : none
+
+void sgReadAhead (struct archive *file, int blk){
+
+    char data[SG_BLOCK_SIZE];
+    int x, first, last, left = -1;
+
+    pthread_mutex_lock(&sgDriverLock);
+    if (blk == file->raLast){
+        pthread_mutex_unlock(&sgDriverLock);
+        return;
+    }
+
+    // A block read once is pushed out as soon as the reader moves on
+    if ((file->raLast >= 0) && sgNoReuse(file, file->raLast)){
+        left = file->raLast;
+    }
+
+    if (file->advice == SG_ADVICE_RANDOM){
+
+        // Advised random, never read ahead
+        file->raWindow = 0;
+
+    }
+    else if (file->advice == SG_ADVICE_SEQUENTIAL){
+
+        // Advised sequential, the window stays open across jumps
+        file->raWindow = sgReadAheadMax;
+        if (blk != file->raLast + 1){
+            file->raAhead = -1;
+        }
+
+    }
+    else if (blk == file->raLast + 1){
+
+        // Sequential, open or grow the window
+        file->raRun++;
+        if (file->raRun >= SG_READAHEAD_RUN){
+            file->raWindow = (file->raWindow == 0) ? 1 : file->raWindow * 2;
+            if (file->raWindow > sgReadAheadMax){
+                file->raWindow = sgReadAheadMax;
             }
+        }
+
+    }
+    else{
+
+        // Random access, stop reading ahead
+        file->raRun = 0;
+        file->raWindow = 0;
+        file->raAhead = -1;
+
+    }
+    file->raLast = blk;
+
+    // The cache may have shrunk under an open window
+    if (file->raWindow > sgReadAheadMax){
+        file->raWindow = sgReadAheadMax;
+    }
+
+    // What the window covers that has not been fetched yet, taken now so
+    // another reader of the file does not fetch it too
+    last = blk + file->raWindow;
+    if (last >= file->blockcount){
+        last = file->blockcount - 1;
+    }
+    first = (file->raAhead > blk) ? file->raAhead + 1 : blk + 1;
+    if (first <= last){
+        file->raAhead = last;
+    }
+    pthread_mutex_unlock(&sgDriverLock);
+
+    if ( (left >= 0) && evictSGDataBlock(file->nodeID[left], file->blocks[left]) ) {
+        logMessage( LOG_ERROR_LEVEL, "sgReadAhead: failed to push out block %d of file %d", left, file->id );
+    }
+
+    for (x = first; x <= last; x++){
 
-            updateRseq(rem, srem);
+        if ( !hasSGDataBlock(file->nodeID[x], file->blocks[x]) ) {
+            if ( sgFetchBlock(file->nodeID[x], file->blocks[x], data) ||
+                    insertSGDataBlock(file->id, file->nodeID[x], file->blocks[x], data, 0) ) {
+                logMessage( LOG_ERROR_LEVEL, "sgReadAhead: failed to prefetch block %d of file %d", x, file->id );
 
+                // The rest is fetched again by the next read
+                pthread_mutex_lock(&sgDriverLock);
+                if (file->raAhead == last){
+                    file->raAhead = x - 1;
+                }
+                pthread_mutex_unlock(&sgDriverLock);
+                return;
+            }
         }
+
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgCacheResized
+// Description  : Size the prefetching to the cache: read-ahead takes a
+//                quarter of it at most so it cannot flush it, an explicit
+//                WILLNEED up to half.  Called at start and after a resize.
+//
+// Inputs       : maxElements - blocks the cache holds
+// Outputs      : none
+
+void sgCacheResized (uint32_t maxElements){
+
+    sgReadAheadMax = (maxElements / 4 < SG_READAHEAD_MAX) ? maxElements / 4 : SG_READAHEAD_MAX;
+    sgWillNeedMax = maxElements / 2;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgNoReuse
+// Description  : Check whether a block was advised NOREUSE, so it leaves
+//                the cache once read (called with the driver lock held)
+//
+// Inputs       : file - the file
+//                blk - block (index in the file)
+// Outputs      : 1 if read once, 0 if not
+
+int sgNoReuse (struct archive *file, int blk){
+
+    return( (blk >= file->nrFirst) && (blk <= file->nrLast) );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgFetchBlock
+// Description  : Obtain a whole block from its node
+//
+// Inputs       : nid - node ID
+//                bid - block ID
+//                data - place to put the block (SG_BLOCK_SIZE)
+// Outputs      : 0 if successful, -1 if failure
+
+int sgFetchBlock (SG_Node_ID nid, SG_Block_ID bid, char *data){
+
+    char initPacket[SG_DATA_PACKET_SIZE], recvPacket[SG_DATA_PACKET_SIZE];
+    size_t pktlen, rpktlen;
+    SG_Node_ID loc, rem;
+    SG_Block_ID blkid;
+    SG_SeqNum sloc, srem;
+    SG_System_OP op;
+    SG_Packet_Status ret;
+
+    pktlen = SG_DATA_PACKET_SIZE;
+    rpktlen = SG_DATA_PACKET_SIZE;
+
+    // One exchange on the bus at a time, so the sequence numbers go out
+    // in the order the nodes expect them
+    pthread_mutex_lock(&sgBusLock);
+    remote = getLastRseq(nid) + 1;
+
+    // Setup the packet
+    if ( (ret = serialize_sg_packet( sgLocalNodeId,    // Local ID
+                                    nid,               // Remote ID
+                                    bid,               // Block ID
+                                    SG_OBTAIN_BLOCK,   // Operation
+                                    sgLocalSeqno++,    // Sender sequence number
+                                    remote,            // Receiver sequence number
+                                    NULL, initPacket, &pktlen)) != SG_PACKT_OK ) {
+        logMessage( LOG_ERROR_LEVEL, "sgFetchBlock: failed serialization of packet [%d].", ret );
+        pthread_mutex_unlock(&sgBusLock);
+        return( -1 );
     }
 
+    // Send the packet
+    if ( sgServicePost(initPacket, &pktlen, recvPacket, &rpktlen) ) {
+        logMessage( LOG_ERROR_LEVEL, "sgFetchBlock: failed packet post" );
+        sgNewEpoch(nid);
+        pthread_mutex_unlock(&sgBusLock);
+        return( -1 );
+    }
+
+    // Unpack the recieived data
+    if ( (ret = deserialize_sg_packet(&loc, &rem, &blkid, &op, &sloc,
+                                    &srem, data, recvPacket, rpktlen)) != SG_PACKT_OK ) {
+        logMessage( LOG_ERROR_LEVEL, "sgFetchBlock: failed deserialization of packet [%d]", ret );
+        pthread_mutex_unlock(&sgBusLock);
+        return( -1 );
+    }
+
+    updateRseq(rem, srem);
+    pthread_mutex_unlock(&sgBusLock);
+
     // Sanity check the return value
     if ( loc == SG_NODE_UNKNOWN ) {
-        logMessage( LOG_ERROR_LEVEL, "sgInitEndpoint: bad local ID returned [%ul]", loc );
+        logMessage( LOG_ERROR_LEVEL, "sgFetchBlock: bad local ID returned [%ul]", loc );
+        return( -1 );
+    }
+
+    return ( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgFlushBlock
+// Description  : Write a whole block back to its node (also the cache's
+//                flush handler for dirty blocks)
+//
+// Inputs       : nid - node ID
+//                bid - block ID
+//                data - the block (SG_BLOCK_SIZE)
+// Outputs      : 0 if successful, -1 if failure
+
+int sgFlushBlock (SG_Node_ID nid, SG_Block_ID bid, char *data){
+
+    char initPacket[SG_DATA_PACKET_SIZE], recvPacket[SG_DATA_PACKET_SIZE];
+    char reply[SG_BLOCK_SIZE];
+    size_t pktlen, rpktlen;
+    SG_Node_ID loc, rem;
+    SG_Block_ID blkid;
+    SG_SeqNum sloc, srem;
+    SG_System_OP op;
+    SG_Packet_Status ret;
+
+    pktlen = SG_DATA_PACKET_SIZE;
+    rpktlen = SG_DATA_PACKET_SIZE;
+
+    // One exchange on the bus at a time, so the sequence numbers go out
+    // in the order the nodes expect them
+    pthread_mutex_lock(&sgBusLock);
+    remote = getLastRseq(nid) + 1;
+
+    // Setup the packet
+    if ( (ret = serialize_sg_packet( sgLocalNodeId,    // Local ID
+                                    nid,               // Remote ID
+                                    bid,               // Block ID
+                                    SG_UPDATE_BLOCK,   // Operation
+                                    sgLocalSeqno++,    // Sender sequence number
+                                    remote,            // Receiver sequence number
+                                    data, initPacket, &pktlen)) != SG_PACKT_OK ) {
+        logMessage( LOG_ERROR_LEVEL, "sgFlushBlock: failed serialization of packet [%d].", ret );
+        pthread_mutex_unlock(&sgBusLock);
+        return( -1 );
+    }
+
+    // Send the packet
+    if ( sgServicePost(initPacket, &pktlen, recvPacket, &rpktlen) ) {
+        logMessage( LOG_ERROR_LEVEL, "sgFlushBlock: failed packet post" );
+        sgNewEpoch(nid);
+        pthread_mutex_unlock(&sgBusLock);
+        return( -1 );
+    }
+
+    // Unpack the recieived data (the block itself stays as written)
+    if ( (ret = deserialize_sg_packet(&loc, &rem, &blkid, &op, &sloc,
+                                    &srem, reply, recvPacket, rpktlen)) != SG_PACKT_OK ) {
+        logMessage( LOG_ERROR_LEVEL, "sgFlushBlock: failed deserialization of packet [%d]", ret );
+        pthread_mutex_unlock(&sgBusLock);
+        return( -1 );
+    }
+
+    updateRseq(rem, srem);
+    pthread_mutex_unlock(&sgBusLock);
+
+    // Sanity check the return value
+    if ( loc == SG_NODE_UNKNOWN ) {
+        logMessage( LOG_ERROR_LEVEL, "sgFlushBlock: bad local ID returned [%ul]", loc );
         return( -1 );
     }
 
-    // Set the local node ID, log and return successfully
-    sgLocalNodeId = rem;
     return ( 0 );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : updateRseq
-// Description  : Update the remote sequence #
+// Description  : Update the remote sequence #.  Anything but the next one
+//                (a gap, or a rollback from a node that restarted) means
+//                the node was not only ours, so it starts a new epoch.
 //
 // Inputs       : nid - nodeID
 //                s - input sequence #
@@ -1028,22 +2622,32 @@ int sgUblock (SgFHandle fh, char *buf, size_t len){
 
 int updateRseq ( SG_Node_ID nid, SG_SeqNum s ){
 
-    int x;
+    int x, stale = 0;
 
+    pthread_mutex_lock(&sgNodeLock);
     for (x = 0; x < nodecount; x++){
 
         if (nArray[x].nodeID == nid){
+            stale = (s != (SG_SeqNum)(nArray[x].rseq + 1));
             nArray[x].rseq = s;
-            return 0;
+            break;
         }
 
     }
 
-    nArray[nodecount].nodeID = nid;
-    nArray[nodecount].rseq = SG_INITIAL_SEQNO;
-    nodecount++;
+    if (x == nodecount){
+        nArray[nodecount].nodeID = nid;
+        nArray[nodecount].rseq = SG_INITIAL_SEQNO;
+        nArray[nodecount].epoch = 0;
+        nodecount++;
+    }
+    pthread_mutex_unlock(&sgNodeLock);
+
+    if (stale){
+        sgNewEpoch(nid);
+    }
     return 0;
-    
+
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1056,14 +2660,78 @@ int updateRseq ( SG_Node_ID nid, SG_SeqNum s ){
 
 SG_SeqNum getLastRseq ( SG_Node_ID nid ) {
 
+    SG_SeqNum found = 0;
     int x;
 
+    pthread_mutex_lock(&sgNodeLock);
     for (x = 0; x < nodecount; x++){
 
         if (nArray[x].nodeID == nid){
-            return nArray[x].rseq;
+            found = nArray[x].rseq;
+            break;
         }
 
     }
-    return 0;
+    pthread_mutex_unlock(&sgNodeLock);
+    return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : getNodeEpoch
+// Description  : Get the epoch of a node, the version its blocks are cached
+//                with (64 bits, so it never wraps)
+//
+// Inputs       : nid - nodeID
+// Outputs      : the node's epoch (0 if it is not known yet)
+
+uint64_t getNodeEpoch ( SG_Node_ID nid ) {
+
+    uint64_t found = 0;
+    int x;
+
+    pthread_mutex_lock(&sgNodeLock);
+    for (x = 0; x < nodecount; x++){
+
+        if (nArray[x].nodeID == nid){
+            found = nArray[x].epoch;
+            break;
+        }
+
+    }
+    pthread_mutex_unlock(&sgNodeLock);
+    return found;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : sgNewEpoch
+// Description  : Start a new epoch for a node whose blocks may have changed
+//                without us (its sequence numbers jumped or rolled back, or
+//                an exchange with it failed part way), so the clean blocks
+//                cached from it are dropped when next looked up
+//
+// Inputs       : nid - nodeID
+// Outputs      : none
+
+void sgNewEpoch ( SG_Node_ID nid ) {
+
+    uint64_t epoch = 0;
+    int x;
+
+    pthread_mutex_lock(&sgNodeLock);
+    for (x = 0; x < nodecount; x++){
+
+        if (nArray[x].nodeID == nid){
+            epoch = ++nArray[x].epoch;
+            break;
+        }
+
+    }
+    pthread_mutex_unlock(&sgNodeLock);
+
+    // The cache is told outside the node lock, it reads epochs under its own
+    if ( (epoch > 0) && invalidateSGNode(nid, epoch) ) {
+        logMessage( LOG_ERROR_LEVEL, "sgNewEpoch: failed to invalidate node %lu", (unsigned long)nid );
+    }
 }
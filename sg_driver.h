@@ -12,12 +12,35 @@
 //
 
 // Includes
+#include <sys/uio.h>
 #include <sg_defs.h>
+#include <sg_cache.h>
 
 // Defines 
+#define SG_ADVICE_NORMAL 0        // No particular access pattern (default)
+#define SG_ADVICE_SEQUENTIAL 1    // Read front to back, read ahead fully
+#define SG_ADVICE_RANDOM 2        // Read at random, do not read ahead
+#define SG_ADVICE_WILLNEED 3      // Range will be read soon, fetch it in the background
+#define SG_ADVICE_DONTNEED 4      // Range will not be read soon, push it out
+#define SG_ADVICE_NOREUSE 5       // Range will be read once, let it go after
+#define SG_ASYNC_DEPTH 32         // Default async queue depth (requests)
+#define SG_ASYNC_DEPTH_LIMIT 4096 // Deepest async queue
 
 // Type definitions
 
+// A range of a file and the caller's buffer for it
+typedef struct {
+    size_t off;               // Offset in the file
+    char *buf;                // Data to write, or place to read into
+    size_t len;               // Length of the range
+} SG_Range;
+
+// A finished asynchronous request
+typedef struct {
+    int token;                // What sgread_async or sgwrite_async returned
+    int result;               // Bytes transferred, -1 if failure
+} SG_Completion;
+
 // Global interface definitions
 
 // Type definitions
@@ -33,12 +56,63 @@ int sgread( SgFHandle fh, char *buf, size_t len );
 int sgwrite( SgFHandle fh, char *buf, size_t len );
     // Write data to the file
 
+int sgpread( SgFHandle fh, char *buf, size_t len, size_t off );
+    // Read data from the file at an offset (the position is not moved, and
+    // there is no read-ahead); like every call here, safe from several threads
+
+int sgpwrite( SgFHandle fh, char *buf, size_t len, size_t off );
+    // Write data to the file at an offset (the position is not moved)
+
+int sgreadv( SgFHandle fh, const struct iovec *iov, int iovcnt );
+    // Read data from the file into several buffers, one after the other
+
+int sgwritev( SgFHandle fh, const struct iovec *iov, int iovcnt );
+    // Write data from several buffers to the file, one after the other
+
+int sgreadranges( SgFHandle fh, const SG_Range *ranges, int count );
+    // Read several ranges of the file in one pass over its blocks (there is
+    // no read-ahead)
+
+int sgwriteranges( SgFHandle fh, const SG_Range *ranges, int count );
+    // Write several ranges of the file in one pass over its blocks; a short
+    // count means a block failed and the blocks before it were written
+
+int sgread_async( SgFHandle fh, char *buf, size_t len, size_t off );
+    // Queue a read at an offset, returns its token (-1 if the queue is
+    // full); buf must stay valid until the read is collected
+
+int sgwrite_async( SgFHandle fh, char *buf, size_t len, size_t off );
+    // Queue a write at an offset, returns its token (-1 if the queue is
+    // full); requests run in the order they are queued
+
+int sgpoll_async( SG_Completion *done, int max );
+    // Collect up to max finished requests without waiting
+
+int sgwait_async( SG_Completion *done, int min, int max );
+    // Wait for at least min finished requests, collect up to max
+
+int sgdepth_async( int depth );
+    // Set the async queue depth (no requests outstanding)
+
 int sgseek( SgFHandle fh, size_t off );
     // Seek to a specific place in the file
 
+int sgadvise( SgFHandle fh, size_t off, size_t len, int hint );
+    // Tell the driver how a range of the file will be used (len 0 for the
+    // rest of the file)
+
+int sgflush( SgFHandle fh );
+    // Write back the file's cached (dirty) blocks
+
 int sgclose( SgFHandle fh );
     // Close the file
 
+int sgsetquota( SgFHandle fh, uint32_t blocks );
+    // Limit the blocks cached for the file (0 for no limit)
+
+int sgfilestats( SgFHandle fh, SG_Cache_Counters *counters );
+    // Get the file's cache counters
+
 int sgshutdown( void );
     // Shut down the filesystem
 
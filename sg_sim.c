@@ -20,25 +20,67 @@
 // Project Includes 
 #include <sg_defs.h>
 #include <sg_driver.h>
+#include <sg_cache.h>
 
 // Defines
-#define SG_ARGUMENTS "hvul:"
+#define SG_ARGUMENTS "hvubwafc:p:s:t:m:x:z:o:q:l:"
 #define USAGE \
-	"USAGE: sg_sim [-h] [-v] [-l <logfile>] <workload>\n" \
+	"USAGE: sg_sim [-h] [-v] [-b] [-w] [-a] [-f] [-c <elements>] [-p <policy>] [-s <shards>] [-t <l2 elements>] [-m <shared elements>] [-x <compressed elements>] [-z <max elements>] [-o <close policy>] [-q <depth>] [-l <logfile>] <workload>\n" \
 	"\n" \
 	"where:\n" \
 	"    -h - help mode (display this message)\n" \
 	"    -v - verbose output\n" \
 	"    -u - perform the unit tests\n" \
+	"    -b - run the cache benchmarks\n" \
+	"    -w - write-back cache, updates are sent when blocks are flushed\n" \
+	"         (default SG_CACHE_WRITEBACK or write-through)\n" \
+	"    -a - TinyLFU admission, keep rarely used blocks from evicting\n" \
+	"         frequently used ones (default SG_CACHE_ADMISSION or off)\n" \
+	"    -f - partition the cache, every open file keeps an equal share\n" \
+	"         (default SG_CACHE_PARTITIONED or off)\n" \
+	"    -c - cache <elements> blocks (default SG_CACHE_ELEMENTS or 128)\n" \
+	"    -p - cache eviction <policy>: lru, lfu, clock, arc or 2q\n" \
+	"         (default SG_CACHE_POLICY or lru)\n" \
+	"    -s - split the cache into <shards> locked shards\n" \
+	"         (default SG_CACHE_SHARDS or 8)\n" \
+	"    -t - keep <l2 elements> evicted blocks in an on-disk second tier\n" \
+	"         (default SG_CACHE_L2_ELEMENTS or 0, off; file SG_CACHE_L2_PATH)\n" \
+	"    -m - share <shared elements> blocks with the other processes on\n" \
+	"         the host (default SG_CACHE_SHM_ELEMENTS or 0, off; segment\n" \
+	"         SG_CACHE_SHM_NAME)\n" \
+	"    -x - keep evicted blocks compressed in <compressed elements>\n" \
+	"         blocks of memory (default SG_CACHE_COMPRESSED or 0, off)\n" \
+	"    -z - size the cache automatically, up to <max elements> blocks\n" \
+	"         (default SG_CACHE_AUTOSIZE or 0, fixed size)\n" \
+	"    -o - what closing a file does with its cached blocks: flush,\n" \
+	"         demote (evict them first) or keep (hot for a grace period\n" \
+	"         of SG_CACHE_CLOSE_GRACE ms, then demote; default\n" \
+	"         SG_CACHE_CLOSE or flush)\n" \
+	"    -q - replay reads and writes asynchronously, up to <depth> at\n" \
+	"         once (default 0, one at a time)\n" \
 	"    -l - write log messages to the filename <logfile>\n" \
 	"and\n" \
 	"    workload - is the name of the workload file.  Not that this\n" \
-	"               file is not needed when running the unit tests.\n" \
+	"               file is not needed when running the unit tests\n" \
+	"               or benchmarks.\n" \
 	"\n" \
 
+//
+// Type definitions
+
+// Outstanding asynchronous operation of the simulation
+typedef struct {
+	int token;       // Request token (-1 if the slot is free)
+	int write;       // Write (or read)
+	char *data;      // Data written, or expected to be read
+	char *buf;       // Where the read goes
+	int size;        // Bytes
+} simasync;
+
 //
 // Global Data
 int verbose;
+int asyncDepth = 0; // Async queue depth (0 to replay synchronously)
 unsigned long SGServiceLevel; // Service log level
 unsigned long SGDriverLevel; // Controller log level
 unsigned long SGSimulatorLevel; // Simulation log level
@@ -47,8 +89,15 @@ unsigned long SGSimulatorLevel; // Simulation log level
 // Functional Prototypes
 
 int simulateScatterGather( char *wload ); // ScatterGather simulation
+int simulateSubmit( simasync *pending, SgFHandle fh, workload_operation *op ); // Queue an operation
+int simulateComplete( simasync *pending, int min ); // Check finished operations
 int sg_unit_test( void ); // The program unit tests
 extern int packetUnitTest( void ); // External function (packet processing)
+extern int shmUnitTest( void ); // External function (shared cache tier)
+extern int versionUnitTest( void ); // External function (cache versions)
+extern int policyUnitTest( void ); // External function (eviction order)
+extern int driverUnitTest( void ); // External function (driver calls)
+extern int sgCacheBenchmark( void ); // External function (cache benchmarks)
 
 //
 // Functions
@@ -65,7 +114,10 @@ extern int packetUnitTest( void ); // External function (packet processing)
 int main( int argc, char *argv[] ) {
 
 	// Local variables
-	int ch, verbose = 0, log_initialized = 0, unit_tests = 0;
+	int ch, verbose = 0, log_initialized = 0, unit_tests = 0, benchmarks = 0;
+	unsigned long long elements;
+	int policy;
+	SG_Cache_Config cacheConfig;
 	
 	// Process the command line parameters
 	while ((ch = getopt(argc, argv, SG_ARGUMENTS)) != -1) {
@@ -83,6 +135,116 @@ int main( int argc, char *argv[] ) {
 			unit_tests = 1;
 			break;
 
+		case 'b': // Benchmark Flag
+			benchmarks = 1;
+			break;
+
+		case 'w': // Write-back cache
+			getSGCacheConfig( &cacheConfig );
+			cacheConfig.writeBack = 1;
+			setSGCacheConfig( &cacheConfig );
+			break;
+
+		case 'a': // TinyLFU admission filter
+			getSGCacheConfig( &cacheConfig );
+			cacheConfig.admission = 1;
+			setSGCacheConfig( &cacheConfig );
+			break;
+
+		case 'f': // Partition the cache by file
+			getSGCacheConfig( &cacheConfig );
+			cacheConfig.partitioned = 1;
+			setSGCacheConfig( &cacheConfig );
+			break;
+
+		case 'c': // Set the cache size
+			getSGCacheConfig( &cacheConfig );
+			elements = strtoull( optarg, NULL, 10 );
+			cacheConfig.maxElements = (elements > SG_CACHE_ELEMENTS_LIMIT) ? 0 : (uint32_t)elements;
+			if ( setSGCacheConfig(&cacheConfig) ) {
+				fprintf( stderr, "Bad cache size (%s), aborting.\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'p': // Set the cache eviction policy
+			getSGCacheConfig( &cacheConfig );
+			if ( (policy = parseSGCachePolicy(optarg)) < 0 ) {
+				fprintf( stderr, "Unknown cache policy (%s), aborting.\n", optarg );
+				return( -1 );
+			}
+			cacheConfig.policy = policy;
+			setSGCacheConfig( &cacheConfig );
+			break;
+
+		case 's': // Set the number of cache shards
+			getSGCacheConfig( &cacheConfig );
+			elements = strtoull( optarg, NULL, 10 );
+			cacheConfig.shards = (elements > SG_CACHE_SHARDS_LIMIT) ? 0 : (uint32_t)elements;
+			if ( setSGCacheConfig(&cacheConfig) ) {
+				fprintf( stderr, "Bad cache shard count (%s), aborting.\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 't': // Set the size of the on-disk second tier
+			getSGCacheConfig( &cacheConfig );
+			elements = strtoull( optarg, NULL, 10 );
+			cacheConfig.l2Elements = (elements > SG_CACHE_ELEMENTS_LIMIT) ? (uint32_t)-1 : (uint32_t)elements;
+			if ( setSGCacheConfig(&cacheConfig) ) {
+				fprintf( stderr, "Bad L2 cache size (%s), aborting.\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'm': // Set the size of the shared memory tier
+			getSGCacheConfig( &cacheConfig );
+			elements = strtoull( optarg, NULL, 10 );
+			cacheConfig.shmElements = (elements > SG_CACHE_ELEMENTS_LIMIT) ? (uint32_t)-1 : (uint32_t)elements;
+			if ( setSGCacheConfig(&cacheConfig) ) {
+				fprintf( stderr, "Bad shared cache size (%s), aborting.\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'x': // Set the memory of the compressed tier
+			getSGCacheConfig( &cacheConfig );
+			elements = strtoull( optarg, NULL, 10 );
+			cacheConfig.compressedElements = (elements > SG_CACHE_ELEMENTS_LIMIT) ? (uint32_t)-1 : (uint32_t)elements;
+			if ( setSGCacheConfig(&cacheConfig) ) {
+				fprintf( stderr, "Bad compressed cache size (%s), aborting.\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'z': // Size the cache automatically up to a ceiling
+			getSGCacheConfig( &cacheConfig );
+			elements = strtoull( optarg, NULL, 10 );
+			cacheConfig.autoSizeElements = (elements > SG_CACHE_ELEMENTS_LIMIT) ? (uint32_t)-1 : (uint32_t)elements;
+			if ( setSGCacheConfig(&cacheConfig) ) {
+				fprintf( stderr, "Bad auto sizing ceiling (%s), aborting.\n", optarg );
+				return( -1 );
+			}
+			break;
+
+		case 'o': // Set the close policy
+			getSGCacheConfig( &cacheConfig );
+			if ( (policy = parseSGCacheClose(optarg)) < 0 ) {
+				fprintf( stderr, "Unknown close policy (%s), aborting.\n", optarg );
+				return( -1 );
+			}
+			cacheConfig.closePolicy = policy;
+			setSGCacheConfig( &cacheConfig );
+			break;
+
+		case 'q': // Replay asynchronously (0 replays synchronously)
+			asyncDepth = atoi( optarg );
+			if ( (asyncDepth < 0) || ((asyncDepth > 0) && sgdepth_async(asyncDepth)) ) {
+				fprintf( stderr, "Bad async queue depth (%s), aborting.\n", optarg );
+				return( -1 );
+			}
+			break;
+
 		case 'l': // Set the log filename
 			initializeLogWithFilename( optarg );
 			log_initialized = 1;
@@ -107,7 +269,18 @@ int main( int argc, char *argv[] ) {
 	}
 
 	// If exgtracting file from data
-	if (unit_tests) {
+	if (benchmarks) {
+
+		// Run the cache benchmarks
+		enableLogLevels( LOG_INFO_LEVEL );
+		logMessage(LOG_INFO_LEVEL, "Running cache benchmarks ....");
+		if (sgCacheBenchmark() == 0) {
+			logMessage(LOG_INFO_LEVEL, "Benchmarks completed successfully.\n\n");
+		} else {
+			logMessage(LOG_ERROR_LEVEL, "Benchmarks failed, aborting.\n\n");
+		}
+
+	} else if (unit_tests) {
 
 		// Run the unit tests
 		enableLogLevels( LOG_INFO_LEVEL );
@@ -162,8 +335,9 @@ int simulateScatterGather( char *wload ) {
 	SgFHandle fh;
 	AssocArray fhTable;
 	char buf[10240];
-	int opens, reads, writes, seeks, closes;
+	int opens, reads, writes, seeks, closes, x;
 	fsysdata *fdata;
+	simasync *pending = NULL;
 
 	/* Initalize the local data and simulation */
 	if ( init_assoc(&fhTable, stringCompareCallback, pointerCompareCallback) ) {
@@ -171,6 +345,16 @@ int simulateScatterGather( char *wload ) {
 		return( -1 );
 	}
 
+	/* Slots for the operations in flight when replaying asynchronously */
+	if ( asyncDepth > 0 ) {
+		if ( (pending = calloc(asyncDepth, sizeof(simasync))) == NULL ) {
+			return( -1 );
+		}
+		for ( x = 0; x < asyncDepth; x++ ) {
+			pending[x].token = -1;
+		}
+	}
+
 	/* Open the workload for processing */
 	if ( openCmpsc311Workload(&state, wload) ) {
 		logMessage( LOG_ERROR_LEVEL, "CMPSC311 SG workload: failed opening workload [%s]", wload );
@@ -228,19 +412,24 @@ int simulateScatterGather( char *wload ) {
 					return( -1 );
 				}
 
-				/* If the position within the file is not a read location, seek */
+				/* Count a seek if the read is not where the last one ended */
 				if ( fdata->pos != operation.pos ) {
-					if ( sgseek(fdata->fhandle, operation.pos) != operation.pos ) {
-						logMessage( LOG_ERROR_LEVEL, "SG error seek failed [%s, pos=%d], aborting", 
-							operation.objname, operation.pos );
-						return( -1 );
-					}
 					fdata->pos = operation.pos;
 					seeks ++;
 				}
 
-				/* Now do the read from the file */
-				if ( sgread(fdata->fhandle, buf, operation.size) != operation.size ) {
+				/* Queue the read, it is checked when it completes */
+				if ( pending != NULL ) {
+					if ( simulateSubmit(pending, fdata->fhandle, &operation) ) {
+						return( -1 );
+					}
+					fdata->pos += operation.size;
+					reads ++;
+					break;
+				}
+
+				/* Now do the read from the file, at its position */
+				if ( sgpread(fdata->fhandle, buf, operation.size, operation.pos) != operation.size ) {
 					logMessage( LOG_ERROR_LEVEL, "SG error read failed [%s, pos=%d, size=%d], aborting", 
 						operation.objname, operation.pos, operation.size );
 					return( -1 );
@@ -270,19 +459,24 @@ int simulateScatterGather( char *wload ) {
 					return( -1 );
 				}
 
-				/* If the position within the file is not a read location, seek */
+				/* Count a seek if the write is not where the last one ended */
 				if ( fdata->pos != operation.pos ) {
-					if ( sgseek(fdata->fhandle, operation.pos) != operation.pos ) {
-						logMessage( LOG_ERROR_LEVEL, "SG error seek failed [%s, pos=%d], aborting", 
-							operation.objname, operation.pos );
-						return( -1 );
-					}
 					fdata->pos = operation.pos;
 					seeks ++;
 				}
 
-				/* Now do the write to the file */
-				if ( sgwrite(fdata->fhandle, operation.data, operation.size) != operation.size ) {
+				/* Queue the write */
+				if ( pending != NULL ) {
+					if ( simulateSubmit(pending, fdata->fhandle, &operation) ) {
+						return( -1 );
+					}
+					fdata->pos += operation.size;
+					writes ++;
+					break;
+				}
+
+				/* Now do the write to the file, at its position */
+				if ( sgpwrite(fdata->fhandle, operation.data, operation.size, operation.pos) != operation.size ) {
 					logMessage( LOG_ERROR_LEVEL, "SG error write failed [%s, pos=%d, size=%d], aborting", 
 						operation.objname, operation.pos, operation.size );
 					return( -1 );
@@ -304,7 +498,10 @@ int simulateScatterGather( char *wload ) {
 					return( -1 );
 				}
 
-				/* Now close the file */
+				/* Check what is in flight, then close the file */
+				if ( (pending != NULL) && simulateComplete(pending, asyncDepth) ) {
+					return( -1 );
+				}
 				if ( sgclose(fdata->fhandle) != 0 ) {
 					logMessage( LOG_ERROR_LEVEL, "SG error close failed [%s, pos=%d, size=%d], aborting", 
 						operation.objname, operation.pos, operation.size );
@@ -320,6 +517,9 @@ int simulateScatterGather( char *wload ) {
 				break;
 
 			case WL_EOF: // End of the workload file
+				if ( (pending != NULL) && simulateComplete(pending, asyncDepth) ) {
+					return( -1 );
+				}
 				if ( sgshutdown() ) {
 					logMessage( LOG_ERROR_LEVEL, "SG shutdown failed" );
 					return( -1 );
@@ -337,9 +537,102 @@ int simulateScatterGather( char *wload ) {
 	
 	/* Log, close workload and delete the local file, return successfully  */
 	closeCmpsc311Workload( &state );
+	free( pending );
 	return( 0 );
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : simulateSubmit
+// Description  : Queue a workload read or write, with its own copy of the
+//                data, first collecting finished operations if every slot
+//                is in flight
+//
+// Inputs       : pending - the slots (asyncDepth of them)
+//                fh - the file handle
+//                op - the workload operation
+// Outputs      : 0 if successful, -1 if failure
+
+int simulateSubmit( simasync *pending, SgFHandle fh, workload_operation *op ) {
+
+	int x;
+
+	for ( x = 0; (x < asyncDepth) && (pending[x].token != -1); x++ );
+	if ( x == asyncDepth ) {
+		if ( simulateComplete(pending, 1) ) {
+			return( -1 );
+		}
+		for ( x = 0; (x < asyncDepth) && (pending[x].token != -1); x++ );
+	}
+
+	pending[x].write = (op->op == WL_WRITE);
+	pending[x].size = op->size;
+	pending[x].data = malloc( op->size );
+	pending[x].buf = pending[x].write ? NULL : malloc( op->size );
+	if ( (pending[x].data == NULL) || (!pending[x].write && (pending[x].buf == NULL)) ) {
+		free( pending[x].data );
+		return( -1 );
+	}
+	memcpy( pending[x].data, op->data, op->size );
+
+	pending[x].token = pending[x].write ?
+		sgwrite_async( fh, pending[x].data, op->size, op->pos ) :
+		sgread_async( fh, pending[x].buf, op->size, op->pos );
+	if ( pending[x].token == -1 ) {
+		logMessage( LOG_ERROR_LEVEL, "SG error queueing %s [%s, pos=%d, size=%d], aborting",
+			pending[x].write ? "write" : "read", op->objname, op->pos, op->size );
+		free( pending[x].data );
+		free( pending[x].buf );
+		return( -1 );
+	}
+
+	return( 0 );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : simulateComplete
+// Description  : Wait for at least min queued operations (or all of them,
+//                if fewer), check their results and free their slots
+//
+// Inputs       : pending - the slots (asyncDepth of them)
+//                min - least to wait for
+// Outputs      : 0 if successful, -1 if failure
+
+int simulateComplete( simasync *pending, int min ) {
+
+	SG_Completion done[64];
+	int n, x, y, ret = 0;
+
+	do {
+		if ( (n = sgwait_async(done, (min < 64) ? min : 64, 64)) < 0 ) {
+			return( -1 );
+		}
+		for ( x = 0; x < n; x++ ) {
+			for ( y = 0; (y < asyncDepth) && (pending[y].token != done[x].token); y++ );
+			if ( y == asyncDepth ) {
+				continue;
+			}
+
+			/* Same checks as the synchronous replay */
+			if ( done[x].result != pending[y].size ) {
+				logMessage( LOG_ERROR_LEVEL, "SG error async %s failed [size=%d]",
+					pending[y].write ? "write" : "read", pending[y].size );
+				ret = -1;
+			} else if ( !pending[y].write && (strncmp(pending[y].buf, pending[y].data, pending[y].size) != 0) ) {
+				logMessage( LOG_ERROR_LEVEL, "SG read data compare failed, aborting" );
+				ret = -1;
+			}
+			free( pending[y].data );
+			free( pending[y].buf );
+			pending[y].token = -1;
+		}
+		min -= n;
+	} while ( (min > 0) && (n > 0) );
+
+	return( ret );
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Function     : sg_unit_test
@@ -354,7 +647,7 @@ int sg_unit_test( void ) {
     logMessage( LOG_INFO_LEVEL, "ScatterGather: beginning unit tests ..." );
 
     // Do the UNIT tests
-    if ( packetUnitTest() ) {
+    if ( packetUnitTest() || shmUnitTest() || versionUnitTest() || policyUnitTest() || driverUnitTest() ) {
         logMessage( LOG_ERROR_LEVEL, "ScatterGather: unit tests failed." );
         return( -1 );
     }
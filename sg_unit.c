@@ -0,0 +1,662 @@
+////////////////////////////////////////////////////////////////////////////////
+//
+//  File           : sg_unit.c
+//  Description    : This file contains the unit tests of the cache tiers and
+//                   the driver, run with the packet tests by sg_sim -u.
+//                   Each one checks behaviour, not speed (see sg_bench.c).
+//
+//   Author        : Yinan Lang
+//   Last Modified : 10/18/2026
+//
+
+// Include Files
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <cmpsc311_log.h>
+
+// Project Includes
+#include <sg_cache.h>
+#include <sg_cache_shm.h>
+#include <sg_driver.h>
+
+// Defines
+#define UNIT_SHM_ELEMENTS 64           // Frames in the test segment
+#define UNIT_POLICY_ELEMENTS 4         // Blocks in the victim order cache
+#define UNIT_DRIVER_ELEMENTS 64        // Blocks in the driver's cache
+
+//
+// Functional Prototypes
+
+int shmUnitTest( void );                                         // Shared tier
+int versionUnitTest( void );                                     // Node epochs
+int policyUnitTest( void );                                      // Victim order
+int driverUnitTest( void );                                      // Driver calls
+static int shmChildPut( const char *name, uint64_t seq, char fill ); // Publish from another process
+static SG_Block_ID unitVictim( int *cached, SG_Block_ID last );  // Block that left
+static int unitEndOfFile( void );                                // sgpread at the end
+static int unitWriteRanges( void );                              // Short sgwriteranges
+static int unitStaleHandle( void );                              // Closed handle reused
+static int unitAsyncOrder( void );                               // Completion order
+static int unitWillNeed( void );                                 // WILLNEED fills the cache
+static void unitFill( char *buf, size_t len, int seed );         // Test data
+static void unitConfig( SG_Cache_Policy policy, uint32_t elements, SG_Cache_Config *saved ); // Plain cache config
+static int unitCache( SG_Cache_Policy policy, uint32_t elements, SG_Cache_Config *saved ); // Plain cache
+static void unitCacheDone( const SG_Cache_Config *saved );      // Close it
+static uint64_t unitEpochOf( SG_Node_ID nde );                   // Version handler
+
+// Global data
+static uint64_t unitEpoch = 0;                                   // What unitEpochOf gives
+
+//
+// Functions
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmUnitTest
+// Description  : Check that the shared tier keeps the last copy published,
+//                whichever process published it and whatever its sequence
+//                number (those are per process and do not compare)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int shmUnitTest( void ) {
+
+    char name[64], block[SG_BLOCK_SIZE];
+    uint64_t seq;
+    SG_Shm *t;
+    int ret = 0;
+
+    snprintf( name, sizeof(name), "/sg_unit_shm_%d", (int)getpid() );
+    unlinkSGShm( name );
+    if ( (t = openSGShm(name, UNIT_SHM_ELEMENTS)) == NULL ) {
+        logMessage( LOG_ERROR_LEVEL, "shmUnitTest: cannot open %s", name );
+        return( -1 );
+    }
+
+    // Another process with a high counter publishes, then this one with a
+    // low counter, then the other one again with a lower one still
+    memset( block, 'B', SG_BLOCK_SIZE );
+    if ( shmChildPut(name, 5000, 'A') ||
+            (shmPut(t, 7, 11, 3, block) != 0) ||
+            (shmGet(t, 7, 11, &seq, block) != 0) || (block[0] != 'B') || (seq != 3) ) {
+        logMessage( LOG_ERROR_LEVEL, "shmUnitTest: a later publish with a lower version was not kept" );
+        ret = -1;
+    }
+    else if ( shmChildPut(name, 1, 'C') ||
+            (shmGet(t, 7, 11, &seq, block) != 0) || (block[0] != 'C') || (block[SG_BLOCK_SIZE - 1] != 'C') ) {
+        logMessage( LOG_ERROR_LEVEL, "shmUnitTest: another process's last publish was not kept" );
+        ret = -1;
+    }
+
+    // Removing it removes it for everyone
+    shmRemove( t, 7, 11 );
+    if ( (ret == 0) && (shmGet(t, 7, 11, &seq, block) == 0) ) {
+        logMessage( LOG_ERROR_LEVEL, "shmUnitTest: removed block still found" );
+        ret = -1;
+    }
+
+    closeSGShm( t );
+    unlinkSGShm( name );
+    if ( ret == 0 ) {
+        logMessage( LOG_INFO_LEVEL, "shmUnitTest: last writer wins across processes" );
+    }
+    return( ret );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : shmChildPut
+// Description  : Publish block (7, 11) filled with one byte from a forked
+//                process of its own, and wait for it
+//
+// Inputs       : name - the segment
+//                seq - the version the child publishes it with
+//                fill - the byte
+// Outputs      : 0 if successful, -1 if failure
+
+static int shmChildPut( const char *name, uint64_t seq, char fill ) {
+
+    char block[SG_BLOCK_SIZE];
+    SG_Shm *t;
+    pid_t pid;
+    int status;
+
+    if ( (pid = fork()) == -1 ) {
+        return( -1 );
+    }
+    if ( pid == 0 ) {
+        memset( block, fill, SG_BLOCK_SIZE );
+        if ( ((t = openSGShm(name, UNIT_SHM_ELEMENTS)) == NULL) || shmPut(t, 7, 11, seq, block) ) {
+            _exit( 1 );
+        }
+        closeSGShm( t );
+        _exit( 0 );
+    }
+
+    if ( (waitpid(pid, &status, 0) != pid) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0) ) {
+        return( -1 );
+    }
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : versionUnitTest
+// Description  : Check that blocks go stale when their node starts a new
+//                epoch and not otherwise, however far apart the epochs are
+//                (a 16 bit sequence number wraps after 32768 packets)
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int versionUnitTest( void ) {
+
+    SG_Cache_Config saved;
+    char block[SG_BLOCK_SIZE];
+    int ret = 0;
+
+    if ( unitCache(SG_CACHE_LRU, 16, &saved) ) {
+        return( -1 );
+    }
+    setSGCacheVersionHandler( unitEpochOf );
+    memset( block, 'v', SG_BLOCK_SIZE );
+
+    // One block from long ago, one from the current epoch
+    unitEpoch = 0;
+    insertSGDataBlock( SG_CACHE_NO_OWNER, 5, 1, block, 0 );
+    unitEpoch = 40000;
+    insertSGDataBlock( SG_CACHE_NO_OWNER, 5, 2, block, 0 );
+    insertSGDataBlock( SG_CACHE_NO_OWNER, 6, 1, block, 0 );
+    invalidateSGNode( 5, 40000 );
+    if ( (readSGDataBlock(SG_CACHE_NO_OWNER, 5, 1, block, 0, SG_BLOCK_SIZE) == 0) ||
+            (readSGDataBlock(SG_CACHE_NO_OWNER, 5, 2, block, 0, SG_BLOCK_SIZE) != 0) ) {
+        logMessage( LOG_ERROR_LEVEL, "versionUnitTest: epoch 40000 did not drop exactly the older block" );
+        ret = -1;
+    }
+
+    // Another epoch much later, for one node only
+    unitEpoch = 70000;
+    invalidateSGNode( 5, 70000 );
+    if ( (ret == 0) && ((readSGDataBlock(SG_CACHE_NO_OWNER, 5, 2, block, 0, SG_BLOCK_SIZE) == 0) ||
+            (readSGDataBlock(SG_CACHE_NO_OWNER, 6, 1, block, 0, SG_BLOCK_SIZE) != 0)) ) {
+        logMessage( LOG_ERROR_LEVEL, "versionUnitTest: epoch 70000 was not kept to its node" );
+        ret = -1;
+    }
+
+    setSGCacheVersionHandler( NULL );
+    unitCacheDone( &saved );
+    if ( ret == 0 ) {
+        logMessage( LOG_INFO_LEVEL, "versionUnitTest: node epochs invalidate without wrapping" );
+    }
+    return( ret );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : policyUnitTest
+// Description  : Check which blocks LRU, ARC and 2Q evict from a full cache
+//                of four when two blocks were hit and three new ones come:
+//                LRU takes the least recent, ARC keeps the blocks seen twice
+//                and 2Q lets its first-reference FIFO go in order, hits or
+//                not
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int policyUnitTest( void ) {
+
+    static const struct {
+        SG_Cache_Policy policy;
+        SG_Block_ID victims[3];
+    } orders[] = {
+        { SG_CACHE_LRU, { 3, 4, 1 } },
+        { SG_CACHE_ARC, { 3, 4, 5 } },
+        { SG_CACHE_2Q,  { 1, 2, 3 } },
+    };
+    SG_Cache_Config saved;
+    char block[SG_BLOCK_SIZE];
+    int cached[UNIT_POLICY_ELEMENTS + 4];
+    SG_Block_ID blk, victim;
+    int x, ret = 0;
+
+    memset( block, 'p', SG_BLOCK_SIZE );
+    for (x = 0; (x < (int)(sizeof(orders) / sizeof(orders[0]))) && (ret == 0); x++){
+
+        if ( unitCache(orders[x].policy, UNIT_POLICY_ELEMENTS, &saved) ) {
+            return( -1 );
+        }
+
+        // Blocks 1 to 4 fill it, 1 and 2 are read again
+        memset( cached, 0, sizeof(cached) );
+        for (blk = 1; blk <= UNIT_POLICY_ELEMENTS; blk++){
+            insertSGDataBlock( SG_CACHE_NO_OWNER, 9, blk, block, 0 );
+            cached[blk] = 1;
+        }
+        readSGDataBlock( SG_CACHE_NO_OWNER, 9, 1, block, 0, SG_BLOCK_SIZE );
+        readSGDataBlock( SG_CACHE_NO_OWNER, 9, 2, block, 0, SG_BLOCK_SIZE );
+
+        // Each new block pushes one out
+        for (blk = UNIT_POLICY_ELEMENTS + 1; (blk <= UNIT_POLICY_ELEMENTS + 3) && (ret == 0); blk++){
+            insertSGDataBlock( SG_CACHE_NO_OWNER, 9, blk, block, 0 );
+            victim = unitVictim( cached, blk );
+            if ( victim != orders[x].victims[blk - UNIT_POLICY_ELEMENTS - 1] ) {
+                logMessage( LOG_ERROR_LEVEL, "policyUnitTest: %s evicted block %lu for block %lu, not %lu",
+                        sgCachePolicyName(orders[x].policy), (unsigned long)victim, (unsigned long)blk,
+                        (unsigned long)orders[x].victims[blk - UNIT_POLICY_ELEMENTS - 1] );
+                ret = -1;
+            }
+        }
+        unitCacheDone( &saved );
+
+    }
+
+    if ( ret == 0 ) {
+        logMessage( LOG_INFO_LEVEL, "policyUnitTest: LRU, ARC and 2Q evict in order" );
+    }
+    return( ret );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unitVictim
+// Description  : Find the block of node 9 the last insert evicted, the one
+//                block that was cached and no longer is
+//
+// Inputs       : cached - which blocks are cached, updated
+//                last - the block just inserted
+// Outputs      : the evicted block, 0 if none or several left
+
+static SG_Block_ID unitVictim( int *cached, SG_Block_ID last ) {
+
+    SG_Block_ID blk, victim = 0;
+    int left = 0;
+
+    for (blk = 1; blk < last; blk++){
+        if ( cached[blk] && !hasSGDataBlock(9, blk) ) {
+            cached[blk] = 0;
+            victim = blk;
+            left++;
+        }
+    }
+    cached[last] = 1;
+    return( (left == 1) ? victim : 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : driverUnitTest
+// Description  : Check the driver calls against the simulated service, on a
+//                plain cache: reads at and past the end of a file, a short
+//                sgwriteranges, a closed handle whose slot was reused, the
+//                order async requests finish in and WILLNEED filling the
+//                cache.  The driver is shut down at the end.
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+int driverUnitTest( void ) {
+
+    SG_Cache_Config saved;
+    int ret;
+
+    // The driver starts its cache on the first sgopen
+    unitConfig( SG_CACHE_LRU, UNIT_DRIVER_ELEMENTS, &saved );
+    ret = unitEndOfFile() || unitWriteRanges() || unitStaleHandle() || unitAsyncOrder() || unitWillNeed();
+    sgshutdown();
+    setSGCacheConfig( &saved );
+
+    if ( ret == 0 ) {
+        logMessage( LOG_INFO_LEVEL, "driverUnitTest: end of file, ranges, handles, async order and WILLNEED" );
+    }
+    return( ret ? -1 : 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unitEndOfFile
+// Description  : Check that sgpread returns nothing at or past the end of a
+//                file and stops a read across it at the end
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int unitEndOfFile( void ) {
+
+    char data[3000], buf[100];
+    SgFHandle fh;
+    int ret = 0;
+
+    unitFill( data, sizeof(data), 1 );
+    if ( ((fh = sgopen("unit_eof")) == -1) || (sgwrite(fh, data, sizeof(data)) != sizeof(data)) ) {
+        logMessage( LOG_ERROR_LEVEL, "unitEndOfFile: cannot write the file" );
+        return( -1 );
+    }
+
+    if ( (sgpread(fh, buf, sizeof(buf), 3000) != 0) || (sgpread(fh, buf, sizeof(buf), 5000) != 0) ) {
+        logMessage( LOG_ERROR_LEVEL, "unitEndOfFile: a read at or past the end returned data" );
+        ret = -1;
+    }
+    else if ( (sgpread(fh, buf, sizeof(buf), 2950) != 50) || memcmp(buf, data + 2950, 50) ) {
+        logMessage( LOG_ERROR_LEVEL, "unitEndOfFile: a read across the end was not cut at it" );
+        ret = -1;
+    }
+
+    sgclose( fh );
+    return( ret );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unitWriteRanges
+// Description  : Check that sgwriteranges refuses a range past the end of
+//                the file, and that ranges running past the most blocks a
+//                file can have come back short, with the blocks before the
+//                failure written and the file grown to them
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int unitWriteRanges( void ) {
+
+    const size_t limit = (size_t)SG_MAX_BLOCKS_PER_FILE * SG_BLOCK_SIZE;
+    SG_Range ranges[2];
+    char *data, buf[SG_BLOCK_SIZE];
+    SgFHandle fh;
+    int ret = 0;
+
+    if ( (data = malloc(limit + SG_BLOCK_SIZE)) == NULL ) {
+        return( -1 );
+    }
+    unitFill( data, limit + SG_BLOCK_SIZE, 2 );
+    if ( (fh = sgopen("unit_ranges")) == -1 ) {
+        free( data );
+        return( -1 );
+    }
+
+    // A hole before the range, nothing is written
+    ranges[0].off = 10;
+    ranges[0].buf = data;
+    ranges[0].len = 10;
+    if ( (sgwriteranges(fh, ranges, 1) != -1) || (sgpread(fh, buf, 10, 0) != 0) ) {
+        logMessage( LOG_ERROR_LEVEL, "unitWriteRanges: a range past the end was written" );
+        ret = -1;
+    }
+
+    // Part of block 0, then the rest of the file and one block too many
+    ranges[0].off = 0;
+    ranges[0].len = 500;
+    ranges[1].off = 500;
+    ranges[1].buf = data + 500;
+    ranges[1].len = limit;
+    if ( (ret == 0) && (sgwriteranges(fh, ranges, 2) != (int)limit) ) {
+        logMessage( LOG_ERROR_LEVEL, "unitWriteRanges: ranges past the last block did not come back short" );
+        ret = -1;
+    }
+    else if ( (ret == 0) && ((sgpread(fh, buf, SG_BLOCK_SIZE, limit - SG_BLOCK_SIZE) != SG_BLOCK_SIZE) ||
+            memcmp(buf, data + limit - SG_BLOCK_SIZE, SG_BLOCK_SIZE) ||
+            (sgpread(fh, buf, SG_BLOCK_SIZE, 0) != SG_BLOCK_SIZE) || memcmp(buf, data, SG_BLOCK_SIZE) ||
+            (sgpread(fh, buf, SG_BLOCK_SIZE, limit) != 0)) ) {
+        logMessage( LOG_ERROR_LEVEL, "unitWriteRanges: a short write did not keep the blocks before the failure" );
+        ret = -1;
+    }
+
+    sgclose( fh );
+    free( data );
+    return( ret );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unitStaleHandle
+// Description  : Check that a closed handle is refused once its slot is
+//                given to another file, which keeps working
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int unitStaleHandle( void ) {
+
+    char data[10], buf[10];
+    SgFHandle old, fh;
+    int ret = 0;
+
+    unitFill( data, sizeof(data), 3 );
+    if ( ((old = sgopen("unit_stale_a")) == -1) || (sgwrite(old, data, sizeof(data)) != sizeof(data)) ||
+            sgclose(old) || ((fh = sgopen("unit_stale_b")) == -1) ) {
+        logMessage( LOG_ERROR_LEVEL, "unitStaleHandle: cannot open, write and close the files" );
+        return( -1 );
+    }
+
+    if ( (fh == old) || (sgpread(old, buf, sizeof(buf), 0) != -1) ||
+            (sgwrite(old, data, sizeof(data)) != -1) || (sgclose(old) != -1) ) {
+        logMessage( LOG_ERROR_LEVEL, "unitStaleHandle: closed handle %d was still accepted (new %d)", old, fh );
+        ret = -1;
+    }
+    else if ( (sgwrite(fh, data, sizeof(data)) != sizeof(data)) ||
+            (sgpread(fh, buf, sizeof(buf), 0) != sizeof(buf)) || memcmp(buf, data, sizeof(buf)) ) {
+        logMessage( LOG_ERROR_LEVEL, "unitStaleHandle: the reused handle %d does not work", fh );
+        ret = -1;
+    }
+
+    sgclose( fh );
+    return( ret );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unitAsyncOrder
+// Description  : Check that async requests finish in the order they were
+//                queued, a read seeing the writes before it and not the one
+//                after it
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int unitAsyncOrder( void ) {
+
+    static const int lens[4] = { SG_BLOCK_SIZE, SG_BLOCK_SIZE, 2 * SG_BLOCK_SIZE, 512 };
+    char first[SG_BLOCK_SIZE], second[SG_BLOCK_SIZE], last[512], buf[2 * SG_BLOCK_SIZE];
+    SG_Completion done[4];
+    int tokens[4], x, ret = 0;
+    SgFHandle fh;
+
+    unitFill( first, sizeof(first), 4 );
+    unitFill( second, sizeof(second), 5 );
+    unitFill( last, sizeof(last), 6 );
+    if ( (fh = sgopen("unit_async")) == -1 ) {
+        return( -1 );
+    }
+
+    tokens[0] = sgwrite_async( fh, first, sizeof(first), 0 );
+    tokens[1] = sgwrite_async( fh, second, sizeof(second), SG_BLOCK_SIZE );
+    tokens[2] = sgread_async( fh, buf, sizeof(buf), 0 );
+    tokens[3] = sgwrite_async( fh, last, sizeof(last), 0 );
+    if ( (tokens[0] == -1) || (tokens[1] == -1) || (tokens[2] == -1) || (tokens[3] == -1) ||
+            (sgwait_async(done, 4, 4) != 4) ) {
+        logMessage( LOG_ERROR_LEVEL, "unitAsyncOrder: cannot queue and collect the requests" );
+        sgclose( fh );
+        return( -1 );
+    }
+
+    for (x = 0; (x < 4) && (ret == 0); x++){
+        if ( (done[x].token != tokens[x]) || (done[x].result != lens[x]) ) {
+            logMessage( LOG_ERROR_LEVEL, "unitAsyncOrder: completion %d was token %d (%d bytes), not %d (%d bytes)",
+                    x, done[x].token, done[x].result, tokens[x], lens[x] );
+            ret = -1;
+        }
+    }
+    if ( (ret == 0) && (memcmp(buf, first, SG_BLOCK_SIZE) || memcmp(buf + SG_BLOCK_SIZE, second, SG_BLOCK_SIZE)) ) {
+        logMessage( LOG_ERROR_LEVEL, "unitAsyncOrder: the read did not see exactly the writes queued before it" );
+        ret = -1;
+    }
+    else if ( (ret == 0) && ((sgpread(fh, buf, sizeof(last), 0) != sizeof(last)) || memcmp(buf, last, sizeof(last))) ) {
+        logMessage( LOG_ERROR_LEVEL, "unitAsyncOrder: the last write was lost" );
+        ret = -1;
+    }
+
+    sgclose( fh );
+    return( ret );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unitWillNeed
+// Description  : Check that WILLNEED puts a file's blocks back in the cache
+//                after DONTNEED took them out, so reading them misses none
+//
+// Inputs       : none
+// Outputs      : 0 if successful, -1 if failure
+
+static int unitWillNeed( void ) {
+
+    char data[4 * SG_BLOCK_SIZE], buf[4 * SG_BLOCK_SIZE];
+    SG_Cache_Stats before, after;
+    SgFHandle fh;
+    int ret = 0;
+
+    unitFill( data, sizeof(data), 7 );
+    if ( ((fh = sgopen("unit_willneed")) == -1) || (sgwrite(fh, data, sizeof(data)) != sizeof(data)) ||
+            sgadvise(fh, 0, 0, SG_ADVICE_DONTNEED) ) {
+        logMessage( LOG_ERROR_LEVEL, "unitWillNeed: cannot write the file and push it out" );
+        return( -1 );
+    }
+
+    // The prefetch does not count lookups, and the read waits for it
+    sgGetCacheStats( &before );
+    if ( sgadvise(fh, 0, 0, SG_ADVICE_WILLNEED) ||
+            (sgpread(fh, buf, sizeof(buf), 0) != sizeof(buf)) || memcmp(buf, data, sizeof(buf)) ) {
+        logMessage( LOG_ERROR_LEVEL, "unitWillNeed: cannot advise and read the file back" );
+        ret = -1;
+    }
+    sgGetCacheStats( &after );
+    if ( (ret == 0) && ((after.total.insertions - before.total.insertions != 4) ||
+            (after.total.misses != before.total.misses)) ) {
+        logMessage( LOG_ERROR_LEVEL, "unitWillNeed: %lu blocks were cached by then, the read missed %lu",
+                (unsigned long)(after.total.insertions - before.total.insertions),
+                (unsigned long)(after.total.misses - before.total.misses) );
+        ret = -1;
+    }
+
+    sgclose( fh );
+    return( ret );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unitFill
+// Description  : Fill a buffer with bytes that differ from test to test
+//
+// Inputs       : buf - the buffer
+//                len - its length
+//                seed - selects the data
+// Outputs      : none
+
+static void unitFill( char *buf, size_t len, int seed ) {
+
+    size_t x;
+
+    for (x = 0; x < len; x++){
+        buf[x] = (char)(x * 7 + seed * 31 + x / 251);
+    }
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unitConfig
+// Description  : Configure the next cache started as one shard with no
+//                other tiers, admission or sizing, whatever the environment
+//                says
+//
+// Inputs       : policy - eviction policy
+//                elements - blocks it holds
+//                saved - where to keep the configuration to restore
+// Outputs      : none
+
+static void unitConfig( SG_Cache_Policy policy, uint32_t elements, SG_Cache_Config *saved ) {
+
+    SG_Cache_Config cfg;
+
+    getSGCacheConfig( saved );
+    cfg = *saved;
+    cfg.maxElements = elements;
+    cfg.policy = policy;
+    cfg.writeBack = 0;
+    cfg.shards = 1;
+    cfg.admission = 0;
+    cfg.partitioned = 0;
+    cfg.l2Elements = 0;
+    cfg.shmElements = 0;
+    cfg.compressedElements = 0;
+    cfg.autoSizeElements = 0;
+    setSGCacheConfig( &cfg );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unitCache
+// Description  : Start a cache of one shard with no other tiers, admission
+//                or sizing, whatever the environment says
+//
+// Inputs       : policy - eviction policy
+//                elements - blocks it holds
+//                saved - where to keep the configuration to restore
+// Outputs      : 0 if successful, -1 if failure
+
+static int unitCache( SG_Cache_Policy policy, uint32_t elements, SG_Cache_Config *saved ) {
+
+    unitConfig( policy, elements, saved );
+    if ( initSGCache(SG_CACHE_CONFIGURED) ) {
+        logMessage( LOG_ERROR_LEVEL, "unitCache: cannot start a %u block cache", elements );
+        setSGCacheConfig( saved );
+        return( -1 );
+    }
+    return( 0 );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unitCacheDone
+// Description  : Close the test cache and put the configuration back
+//
+// Inputs       : saved - the configuration unitCache replaced
+// Outputs      : none
+
+static void unitCacheDone( const SG_Cache_Config *saved ) {
+
+    closeSGCache();
+    setSGCacheConfig( saved );
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Function     : unitEpochOf
+// Description  : The version handler of the tests, every node is at the
+//                same epoch
+//
+// Inputs       : nde - node ID (not used)
+// Outputs      : the epoch
+
+static uint64_t unitEpochOf( SG_Node_ID nde ) {
+
+    return( unitEpoch );
+
+}